@@ -0,0 +1,1286 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * May 24, 2008
+ * bvh.c
+ *
+ * This file contains the definitions for building and traversing the
+ * bounding volume hierarchy.
+ */
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "bvh.h"
+#include "cscene.h"
+#include "mesh.h"
+#include "scheduler.h"
+#include "simd.h"
+
+/* sphere slot of an object to skip, ~0 if it is no sphere (or null) */
+static unsigned int bvh_exclude_slot(const cscene_t *cs,
+		const scene_t *scene, const object3d_t *exc)
+{
+	unsigned int ref;
+
+	if(!exc)
+		return ~0u;
+	ref = cs->objectRef[exc - scene->objects];
+	return ref != ~0u && CSCENE_REF_TYPE(ref) == CSCENE_REF_SPHERE ?
+		CSCENE_REF_SLOT(ref) : ~0u;
+}
+
+/* end of the run of spheres in neighbouring slots that starts at leaf
+ * entry first (a sphere) and ends by end at the latest */
+static unsigned int bvh_sphere_run(const cscene_t *cs, const bvh_t *bvh,
+		unsigned int first, unsigned int end)
+{
+	unsigned int	ref = cs->objectRef[bvh->prims[first]];
+	unsigned int	i = first + 1;
+
+	/* the next slot has the next sphere reference */
+	for(; i < end && cs->objectRef[bvh->prims[i]] ==
+		CSCENE_REF(CSCENE_REF_SLOT(ref) + i - first, CSCENE_REF_SPHERE);
+		++i);
+	return i;
+}
+
+/* primitives below which a subtree is left to the worker that found it */
+#define BVH_TASK_PRIMS		4096
+/* primitives above which a node is binned and partitioned by several
+ * workers at once, in pieces of BVH_PIECE_PRIMS */
+#define BVH_PARALLEL_PRIMS	(128 * 1024)
+#define BVH_PIECE_PRIMS		(32 * 1024)
+
+/* primitives whose centroids fall in one bin of one axis */
+typedef struct
+{
+	aabb_t		bounds;		/* of the primitives */
+	unsigned int	count;
+} bvh_bin_t;
+
+/* state shared while building a single hierarchy */
+typedef struct
+{
+	bvh_t		*bvh;
+	const aabb_t	*bounds;	/* bounds of every primitive */
+	float		*centroids;	/* 3 floats per primitive */
+	unsigned int	*spare;		/* second list of primitive indices for
+					 * partitioning out of place */
+	unsigned int	leafSize;
+	unsigned int	nBins;
+	scheduler_t	*sched;		/* null - build on this thread only */
+} bvh_builder_t;
+
+struct bvh_job_s;
+
+/* part of a big node handled by one worker */
+typedef struct
+{
+	struct bvh_job_s *job;
+	unsigned int	begin;		/* primitives of the piece */
+	unsigned int	end;
+	unsigned int	left;		/* where its primitives go in the other */
+	unsigned int	right;		/* list when partitioning */
+	aabb_t		cbounds[2];	/* centroids that went left and right */
+} bvh_piece_t;
+
+/* node still to be built over src[begin, end).  Its subtree gets the
+ * 2n-1 nodes from index on - enough for any tree over n primitives - so
+ * subtrees can be built at the same time without sharing a counter */
+typedef struct bvh_job_s
+{
+	bvh_builder_t	*b;
+	unsigned int	*src;		/* bvh->prims or b->spare */
+	unsigned int	begin;
+	unsigned int	end;
+	unsigned int	index;
+	unsigned int	depth;
+	aabb_t		bounds;		/* of the primitives */
+	aabb_t		cbounds;	/* of their centroids */
+	float		scale[3];	/* centroid to bin along each axis */
+
+	/* chosen split - bins below split along axis go left */
+	unsigned int	axis;
+	unsigned int	split;
+	aabb_t		childBounds[2];
+	aabb_t		childCBounds[2];
+	unsigned int	nLeft;
+
+	/* big nodes only */
+	pthread_mutex_t	lock;
+	unsigned int	pending;	/* pieces still running */
+	unsigned int	nPieces;
+	bvh_piece_t	*pieces;
+	bvh_bin_t	*bins;		/* 3 axes of nBins for every piece */
+} bvh_job_t;
+
+static void bvh_job_task(scheduler_t *sched, unsigned int worker, void *data);
+
+/* set up a job over src[begin, end) */
+static void bvh_job_init(bvh_job_t *job, bvh_builder_t *b, unsigned int *src,
+		unsigned int begin, unsigned int end, unsigned int index,
+		unsigned int depth, const aabb_t *bounds, const aabb_t *cbounds)
+{
+	unsigned int	i = 0;
+	float		extent;
+
+	job->b = b;
+	job->src = src;
+	job->begin = begin;
+	job->end = end;
+	job->index = index;
+	job->depth = depth;
+	job->bounds = *bounds;
+	job->cbounds = *cbounds;
+	for(; i < 3; ++i)
+	{
+		extent = cbounds->max[i] - cbounds->min[i];
+		job->scale[i] = extent > 0.0f ? b->nBins / extent : 0.0f;
+	}
+}
+
+/* aabb_grow() and aabb_grow_point() for the inner loops of the builder,
+ * where a call per primitive would cost more than the work */
+static void bvh_grow(aabb_t *box, const aabb_t *other)
+{
+	unsigned int	i = 0;
+
+	for(; i < 3; ++i)
+	{
+		box->min[i] = other->min[i] < box->min[i] ? other->min[i] : box->min[i];
+		box->max[i] = other->max[i] > box->max[i] ? other->max[i] : box->max[i];
+	}
+}
+
+static void bvh_grow_centroid(aabb_t *box, const float *c)
+{
+	unsigned int	i = 0;
+
+	for(; i < 3; ++i)
+	{
+		box->min[i] = c[i] < box->min[i] ? c[i] : box->min[i];
+		box->max[i] = c[i] > box->max[i] ? c[i] : box->max[i];
+	}
+}
+
+/* bin of a centroid coordinate c along an axis whose centroids start at
+ * min and are scale bins per unit */
+static unsigned int bvh_bin_index(float c, float min, float scale,
+		unsigned int nBins)
+{
+	int	k = (int)((c - min) * scale);
+
+	if(k < 0)
+		return 0;
+	return (unsigned int)k < nBins ? (unsigned int)k : nBins - 1;
+}
+
+/* bin of a primitive of a job along its split axis */
+static unsigned int bvh_split_bin(const bvh_job_t *job, unsigned int prim)
+{
+	return bvh_bin_index(job->b->centroids[prim * 3 + job->axis],
+		job->cbounds.min[job->axis], job->scale[job->axis], job->b->nBins);
+}
+
+/* empty every bin of the 3 axes */
+static void bvh_bins_clear(bvh_bin_t *bins, unsigned int n)
+{
+	unsigned int	i = 0;
+
+	for(; i < n; ++i)
+	{
+		aabb_init(&bins[i].bounds);
+		bins[i].count = 0;
+	}
+}
+
+/* sort src[begin, end) of a job into bins along each axis */
+static void bvh_bin_range(const bvh_job_t *job, unsigned int begin,
+		unsigned int end, bvh_bin_t *bins)
+{
+	const bvh_builder_t	*b = job->b;
+	const unsigned int	nBins = b->nBins;
+	const float		*c;
+	const aabb_t		*box;
+	bvh_bin_t		*bin;
+	unsigned int		prim;
+	unsigned int		axis;
+	float			min[3], scale[3];
+
+	/* kept local, the compiler cannot tell the bins do not overlap them */
+	for(axis = 0; axis < 3; ++axis)
+	{
+		min[axis] = job->cbounds.min[axis];
+		scale[axis] = job->scale[axis];
+	}
+
+	bvh_bins_clear(bins, 3 * nBins);
+	for(; begin < end; ++begin)
+	{
+		prim = job->src[begin];
+		c = &b->centroids[prim * 3];
+		box = &b->bounds[prim];
+		for(axis = 0; axis < 3; ++axis)
+		{
+			bin = &bins[axis * nBins +
+				bvh_bin_index(c[axis], min[axis], scale[axis], nBins)];
+			bvh_grow(&bin->bounds, box);
+			++bin->count;
+		}
+	}
+}
+
+/* pick the split between bins with the lowest surface area heuristic
+ * cost (a traversal step and an intersection both cost 1).  Returns 0 if
+ * the node is better off as a leaf */
+static int bvh_choose_split(bvh_job_t *job, const bvh_bin_t *bins)
+{
+	const bvh_builder_t	*b = job->b;
+	const bvh_bin_t		*axisBins;
+	unsigned int		n = job->end - job->begin;
+	unsigned int		axis = 0;
+	unsigned int		k;
+	unsigned int		count;
+	float			rightCost[BVH_MAX_BINS];
+	float			area = aabb_area(&job->bounds);
+	float			invArea = area > 0.0f ? 1.0f / area : 0.0f;
+	float			best = FLT_MAX;
+	float			cost;
+	aabb_t			box;
+	int			found = 0;
+
+	if(job->depth >= BVH_MAX_DEPTH)
+		return 0;
+
+	for(; axis < 3; ++axis)
+	{
+		if(job->scale[axis] <= 0.0f)
+			continue;
+		axisBins = &bins[axis * b->nBins];
+
+		/* cost of everything right of each split */
+		aabb_init(&box);
+		count = 0;
+		for(k = b->nBins - 1; k > 0; --k)
+		{
+			aabb_grow(&box, &axisBins[k].bounds);
+			count += axisBins[k].count;
+			rightCost[k] = count * aabb_area(&box);
+		}
+
+		/* then sweep the left side over them */
+		aabb_init(&box);
+		count = 0;
+		for(k = 1; k < b->nBins; ++k)
+		{
+			aabb_grow(&box, &axisBins[k - 1].bounds);
+			count += axisBins[k - 1].count;
+			if(!count || count == n)
+				continue;
+			cost = 1.0f + (count * aabb_area(&box) + rightCost[k]) * invArea;
+			if(cost < best)
+			{
+				best = cost;
+				job->axis = axis;
+				job->split = k;
+				found = 1;
+			}
+		}
+	}
+
+	/* small nodes only split when it pays off */
+	if(!found || (n <= b->leafSize && best >= (float)n))
+		return 0;
+
+	/* centroid bounds of the children are found while partitioning */
+	axisBins = &bins[job->axis * b->nBins];
+	job->nLeft = 0;
+	aabb_init(&job->childBounds[0]);
+	aabb_init(&job->childBounds[1]);
+	for(k = 0; k < b->nBins; ++k)
+	{
+		aabb_grow(&job->childBounds[k >= job->split], &axisBins[k].bounds);
+		if(k < job->split)
+			job->nLeft += axisBins[k].count;
+	}
+
+	return 1;
+}
+
+/* make a job's node a leaf */
+static void bvh_make_leaf(bvh_job_t *job)
+{
+	bvh_t		*bvh = job->b->bvh;
+	bvh_node_t	*node = &bvh->nodes[job->index];
+
+	node->bounds = job->bounds;
+	node->first = job->begin;
+	node->count = job->end - job->begin;
+	/* leaves always refer to bvh->prims */
+	if(job->src != bvh->prims)
+		memcpy(&bvh->prims[job->begin], &job->src[job->begin],
+			sizeof(unsigned int) * node->count);
+}
+
+/* turn a split job into its node and the jobs of its 2 children, whose
+ * primitives are now in src */
+static void bvh_make_interior(bvh_job_t *job, unsigned int *src,
+		bvh_job_t *left, bvh_job_t *right)
+{
+	bvh_node_t	*node = &job->b->bvh->nodes[job->index];
+	unsigned int	mid = job->begin + job->nLeft;
+
+	node->bounds = job->bounds;
+	node->count = 0;
+	node->first = job->index + 2 * job->nLeft;
+	bvh_job_init(left, job->b, src, job->begin, mid, job->index + 1,
+		job->depth + 1, &job->childBounds[0], &job->childCBounds[0]);
+	bvh_job_init(right, job->b, src, mid, job->end, node->first,
+		job->depth + 1, &job->childBounds[1], &job->childCBounds[1]);
+}
+
+/* hand a job to another worker */
+static void bvh_spawn(const bvh_job_t *job, unsigned int worker)
+{
+	bvh_job_t	*copy = malloc(sizeof(bvh_job_t));
+
+	*copy = *job;
+	scheduler_push(job->b->sched, worker, bvh_job_task, copy);
+}
+
+/* build the subtree of a job on this worker.  Big enough right subtrees
+ * are handed out as tasks of their own.  bins is room for 3 * nBins */
+static void bvh_build_job(bvh_job_t *job, unsigned int worker,
+		bvh_bin_t *bins)
+{
+	bvh_builder_t	*b = job->b;
+	bvh_job_t	left, right;
+	unsigned int	*src;
+	unsigned int	i, j, tmp;
+
+	for(;;)
+	{
+		bvh_bin_range(job, job->begin, job->end, bins);
+		if(!bvh_choose_split(job, bins))
+		{
+			bvh_make_leaf(job);
+			return;
+		}
+
+		/* partition in place around the chosen bin */
+		src = job->src;
+		aabb_init(&job->childCBounds[0]);
+		aabb_init(&job->childCBounds[1]);
+		for(i = j = job->begin; i < job->end; ++i)
+		{
+			tmp = src[i];
+			if(bvh_split_bin(job, tmp) < job->split)
+			{
+				bvh_grow_centroid(&job->childCBounds[0],
+					&b->centroids[tmp * 3]);
+				src[i] = src[j];
+				src[j++] = tmp;
+			}
+			else
+			{
+				bvh_grow_centroid(&job->childCBounds[1],
+					&b->centroids[tmp * 3]);
+			}
+		}
+
+		bvh_make_interior(job, src, &left, &right);
+		if(b->sched && right.end - right.begin >= BVH_TASK_PRIMS)
+			bvh_spawn(&right, worker);
+		else
+			bvh_build_job(&right, worker, bins);
+		*job = left;
+	}
+}
+
+/* task - out of place partition of one piece of a big node, the last
+ * piece to finish hands out its children */
+static void bvh_partition_piece(scheduler_t *sched, unsigned int worker,
+				void *data)
+{
+	bvh_piece_t	*piece = (bvh_piece_t *)data;
+	bvh_job_t	*job = piece->job;
+	bvh_builder_t	*b = job->b;
+	unsigned int	*dst = job->src == b->spare ? b->bvh->prims : b->spare;
+	unsigned int	i = piece->begin;
+	unsigned int	prim;
+	unsigned int	last;
+	bvh_job_t	left, right;
+
+	aabb_init(&piece->cbounds[0]);
+	aabb_init(&piece->cbounds[1]);
+	for(; i < piece->end; ++i)
+	{
+		prim = job->src[i];
+		if(bvh_split_bin(job, prim) < job->split)
+		{
+			bvh_grow_centroid(&piece->cbounds[0], &b->centroids[prim * 3]);
+			dst[piece->left++] = prim;
+		}
+		else
+		{
+			bvh_grow_centroid(&piece->cbounds[1], &b->centroids[prim * 3]);
+			dst[piece->right++] = prim;
+		}
+	}
+
+	pthread_mutex_lock(&job->lock);
+	last = --job->pending == 0;
+	pthread_mutex_unlock(&job->lock);
+	if(!last)
+		return;
+
+	aabb_init(&job->childCBounds[0]);
+	aabb_init(&job->childCBounds[1]);
+	for(i = 0; i < job->nPieces; ++i)
+	{
+		aabb_grow(&job->childCBounds[0], &job->pieces[i].cbounds[0]);
+		aabb_grow(&job->childCBounds[1], &job->pieces[i].cbounds[1]);
+	}
+	bvh_make_interior(job, dst, &left, &right);
+	bvh_spawn(&right, worker);
+	bvh_spawn(&left, worker);
+	pthread_mutex_destroy(&job->lock);
+	free(job->pieces);
+	free(job->bins);
+	free(job);
+}
+
+/* task - bin one piece of a big node, the last piece to finish picks the
+ * split and starts partitioning */
+static void bvh_bin_piece(scheduler_t *sched, unsigned int worker,
+			void *data)
+{
+	bvh_piece_t	*piece = (bvh_piece_t *)data;
+	bvh_job_t	*job = piece->job;
+	bvh_builder_t	*b = job->b;
+	bvh_bin_t	*bins = job->bins;
+	bvh_bin_t	total[3 * BVH_MAX_BINS];
+	unsigned int	nBins = 3 * b->nBins;
+	unsigned int	last;
+	unsigned int	left, right;
+	unsigned int	i, k;
+
+	bvh_bin_range(job, piece->begin, piece->end,
+		&bins[(piece - job->pieces) * nBins]);
+
+	pthread_mutex_lock(&job->lock);
+	last = --job->pending == 0;
+	pthread_mutex_unlock(&job->lock);
+	if(!last)
+		return;
+
+	bvh_bins_clear(total, nBins);
+	for(i = 0; i < job->nPieces; ++i)
+	{
+		for(k = 0; k < nBins; ++k)
+		{
+			aabb_grow(&total[k].bounds, &bins[i * nBins + k].bounds);
+			total[k].count += bins[i * nBins + k].count;
+		}
+	}
+	if(!bvh_choose_split(job, total))
+	{
+		bvh_make_leaf(job);
+		pthread_mutex_destroy(&job->lock);
+		free(job->pieces);
+		free(job->bins);
+		free(job);
+		return;
+	}
+
+	/* where each piece's primitives go, in the same order as now */
+	left = job->begin;
+	right = job->begin + job->nLeft;
+	for(i = 0; i < job->nPieces; ++i)
+	{
+		job->pieces[i].left = left;
+		job->pieces[i].right = right;
+		for(k = 0; k < job->split; ++k)
+		{
+			left += bins[i * nBins + job->axis * b->nBins + k].count;
+		}
+		right += job->pieces[i].end - job->pieces[i].begin -
+			(left - job->pieces[i].left);
+	}
+
+	job->pending = job->nPieces;
+	for(i = 0; i < job->nPieces; ++i)
+	{
+		scheduler_push(sched, (worker + i) % sched->nWorkers,
+			bvh_partition_piece, &job->pieces[i]);
+	}
+}
+
+/* task - build the subtree of a job.  Big nodes are binned and split by
+ * several workers, the rest by this one */
+static void bvh_job_task(scheduler_t *sched, unsigned int worker, void *data)
+{
+	bvh_job_t	*job = (bvh_job_t *)data;
+	bvh_builder_t	*b = job->b;
+	bvh_bin_t	bins[3 * BVH_MAX_BINS];
+	unsigned int	n = job->end - job->begin;
+	unsigned int	i = 0;
+
+	if(n < BVH_PARALLEL_PRIMS)
+	{
+		bvh_build_job(job, worker, bins);
+		free(job);
+		return;
+	}
+
+	job->nPieces = (n + BVH_PIECE_PRIMS - 1) / BVH_PIECE_PRIMS;
+	job->pieces = malloc(sizeof(bvh_piece_t) * job->nPieces);
+	job->bins = malloc(sizeof(bvh_bin_t) * 3 * b->nBins * job->nPieces);
+	job->pending = job->nPieces;
+	pthread_mutex_init(&job->lock, 0);
+	for(; i < job->nPieces; ++i)
+	{
+		job->pieces[i].job = job;
+		job->pieces[i].begin = job->begin + i * BVH_PIECE_PRIMS;
+		job->pieces[i].end = i == job->nPieces - 1 ? job->end :
+			job->pieces[i].begin + BVH_PIECE_PRIMS;
+	}
+	for(i = 0; i < job->nPieces; ++i)
+	{
+		scheduler_push(sched, (worker + i) % sched->nWorkers, bvh_bin_piece,
+			&job->pieces[i]);
+	}
+}
+
+/* nodes of a finished build are spread over all 2n-1 slots, move them
+ * together keeping the depth first order */
+static void bvh_compact(bvh_t *bvh)
+{
+	bvh_node_t	*nodes = malloc(sizeof(bvh_node_t) *
+				(bvh->nPrims ? 2 * bvh->nPrims - 1 : 1));
+	unsigned int	stack[BVH_STACK_SIZE];	/* nodes left to move */
+	unsigned int	parent[BVH_STACK_SIZE];	/* whose second child it is */
+	unsigned int	top = 0;
+	unsigned int	old;
+	unsigned int	up;
+	unsigned int	n = 0;
+
+	stack[top] = 0;
+	parent[top++] = ~0u;
+	while(top)
+	{
+		--top;
+		old = stack[top];
+		up = parent[top];
+		nodes[n] = bvh->nodes[old];
+		if(up != ~0u)
+			nodes[up].first = n;
+		if(!nodes[n].count)
+		{	/* second child later, first child next */
+			stack[top] = nodes[n].first;
+			parent[top++] = n;
+			stack[top] = old + 1;
+			parent[top++] = ~0u;
+		}
+		++n;
+	}
+
+	free(bvh->nodes);
+	bvh->nodes = nodes;
+	bvh->nNodes = n;
+}
+
+/* set the hierarchy options to their defaults */
+bvh_options_t* init_bvh_options(bvh_options_t *options)
+{
+	options->leafSize = BVH_LEAF_SIZE;
+	options->nBins = BVH_DEFAULT_BINS;
+	options->numThreads = 0;
+	options->rebuildCost = BVH_REBUILD_COST;
+
+	return options;
+}
+
+/* build a hierarchy over a list of primitive bounding boxes */
+bvh_t* bvh_build(const aabb_t *bounds, unsigned int nPrims,
+		const bvh_options_t *options)
+{
+	bvh_t		*bvh = malloc(sizeof(bvh_t));
+	bvh_builder_t	builder;
+	bvh_options_t	defaults;
+	bvh_job_t	*root;
+	bvh_bin_t	bins[3 * BVH_MAX_BINS];
+	aabb_t		box, cbox;
+	point_t		c;
+	unsigned int	i = 0;
+	unsigned int	j;
+
+	if(!options)
+		options = init_bvh_options(&defaults);
+
+	bvh->nPrims = nPrims;
+	bvh->nNodes = 0;
+	bvh->mapped = 0;
+	/* a binary tree never needs more than 2n-1 nodes */
+	bvh->nodes = malloc(sizeof(bvh_node_t) * (nPrims ? 2 * nPrims - 1 : 1));
+	bvh->prims = malloc(sizeof(unsigned int) * (nPrims ? nPrims : 1));
+
+	builder.bvh = bvh;
+	builder.bounds = bounds;
+	builder.centroids = malloc(sizeof(float) * 3 * (nPrims ? nPrims : 1));
+	builder.spare = 0;
+	builder.leafSize = options->leafSize ? options->leafSize : 1;
+	builder.nBins = options->nBins < 2 ? 2 :
+		options->nBins > BVH_MAX_BINS ? BVH_MAX_BINS : options->nBins;
+	builder.sched = 0;
+
+	aabb_init(&box);
+	aabb_init(&cbox);
+	for(; i < nPrims; ++i)
+	{
+		bvh->prims[i] = i;
+		for(j = 0; j < 3; ++j)
+		{
+			c.c[j] = builder.centroids[i*3 + j] = 0.5f *
+				(bounds[i].min[j] + bounds[i].max[j]);
+		}
+		aabb_grow(&box, &bounds[i]);
+		aabb_grow_point(&cbox, &c);
+	}
+
+	if(nPrims)
+	{
+		root = malloc(sizeof(bvh_job_t));
+		bvh_job_init(root, &builder, bvh->prims, 0, nPrims, 0, 0, &box,
+			&cbox);
+		/* small trees are not worth starting threads for */
+		if(nPrims >= BVH_TASK_PRIMS && (options->numThreads > 1 ||
+			(!options->numThreads && scheduler_cpu_count() > 1)))
+		{
+			builder.sched = scheduler_create(options->numThreads);
+			builder.spare = malloc(sizeof(unsigned int) * nPrims);
+			scheduler_push(builder.sched, 0, bvh_job_task, root);
+			scheduler_run(builder.sched);
+			scheduler_free(builder.sched);
+			free(builder.spare);
+		}
+		else
+		{
+			bvh_build_job(root, 0, bins);
+			free(root);
+		}
+		bvh_compact(bvh);
+	}
+	else
+	{	/* empty tree is a single empty leaf */
+		aabb_init(&bvh->nodes[0].bounds);
+		bvh->nodes[0].first = 0;
+		bvh->nodes[0].count = 0;
+		bvh->nNodes = 1;
+	}
+
+	free(builder.centroids);
+	bvh->buildCost = bvh_sah_cost(bvh);
+	return bvh;
+}
+
+/* expected cost of a ray through a hierarchy */
+float bvh_sah_cost(const bvh_t *bvh)
+{
+	float		area = aabb_area(&bvh->nodes[0].bounds);
+	float		cost = 0.0f;
+	unsigned int	i = 0;
+
+	if(area <= 0.0f)
+		return 0.0f;
+	for(; i < bvh->nNodes; ++i)
+	{
+		cost += aabb_area(&bvh->nodes[i].bounds) *
+			(bvh->nodes[i].count ? bvh->nodes[i].count : 1);
+	}
+	return cost / area;
+}
+
+/* cleanup dynamic memory from building a hierarchy */
+void bvh_free(bvh_t *bvh)
+{
+	if(bvh)
+	{
+		if(!bvh->mapped)
+		{
+			free(bvh->nodes);
+			free(bvh->prims);
+		}
+		free(bvh);
+	}
+}
+
+/* milliseconds since start */
+static double bvh_elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, 0);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* bounds of every object in the scene */
+static aabb_t* bvh_object_bounds(const scene_t *scene)
+{
+	aabb_t		*bounds = malloc(sizeof(aabb_t) *
+				(scene->nObjects ? scene->nObjects : 1));
+	unsigned int	i = 0;
+
+	for(; i < scene->nObjects; ++i)
+	{
+		get_object_bounds(&bounds[i], &scene->objects[i]);
+	}
+
+	return bounds;
+}
+
+/* build the hierarchy over the objects of the scene and its 4 wide copy */
+static void bvh_build_objects(scene_t *scene, const aabb_t *bounds,
+		const bvh_options_t *options)
+{
+	bvh4_free(scene->bvh4);
+	bvh_free(scene->bvh);
+	scene->bvh = bvh_build(bounds, scene->nObjects, options);
+	scene->bvh4 = bvh4_build(scene->bvh);
+}
+
+/* build the hierarchy over the triangles of every mesh in the scene */
+void bvh_build_meshes(scene_t *scene, const bvh_options_t *options)
+{
+	mesh_t		*mesh;
+	unsigned int	i = 0;
+	struct timeval	start;
+
+	for(; i < scene->nObjects; ++i)
+	{
+		if(scene->objects[i].geometryType != GEOMETRY_TRIANGLE_MESH)
+			continue;
+		mesh = &scene->objects[i].mesh_obj;
+		gettimeofday(&start, 0);
+		mesh_prepare(mesh, options);
+		printf("Mesh BVH built:\t%u nodes over %u triangles in %.3f ms "
+			"(SAH cost %.2f)\n", mesh->bvh->nNodes, mesh->nTriangles,
+			bvh_elapsed(&start), mesh->bvh->buildCost);
+	}
+}
+
+/* build the hierarchy over every object in the scene (scene->bvh) with
+ * its 4 wide copy and over the triangles of every mesh */
+bvh_t* bvh_build_scene(scene_t *scene, const bvh_options_t *options)
+{
+	aabb_t		*bounds;
+	struct timeval	start;
+
+	/* meshes first, their bounds come from their own hierarchy */
+	bvh_build_meshes(scene, options);
+
+	gettimeofday(&start, 0);
+	bounds = bvh_object_bounds(scene);
+	bvh_build_objects(scene, bounds, options);
+	free(bounds);
+	printf("BVH built:\t%u nodes (%u 4 wide) over %u objects in %.3f ms "
+		"(SAH cost %.2f)\n", scene->bvh->nNodes, scene->bvh4->nNodes,
+		scene->nObjects, bvh_elapsed(&start), scene->bvh->buildCost);
+
+	/* compile again so spheres are stored in leaf order and meshes
+	 * pick up their hierarchies */
+	if(scene->compiled)
+		cscene_build(scene);
+
+	return scene->bvh;
+}
+
+/* update the node bounds of a hierarchy bottom up */
+void bvh_refit(bvh_t *bvh, const aabb_t *bounds)
+{
+	bvh_node_t	*node;
+	unsigned int	i = bvh->nNodes;
+	unsigned int	j, end;
+
+	/* children always come after their parent */
+	while(i--)
+	{
+		node = &bvh->nodes[i];
+		if(node->count)
+		{
+			node->bounds = bounds[bvh->prims[node->first]];
+			end = node->first + node->count;
+			for(j = node->first + 1; j < end; ++j)
+				bvh_grow(&node->bounds, &bounds[bvh->prims[j]]);
+		}
+		else if(bvh->nPrims)
+		{
+			node->bounds = bvh->nodes[i + 1].bounds;
+			bvh_grow(&node->bounds, &bvh->nodes[node->first].bounds);
+		}
+	}
+}
+
+/* bring the scene hierarchy up to date after objects moved */
+bvh_t* bvh_refit_scene(scene_t *scene, const bvh_options_t *options)
+{
+	bvh_options_t	defaults;
+	aabb_t		*bounds;
+	struct timeval	start;
+	float		cost;
+
+	if(!options)
+		options = init_bvh_options(&defaults);
+
+	gettimeofday(&start, 0);
+	bounds = bvh_object_bounds(scene);
+	bvh_refit(scene->bvh, bounds);
+	cost = bvh_sah_cost(scene->bvh);
+
+	if(cost <= scene->bvh->buildCost * options->rebuildCost)
+	{
+		bvh4_free(scene->bvh4);
+		scene->bvh4 = bvh4_build(scene->bvh);
+		free(bounds);
+		printf("BVH refit:\t%u objects in %.3f ms (SAH cost %.2f, %.2f "
+			"when built)\n", scene->nObjects, bvh_elapsed(&start), cost,
+			scene->bvh->buildCost);
+		return scene->bvh;
+	}
+
+	/* the tree has drifted too far from the objects */
+	bvh_build_objects(scene, bounds, options);
+	free(bounds);
+	printf("BVH rebuilt:\t%u objects in %.3f ms (SAH cost %.2f, %.2f "
+		"refit)\n", scene->nObjects, bvh_elapsed(&start),
+		scene->bvh->buildCost, cost);
+
+	/* leaves hold other objects now, spheres go back into leaf order */
+	cscene_build(scene);
+
+	return scene->bvh;
+}
+
+/* nearest hit so far while walking the scene hierarchy */
+typedef struct
+{
+	object3d_t	*obj;		/* null if nothing was hit */
+	float		tmax;		/* its distance */
+	unsigned int	prim;		/* triangle hit on a mesh */
+	int		sphere;		/* obj is a sphere, intersect not set */
+	point_t		intersect;
+} bvh_hit_t;
+
+/* test the objects of leaf entries [first, end) against a ray, keeping
+ * the nearest hit.  Runs of spheres in neighbouring slots are tested 4 at
+ * a time, anything else one at a time */
+static void bvh_leaf_intersect(const scene_t *scene, unsigned int first,
+		unsigned int end, const ray_t *ray, const object3d_t *exc,
+		unsigned int excSlot, int bounded, bvh_hit_t *hit)
+{
+	const bvh_t	*bvh = scene->bvh;
+	const cscene_t	*cs = scene->compiled;
+	object3d_t	*test;		/* object being tested */
+	unsigned int	i = first;
+	unsigned int	j;
+	unsigned int	ref, slot;
+	unsigned int	tmpPrim;	/* triangle of last intersection */
+	float		tmpD;		/* distance to last intersection */
+	point_t		tmpInt;		/* last intersection point */
+
+	for(; i < end; i = j)
+	{
+		ref = cs->objectRef[bvh->prims[i]];
+		if(ref != ~0u && CSCENE_REF_TYPE(ref) == CSCENE_REF_SPHERE)
+		{
+			j = bvh_sphere_run(cs, bvh, i, end);
+			tmpD = hit->tmax;
+			slot = cscene_hit_spheres(cs, CSCENE_REF_SLOT(ref), j - i,
+				ray, excSlot, bounded, &tmpD);
+			if(slot != ~0u)
+			{
+				hit->tmax = tmpD;
+				hit->obj = &scene->objects[cs->sphereObject[slot]];
+				hit->prim = 0;
+				hit->sphere = 1;
+			}
+			continue;
+		}
+		j = i + 1;
+
+		test = &scene->objects[bvh->prims[i]];
+		/* if this is the object we want to exclude, skip */
+		if(test == exc)
+			continue;
+
+		if(cscene_intersect(cs, bvh->prims[i], ray, &tmpInt, &tmpD,
+			&tmpPrim))
+		{
+			/* a sphere behind the ray gives distance 0 */
+			if(!(tmpD > 0.0f))
+				continue;
+			if(tmpD < hit->tmax)
+			{
+				hit->tmax = tmpD;
+				hit->obj = test;
+				hit->prim = tmpPrim;
+				hit->sphere = 0;
+				vec4_set(&hit->intersect, (float *)&tmpInt);
+			}
+		}
+	}
+}
+
+/* tests if any object of leaf entries [first, end) other than exc is hit
+ * in (0, ray->magnitude), with the same runs of spheres as above */
+static int bvh_leaf_occluded(const scene_t *scene, unsigned int first,
+		unsigned int end, const ray_t *ray, const object3d_t *exc,
+		unsigned int excSlot)
+{
+	const bvh_t	*bvh = scene->bvh;
+	const cscene_t	*cs = scene->compiled;
+	unsigned int	i = first;
+	unsigned int	j;
+	unsigned int	ref;
+	float		tmpD;		/* distance to intersection */
+
+	for(; i < end; i = j)
+	{
+		ref = cs->objectRef[bvh->prims[i]];
+		if(ref != ~0u && CSCENE_REF_TYPE(ref) == CSCENE_REF_SPHERE)
+		{
+			j = bvh_sphere_run(cs, bvh, i, end);
+			tmpD = ray->magnitude;
+			if(cscene_hit_spheres(cs, CSCENE_REF_SLOT(ref), j - i,
+				ray, excSlot, 1, &tmpD) != ~0u)
+				return 1;
+			continue;
+		}
+		j = i + 1;
+
+		if(&scene->objects[bvh->prims[i]] == exc)
+			continue;
+		if(cscene_hit(cs, bvh->prims[i], ray, &tmpD) &&
+			tmpD < ray->magnitude && tmpD > 0.0f)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* ray data splatted across the lanes for testing the children of wide
+ * nodes.  A zero direction component gets a huge reciprocal rather than
+ * an infinite one, so a slab plane through the origin gives 0 instead of
+ * NaN and the test agrees with ray_intersect_aabb() */
+typedef struct
+{
+	simd4f_t	ox, oy, oz;	/* origin */
+	simd4f_t	ix, iy, iz;	/* reciprocal direction */
+} bvh4_ray_t;
+
+static void bvh4_ray_init(bvh4_ray_t *r, const ray_t *ray)
+{
+	float	inv[3];
+	int	i = 0;
+
+	for(; i < 3; ++i)
+	{
+		inv[i] = 1.0f / ray->direction.c[i];
+		if(!(inv[i] < FLT_MAX && inv[i] > -FLT_MAX))
+			inv[i] = inv[i] < 0.0f ? -FLT_MAX : FLT_MAX;
+	}
+	r->ox = simd4_splat(ray->origin.x);
+	r->oy = simd4_splat(ray->origin.y);
+	r->oz = simd4_splat(ray->origin.z);
+	r->ix = simd4_splat(inv[0]);
+	r->iy = simd4_splat(inv[1]);
+	r->iz = simd4_splat(inv[2]);
+}
+
+/* slab test of a ray against all children of a wide node, clipped to
+ * [0, tmax].  Returns a bit per child that is hit and stores the entry
+ * distance of every child in tnear.  Empty children must still be skipped
+ * by the caller */
+static unsigned int bvh4_hit_children(const bvh4_node_t *node,
+		const bvh4_ray_t *r, float tmax, simd4f_t *tnear)
+{
+	simd4f_t	t0, t1;
+	simd4f_t	lo = simd4_splat(0.0f);
+	simd4f_t	hi = simd4_splat(tmax);
+
+	t0 = simd4_mul(simd4_sub(simd4_load(node->minX), r->ox), r->ix);
+	t1 = simd4_mul(simd4_sub(simd4_load(node->maxX), r->ox), r->ix);
+	lo = simd4_max(lo, simd4_min(t0, t1));
+	hi = simd4_min(hi, simd4_max(t0, t1));
+	t0 = simd4_mul(simd4_sub(simd4_load(node->minY), r->oy), r->iy);
+	t1 = simd4_mul(simd4_sub(simd4_load(node->maxY), r->oy), r->iy);
+	lo = simd4_max(lo, simd4_min(t0, t1));
+	hi = simd4_min(hi, simd4_max(t0, t1));
+	t0 = simd4_mul(simd4_sub(simd4_load(node->minZ), r->oz), r->iz);
+	t1 = simd4_mul(simd4_sub(simd4_load(node->maxZ), r->oz), r->iz);
+	lo = simd4_max(lo, simd4_min(t0, t1));
+	hi = simd4_min(hi, simd4_max(t0, t1));
+
+	*tnear = lo;
+	return ~simd4m_bits(simd4_cmpgt(lo, hi)) & 0xF;
+}
+
+/* give a wide node the children of binary node index (an interior node),
+ * opening the child with the largest surface area until there are 4 or
+ * only leaves are left.  Interior children are collapsed the same way
+ * right after their parent, so nodes stay in depth first order.  Returns
+ * the index of the wide node */
+static unsigned int bvh4_collapse(bvh4_t *bvh4, unsigned int index)
+{
+	const bvh_t	*bvh = bvh4->bvh;
+	const bvh_node_t *node;
+	unsigned int	slot[BVH4_WIDTH];	/* binary nodes of the children */
+	unsigned int	wide = bvh4->nNodes++;
+	unsigned int	n = 2;
+	unsigned int	i;
+	unsigned int	best;
+	unsigned int	child;
+	float		area, bestArea;
+	bvh4_node_t	*out;
+
+	slot[0] = index + 1;
+	slot[1] = bvh->nodes[index].first;
+	while(n < BVH4_WIDTH)
+	{
+		best = ~0u;
+		bestArea = -1.0f;
+		for(i = 0; i < n; ++i)
+		{
+			node = &bvh->nodes[slot[i]];
+			area = aabb_area(&node->bounds);
+			if(!node->count && area > bestArea)
+			{
+				best = i;
+				bestArea = area;
+			}
+		}
+		if(best == ~0u)
+			break;
+		/* its first child takes its place, the second goes last */
+		slot[n++] = bvh->nodes[slot[best]].first;
+		slot[best] = slot[best] + 1;
+	}
+
+	for(i = 0; i < BVH4_WIDTH; ++i)
+	{
+		if(i < n)
+		{
+			node = &bvh->nodes[slot[i]];
+			child = node->count ? BVH4_LEAF | node->first :
+				bvh4_collapse(bvh4, slot[i]);
+		}
+		else
+		{
+			node = 0;
+			child = BVH4_EMPTY;
+		}
+
+		out = &bvh4->nodes[wide];
+		out->child[i] = child;
+		out->count[i] = node ? node->count : 0;
+		out->minX[i] = node ? node->bounds.min[0] : FLT_MAX;
+		out->minY[i] = node ? node->bounds.min[1] : FLT_MAX;
+		out->minZ[i] = node ? node->bounds.min[2] : FLT_MAX;
+		out->maxX[i] = node ? node->bounds.max[0] : -FLT_MAX;
+		out->maxY[i] = node ? node->bounds.max[1] : -FLT_MAX;
+		out->maxZ[i] = node ? node->bounds.max[2] : -FLT_MAX;
+	}
+
+	return wide;
+}
+
+/* collapse a binary hierarchy into a 4 wide one */
+bvh4_t* bvh4_build(const bvh_t *bvh)
+{
+	bvh4_t		*bvh4 = malloc(sizeof(bvh4_t));
+	bvh4_node_t	*root;
+	const bvh_node_t *node = &bvh->nodes[0];
+	unsigned int	i = 1;
+
+	/* every wide node takes the place of at least one interior node
+	 * (and a leaf as root needs one) */
+	bvh4->block = malloc(sizeof(bvh4_node_t) * (bvh->nNodes / 2 + 1) + 63);
+	bvh4->nodes = (bvh4_node_t *)(((unsigned long)bvh4->block + 63) &
+				~63ul);
+	bvh4->nNodes = 0;
+	bvh4->bvh = bvh;
+
+	if(!node->count && bvh->nNodes > 1)
+	{
+		bvh4_collapse(bvh4, 0);
+		return bvh4;
+	}
+
+	/* a tree that is one leaf (or empty) is a root with one child */
+	root = &bvh4->nodes[bvh4->nNodes++];
+	root->child[0] = BVH4_LEAF | node->first;
+	root->count[0] = node->count;
+	root->minX[0] = node->bounds.min[0];
+	root->minY[0] = node->bounds.min[1];
+	root->minZ[0] = node->bounds.min[2];
+	root->maxX[0] = node->bounds.max[0];
+	root->maxY[0] = node->bounds.max[1];
+	root->maxZ[0] = node->bounds.max[2];
+	for(; i < BVH4_WIDTH; ++i)
+	{
+		root->child[i] = BVH4_EMPTY;
+		root->count[i] = 0;
+		root->minX[i] = root->minY[i] = root->minZ[i] = FLT_MAX;
+		root->maxX[i] = root->maxY[i] = root->maxZ[i] = -FLT_MAX;
+	}
+
+	return bvh4;
+}
+
+/* cleanup dynamic memory from collapsing a hierarchy */
+void bvh4_free(bvh4_t *bvh4)
+{
+	if(bvh4)
+	{
+		free(bvh4->block);
+		free(bvh4);
+	}
+}
+
+/* child of a wide node waiting to be visited */
+typedef struct
+{
+	unsigned int	child;		/* see bvh4_node_t */
+	unsigned int	count;
+	float		tnear;		/* entry distance */
+} bvh4_entry_t;
+
+/* gets the closest object this ray intersects using the 4 wide scene
+ * hierarchy */
+object3d_t* bvh_intersect(point_t *intersect, float *d, unsigned int *prim,
+		const ray_t *ray, const scene_t *scene, const object3d_t *exc,
+		int bounded)
+{
+	const bvh4_t	*bvh4 = scene->bvh4;
+	const bvh4_node_t *node;
+	bvh4_entry_t	stack[BVH4_STACK_SIZE];	/* children left to visit */
+	bvh4_entry_t	*entry;
+	unsigned int	top = 0;
+	unsigned int	bits;		/* children of node that are hit */
+	unsigned int	lane;
+	unsigned int	n, i;
+	unsigned int	order[BVH4_WIDTH];	/* hit children by distance */
+	unsigned int	excSlot = bvh_exclude_slot(scene->compiled, scene, exc);
+	float		tnear[BVH4_WIDTH] SIMD_ALIGN;
+	simd4f_t	t;
+	bvh4_ray_t	r;
+	bvh_hit_t	hit;
+
+	hit.obj = 0;
+	/* never look past the end of a bounded ray */
+	hit.tmax = bounded ? ray->magnitude : FLT_MAX;
+	hit.prim = 0;
+	hit.sphere = 0;
+	bvh4_ray_init(&r, ray);
+
+	stack[top].child = 0;
+	stack[top].count = 0;
+	stack[top++].tnear = 0.0f;
+	while(top)
+	{
+		entry = &stack[--top];
+		/* something closer was found since this child was pushed */
+		if(entry->tnear > hit.tmax)
+			continue;
+
+		if(entry->child & BVH4_LEAF)
+		{
+			bvh_leaf_intersect(scene, entry->child & ~BVH4_LEAF,
+				(entry->child & ~BVH4_LEAF) + entry->count, ray, exc,
+				excSlot, bounded, &hit);
+			continue;
+		}
+
+		node = &bvh4->nodes[entry->child];
+		bits = bvh4_hit_children(node, &r, hit.tmax, &t);
+		if(!bits)
+			continue;
+		simd4_store(tnear, t);
+
+		/* push the hit children farthest first so the nearest is
+		 * visited next */
+		for(n = 0, lane = 0; lane < BVH4_WIDTH; ++lane)
+		{
+			if(!(bits & (1u << lane)) || node->child[lane] == BVH4_EMPTY)
+				continue;
+			for(i = n++; i > 0 && tnear[order[i - 1]] < tnear[lane]; --i)
+				order[i] = order[i - 1];
+			order[i] = lane;
+		}
+		for(i = 0; i < n; ++i)
+		{
+			lane = order[i];
+			stack[top].child = node->child[lane];
+			stack[top].count = node->count[lane];
+			stack[top++].tnear = tnear[lane];
+		}
+	}
+
+	if(!hit.obj)
+		return 0;
+	*d = hit.tmax;
+	*prim = hit.prim;
+	/* sphere hits only have a distance, the point is only worked out
+	 * for the one that was nearest */
+	if(hit.sphere)
+		*intersect = vec4v_madd(ray->origin, ray->direction, hit.tmax);
+	else
+		*intersect = hit.intersect;
+	return hit.obj;
+}
+
+/* tests if anything other than exc is hit in (0, ray->magnitude) using
+ * the 4 wide scene hierarchy */
+int bvh_occluded(const ray_t *ray, const scene_t *scene,
+		const object3d_t *exc)
+{
+	const bvh4_t	*bvh4 = scene->bvh4;
+	const bvh4_node_t *node;
+	unsigned int	stack[BVH4_STACK_SIZE];	/* nodes left to visit */
+	unsigned int	top = 0;
+	unsigned int	bits;		/* children of node that are hit */
+	unsigned int	lane;
+	unsigned int	excSlot = bvh_exclude_slot(scene->compiled, scene, exc);
+	simd4f_t	tnear;		/* unused entry distance of children */
+	bvh4_ray_t	r;
+
+	bvh4_ray_init(&r, ray);
+
+	stack[top++] = 0;
+	while(top)
+	{
+		node = &bvh4->nodes[stack[--top]];
+		/* order does not matter, any hit ends the search */
+		bits = bvh4_hit_children(node, &r, ray->magnitude, &tnear);
+		for(lane = 0; bits; ++lane, bits >>= 1)
+		{
+			if(!(bits & 1) || node->child[lane] == BVH4_EMPTY)
+				continue;
+			if(!(node->child[lane] & BVH4_LEAF))
+			{
+				stack[top++] = node->child[lane];
+				continue;
+			}
+			if(bvh_leaf_occluded(scene, node->child[lane] & ~BVH4_LEAF,
+				(node->child[lane] & ~BVH4_LEAF) + node->count[lane],
+				ray, exc, excSlot))
+				return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * May 24, 2008
+ * bvh.h
+ *
+ * This file contains the definition for the bounding volume hierarchy used
+ * to accelerate ray/object intersection queries.  The hierarchy itself only
+ * knows about bounding boxes and primitive indices so it can be built over
+ * any list of primitives.
+ *
+ * Single rays through the scene walk a 4 wide copy of the scene hierarchy
+ * instead (bvh4_t).  It is made by collapsing the binary tree so every
+ * node holds up to 4 children, with their bounds stored as 4 floats per
+ * plane so one SIMD slab test covers all of them.  Its leaves are the
+ * leaves of the binary tree.
+ */
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "scene.h"
+
+/* largest number of primitives a leaf is kept to by default.  Nodes this
+ * small only become leaves when splitting them does not pay off */
+#define BVH_LEAF_SIZE		4
+/* default and largest number of bins the builder sorts primitives into
+ * along each axis to look for the best split */
+#define BVH_DEFAULT_BINS	16
+#define BVH_MAX_BINS		64
+/* a refit hierarchy is built again once its cost passes this many times
+ * its cost when it was built (see bvh_refit_scene()) */
+#define BVH_REBUILD_COST	1.3f
+/* deepest a tree may get - also bounds the traversal stack */
+#define BVH_MAX_DEPTH		60
+#define BVH_STACK_SIZE		(BVH_MAX_DEPTH + 4)
+
+/* nodes are stored depth first - an interior node's first child
+ * immediately follows it in the node array */
+typedef struct
+{
+	aabb_t		bounds;		/* bounds of everything below node */
+	unsigned int	first;		/* leaf: first entry in prims
+					 * interior: index of second child */
+	unsigned int	count;		/* primitives in leaf, 0 if interior */
+} bvh_node_t;
+
+typedef struct bvh_s
+{
+	bvh_node_t	*nodes;		/* node storage, root at index 0 */
+	unsigned int	nNodes;		/* number of nodes used */
+	unsigned int	*prims;		/* primitive indices referenced by leaves */
+	unsigned int	nPrims;		/* number of primitives */
+	float		buildCost;	/* bvh_sah_cost() when built */
+	int		mapped;		/* nodes and prims belong to a mapped
+					 * scene file (see scenebin.h) */
+} bvh_t;
+
+/* children per node of a wide hierarchy */
+#define BVH4_WIDTH		4
+/* set in a child of a wide node if it is a leaf, the rest is the first
+ * entry of the leaf in the prims of the binary tree */
+#define BVH4_LEAF		0x80000000u
+/* child of a wide node that is not used */
+#define BVH4_EMPTY		0xFFFFFFFFu
+/* nodes left to visit while walking a wide hierarchy */
+#define BVH4_STACK_SIZE		(3 * BVH_MAX_DEPTH + 4)
+
+/* 128 bytes - two cache lines - kept 64 byte aligned.  Child bounds are
+ * stored plane by plane, lane i of each array belongs to child i.
+ * Unused children have empty bounds */
+typedef struct
+{
+	float		minX[BVH4_WIDTH];
+	float		minY[BVH4_WIDTH];
+	float		minZ[BVH4_WIDTH];
+	float		maxX[BVH4_WIDTH];
+	float		maxY[BVH4_WIDTH];
+	float		maxZ[BVH4_WIDTH];
+	unsigned int	child[BVH4_WIDTH];	/* node index, BVH4_LEAF or
+						 * BVH4_EMPTY */
+	unsigned int	count[BVH4_WIDTH];	/* primitives of a leaf */
+} bvh4_node_t;
+
+typedef struct bvh4_s
+{
+	bvh4_node_t	*nodes;		/* root at index 0 */
+	unsigned int	nNodes;
+	const bvh_t	*bvh;		/* tree the leaves belong to */
+	void		*block;		/* unaligned storage of nodes */
+} bvh4_t;
+
+/* how hierarchies are built */
+typedef struct bvh_options_s
+{
+	unsigned int	leafSize;	/* see BVH_LEAF_SIZE */
+	unsigned int	nBins;		/* see BVH_DEFAULT_BINS */
+	unsigned int	numThreads;	/* build threads (0 = one per cpu) */
+	float		rebuildCost;	/* see BVH_REBUILD_COST */
+} bvh_options_t;
+
+/* set the hierarchy options to their defaults */
+bvh_options_t* init_bvh_options(bvh_options_t *options);
+
+/* build a hierarchy over a list of primitive bounding boxes.  Splits are
+ * picked with the surface area heuristic over bins of primitive centroids.
+ * Big nodes are binned and partitioned by every thread at once and
+ * subtrees are built as tasks of their own.  options may be null for the
+ * defaults */
+bvh_t* bvh_build(const aabb_t *bounds, unsigned int nPrims,
+		const bvh_options_t *options);
+
+/* cleanup dynamic memory from building a hierarchy */
+void bvh_free(bvh_t *bvh);
+
+/* update the node bounds of a hierarchy bottom up for new primitive
+ * bounds.  The tree keeps its shape, so its cost grows as primitives
+ * move away from where it was built */
+void bvh_refit(bvh_t *bvh, const aabb_t *bounds);
+
+/* collapse a binary hierarchy into a 4 wide one.  The binary tree must
+ * outlive it */
+bvh4_t* bvh4_build(const bvh_t *bvh);
+
+/* cleanup dynamic memory from collapsing a hierarchy */
+void bvh4_free(bvh4_t *bvh4);
+
+/* expected cost of a ray through a hierarchy by the surface area
+ * heuristic, counting a node visit and a primitive test as 1 each */
+float bvh_sah_cost(const bvh_t *bvh);
+
+/* build the hierarchy over the triangles of every mesh in the scene.
+ * Prints how long each took and its cost (see bvh_sah_cost()) */
+void bvh_build_meshes(scene_t *scene, const bvh_options_t *options);
+
+/* build the hierarchy over every object in the scene (scene->bvh) and its
+ * 4 wide copy (scene->bvh4), after the hierarchy of every mesh (see
+ * bvh_build_meshes()).  Prints how long each took and its cost */
+bvh_t* bvh_build_scene(scene_t *scene, const bvh_options_t *options);
+
+/* bring the scene hierarchy up to date after objects moved (see
+ * scene_move_sphere()).  It is refit and its 4 wide copy collapsed again,
+ * unless the refit tree costs more than options->rebuildCost times its
+ * cost when built, then it is built again.  Mesh hierarchies are left as
+ * they are.  Prints how long it took and the cost */
+bvh_t* bvh_refit_scene(scene_t *scene, const bvh_options_t *options);
+
+/* gets the closest object this ray intersects using the 4 wide scene
+ * hierarchy.
+ * prim - triangle hit if the object is a mesh (see get_object_normal())
+ * exc - object to skip (may be null)
+ * bounded - if non zero, only hits in (0, ray->magnitude) count
+ * returns null if there is no object intersected */
+object3d_t* bvh_intersect(point_t *intersect, float *d, unsigned int *prim,
+		const ray_t *ray, const scene_t *scene, const object3d_t *exc,
+		int bounded);
+
+/* tests if anything other than exc is hit in (0, ray->magnitude) using
+ * the 4 wide scene hierarchy.  Stops at the first hit found. */
+int bvh_occluded(const ray_t *ray, const scene_t *scene,
+		const object3d_t *exc);
+
+#endif
@@ -66,6 +66,51 @@ color_t* color_mult(color_t *colorout, const color_t *color1,
 color_t* color_average(color_t *colorout, color_t *colors, 
 					   unsigned int ncolors);
 
+/* value returning versions of the most used functions above.  These are
+ * static inline so shading code can keep colors in registers */
+
+/* build a color from channels */
+static inline color_t colorv_make(float r, float g, float b)
+{
+	color_t c;
+	c.r = r;
+	c.g = g;
+	c.b = b;
+	return c;
+}
+
+/* c1 + c2 */
+static inline color_t colorv_add(color_t c1, color_t c2)
+{
+	return colorv_make(c1.r + c2.r, c1.g + c2.g, c1.b + c2.b);
+}
+
+/* c * s */
+static inline color_t colorv_scale(color_t c, float s)
+{
+	return colorv_make(c.r * s, c.g * s, c.b * s);
+}
+
+/* c1 * c2 - channel by channel */
+static inline color_t colorv_mult(color_t c1, color_t c2)
+{
+	return colorv_make(c1.r * c2.r, c1.g * c2.g, c1.b * c2.b);
+}
+
+/* acc + c * s - accumulate a weighted color */
+static inline color_t colorv_madd(color_t acc, color_t c, float s)
+{
+	return colorv_make(acc.r + c.r * s, acc.g + c.g * s, acc.b + c.b * s);
+}
+
+/* c with every channel clamped at 1.0f */
+static inline color_t colorv_clamp(color_t c)
+{
+	return colorv_make(c.r > 1.0f ? 1.0f : c.r,
+			c.g > 1.0f ? 1.0f : c.g,
+			c.b > 1.0f ? 1.0f : c.b);
+}
+
 /**********************************************************
  * 
  *	Tone reproduction related functions
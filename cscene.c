@@ -0,0 +1,469 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 7, 2008
+ * cscene.c
+ *
+ * This file contains the definitions for compiling a scene into structure
+ * of arrays form and intersecting rays with the compiled geometry.
+ */
+
+#if defined(__SPU__) || defined(__PPU__)
+	#include <malloc_align.h>
+	#include <free_align.h>
+#endif
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cscene.h"
+#include "bvh.h"
+#include "mesh.h"
+
+/* round a byte count up so the next array stays 16 byte aligned */
+#define CSCENE_ALIGN(size)	(((size) + 15) & ~15u)
+
+/* hand out the next array of a block.  With no block only the size is
+ * accumulated so the same code measures and fills the block */
+static void* cscene_carve(char *block, unsigned int *size, unsigned int bytes)
+{
+	void *p = block ? block + *size : 0;
+
+	*size += CSCENE_ALIGN(bytes);
+	return p;
+}
+
+/* lay every array out in a block (or measure the block if it is null) */
+static unsigned int cscene_layout(cscene_t *cs, char *block)
+{
+	unsigned int size = 0;
+	unsigned int nSpheres = (cs->nSpheres + CSCENE_SPHERE_PAD - 1) &
+				~(CSCENE_SPHERE_PAD - 1);
+
+	cs->polyPlane = cscene_carve(block, &size, sizeof(plane_t) * cs->nPolygons);
+	cs->sphereX = cscene_carve(block, &size, sizeof(float) * nSpheres);
+	cs->sphereY = cscene_carve(block, &size, sizeof(float) * nSpheres);
+	cs->sphereZ = cscene_carve(block, &size, sizeof(float) * nSpheres);
+	cs->sphereR = cscene_carve(block, &size, sizeof(float) * nSpheres);
+	cs->sphereObject = cscene_carve(block, &size,
+				sizeof(unsigned int) * nSpheres);
+	cs->polyInfo = cscene_carve(block, &size,
+				sizeof(cscene_poly_t) * cs->nPolygons);
+	cs->polyEdge = cscene_carve(block, &size, sizeof(float) * 4 * cs->nEdges);
+	cs->polyObject = cscene_carve(block, &size,
+				sizeof(unsigned int) * cs->nPolygons);
+	cs->meshes = cscene_carve(block, &size, sizeof(mesh_t) * cs->nMeshes);
+	cs->meshObject = cscene_carve(block, &size,
+				sizeof(unsigned int) * cs->nMeshes);
+	cs->materials = cscene_carve(block, &size,
+				sizeof(material_t) * cs->nMaterials);
+	cs->objectRef = cscene_carve(block, &size,
+				sizeof(unsigned int) * cs->nObjects);
+	cs->objectMaterial = cscene_carve(block, &size,
+				sizeof(unsigned int) * cs->nObjects);
+
+	return size;
+}
+
+/* hash of the bytes of a material (FNV-1a) */
+static unsigned int cscene_material_hash(const material_t *m)
+{
+	const unsigned char	*b = (const unsigned char *)m;
+	unsigned int		h = 2166136261u;
+	unsigned int		i = 0;
+
+	for(; i < sizeof(material_t); ++i)
+	{
+		h = (h ^ b[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+/* give every distinct material an index.  objectMaterial gets the index
+ * of each object's material and the first object using each material is
+ * recorded in firstUser.  Returns the number of distinct materials */
+static unsigned int cscene_find_materials(const scene_t *scene,
+		unsigned int *objectMaterial, unsigned int *firstUser)
+{
+	unsigned int	nMaterials = 0;
+	unsigned int	tableSize = 16;
+	unsigned int	*table;		/* hashed material index + 1, 0 = empty */
+	unsigned int	i = 0;
+	unsigned int	h;
+	const material_t *m;
+
+	while(tableSize < scene->nObjects * 2)
+		tableSize <<= 1;
+	table = calloc(tableSize, sizeof(unsigned int));
+
+	for(; i < scene->nObjects; ++i)
+	{
+		m = &scene->objects[i].material;
+		h = cscene_material_hash(m) & (tableSize - 1);
+		/* linear probing until the material or an empty slot */
+		while(table[h] && memcmp(m,
+			&scene->objects[firstUser[table[h] - 1]].material,
+			sizeof(material_t)))
+			h = (h + 1) & (tableSize - 1);
+
+		if(!table[h])
+		{
+			firstUser[nMaterials] = i;
+			table[h] = ++nMaterials;
+		}
+		objectMaterial[i] = table[h] - 1;
+	}
+
+	free(table);
+	return nMaterials;
+}
+
+/* compile the objects of a scene (scene->compiled) */
+cscene_t* cscene_build(scene_t *scene)
+{
+	cscene_t	*cs = malloc(sizeof(cscene_t));
+	unsigned int	n = scene->nObjects ? scene->nObjects : 1;
+	unsigned int	*objectMaterial = malloc(sizeof(unsigned int) * n);
+	unsigned int	*firstUser = malloc(sizeof(unsigned int) * n);
+	unsigned int	i = 0;
+	unsigned int	slot;
+	unsigned int	edge = 0;
+	unsigned int	object;
+	const object3d_t *obj;
+	const polygon_t	*poly;
+
+	cs->nObjects = scene->nObjects;
+	cs->mapped = 0;
+	cs->nSpheres = 0;
+	cs->nPolygons = 0;
+	cs->nEdges = 0;
+	cs->nMeshes = 0;
+	for(; i < scene->nObjects; ++i)
+	{
+		obj = &scene->objects[i];
+		if(obj->geometryType == GEOMETRY_SPHERE)
+		{
+			++cs->nSpheres;
+		}
+		else if(obj->geometryType == GEOMETRY_POLYGON)
+		{
+			++cs->nPolygons;
+			cs->nEdges += obj->poly_obj.nVerticies;
+		}
+		else if(obj->geometryType == GEOMETRY_TRIANGLE_MESH)
+		{
+			++cs->nMeshes;
+		}
+	}
+	cs->nMaterials = cscene_find_materials(scene, objectMaterial, firstUser);
+
+	/* measure then allocate and carve the block */
+	cs->blockSize = cscene_layout(cs, 0);
+#if defined(__SPU__) || defined(__PPU__)
+	cs->block = _malloc_align(cs->blockSize ? cs->blockSize : 16, 4);
+#else
+	cs->block = malloc(cs->blockSize ? cs->blockSize : 16);
+#endif
+	memset(cs->block, 0, cs->blockSize);
+	cscene_layout(cs, cs->block);
+
+	for(i = 0; i < cs->nMaterials; ++i)
+	{
+		cs->materials[i] = scene->objects[firstUser[i]].material;
+	}
+
+	/* slots are handed out in the order the hierarchy leaves list the
+	 * objects, which keeps the spheres of each leaf together */
+	cs->nSpheres = 0;
+	cs->nPolygons = 0;
+	cs->nMeshes = 0;
+	for(object = 0; object < scene->nObjects; ++object)
+	{
+		i = scene->bvh && scene->bvh->nPrims == scene->nObjects ?
+			scene->bvh->prims[object] : object;
+		obj = &scene->objects[i];
+		cs->objectMaterial[i] = objectMaterial[i];
+
+		switch(obj->geometryType)
+		{
+		case GEOMETRY_SPHERE:
+			slot = cs->nSpheres++;
+			cs->sphereX[slot] = obj->sphr_obj.center.x;
+			cs->sphereY[slot] = obj->sphr_obj.center.y;
+			cs->sphereZ[slot] = obj->sphr_obj.center.z;
+			cs->sphereR[slot] = obj->sphr_obj.radius;
+			cs->sphereObject[slot] = i;
+			cs->objectRef[i] = CSCENE_REF(slot, CSCENE_REF_SPHERE);
+			break;
+		case GEOMETRY_POLYGON:
+			poly = &obj->poly_obj;
+			slot = cs->nPolygons++;
+			cs->polyPlane[slot] = poly->plane;
+			cs->polyInfo[slot].firstEdge = edge;
+			cs->polyInfo[slot].nEdges = poly->nVerticies;
+			cs->polyInfo[slot].axisU = poly->axisU;
+			cs->polyInfo[slot].axisV = poly->axisV;
+			memcpy(&cs->polyEdge[edge * 4], poly->edge,
+				sizeof(float) * 4 * poly->nVerticies);
+			edge += poly->nVerticies;
+			cs->polyObject[slot] = i;
+			cs->objectRef[i] = CSCENE_REF(slot, CSCENE_REF_POLYGON);
+			break;
+		case GEOMETRY_TRIANGLE_MESH:
+			slot = cs->nMeshes++;
+			cs->meshes[slot] = obj->mesh_obj;
+			cs->meshObject[slot] = i;
+			cs->objectRef[i] = CSCENE_REF(slot, CSCENE_REF_MESH);
+			break;
+		default:
+			/* unknown geometry is never hit */
+			cs->objectRef[i] = ~0u;
+			break;
+		}
+	}
+
+	/* padding spheres never belong to an object */
+	for(i = cs->nSpheres; i % CSCENE_SPHERE_PAD; ++i)
+	{
+		cs->sphereObject[i] = ~0u;
+	}
+
+	free(objectMaterial);
+	free(firstUser);
+
+	cscene_free(scene->compiled);
+	scene->compiled = cs;
+
+#if defined(_DEBUG)
+	printf("Scene compiled:\t%d spheres, %d polygons, %d meshes, %d materials, "
+		"%d bytes\n", cs->nSpheres, cs->nPolygons, cs->nMeshes,
+		cs->nMaterials, cs->blockSize);
+#endif
+
+	return cs;
+}
+
+/* copy the geometry of one object into the compiled scene again */
+void cscene_update(cscene_t *cs, const scene_t *scene, unsigned int object)
+{
+	unsigned int		ref = cs->objectRef[object];
+	unsigned int		slot = CSCENE_REF_SLOT(ref);
+	const object3d_t	*obj = &scene->objects[object];
+	const polygon_t		*poly;
+	cscene_poly_t		*info;
+
+	if(ref == ~0u)
+		return;
+
+	switch(CSCENE_REF_TYPE(ref))
+	{
+	case CSCENE_REF_SPHERE:
+		cs->sphereX[slot] = obj->sphr_obj.center.x;
+		cs->sphereY[slot] = obj->sphr_obj.center.y;
+		cs->sphereZ[slot] = obj->sphr_obj.center.z;
+		cs->sphereR[slot] = obj->sphr_obj.radius;
+		break;
+	case CSCENE_REF_POLYGON:
+		poly = &obj->poly_obj;
+		info = &cs->polyInfo[slot];
+		cs->polyPlane[slot] = poly->plane;
+		info->axisU = poly->axisU;
+		info->axisV = poly->axisV;
+		memcpy(&cs->polyEdge[info->firstEdge * 4], poly->edge,
+			sizeof(float) * 4 * info->nEdges);
+		break;
+	case CSCENE_REF_MESH:
+		cs->meshes[slot] = obj->mesh_obj;
+		break;
+	}
+}
+
+/* lay the arrays of a compiled scene out over an existing block */
+cscene_t* cscene_attach(cscene_t *cs, void *block, unsigned int blockSize)
+{
+	if(cscene_layout(cs, 0) != blockSize)
+		return 0;
+
+	cs->block = block;
+	cs->blockSize = blockSize;
+	cs->mapped = 1;
+	cscene_layout(cs, block);
+
+	return cs;
+}
+
+/* cleanup dynamic memory from compiling a scene */
+void cscene_free(cscene_t *cs)
+{
+	if(cs)
+	{
+		if(!cs->mapped)
+		{
+#if defined(__SPU__) || defined(__PPU__)
+			_free_align(cs->block);
+#else
+			free(cs->block);
+#endif
+		}
+		free(cs);
+	}
+}
+
+/* same as ray_intersect_object() on scene->objects[object] */
+int cscene_intersect(const cscene_t *cs, unsigned int object,
+		const ray_t *ray, point_t *pt, float *distance,
+		unsigned int *prim)
+{
+	unsigned int		ref = cs->objectRef[object];
+	unsigned int		slot = CSCENE_REF_SLOT(ref);
+	const cscene_poly_t	*info;
+	point_t			center;
+
+	*prim = 0;
+	if(ref == ~0u)
+		return 0;
+
+	if(CSCENE_REF_TYPE(ref) == CSCENE_REF_MESH)
+	{
+		*distance = FLT_MAX;
+		*prim = ray_hit_mesh(ray, &cs->meshes[slot], distance, 0);
+		if(*prim == ~0u)
+			return 0;
+		*pt = vec4v_madd(ray->origin, ray->direction, *distance);
+		return 1;
+	}
+
+	if(CSCENE_REF_TYPE(ref) == CSCENE_REF_POLYGON)
+	{
+		info = &cs->polyInfo[slot];
+		return ray_intersect_poly_edges(ray, &cs->polyPlane[slot],
+			info->axisU, info->axisV, &cs->polyEdge[info->firstEdge * 4],
+			info->nEdges, pt, distance);
+	}
+
+	center = vec4v_make(cs->sphereX[slot], cs->sphereY[slot],
+			cs->sphereZ[slot], 1.0f);
+	if(!ray_hit_sphere_at(ray, &center, cs->sphereR[slot], distance))
+		return 0;
+	/* use distance to calculate where intersection point is */
+	*pt = vec4v_madd(ray->origin, ray->direction, *distance);
+	return 1;
+}
+
+/* same as ray_hit_object() on scene->objects[object] */
+int cscene_hit(const cscene_t *cs, unsigned int object,
+		const ray_t *ray, float *distance)
+{
+	unsigned int		ref = cs->objectRef[object];
+	unsigned int		slot = CSCENE_REF_SLOT(ref);
+	const cscene_poly_t	*info;
+	point_t			center;
+
+	if(ref == ~0u)
+		return 0;
+
+	if(CSCENE_REF_TYPE(ref) == CSCENE_REF_MESH)
+	{
+		*distance = ray->magnitude;
+		return ray_hit_mesh(ray, &cs->meshes[slot], distance, 1) != ~0u;
+	}
+
+	if(CSCENE_REF_TYPE(ref) == CSCENE_REF_POLYGON)
+	{
+		info = &cs->polyInfo[slot];
+		return ray_hit_poly_edges(ray, &cs->polyPlane[slot],
+			info->axisU, info->axisV, &cs->polyEdge[info->firstEdge * 4],
+			info->nEdges, distance);
+	}
+
+	center = vec4v_make(cs->sphereX[slot], cs->sphereY[slot],
+			cs->sphereZ[slot], 1.0f);
+	return ray_hit_sphere_at(ray, &center, cs->sphereR[slot], distance);
+}
+
+/* nearest of the spheres in slots [first, first + count) along a ray */
+unsigned int cscene_hit_spheres(const cscene_t *cs, unsigned int first,
+		unsigned int count, const ray_t *ray, unsigned int exc,
+		int bounded, float *distance)
+{
+	unsigned int	end = first + count;
+	unsigned int	padded = (cs->nSpheres + CSCENE_SPHERE_PAD - 1) &
+				~(CSCENE_SPHERE_PAD - 1);
+	unsigned int	i = first;
+	unsigned int	base;		/* slot in the first lane */
+	unsigned int	bits;		/* lanes still in the running */
+	unsigned int	lane;
+	unsigned int	slot = ~0u;	/* return value */
+	float		w[4] SIMD_ALIGN;
+	float		tmax = *distance;
+	simd4f_t	ox = simd4_splat(ray->origin.x);
+	simd4f_t	oy = simd4_splat(ray->origin.y);
+	simd4f_t	oz = simd4_splat(ray->origin.z);
+	simd4f_t	dx = simd4_splat(ray->direction.x);
+	simd4f_t	dy = simd4_splat(ray->direction.y);
+	simd4f_t	dz = simd4_splat(ray->direction.z);
+	simd4f_t	zero = simd4_splat(0.0f);
+	simd4f_t	half = simd4_splat(0.5f);
+	simd4f_t	lx, ly, lz, r, B, C, det, sq, wOne, wTwo, t;
+	simd4m_t	valid;
+
+	if(bounded && ray->magnitude < tmax)
+		tmax = ray->magnitude;
+
+	for(; i < end; i += 4)
+	{
+		/* a group running off the arrays slides back and skips the
+		 * lanes it already looked at */
+		base = i + 4 <= padded ? i : padded - 4;
+		bits = (end - i >= 4 ? 0xF : (1u << (end - i)) - 1) << (i - base);
+		if(exc - base < 4)
+			bits &= ~(1u << (exc - base));
+		if(!bits)
+			continue;
+
+		/* d = origin - center, B = 2 (direction . d), C = d . d - r^2 */
+		lx = simd4_sub(ox, simd4_loadu(&cs->sphereX[base]));
+		ly = simd4_sub(oy, simd4_loadu(&cs->sphereY[base]));
+		lz = simd4_sub(oz, simd4_loadu(&cs->sphereZ[base]));
+		r = simd4_loadu(&cs->sphereR[base]);
+		B = simd4_add(simd4_add(simd4_mul(dx, lx), simd4_mul(dy, ly)),
+			simd4_mul(dz, lz));
+		B = simd4_add(B, B);
+		C = simd4_sub(simd4_add(simd4_add(simd4_mul(lx, lx),
+			simd4_mul(ly, ly)), simd4_mul(lz, lz)), simd4_mul(r, r));
+		det = simd4_sub(simd4_mul(B, B), simd4_mul(simd4_splat(4.0f), C));
+		sq = simd4_sqrt(simd4_max(det, zero));
+		wOne = simd4_mul(simd4_sub(simd4_sub(zero, B), sq), half);
+		wTwo = simd4_mul(simd4_add(simd4_sub(zero, B), sq), half);
+
+		/* least positive root, 0 if neither is, wOne if they are equal */
+		t = simd4_select(simd4_cmpgt(wOne, zero), wOne, zero);
+		t = simd4_select(simd4m_and(simd4_cmpgt(wTwo, zero),
+			simd4_cmplt(wTwo, t)), wTwo, t);
+		t = simd4_select(simd4_cmpeq(det, zero), wOne, t);
+
+		/* t is 0 for spheres behind the ray */
+		valid = simd4m_and(simd4m_andnot(simd4_cmplt(t, simd4_splat(tmax)),
+			simd4_cmplt(det, zero)), simd4_cmpgt(t, zero));
+		bits &= simd4m_bits(valid);
+		if(!bits)
+			continue;
+
+		/* lanes are in slot order so ties go to the lower slot */
+		simd4_store(w, t);
+		for(lane = 0; lane < 4; ++lane)
+		{
+			if((bits & (1u << lane)) && w[lane] < tmax)
+			{
+				tmax = w[lane];
+				slot = base + lane;
+			}
+		}
+	}
+
+	if(slot != ~0u)
+		*distance = tmax;
+	return slot;
+}
@@ -0,0 +1,139 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 7, 2008
+ * cscene.h
+ *
+ * This file contains the definition for the compiled scene.  The objects
+ * of a scene_t are easy to build and to shade but slow to intersect: every
+ * object3d_t carries a whole material and polygons point to vertices
+ * somewhere else in memory.  The compiled scene copies the geometry into
+ * contiguous structure of arrays storage split by geometry type, which is
+ * all the intersection loops ever look at:
+ *
+ *	spheres		- center x, y, z and radius arrays
+ *	polygons	- plane array, small info record and one shared pool
+ *			  of point in polygon edge data
+ *	meshes		- copies of the mesh_t headers, the vertex and index
+ *			  buffers stay shared with the scene objects
+ *	materials	- every distinct material once, objects refer to
+ *			  them by index
+ *
+ * Everything lives in a single 16 byte aligned block so it can be moved
+ * around (DMA, files) in one piece.  Objects keep their index in
+ * scene->objects, which is what the hierarchy and the shading code use.
+ * When the scene has a hierarchy the geometry is stored in the order its
+ * leaves reference objects, so the spheres of a leaf sit next to each
+ * other and can be tested 4 at a time (see cscene_hit_spheres()).
+ */
+
+#ifndef _CSCENE_H_
+#define _CSCENE_H_
+
+#include "scene.h"
+
+/* where an object's geometry lives - slot in the array of its type, with
+ * the type in the low 2 bits */
+#define CSCENE_REF_SPHERE	0x0
+#define CSCENE_REF_POLYGON	0x1
+#define CSCENE_REF_MESH		0x2
+#define CSCENE_REF_TYPE(ref)	((ref) & 0x3)
+#define CSCENE_REF_SLOT(ref)	((ref) >> 2)
+#define CSCENE_REF(slot, type)	(((slot) << 2) | (type))
+
+/* sphere arrays are padded to a multiple of this for SIMD loops */
+#define CSCENE_SPHERE_PAD	4
+
+/* per polygon data that is not the plane */
+typedef struct
+{
+	unsigned int	firstEdge;	/* first edge in the edge pool */
+	unsigned short	nEdges;		/* edges (= vertices) of polygon */
+	unsigned char	axisU;		/* projection axes, see polygon_t */
+	unsigned char	axisV;
+} cscene_poly_t;
+
+typedef struct cscene_s
+{
+	/* spheres - padding has radius 0 and object ~0 */
+	unsigned int	nSpheres;
+	float		*sphereX;
+	float		*sphereY;
+	float		*sphereZ;
+	float		*sphereR;
+	unsigned int	*sphereObject;	/* index into scene->objects */
+
+	/* polygons */
+	unsigned int	nPolygons;
+	unsigned int	nEdges;		/* size of edge pool in edges */
+	plane_t		*polyPlane;
+	cscene_poly_t	*polyInfo;
+	float		*polyEdge;	/* 4 floats per edge, see polygon_t */
+	unsigned int	*polyObject;	/* index into scene->objects */
+
+	/* triangle meshes */
+	unsigned int	nMeshes;
+	mesh_t		*meshes;
+	unsigned int	*meshObject;	/* index into scene->objects */
+
+	/* distinct materials */
+	unsigned int	nMaterials;
+	material_t	*materials;
+
+	/* one entry per object in scene->objects */
+	unsigned int	nObjects;
+	unsigned int	*objectRef;	/* CSCENE_REF_* of its geometry */
+	unsigned int	*objectMaterial;/* index into materials */
+
+	void		*block;		/* storage for every array above */
+	unsigned int	blockSize;	/* in bytes */
+	int		mapped;		/* block belongs to a mapped scene file */
+} cscene_t;
+
+/* compile the objects of a scene (scene->compiled).  Call again whenever
+ * objects are added or changed. */
+cscene_t* cscene_build(scene_t *scene);
+
+/* copy the geometry of one object that changed shape or place (but not
+ * type or material) into the compiled scene again */
+void cscene_update(cscene_t *cs, const scene_t *scene, unsigned int object);
+
+/* lay the arrays of a compiled scene whose counts are already set out
+ * over an existing block (a compiled scene file).  The block is used in
+ * place and never freed.  Returns null if the block has the wrong size */
+cscene_t* cscene_attach(cscene_t *cs, void *block, unsigned int blockSize);
+
+/* cleanup dynamic memory from compiling a scene */
+void cscene_free(cscene_t *cs);
+
+/* material of an object */
+static inline const material_t* cscene_material(const cscene_t *cs,
+		unsigned int object)
+{
+	return &cs->materials[cs->objectMaterial[object]];
+}
+
+/* same as ray_intersect_object() on scene->objects[object].  prim gets
+ * the triangle hit on a mesh, 0 for anything else */
+int cscene_intersect(const cscene_t *cs, unsigned int object,
+		const ray_t *ray, point_t *pt, float *distance,
+		unsigned int *prim);
+
+/* same as ray_hit_object() on scene->objects[object], except that a mesh
+ * gives the first hit found in (0, ray->magnitude) rather than the
+ * nearest - this is only ever asked for shadows */
+int cscene_hit(const cscene_t *cs, unsigned int object,
+		const ray_t *ray, float *distance);
+
+/* nearest of the spheres in slots [first, first + count) along a ray,
+ * tested 4 at a time with the math of ray_hit_sphere().  Only hits in
+ * front of the ray and nearer than *distance count, with bounded set also
+ * only those nearer than ray->magnitude.  exc is a slot to skip (~0 for
+ * none).  Returns the
+ * slot of the nearest hit with its distance in *distance, or ~0 if none.
+ * The point of intersection is left to the caller */
+unsigned int cscene_hit_spheres(const cscene_t *cs, unsigned int first,
+		unsigned int count, const ray_t *ray, unsigned int exc,
+		int bounded, float *distance);
+
+#endif
@@ -8,8 +8,19 @@
  *  in the ray tracer.
  */
 
+#if defined(__SPU__) || defined(__PPU__)
+	#include <malloc_align.h>
+#endif
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
 #include "geometry.h"
 
+/* padding added around bounding boxes so flat geometry (floor polygons)
+ * never ends up with a zero thickness slab */
+#define AABB_EPSILON		0.0001f
+
 /* generate a plane equation given a polygon - uses the first three vertices */
 plane_t* poly_plane(plane_t *planeout, const polygon_t *poly)
 {
@@ -23,23 +34,92 @@ plane_t* poly_plane(plane_t *planeout, const polygon_t *poly)
 	/* now normalize it */
 	vec4_normalize((vector4_t *)planeout);
 
-	/* now calculate F - shortest distance from origin to point on plane */
+	/* now calculate F - signed distance from plane to origin */
 	/* we do this by taking the dot product of the normal and a known
-	 * point on the plane */
-	planeout->F = vec4_dot((vector4_t *)planeout, &poly->vertex[0]);
-	/* force F to be positive? */
-	if(planeout->F < 0.0f)
-		planeout->F = -planeout->F;
+	 * point on the plane.  The sign has to stay - intersection tests
+	 * solve Ax + By + Cz + F = 0 and the point in polygon test trusts
+	 * the point that comes out of it */
+	planeout->F = -vec4_dot((vector4_t *)planeout, &poly->vertex[0]);
 	return planeout;
 }
 
+/* precompute the projection axes and edge equations of a polygon used
+ * by the point in polygon test - call after poly_plane() */
+polygon_t* poly_prepare(polygon_t *poly)
+{
+	unsigned int	i = 0;
+	unsigned int	drop = 0;	/* axis the polygon is projected along */
+	const point_t	*a, *b;		/* end points of current edge */
+	float		dv;
+
+	/* projecting along the largest normal component keeps the
+	 * projected polygon as large (and well conditioned) as possible */
+	if(fabsf(poly->plane.B) > fabsf(poly->plane.c[drop]))
+		drop = 1;
+	if(fabsf(poly->plane.C) > fabsf(poly->plane.c[drop]))
+		drop = 2;
+	poly->axisU = (drop + 1) % 3;
+	poly->axisV = (drop + 2) % 3;
+
+	/* edges may already have a home (the scene's edge pool) */
+	if(!poly->edge)
+	{
+#if defined(__SPU__) || defined(__PPU__)
+		poly->edge = _malloc_align(sizeof(float) * 4 * poly->nVerticies, 4);
+#else
+		poly->edge = malloc(sizeof(float) * 4 * poly->nVerticies);
+#endif
+	}
+
+	for(; i < poly->nVerticies; ++i)
+	{
+		a = &poly->vertex[i];
+		b = &poly->vertex[(i + 1) % poly->nVerticies];
+		dv = b->c[poly->axisV] - a->c[poly->axisV];
+
+		poly->edge[i*4 + 0] = a->c[poly->axisU];
+		poly->edge[i*4 + 1] = a->c[poly->axisV];
+		poly->edge[i*4 + 2] = b->c[poly->axisV];
+		/* horizontal edges never cross the test line so slope is unused */
+		poly->edge[i*4 + 3] = (dv != 0.0f) ?
+			(b->c[poly->axisU] - a->c[poly->axisU]) / dv : 0.0f;
+	}
+
+	return poly;
+}
+
+/* tests if a point on the plane of the polygon, given by its coordinates
+ * along the projection axes, lies inside the polygon.
+ * Crossing test - count how many edges a line from the point towards +u
+ * crosses, odd means inside.  Conditions are combined with bitwise ops
+ * so the loop has no data dependent branches. */
+int poly_contains(const polygon_t *poly, float u, float v)
+{
+	return poly_edges_contain(poly->edge, poly->nVerticies, u, v);
+}
+
+/* same test given only the edge data of a polygon */
+int poly_edges_contain(const float *edge, unsigned int nEdges, float u, float v)
+{
+	const float	*e = edge;
+	const float	*end = e + 4 * nEdges;
+	int		inside = 0;
+
+	for(; e < end; e += 4)
+	{
+		inside ^= ((e[1] > v) != (e[2] > v)) &
+			(u < e[0] + (v - e[1]) * e[3]);
+	}
+
+	return inside;
+}
+
 /* get normal vector to sphere at point passed in */
 vector4_t* get_sphere_normal(vector4_t *vecout, const sphere_t *sphere,
 							 const point_t *pt)
-{	/* subtract point on surface from center point of sphere */
-	vec4_sub(vecout, pt, &sphere->center);
-	/* normalize normal vector */
-	vec4_normalize(vecout);
+{	/* subtract point on surface from center point of sphere and
+	 * normalize normal vector */
+	*vecout = vec4v_normalize(vec4v_sub(*pt, sphere->center));
 
 	return vecout;
 }
@@ -56,3 +136,89 @@ vector4_t* get_polygon_normal(vector4_t *vecout, const polygon_t *poly,
 	return vecout;
 }
 
+/* set a bounding box to be empty (min > max) */
+aabb_t* aabb_init(aabb_t *box)
+{
+	box->min[0] = box->min[1] = box->min[2] = FLT_MAX;
+	box->max[0] = box->max[1] = box->max[2] = -FLT_MAX;
+
+	return box;
+}
+
+/* grow a bounding box to contain a point */
+aabb_t* aabb_grow_point(aabb_t *box, const point_t *pt)
+{
+	unsigned int i = 0;
+
+	for(; i < 3; ++i)
+	{
+		if(pt->c[i] < box->min[i])
+			box->min[i] = pt->c[i];
+		if(pt->c[i] > box->max[i])
+			box->max[i] = pt->c[i];
+	}
+
+	return box;
+}
+
+/* grow a bounding box to contain another bounding box */
+aabb_t* aabb_grow(aabb_t *box, const aabb_t *other)
+{
+	unsigned int i = 0;
+
+	for(; i < 3; ++i)
+	{
+		if(other->min[i] < box->min[i])
+			box->min[i] = other->min[i];
+		if(other->max[i] > box->max[i])
+			box->max[i] = other->max[i];
+	}
+
+	return box;
+}
+
+/* surface area of a bounding box (0 if empty) */
+float aabb_area(const aabb_t *box)
+{
+	float dx = box->max[0] - box->min[0];
+	float dy = box->max[1] - box->min[1];
+	float dz = box->max[2] - box->min[2];
+
+	if(dx < 0.0f || dy < 0.0f || dz < 0.0f)
+		return 0.0f;
+
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+/* get bounding box of a sphere */
+aabb_t* get_sphere_bounds(aabb_t *boxout, const sphere_t *sphere)
+{
+	unsigned int i = 0;
+
+	for(; i < 3; ++i)
+	{
+		boxout->min[i] = sphere->center.c[i] - sphere->radius - AABB_EPSILON;
+		boxout->max[i] = sphere->center.c[i] + sphere->radius + AABB_EPSILON;
+	}
+
+	return boxout;
+}
+
+/* get bounding box of a polygon */
+aabb_t* get_polygon_bounds(aabb_t *boxout, const polygon_t *poly)
+{
+	unsigned int i = 0;
+
+	aabb_init(boxout);
+	for(; i < poly->nVerticies; ++i)
+	{
+		aabb_grow_point(boxout, &poly->vertex[i]);
+	}
+	for(i = 0; i < 3; ++i)
+	{
+		boxout->min[i] -= AABB_EPSILON;
+		boxout->max[i] += AABB_EPSILON;
+	}
+
+	return boxout;
+}
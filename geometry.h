@@ -16,6 +16,10 @@
 
 #define GEOMETRY_SPHERE		0x01
 #define GEOMETRY_POLYGON	0x02
+#define GEOMETRY_TRIANGLE_MESH	0x03
+
+/* hierarchy over the triangles of a mesh (see bvh.h) */
+struct bvh_s;
 
 
 /* spheres will be defined by a center point and radius */
@@ -45,11 +49,62 @@ typedef struct
 #ifdef __SPU__
 	};
 #endif
+
+	/* point in polygon test data generated at scene load time.
+	 * The polygon is projected onto the two axes the plane normal is
+	 * smallest along and each edge is stored as 4 floats:
+	 * u0, v0 (first vertex), v1 (second vertex v), du/dv (inverse slope) */
+	unsigned int		axisU;		/* first projection axis */
+	unsigned int		axisV;		/* second projection axis */
+#ifdef __SPU__
+	union
+	{
+		unsigned long long	edge_ea;
+#endif
+		float			*edge;	/* 4 floats per edge */
+#ifdef __SPU__
+	};
+#endif
 } polygon_t;
 
+/* triangle meshes are any number of triangles sharing one vertex buffer.
+ * Vertex positions are kept as structure of arrays and every triangle is
+ * 3 indices into them, counter clockwise seen from the front.  A mesh is
+ * a single object with a single material, it keeps its own hierarchy over
+ * its triangles (see mesh.h) */
+typedef struct
+{
+	unsigned int		nVertices;
+	unsigned int		nTriangles;
+	float			*vx;		/* vertex positions */
+	float			*vy;
+	float			*vz;
+	unsigned int		*index;		/* 3 per triangle */
+	struct bvh_s		*bvh;		/* hierarchy over triangles */
+} mesh_t;
+
+/* axis aligned bounding box - used by acceleration structures */
+typedef struct
+{
+	float		min[3];		/* smallest x, y, z */
+	float		max[3];		/* largest x, y, z */
+} aabb_t;
+
 /* generate a plane equation given a polygon - uses the first three vertices */
 plane_t* poly_plane(plane_t *planeout, const polygon_t *poly);
 
+/* precompute the projection axes and edge equations of a polygon used
+ * by the point in polygon test - call after poly_plane().  Edge data is
+ * written to poly->edge, which is allocated if it is null */
+polygon_t* poly_prepare(polygon_t *poly);
+
+/* tests if a point on the plane of the polygon, given by its coordinates
+ * along the projection axes, lies inside the polygon */
+int poly_contains(const polygon_t *poly, float u, float v);
+
+/* same test given only the edge data of a polygon (4 floats per edge) */
+int poly_edges_contain(const float *edge, unsigned int nEdges, float u, float v);
+
 /* get normal vector to sphere at point passed in */
 vector4_t* get_sphere_normal(vector4_t *vecout, const sphere_t *sphere,
 							 const point_t *pt);
@@ -58,4 +113,22 @@ vector4_t* get_sphere_normal(vector4_t *vecout, const sphere_t *sphere,
 vector4_t* get_polygon_normal(vector4_t *vecout, const polygon_t *poly,
 							  const point_t *pt);
 
+/* set a bounding box to be empty (min > max) */
+aabb_t* aabb_init(aabb_t *box);
+
+/* grow a bounding box to contain a point */
+aabb_t* aabb_grow_point(aabb_t *box, const point_t *pt);
+
+/* grow a bounding box to contain another bounding box */
+aabb_t* aabb_grow(aabb_t *box, const aabb_t *other);
+
+/* surface area of a bounding box (0 if empty) */
+float aabb_area(const aabb_t *box);
+
+/* get bounding box of a sphere */
+aabb_t* get_sphere_bounds(aabb_t *boxout, const sphere_t *sphere);
+
+/* get bounding box of a polygon */
+aabb_t* get_polygon_bounds(aabb_t *boxout, const polygon_t *poly);
+
 #endif
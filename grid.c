@@ -0,0 +1,404 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 18, 2008
+ * grid.c
+ *
+ * This file contains the definitions for building the object grid and
+ * walking rays through it.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "grid.h"
+#include "cscene.h"
+
+/* range of cells along an axis a box touches */
+static void grid_span(const grid_t *grid, const aabb_t *box,
+		unsigned int axis, unsigned int *lo, unsigned int *hi)
+{
+	float f;
+
+	f = (box->min[axis] - grid->bounds.min[axis]) * grid->invCell[axis];
+	*lo = f <= 0.0f ? 0 : (unsigned int)f;
+	f = (box->max[axis] - grid->bounds.min[axis]) * grid->invCell[axis];
+	*hi = f >= (float)(grid->dim[axis] - 1) ? grid->dim[axis] - 1 :
+		(unsigned int)f;
+	if(*lo > *hi)
+		*lo = *hi;
+}
+
+/* walk every cell an object touches, counting (fill = 0) or recording it */
+static unsigned long long grid_visit(grid_t *grid, const aabb_t *bounds,
+		unsigned int object, unsigned int *fill)
+{
+	unsigned int	lo[3], hi[3];
+	unsigned int	x, y, z;
+	unsigned int	cell;
+
+	/* objects that are never hit (no bounds) stay out */
+	if(bounds[object].min[0] > bounds[object].max[0])
+		return 0;
+
+	for(x = 0; x < 3; ++x)
+		grid_span(grid, &bounds[object], x, &lo[x], &hi[x]);
+
+	for(z = lo[2]; z <= hi[2]; ++z)
+	{
+		for(y = lo[1]; y <= hi[1]; ++y)
+		{
+			cell = (z * grid->dim[1] + y) * grid->dim[0] + lo[0];
+			for(x = lo[0]; x <= hi[0]; ++x, ++cell)
+			{
+				if(fill)
+					grid->objects[fill[cell]++] = object;
+				else
+					++grid->cellStart[cell];
+			}
+		}
+	}
+
+	return (unsigned long long)(hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) *
+		(hi[2] - lo[2] + 1);
+}
+
+/* build a grid over the bounds of a list of objects */
+grid_t* grid_build(const aabb_t *bounds, unsigned int nObjects)
+{
+	grid_t			*grid;
+	aabb_t			box;
+	float			extent[3];
+	float			volume = 1.0f;
+	float			cell;
+	unsigned long long	refs = 0;
+	unsigned int		nCells;
+	unsigned int		*fill;
+	unsigned int		i = 0;
+	unsigned int		sum;
+	unsigned int		count;
+
+	aabb_init(&box);
+	for(; i < nObjects; ++i)
+	{
+		if(bounds[i].min[0] <= bounds[i].max[0])
+			aabb_grow(&box, &bounds[i]);
+	}
+	if(box.min[0] > box.max[0])
+		return 0;
+
+	grid = malloc(sizeof(grid_t));
+	for(i = 0; i < 3; ++i)
+	{
+		/* pad a little so hits right on the edge stay inside */
+		extent[i] = box.max[i] - box.min[i];
+		extent[i] += extent[i] * 1e-4f + 1e-4f;
+		grid->bounds.min[i] = box.min[i] - extent[i] * 0.5e-4f;
+		grid->bounds.max[i] = grid->bounds.min[i] + extent[i];
+		volume *= extent[i];
+	}
+
+	/* cells of about equal size on every axis, GRID_CELLS_PER_OBJECT of
+	 * them per object */
+	cell = cbrtf(volume / (nObjects * GRID_CELLS_PER_OBJECT));
+	nCells = 1;
+	for(i = 0; i < 3; ++i)
+	{
+		grid->dim[i] = (unsigned int)ceilf(extent[i] / cell);
+		if(grid->dim[i] < 1)
+			grid->dim[i] = 1;
+		if(grid->dim[i] > GRID_MAX_DIM)
+			grid->dim[i] = GRID_MAX_DIM;
+		grid->cellSize[i] = extent[i] / grid->dim[i];
+		grid->invCell[i] = grid->dim[i] / extent[i];
+		nCells *= grid->dim[i];
+	}
+
+	/* count objects per cell, turn counts into offsets, then fill */
+	grid->cellStart = calloc(nCells + 1, sizeof(unsigned int));
+	grid->objects = 0;
+	for(i = 0; i < nObjects && refs <= GRID_MAX_REFS; ++i)
+	{
+		refs += grid_visit(grid, bounds, i, 0);
+	}
+	if(refs > GRID_MAX_REFS)
+	{	/* objects are too big for the grid to help */
+		grid_free(grid);
+		return 0;
+	}
+
+	for(sum = 0, i = 0; i <= nCells; ++i)
+	{
+		count = grid->cellStart[i];
+		grid->cellStart[i] = sum;
+		sum += count;
+	}
+	grid->objects = malloc(sizeof(unsigned int) * (sum ? sum : 1));
+	fill = malloc(sizeof(unsigned int) * nCells);
+	memcpy(fill, grid->cellStart, sizeof(unsigned int) * nCells);
+	/* objects are added in scene order, so every cell lists them in order */
+	for(i = 0; i < nObjects; ++i)
+	{
+		grid_visit(grid, bounds, i, fill);
+	}
+	free(fill);
+
+	return grid;
+}
+
+/* cleanup dynamic memory from building a grid */
+void grid_free(grid_t *grid)
+{
+	if(grid)
+	{
+		free(grid->cellStart);
+		free(grid->objects);
+		free(grid);
+	}
+}
+
+/* build the grid over every object in the scene (scene->grid) */
+grid_t* grid_build_scene(scene_t *scene)
+{
+	aabb_t		*bounds = malloc(sizeof(aabb_t) *
+				(scene->nObjects ? scene->nObjects : 1));
+	unsigned int	i = 0;
+	struct timeval	start, end;
+	grid_t		*grid;
+
+	gettimeofday(&start, 0);
+	for(; i < scene->nObjects; ++i)
+	{
+		get_object_bounds(&bounds[i], &scene->objects[i]);
+	}
+
+	grid_free(scene->grid);
+	scene->grid = grid = grid_build(bounds, scene->nObjects);
+	free(bounds);
+	gettimeofday(&end, 0);
+
+	if(grid)
+		printf("Grid built:\t%ux%ux%u cells, %u references over %u "
+			"objects in %.3f ms\n", grid->dim[0], grid->dim[1],
+			grid->dim[2], grid->cellStart[grid->dim[0] * grid->dim[1] *
+			grid->dim[2]], scene->nObjects,
+			(end.tv_sec - start.tv_sec) * 1000.0 +
+			(end.tv_usec - start.tv_usec) / 1000.0);
+
+	return grid;
+}
+
+/* state of a ray stepping through the cells of a grid */
+typedef struct
+{
+	unsigned int	cell[3];	/* current cell */
+	int		step[3];	/* -1, 0 or 1 along each axis */
+	float		tNext[3];	/* distance to the next cell boundary */
+	float		tDelta[3];	/* distance between cell boundaries */
+} grid_walk_t;
+
+/* start a walk where a ray enters the grid before tmax.  Returns 0 if it
+ * misses the grid */
+static int grid_walk_init(grid_walk_t *w, const grid_t *grid,
+		const ray_t *ray, float tmax)
+{
+	float		tmin = 0.0f;
+	float		t0, t1, tmp;
+	float		f;
+	float		inv;
+	unsigned int	i = 0;
+
+	/* clip the ray to the grid bounds */
+	for(; i < 3; ++i)
+	{
+		if(ray->direction.c[i] == 0.0f)
+		{
+			if(ray->origin.c[i] < grid->bounds.min[i] ||
+				ray->origin.c[i] > grid->bounds.max[i])
+				return 0;
+			continue;
+		}
+		inv = 1.0f / ray->direction.c[i];
+		t0 = (grid->bounds.min[i] - ray->origin.c[i]) * inv;
+		t1 = (grid->bounds.max[i] - ray->origin.c[i]) * inv;
+		if(t0 > t1)
+		{
+			tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		tmin = t0 > tmin ? t0 : tmin;
+		tmax = t1 < tmax ? t1 : tmax;
+		if(tmin > tmax)
+			return 0;
+	}
+
+	/* cell where the ray enters and the distances to its walls */
+	for(i = 0; i < 3; ++i)
+	{
+		f = (ray->origin.c[i] + ray->direction.c[i] * tmin -
+			grid->bounds.min[i]) * grid->invCell[i];
+		w->cell[i] = f <= 0.0f ? 0 : f >= (float)(grid->dim[i] - 1) ?
+			grid->dim[i] - 1 : (unsigned int)f;
+
+		if(ray->direction.c[i] > 0.0f)
+		{
+			w->step[i] = 1;
+			w->tDelta[i] = grid->cellSize[i] / ray->direction.c[i];
+			w->tNext[i] = (grid->bounds.min[i] + (w->cell[i] + 1) *
+				grid->cellSize[i] - ray->origin.c[i]) /
+				ray->direction.c[i];
+		}
+		else if(ray->direction.c[i] < 0.0f)
+		{
+			w->step[i] = -1;
+			w->tDelta[i] = -grid->cellSize[i] / ray->direction.c[i];
+			w->tNext[i] = (grid->bounds.min[i] + w->cell[i] *
+				grid->cellSize[i] - ray->origin.c[i]) /
+				ray->direction.c[i];
+		}
+		else
+		{
+			w->step[i] = 0;
+			w->tDelta[i] = FLT_MAX;
+			w->tNext[i] = FLT_MAX;
+		}
+	}
+
+	return 1;
+}
+
+/* distance the ray leaves the current cell */
+static float grid_walk_exit(const grid_walk_t *w)
+{
+	float t = w->tNext[0] < w->tNext[1] ? w->tNext[0] : w->tNext[1];
+
+	return w->tNext[2] < t ? w->tNext[2] : t;
+}
+
+/* move to the next cell along the ray.  Returns 0 once it leaves the
+ * grid */
+static int grid_walk_step(grid_walk_t *w, const grid_t *grid)
+{
+	unsigned int axis;
+
+	if(w->tNext[0] < w->tNext[1])
+		axis = w->tNext[0] < w->tNext[2] ? 0 : 2;
+	else
+		axis = w->tNext[1] < w->tNext[2] ? 1 : 2;
+
+	/* stepping below 0 wraps around past dim too */
+	w->cell[axis] += w->step[axis];
+	if(w->cell[axis] >= grid->dim[axis])
+		return 0;
+	w->tNext[axis] += w->tDelta[axis];
+	return 1;
+}
+
+/* first object entry of a cell, with the end in *end */
+static const unsigned int* grid_cell(const grid_t *grid,
+		const grid_walk_t *w, const unsigned int **end)
+{
+	unsigned int cell = (w->cell[2] * grid->dim[1] + w->cell[1]) *
+				grid->dim[0] + w->cell[0];
+
+	*end = &grid->objects[grid->cellStart[cell + 1]];
+	return &grid->objects[grid->cellStart[cell]];
+}
+
+/* gets the closest object this ray intersects using the grid */
+object3d_t* grid_intersect(point_t *intersect, float *d, unsigned int *prim,
+		const ray_t *ray, const scene_t *scene, const object3d_t *exc,
+		int bounded)
+{
+	const grid_t	*grid = scene->grid;
+	const cscene_t	*cs = scene->compiled;
+	const unsigned int *p, *end;
+	object3d_t	*obj = 0;	/* return value */
+	object3d_t	*test;		/* object being tested */
+	unsigned int	mailbox[GRID_MAILBOX_SIZE];	/* objects tested */
+	unsigned int	tmpPrim;	/* triangle of last intersection */
+	float		tmpD;		/* distance to last intersection */
+	point_t		tmpInt;		/* last intersection point */
+	grid_walk_t	w;
+	/* closest hit so far - never look past the end of a bounded ray */
+	float		tmax = bounded ? ray->magnitude : FLT_MAX;
+
+	if(!grid_walk_init(&w, grid, ray, tmax))
+		return 0;
+	memset(mailbox, 0xFF, sizeof(mailbox));
+
+	do
+	{
+		for(p = grid_cell(grid, &w, &end); p < end; ++p)
+		{
+			if(mailbox[*p & (GRID_MAILBOX_SIZE - 1)] == *p)
+				continue;
+			mailbox[*p & (GRID_MAILBOX_SIZE - 1)] = *p;
+
+			test = &scene->objects[*p];
+			/* if this is the object we want to exclude, skip */
+			if(test == exc)
+				continue;
+
+			/* hits beyond this cell count too, an object is only
+			 * tested once */
+			if(cscene_intersect(cs, *p, ray, &tmpInt, &tmpD, &tmpPrim))
+			{
+				/* a sphere behind the ray gives distance 0 */
+				if(!(tmpD > 0.0f))
+					continue;
+				if(tmpD < tmax)
+				{
+					tmax = tmpD;
+					*d = tmpD;
+					*prim = tmpPrim;
+					obj = test;
+					vec4_set(intersect, (float *)&tmpInt);
+				}
+			}
+		}
+		/* nothing in a later cell can be nearer than a hit in this one */
+	} while(grid_walk_exit(&w) < tmax && grid_walk_step(&w, grid));
+
+	return obj;
+}
+
+/* tests if anything other than exc is hit in (0, ray->magnitude) using
+ * the grid */
+int grid_occluded(const ray_t *ray, const scene_t *scene,
+		const object3d_t *exc)
+{
+	const grid_t	*grid = scene->grid;
+	const cscene_t	*cs = scene->compiled;
+	const unsigned int *p, *end;
+	unsigned int	mailbox[GRID_MAILBOX_SIZE];	/* objects tested */
+	float		tmpD;		/* distance to intersection */
+	grid_walk_t	w;
+
+	if(!grid_walk_init(&w, grid, ray, ray->magnitude))
+		return 0;
+	memset(mailbox, 0xFF, sizeof(mailbox));
+
+	do
+	{
+		for(p = grid_cell(grid, &w, &end); p < end; ++p)
+		{
+			if(mailbox[*p & (GRID_MAILBOX_SIZE - 1)] == *p)
+				continue;
+			mailbox[*p & (GRID_MAILBOX_SIZE - 1)] = *p;
+
+			if(&scene->objects[*p] == exc)
+				continue;
+			if(cscene_hit(cs, *p, ray, &tmpD) &&
+				tmpD < ray->magnitude && tmpD > 0.0f)
+				return 1;
+		}
+	} while(grid_walk_exit(&w) < ray->magnitude &&
+		grid_walk_step(&w, grid));
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 18, 2008
+ * grid.h
+ *
+ * This file contains the definition for the object grid, the acceleration
+ * structure a scene can pick instead of the hierarchy (see the accel key
+ * of the desc block in scene.c).  It is a uniform grid over the bounds of
+ * every object where each cell lists the objects whose bounds touch it.
+ * Rays step from cell to cell in the order they pass through them
+ * (3D-DDA) and stop at the first cell that ends beyond the nearest hit.
+ * It is quick to build and suits clouds of many small objects of about
+ * the same size, where a hierarchy spends most of its time on nodes.
+ *
+ * An object spanning several cells would be tested once per cell, so
+ * every ray keeps a small mailbox of objects it already tested, hashed by
+ * object index.  It lives on the stack of the ray and needs no shared
+ * state between threads.
+ */
+
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include "scene.h"
+
+/* cells per object the resolution is picked for */
+#define GRID_CELLS_PER_OBJECT	4.0f
+/* most cells along any axis */
+#define GRID_MAX_DIM		512
+/* give up on the grid if cells would reference more objects than this */
+#define GRID_MAX_REFS		(64 * 1024 * 1024)
+/* objects remembered per ray - a power of 2 */
+#define GRID_MAILBOX_SIZE	64
+
+typedef struct grid_s
+{
+	aabb_t		bounds;		/* of the grid */
+	float		cellSize[3];
+	float		invCell[3];	/* cells per unit along each axis */
+	unsigned int	dim[3];		/* cells along each axis */
+	unsigned int	*cellStart;	/* first entry of each cell in objects,
+					 * one extra entry marks the end */
+	unsigned int	*objects;	/* object indices of every cell */
+} grid_t;
+
+/* build a grid over the bounds of a list of objects.  Returns null if
+ * there are no objects or they would not fit a grid */
+grid_t* grid_build(const aabb_t *bounds, unsigned int nObjects);
+
+/* cleanup dynamic memory from building a grid */
+void grid_free(grid_t *grid);
+
+/* build the grid over every object in the scene (scene->grid).  Prints
+ * its size and how long it took */
+grid_t* grid_build_scene(scene_t *scene);
+
+/* same as bvh_intersect() using the grid of the scene */
+object3d_t* grid_intersect(point_t *intersect, float *d, unsigned int *prim,
+		const ray_t *ray, const scene_t *scene, const object3d_t *exc,
+		int bounded);
+
+/* same as bvh_occluded() using the grid of the scene */
+int grid_occluded(const ray_t *ray, const scene_t *scene,
+		const object3d_t *exc);
+
+#endif
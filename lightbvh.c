@@ -0,0 +1,229 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 13, 2008
+ * lightbvh.c
+ *
+ * This file contains the definitions for building and sampling the light
+ * hierarchy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lightbvh.h"
+
+/* how bright a light is - average of its channels */
+static float lightbvh_power(const pointlight_t *light)
+{
+	return (light->color.r + light->color.g + light->color.b) *
+		(1.0f / 3.0f);
+}
+
+/* how much a node may light a point - its power, or zero if the point is
+ * out of reach of every light below or faces away from all of them */
+static float lightbvh_importance(const lightbvh_t *lbvh, unsigned int node,
+			const point_t *pt, const vector4_t *N)
+{
+	const aabb_t	*box = &lbvh->tree->nodes[node].bounds;
+	unsigned int	i = 0;
+	float		d;
+	float		dist = 0.0f;	/* squared distance to the box */
+	float		facing = 0.0f;	/* largest N . (corner - pt) */
+
+	for(; i < 3; ++i)
+	{
+		d = pt->c[i] < box->min[i] ? box->min[i] - pt->c[i] :
+			pt->c[i] > box->max[i] ? pt->c[i] - box->max[i] : 0.0f;
+		dist += d * d;
+		facing += N->c[i] * ((N->c[i] > 0.0f ? box->max[i] : box->min[i]) -
+			pt->c[i]);
+	}
+
+	if(facing <= 0.0f)
+		return 0.0f;
+	if(lbvh->reach[node] >= 0.0f && dist > lbvh->reach[node] * lbvh->reach[node])
+		return 0.0f;
+	return lbvh->power[node];
+}
+
+/* how much a single light may light a point.  Weighted by the cosine so
+ * lights overhead are picked more often, with a floor so lights at
+ * grazing angles (which still give highlights) are not starved */
+static float lightbvh_light_importance(const pointlight_t *light,
+			const point_t *pt, const vector4_t *N)
+{
+	vector4_t	S = vec4v_sub(light->position, *pt);
+	float		dist = vec4v_magnitude(S);
+	float		cosine;
+
+	if(dist <= 0.0f)
+		return 0.0f;
+	if(light->range > 0.0f && dist > light->range)
+		return 0.0f;
+	cosine = vec4v_dot(S, *N) / dist;
+	if(cosine <= 0.0f)
+		return 0.0f;
+	return lightbvh_power(light) * (cosine + 0.25f);
+}
+
+/* build a light hierarchy over a list of lights */
+lightbvh_t* lightbvh_build(const pointlight_t *lights, unsigned int nLights)
+{
+	lightbvh_t	*lbvh = malloc(sizeof(lightbvh_t));
+	aabb_t		*bounds = malloc(sizeof(aabb_t) * (nLights ? nLights : 1));
+	bvh_node_t	*node;
+	unsigned int	i = 0;
+	unsigned int	j;
+	unsigned int	left, right;
+	float		range;
+
+	for(; i < nLights; ++i)
+	{
+		aabb_init(&bounds[i]);
+		aabb_grow_point(&bounds[i], &lights[i].position);
+	}
+	lbvh->tree = bvh_build(bounds, nLights, 0);
+	free(bounds);
+
+	lbvh->power = malloc(sizeof(float) * lbvh->tree->nNodes);
+	lbvh->reach = malloc(sizeof(float) * lbvh->tree->nNodes);
+
+	/* children always come after their parent, so work backwards */
+	for(i = lbvh->tree->nNodes; i-- > 0; )
+	{
+		node = &lbvh->tree->nodes[i];
+		lbvh->power[i] = 0.0f;
+		lbvh->reach[i] = 0.0f;
+		if(node->count || !lbvh->tree->nPrims)
+		{
+			for(j = node->first; j < node->first + node->count; ++j)
+			{
+				lbvh->power[i] += lightbvh_power(
+					&lights[lbvh->tree->prims[j]]);
+				range = lights[lbvh->tree->prims[j]].range;
+				if(range <= 0.0f || lbvh->reach[i] < 0.0f)
+					lbvh->reach[i] = -1.0f;
+				else if(range > lbvh->reach[i])
+					lbvh->reach[i] = range;
+			}
+			continue;
+		}
+
+		left = i + 1;
+		right = node->first;
+		lbvh->power[i] = lbvh->power[left] + lbvh->power[right];
+		if(lbvh->reach[left] < 0.0f || lbvh->reach[right] < 0.0f)
+			lbvh->reach[i] = -1.0f;
+		else
+			lbvh->reach[i] = lbvh->reach[left] > lbvh->reach[right] ?
+				lbvh->reach[left] : lbvh->reach[right];
+	}
+
+#if defined(_DEBUG)
+	printf("Light BVH built:\t%d nodes over %d lights\n",
+		lbvh->tree->nNodes, nLights);
+#endif
+
+	return lbvh;
+}
+
+/* cleanup dynamic memory from building a light hierarchy */
+void lightbvh_free(lightbvh_t *lbvh)
+{
+	if(lbvh)
+	{
+		bvh_free(lbvh->tree);
+		free(lbvh->power);
+		free(lbvh->reach);
+		free(lbvh);
+	}
+}
+
+/* build the light hierarchy of a scene (scene->lightBvh) */
+lightbvh_t* lightbvh_build_scene(scene_t *scene)
+{
+	lightbvh_free(scene->lightBvh);
+	scene->lightBvh = lightbvh_build(scene->lights, scene->nLights);
+
+	return scene->lightBvh;
+}
+
+/* picks a light for a point on a surface */
+unsigned int lightbvh_sample(const lightbvh_t *lbvh, const pointlight_t *lights,
+		const point_t *pt, const vector4_t *N, float u, float *pdf)
+{
+	const bvh_t	*tree = lbvh->tree;
+	const bvh_node_t *node;
+	unsigned int	index = 0;
+	unsigned int	i;
+	unsigned int	left, right;
+	unsigned int	light;
+	float		weight, pick = 0.0f;
+	float		wL, wR;
+	float		total;
+	float		p = 1.0f;
+
+	if(!tree->nPrims || lightbvh_importance(lbvh, 0, pt, N) <= 0.0f)
+		return ~0u;
+
+	/* walk down choosing children by importance, reusing u at every step */
+	for(;;)
+	{
+		node = &tree->nodes[index];
+		if(node->count)
+			break;
+
+		left = index + 1;
+		right = node->first;
+		wL = lightbvh_importance(lbvh, left, pt, N);
+		wR = lightbvh_importance(lbvh, right, pt, N);
+		total = wL + wR;
+		if(total <= 0.0f)
+			return ~0u;
+
+		wL /= total;
+		if(u < wL)
+		{
+			u /= wL;
+			p *= wL;
+			index = left;
+		}
+		else
+		{
+			u = (u - wL) / (1.0f - wL);
+			p *= 1.0f - wL;
+			index = right;
+		}
+		/* rounding may push u to 1 */
+		if(u >= 1.0f)
+			u = 0.99999994f;
+	}
+
+	/* then a light of the leaf (leaves of lights at the same spot may be
+	 * big, so weights are worked out twice rather than stored) */
+	total = 0.0f;
+	for(i = node->first; i < node->first + node->count; ++i)
+	{
+		total += lightbvh_light_importance(&lights[tree->prims[i]], pt, N);
+	}
+	if(total <= 0.0f)
+		return ~0u;
+
+	u *= total;
+	light = ~0u;
+	for(i = node->first; i < node->first + node->count; ++i)
+	{
+		weight = lightbvh_light_importance(&lights[tree->prims[i]], pt, N);
+		if(weight <= 0.0f)
+			continue;
+		/* the last light that can be picked takes what rounding left */
+		light = tree->prims[i];
+		pick = weight;
+		if(u < weight)
+			break;
+		u -= weight;
+	}
+
+	*pdf = p * (pick / total);
+	return light;
+}
@@ -0,0 +1,51 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 13, 2008
+ * lightbvh.h
+ *
+ * This file contains the definition for the light hierarchy used to pick
+ * a few lights at random for each shading point instead of casting a
+ * shadow ray towards every light.  The hierarchy is a regular bvh_t over
+ * the light positions with the total power and the reach of the lights
+ * below every node stored alongside it.  A light is picked by walking
+ * down the tree, choosing a child in proportion to how much it may light
+ * the point: its power, zero if the point is out of reach of every light
+ * in it or faces away from all of them.  Every light that can light the
+ * point can be picked, so dividing by the probability of the pick gives
+ * an unbiased estimate.
+ */
+
+#ifndef _LIGHTBVH_H_
+#define _LIGHTBVH_H_
+
+#include "scene.h"
+#include "bvh.h"
+
+/* most lights a shading point may sample */
+#define LIGHTBVH_MAX_SAMPLES	256
+
+typedef struct lightbvh_s
+{
+	bvh_t		*tree;		/* hierarchy over light positions */
+	float		*power;		/* per node - power of lights below */
+	float		*reach;		/* per node - largest range below,
+					 * negative if a light reaches everywhere */
+} lightbvh_t;
+
+/* build a light hierarchy over a list of lights */
+lightbvh_t* lightbvh_build(const pointlight_t *lights, unsigned int nLights);
+
+/* cleanup dynamic memory from building a light hierarchy */
+void lightbvh_free(lightbvh_t *lbvh);
+
+/* build the light hierarchy of a scene (scene->lightBvh) */
+lightbvh_t* lightbvh_build_scene(scene_t *scene);
+
+/* picks a light for a point on a surface with normal N.  u is a random
+ * number in [0, 1).  Returns the light and its probability through pdf,
+ * or ~0 if no light can reach the point */
+unsigned int lightbvh_sample(const lightbvh_t *lbvh, const pointlight_t *lights,
+		const point_t *pt, const vector4_t *N, float u, float *pdf);
+
+#endif
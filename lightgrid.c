@@ -0,0 +1,228 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 12, 2008
+ * lightgrid.c
+ *
+ * This file contains the definitions for building the light grid.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "lightgrid.h"
+
+/* tests if the sphere a light reaches touches a cell */
+static int lightgrid_touches(const lightgrid_t *grid, const pointlight_t *light,
+			unsigned int x, unsigned int y, unsigned int z)
+{
+	unsigned int	cell[3];
+	unsigned int	i = 0;
+	float		lo, hi;
+	float		d;
+	float		dist = 0.0f;	/* squared distance to the cell */
+
+	cell[0] = x;
+	cell[1] = y;
+	cell[2] = z;
+	for(; i < 3; ++i)
+	{
+		lo = grid->min[i] + cell[i] / grid->invCell[i];
+		hi = grid->min[i] + (cell[i] + 1) / grid->invCell[i];
+		d = light->position.c[i] < lo ? lo - light->position.c[i] :
+			light->position.c[i] > hi ? light->position.c[i] - hi : 0.0f;
+		dist += d * d;
+	}
+
+	/* a little slack so rounding never loses a light */
+	return dist <= light->range * light->range * 1.0001f;
+}
+
+/* range of cells along an axis a light may reach */
+static void lightgrid_span(const lightgrid_t *grid, const pointlight_t *light,
+			unsigned int axis, unsigned int *lo, unsigned int *hi)
+{
+	float f;
+
+	f = (light->position.c[axis] - light->range - grid->min[axis]) *
+		grid->invCell[axis];
+	*lo = f <= 0.0f ? 0 : (unsigned int)f;
+	f = (light->position.c[axis] + light->range - grid->min[axis]) *
+		grid->invCell[axis];
+	*hi = f >= (float)(grid->dim[axis] - 1) ? grid->dim[axis] - 1 :
+		(unsigned int)f;
+	if(*lo > *hi)
+		*lo = *hi;
+}
+
+/* walk every cell a light touches, counting (fill = 0) or recording it */
+static unsigned long long lightgrid_visit(lightgrid_t *grid,
+		const pointlight_t *lights, unsigned int light, unsigned int *fill)
+{
+	const pointlight_t	*l = &lights[light];
+	unsigned long long	n = 0;
+	unsigned int		lo[3], hi[3];
+	unsigned int		x, y, z;
+	unsigned int		cell;
+
+	if(l->range <= 0.0f)
+	{	/* reaches everywhere */
+		lo[0] = lo[1] = lo[2] = 0;
+		hi[0] = grid->dim[0] - 1;
+		hi[1] = grid->dim[1] - 1;
+		hi[2] = grid->dim[2] - 1;
+	}
+	else
+	{
+		for(x = 0; x < 3; ++x)
+			lightgrid_span(grid, l, x, &lo[x], &hi[x]);
+	}
+
+	for(z = lo[2]; z <= hi[2]; ++z)
+	{
+		for(y = lo[1]; y <= hi[1]; ++y)
+		{
+			for(x = lo[0]; x <= hi[0]; ++x)
+			{
+				if(l->range > 0.0f &&
+					!lightgrid_touches(grid, l, x, y, z))
+					continue;
+				cell = (z * grid->dim[1] + y) * grid->dim[0] + x;
+				if(fill)
+					grid->lights[fill[cell]++] = light;
+				else
+					++grid->cellStart[cell];
+				++n;
+			}
+		}
+	}
+
+	return n;
+}
+
+/* build a light grid over a list of lights */
+lightgrid_t* lightgrid_build(const pointlight_t *lights, unsigned int nLights)
+{
+	lightgrid_t		*grid;
+	aabb_t			bounds;
+	point_t			p;
+	float			extent[3];
+	float			volume = 1.0f;
+	float			cell;
+	unsigned long long	refs = 0;
+	unsigned int		nCells;
+	unsigned int		*fill;
+	unsigned int		nBounded = 0;
+	unsigned int		i = 0;
+	unsigned int		sum;
+	unsigned int		count;
+
+	if(nLights < LIGHTGRID_MIN_LIGHTS)
+		return 0;
+
+	/* grid covers everything a light with a range reaches */
+	aabb_init(&bounds);
+	for(; i < nLights; ++i)
+	{
+		if(lights[i].range <= 0.0f)
+			continue;
+		++nBounded;
+		p = vec4v_sub(lights[i].position, vec4v_make(lights[i].range,
+			lights[i].range, lights[i].range, 0.0f));
+		aabb_grow_point(&bounds, &p);
+		p = vec4v_add(lights[i].position, vec4v_make(lights[i].range,
+			lights[i].range, lights[i].range, 0.0f));
+		aabb_grow_point(&bounds, &p);
+	}
+	/* nothing to gain if no light has a range */
+	if(!nBounded)
+		return 0;
+
+	grid = malloc(sizeof(lightgrid_t));
+	for(i = 0; i < 3; ++i)
+	{
+		/* pad a little so points right on the edge stay inside */
+		extent[i] = bounds.max[i] - bounds.min[i];
+		extent[i] += extent[i] * 1e-4f + 1e-4f;
+		grid->min[i] = bounds.min[i] - extent[i] * 0.5e-4f;
+		volume *= extent[i];
+	}
+
+	/* about one cell per light */
+	cell = cbrtf(volume / nBounded);
+	nCells = 1;
+	for(i = 0; i < 3; ++i)
+	{
+		grid->dim[i] = (unsigned int)ceilf(extent[i] / cell);
+		if(grid->dim[i] < 1)
+			grid->dim[i] = 1;
+		if(grid->dim[i] > LIGHTGRID_MAX_DIM)
+			grid->dim[i] = LIGHTGRID_MAX_DIM;
+		grid->invCell[i] = grid->dim[i] / extent[i];
+		nCells *= grid->dim[i];
+	}
+
+	/* count lights per cell, turn counts into offsets, then fill */
+	grid->cellStart = calloc(nCells + 1, sizeof(unsigned int));
+	grid->lights = 0;
+	grid->unbounded = malloc(sizeof(unsigned int) * nLights);
+	grid->nUnbounded = 0;
+	for(i = 0; i < nLights && refs <= LIGHTGRID_MAX_REFS; ++i)
+	{
+		refs += lightgrid_visit(grid, lights, i, 0);
+		if(lights[i].range <= 0.0f)
+			grid->unbounded[grid->nUnbounded++] = i;
+	}
+	if(refs > LIGHTGRID_MAX_REFS)
+	{	/* ranges are too big for the grid to help */
+		lightgrid_free(grid);
+		return 0;
+	}
+
+	for(sum = 0, i = 0; i <= nCells; ++i)
+	{
+		count = grid->cellStart[i];
+		grid->cellStart[i] = sum;
+		sum += count;
+	}
+	grid->lights = malloc(sizeof(unsigned int) * (sum ? sum : 1));
+	fill = malloc(sizeof(unsigned int) * nCells);
+	for(i = 0; i < nCells; ++i)
+	{
+		fill[i] = grid->cellStart[i];
+	}
+	/* lights are added in scene order, so every cell lists them in order */
+	for(i = 0; i < nLights; ++i)
+	{
+		lightgrid_visit(grid, lights, i, fill);
+	}
+	free(fill);
+
+#if defined(_DEBUG)
+	printf("Light grid:\t%dx%dx%d cells, %d references\n",
+		grid->dim[0], grid->dim[1], grid->dim[2], sum);
+#endif
+
+	return grid;
+}
+
+/* cleanup dynamic memory from building a light grid */
+void lightgrid_free(lightgrid_t *grid)
+{
+	if(grid)
+	{
+		free(grid->cellStart);
+		free(grid->lights);
+		free(grid->unbounded);
+		free(grid);
+	}
+}
+
+/* build the light grid of a scene (scene->lightGrid) */
+lightgrid_t* lightgrid_build_scene(scene_t *scene)
+{
+	lightgrid_free(scene->lightGrid);
+	scene->lightGrid = lightgrid_build(scene->lights, scene->nLights);
+
+	return scene->lightGrid;
+}
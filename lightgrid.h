@@ -0,0 +1,76 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 12, 2008
+ * lightgrid.h
+ *
+ * This file contains the definition for the light grid.  A point light
+ * only reaches as far as its range, so scenes with many small lights
+ * spend most of their shading time on lights that cannot possibly reach
+ * the point being shaded.  The light grid is a uniform grid over the
+ * space the lights reach where every cell lists the lights whose range
+ * touches it, in scene order, so shading only visits lights that can
+ * matter.
+ */
+
+#ifndef _LIGHTGRID_H_
+#define _LIGHTGRID_H_
+
+#include "scene.h"
+
+/* scenes with fewer lights than this simply loop over all of them */
+#define LIGHTGRID_MIN_LIGHTS	16
+/* most cells along any axis */
+#define LIGHTGRID_MAX_DIM	128
+/* give up on the grid if cells would reference more lights than this */
+#define LIGHTGRID_MAX_REFS	(16 * 1024 * 1024)
+
+typedef struct lightgrid_s
+{
+	float		min[3];		/* corner of the grid */
+	float		invCell[3];	/* cells per unit along each axis */
+	unsigned int	dim[3];		/* cells along each axis */
+	unsigned int	*cellStart;	/* first entry of each cell in lights,
+					 * one extra entry marks the end */
+	unsigned int	*lights;	/* light indices of every cell */
+	unsigned int	nUnbounded;	/* lights without a range (range <= 0) */
+	unsigned int	*unbounded;	/* they are in every cell too */
+} lightgrid_t;
+
+/* build a light grid over a list of lights.  Returns null if the lights
+ * are not worth a grid */
+lightgrid_t* lightgrid_build(const pointlight_t *lights, unsigned int nLights);
+
+/* cleanup dynamic memory from building a light grid */
+void lightgrid_free(lightgrid_t *grid);
+
+/* build the light grid of a scene (scene->lightGrid, may be null) */
+lightgrid_t* lightgrid_build_scene(scene_t *scene);
+
+/* gets the lights that may reach a point, in scene order.  Returns how
+ * many there are and points list at them */
+static inline unsigned int lightgrid_lookup(const lightgrid_t *grid,
+		const point_t *pt, const unsigned int **list)
+{
+	unsigned int	cell[3];
+	unsigned int	i = 0;
+	float		f;
+
+	for(; i < 3; ++i)
+	{
+		f = (pt->c[i] - grid->min[i]) * grid->invCell[i];
+		/* outside the grid only the lights without a range reach */
+		if(!(f >= 0.0f && f < (float)grid->dim[i]))
+		{
+			*list = grid->unbounded;
+			return grid->nUnbounded;
+		}
+		cell[i] = (unsigned int)f;
+	}
+
+	i = (cell[2] * grid->dim[1] + cell[1]) * grid->dim[0] + cell[0];
+	*list = &grid->lights[grid->cellStart[i]];
+	return grid->cellStart[i+1] - grid->cellStart[i];
+}
+
+#endif
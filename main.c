@@ -17,6 +17,12 @@
 #include "main.h"
 #include "scene.h"
 #include "raytrace.h"
+#include "bvh.h"
+#include "cscene.h"
+#include "grid.h"
+#include "lightbvh.h"
+#include "lightgrid.h"
+#include "scenebin.h"
 #include "output.h"
 #ifdef _DEBUG
 	#include "matrix4.h"
@@ -93,6 +99,280 @@ void do_stuff()
 }
 #endif
 
+/* write buffer to file as a binary PPM.  Unlike write_image() this always
+ * writes a file and returns, whichever output backend is built */
+int write_ppm(const char *filename, const unsigned int *buffer,
+		unsigned int width, unsigned int height)
+{
+	unsigned char	*row = malloc(3 * width);
+	unsigned int	i, j = 0;
+	int		result = 1;
+	FILE		*fp = fopen(filename, "wb");
+
+	if(!fp || !row)
+	{
+		printf("Could not open file {%s} for writing.\n", filename);
+		if(fp)
+			fclose(fp);
+		free(row);
+		return 0;
+	}
+
+	fprintf(fp, "P6\n%u %u\n255\n", width, height);
+	for(; j < height && result; ++j)
+	{
+		for(i = 0; i < width; ++i)
+		{
+			row[3*i] = (buffer[i+j*width] >> 16) & 0xFF;
+			row[3*i+1] = (buffer[i+j*width] >> 8) & 0xFF;
+			row[3*i+2] = buffer[i+j*width] & 0xFF;
+		}
+		result = fwrite(row, 3, width, fp) == width;
+	}
+	if(!result)
+		printf("Could not write file {%s}.\n", filename);
+
+	free(row);
+	fclose(fp);
+	return result;
+}
+
+/* progressive mode - writes the image so far over the output file as a
+ * PPM, data is the file name.  write_image() is left for the final image
+ * since the GLUT backend opens a viewer there and never returns */
+void write_snapshot(unsigned int *buffer, unsigned int width,
+		unsigned int height, unsigned int spp, void *data)
+{
+	write_ppm((const char *)data, buffer, width, height);
+}
+
+/* loads a scene for rendering - compiled scene files are mapped as is,
+ * scene descriptions are parsed and get a hierarchy built over them */
+int load_scene(const char *filename, scene_t *scene,
+		const bvh_options_t *bvhOptions)
+{
+	struct timeval	start, end;
+	int		result;
+
+	gettimeofday(&start, 0);
+	if(scenebin_probe(filename))
+	{
+		result = scenebin_load(filename, scene);
+	}
+	else
+	{
+		result = parse_scene(filename, scene);
+		/* build the acceleration structure the scene asks for over its
+		 * objects, falling back on the hierarchy if a grid does not fit */
+		if(result && scene->accel == SCENE_ACCEL_GRID)
+		{
+			bvh_build_meshes(scene, bvhOptions);
+			if(!grid_build_scene(scene))
+			{
+				printf("Objects do not fit a grid, using a hierarchy.\n");
+				scene->accel = SCENE_ACCEL_BVH;
+			}
+			/* meshes pick up their hierarchies */
+			cscene_build(scene);
+		}
+		else if(result && scene->accel == SCENE_ACCEL_NONE)
+		{
+			bvh_build_meshes(scene, bvhOptions);
+			cscene_build(scene);
+		}
+		if(result && scene->accel == SCENE_ACCEL_BVH)
+			bvh_build_scene(scene, bvhOptions);
+	}
+	/* sort lights into space so shading only visits the ones in range */
+	if(result)
+		lightgrid_build_scene(scene);
+	gettimeofday(&end, 0);
+
+	if(result)
+		printf("Scene ready in:\t%.3f ms\n",
+			(end.tv_sec - start.tv_sec) * 1000.0 +
+			(end.tv_usec - start.tv_usec) / 1000.0);
+	return result;
+}
+
+/* compile mode - parse a scene description and write it out as a compiled
+ * scene file that later renders map instead of parsing */
+int compile_scene(const char *sceneFile, const char *outFile)
+{
+	scene_t	scene;
+	int	result;
+
+	if(!load_scene(sceneFile, &scene, 0))
+		return 0;
+	result = scenebin_write(outFile, &scene);
+	free_scene(&scene);
+
+	return result;
+}
+
+/* a random number in [-1, 1] */
+static float animate_random()
+{
+	return 2.0f * rand() / (float)RAND_MAX - 1.0f;
+}
+
+/* milliseconds since start */
+static double animate_elapsed(const struct timeval *start)
+{
+	struct timeval	end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000.0 +
+		(end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* traces ANIMATE_RAYS rays from the eye towards the look at point, spread
+ * over a cone about as wide as the distance to it.  Keeps what each ray
+ * hit and how far away in hits and dists, returns how many hit anything */
+static unsigned int animate_trace(const scene_t *scene, unsigned int seed,
+		object3d_t **hits, float *dists)
+{
+	ray_t		ray;
+	vector4_t	view;
+	point_t		intersect;
+	unsigned int	prim;
+	unsigned int	i, nHits = 0;
+	float		spread;
+
+	view = vec4v_make(scene->lookAt.x - scene->eyePos.x,
+		scene->lookAt.y - scene->eyePos.y,
+		scene->lookAt.z - scene->eyePos.z, 0.0f);
+	spread = vec4v_magnitude(view);
+	/* the same rays every time for the same seed */
+	srand(seed);
+	for(i = 0; i < ANIMATE_RAYS; ++i)
+	{
+		ray.origin = scene->eyePos;
+		ray.direction = vec4v_normalize(vec4v_make(
+			view.x + spread * animate_random(),
+			view.y + spread * animate_random(),
+			view.z + spread * animate_random(), 0.0f));
+		ray.magnitude = 1e9f;
+		hits[i] = get_object3d_intersect(&intersect, &dists[i], &prim,
+			&ray, scene);
+		if(hits[i])
+			++nHits;
+		else
+			dists[i] = 0.0f;
+	}
+	return nHits;
+}
+
+/* animate mode - moves every sphere and polygon of a scene along its own
+ * random direction by up to speed per frame, brings the acceleration
+ * structure up to date with scene_update() and traces rays from the eye.
+ * After the last frame the structure is built from scratch and the same
+ * rays must hit the same objects at the same distances */
+int animate_scene(const char *sceneFile, unsigned int frames, float speed)
+{
+	scene_t		scene;
+	bvh_options_t	bvhOptions;
+	float		*velocity;	/* of each object, per frame */
+	point_t		*points;	/* moved vertices of a polygon */
+	object3d_t	**hits, **freshHits;
+	float		*dists, *freshDists;
+	object3d_t	*obj;
+	polygon_t	*poly;
+	point_t		center;
+	struct timeval	start;
+	unsigned int	maxVerts = 0;
+	unsigned int	i, j, f, nHits, differ = 0;
+	double		sum;
+
+	init_bvh_options(&bvhOptions);
+	if(!load_scene(sceneFile, &scene, &bvhOptions))
+		return 0;
+
+	velocity = malloc(sizeof(float) * 3 * (scene.nObjects + 1));
+	hits = malloc(sizeof(object3d_t *) * ANIMATE_RAYS);
+	freshHits = malloc(sizeof(object3d_t *) * ANIMATE_RAYS);
+	dists = malloc(sizeof(float) * ANIMATE_RAYS);
+	freshDists = malloc(sizeof(float) * ANIMATE_RAYS);
+	srand(1);
+	for(i = 0; i < scene.nObjects; ++i)
+	{
+		velocity[3*i] = speed * animate_random();
+		velocity[3*i+1] = speed * animate_random();
+		velocity[3*i+2] = speed * animate_random();
+		if(scene.objects[i].geometryType == GEOMETRY_POLYGON &&
+			scene.objects[i].poly_obj.nVerticies > maxVerts)
+			maxVerts = scene.objects[i].poly_obj.nVerticies;
+	}
+	points = malloc(sizeof(point_t) * (maxVerts + 1));
+
+	for(f = 0; f < frames; ++f)
+	{
+		gettimeofday(&start, 0);
+		for(i = 0; i < scene.nObjects; ++i)
+		{
+			obj = &scene.objects[i];
+			if(obj->geometryType == GEOMETRY_SPHERE)
+			{
+				center = obj->sphr_obj.center;
+				center.x += velocity[3*i];
+				center.y += velocity[3*i+1];
+				center.z += velocity[3*i+2];
+				scene_move_sphere(&scene, i, &center,
+					obj->sphr_obj.radius);
+			}
+			else if(obj->geometryType == GEOMETRY_POLYGON)
+			{
+				poly = &obj->poly_obj;
+				for(j = 0; j < poly->nVerticies; ++j)
+				{
+					points[j] = poly->vertex[j];
+					points[j].x += velocity[3*i];
+					points[j].y += velocity[3*i+1];
+					points[j].z += velocity[3*i+2];
+				}
+				scene_move_polygon(&scene, i, points);
+			}
+		}
+		scene_update(&scene, &bvhOptions);
+		printf("Frame %u moved:\t%.3f ms\n", f, animate_elapsed(&start));
+
+		gettimeofday(&start, 0);
+		nHits = animate_trace(&scene, f + 1, hits, dists);
+		for(i = 0, sum = 0.0; i < ANIMATE_RAYS; ++i)
+			sum += dists[i];
+		printf("Frame %u traced:	%u of %u rays hit (distance sum %.3f) "
+			"in %.3f ms\n", f, nHits, ANIMATE_RAYS, sum,
+			animate_elapsed(&start));
+	}
+
+	/* the last frame again over a structure built from scratch */
+	if(scene.accel == SCENE_ACCEL_BVH)
+		bvh_build_scene(&scene, &bvhOptions);
+	else if(scene.accel == SCENE_ACCEL_GRID)
+		grid_build_scene(&scene);
+	if(frames)
+	{
+		animate_trace(&scene, frames, freshHits, freshDists);
+		for(i = 0; i < ANIMATE_RAYS; ++i)
+		{
+			if(hits[i] != freshHits[i] || dists[i] != freshDists[i])
+				++differ;
+		}
+		printf("Fresh build:	%u of %u rays differ\n", differ,
+			ANIMATE_RAYS);
+	}
+
+	free(velocity);
+	free(points);
+	free(hits);
+	free(freshHits);
+	free(dists);
+	free(freshDists);
+	free_scene(&scene);
+
+	return differ == 0;
+}
+
 /* Params - 
  * 	0 - program name
  * 	1 - output image filename
@@ -101,6 +381,34 @@ void do_stuff()
  * 	4 - image height
  * 	5 - samples_per_pixel^2
  * 	6 - depth
+ *
+ * Optional params (after the above) -
+ * 	--threads n	- number of render threads (0 = one per cpu)
+ * 	--tile n	- width/height of square render tiles in pixels
+ * 	--packets n	- trace primary rays in packets (0 = one at a time)
+ * 	--min-weight w	- skip reflected/transmitted rays worth less than w
+ * 	--roulette n	- play russian roulette below min-weight (0 = skip)
+ * 	--light-samples n - lights picked at random per shading point (0 = all)
+ * 	--adaptive t	- supersample only pixels with contrast above t (0 = all)
+ * 	--sampler s	- sub sample placement: grid, jitter or sobol
+ * 	--spp n		- samples per pixel, any number (overrides the 6th param)
+ * 	--progressive n	- render in passes, rewriting outputFile as a PPM
+ * 			  after each (the final image goes to write_image())
+ * 			  (n > 1 - start with a preview at every nth pixel)
+ * 	--time-budget s	- keep adding samples, noisiest tiles first, until s
+ * 			  seconds after the start and write what there is
+ * 	--bvh-leaf n	- primitives a hierarchy leaf is kept to
+ * 	--bvh-bins n	- bins per axis the hierarchy builder splits with
+ *
+ * Compile mode - 
+ * 	raytrace compile sceneFile compiledFile
+ * writes a compiled scene file that can be given as sceneFile above
+ *
+ * Animate mode -
+ * 	raytrace animate sceneFile frames speed
+ * moves the objects for a number of frames, printing how long keeping the
+ * acceleration structure up to date takes, and checks the result against
+ * one built from scratch (see animate_scene())
  */
 int main(int argc, char **argv)
 {
@@ -110,11 +418,14 @@ int main(int argc, char **argv)
 	unsigned int		imgHeight = 0;
 	unsigned int		samplesPerPixel = 1;
 	unsigned int		depth = 1;
+	int			i = ARGC_EXPECTED;
+	render_options_t	options;
+	bvh_options_t		bvhOptions;
 	scene_t			scene;
-	time_t			start, end;
+	struct timeval		start, end;
 	double			diff;
 	
-	time(&start);
+	gettimeofday(&start, 0);
 	
 	/* copy command line params to global */
 	g_argc = argc;
@@ -124,14 +435,109 @@ int main(int argc, char **argv)
 	do_stuff();
 #endif
 
+	if(argc == ARGC_COMPILE && !strcmp(argv[ARGV_MODE], ARGMODE_COMPILE))
+	{
+		return compile_scene(argv[ARGV_COMPILESCENE],
+			argv[ARGV_COMPILEOUTPUT]) ? 0 : 1;
+	}
+	if(argc == ARGC_ANIMATE && !strcmp(argv[ARGV_MODE], ARGMODE_ANIMATE))
+	{
+		return animate_scene(argv[ARGV_ANIMATESCENE],
+			atoi(argv[ARGV_ANIMATEFRAMES]),
+			(float)atof(argv[ARGV_ANIMATESPEED])) ? 0 : 1;
+	}
+
 	if(argc < ARGC_EXPECTED)
 	{
-		printf("raytrace outputFile sceneFile imgWidth imgHeight samplesPerPixel^2 depth\n");
+		printf("raytrace outputFile sceneFile imgWidth imgHeight samplesPerPixel^2 depth [--threads n] [--tile n] [--packets n] [--min-weight w] [--roulette n] [--light-samples n] [--adaptive t] [--sampler grid|jitter|sobol] [--spp n] [--progressive n] [--time-budget s] [--bvh-leaf n] [--bvh-bins n]\n");
+		printf("  --progressive rewrites outputFile as a PPM after every pass\n");
+		printf("raytrace compile sceneFile compiledFile\n");
+		printf("raytrace animate sceneFile frames speed\n");
 		exit(1);
 	}
 
+	init_render_options(&options);
+	init_bvh_options(&bvhOptions);
+	/* optional arguments all take a single value */
+	for(; i < argc; i += 2)
+	{
+		if(i + 1 >= argc)
+		{
+			printf("Missing value for option %s.  Exiting...\n", argv[i]);
+			exit(1);
+		}
+
+		if(!strcmp(argv[i], ARGOPT_THREADS))
+		{
+			options.numThreads = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_TILE))
+		{
+			options.tileSize = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_PACKETS))
+		{
+			options.packets = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_MINWEIGHT))
+		{
+			options.minWeight = (float)atof(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_ROULETTE))
+		{
+			options.roulette = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_LIGHTSAMPLES))
+		{
+			options.lightSamples = atoi(argv[i+1]);
+			if(options.lightSamples > LIGHTBVH_MAX_SAMPLES)
+				options.lightSamples = LIGHTBVH_MAX_SAMPLES;
+		}
+		else if(!strcmp(argv[i], ARGOPT_ADAPTIVE))
+		{
+			options.adaptive = (float)atof(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_SAMPLER))
+		{
+			if(sampler_type(argv[i+1]) < 0)
+			{
+				printf("Unknown sampler %s.  Exiting...\n", argv[i+1]);
+				exit(1);
+			}
+			options.sampler = sampler_type(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_SPP))
+		{
+			options.spp = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_PROGRESSIVE))
+		{
+			options.progressive = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_TIMEBUDGET))
+		{
+			options.timeBudget = (float)atof(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_BVHLEAF))
+		{
+			bvhOptions.leafSize = atoi(argv[i+1]);
+		}
+		else if(!strcmp(argv[i], ARGOPT_BVHBINS))
+		{
+			bvhOptions.nBins = atoi(argv[i+1]);
+		}
+		else
+		{
+			printf("Unknown option %s.  Exiting...\n", argv[i]);
+			exit(1);
+		}
+	}
+
 	imgOut = argv[ARGV_OUTPUTIMG];
 	sceneFile = argv[ARGV_SCENEFILE];
+	/* every pass of a progressive render replaces the output image */
+	options.snapshot = write_snapshot;
+	options.snapshotData = (void *)imgOut;
 	imgWidth = atoi(argv[ARGV_IMAGEWIDTH]);
 	imgHeight = atoi(argv[ARGV_IMAGEHEIGHT]);
 	/* this is actually sqrt(spp) */
@@ -149,15 +555,32 @@ int main(int argc, char **argv)
 	printf("Image Height = %d\n", imgHeight);
 #endif
 
-	/* parse scene file */
-	if(!parse_scene(sceneFile, &scene))
+	/* parse or map scene file */
+	/* the hierarchy is built by as many threads as render */
+	bvhOptions.numThreads = options.numThreads;
+	if(!load_scene(sceneFile, &scene, &bvhOptions))
 	{
 		printf("Error parsing scene file.  Exiting...\n");
 		exit(1);
 	}
+	/* hierarchy to pick lights from, only needed when picking */
+	if(options.lightSamples)
+		lightbvh_build_scene(&scene);
+
+	/* the time budget covers loading the scene too */
+	if(options.timeBudget > 0.0f)
+	{
+		gettimeofday(&end, 0);
+		options.timeBudget -= (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1e6f;
+		/* out of time already - the preview is all there will be */
+		if(options.timeBudget <= 0.0f)
+			options.timeBudget = 1e-6f;
+	}
 
-	raytrace(frame_buffer, &scene, 45.0f, imgWidth/(float)imgHeight,
-		1.0f, 200.0f, imgWidth, imgHeight, samplesPerPixel, depth);
+	raytrace(frame_buffer, &scene, scene.fovY, imgWidth/(float)imgHeight,
+		scene.nearZ, scene.farZ, imgWidth, imgHeight, samplesPerPixel, depth,
+		&options);
 
 	/* output file image to file or screen (netbpm lib?) */
 	write_image(imgOut, frame_buffer, imgWidth, imgHeight);
@@ -165,8 +588,8 @@ int main(int argc, char **argv)
 	free_scene(&scene);
 	free_buffers();
 
-	time(&end);
-	diff = difftime(end, start);
+	gettimeofday(&end, 0);
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
 	printf("Run time:\t%f\n", diff);
 
 	return 0;
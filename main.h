@@ -18,6 +18,37 @@
 #define ARGV_DEPTH			6
 
 #define ARGC_EXPECTED			7
+
+/* raytrace compile sceneFile compiledFile */
+#define ARGV_MODE			1
+#define ARGV_COMPILESCENE		2
+#define ARGV_COMPILEOUTPUT		3
+#define ARGC_COMPILE			4
+#define ARGMODE_COMPILE			"compile"
+
+/* raytrace animate sceneFile frames speed */
+#define ARGV_ANIMATESCENE		2
+#define ARGV_ANIMATEFRAMES		3
+#define ARGV_ANIMATESPEED		4
+#define ARGC_ANIMATE			5
+#define ARGMODE_ANIMATE			"animate"
+/* rays from the eye traced after each frame */
+#define ANIMATE_RAYS			200000
+
+/* optional arguments that may follow the expected ones */
+#define ARGOPT_THREADS			"--threads"
+#define ARGOPT_TILE			"--tile"
+#define ARGOPT_PACKETS			"--packets"
+#define ARGOPT_MINWEIGHT		"--min-weight"
+#define ARGOPT_ROULETTE			"--roulette"
+#define ARGOPT_LIGHTSAMPLES		"--light-samples"
+#define ARGOPT_ADAPTIVE			"--adaptive"
+#define ARGOPT_SAMPLER			"--sampler"
+#define ARGOPT_SPP			"--spp"
+#define ARGOPT_PROGRESSIVE		"--progressive"
+#define ARGOPT_TIMEBUDGET		"--time-budget"
+#define ARGOPT_BVHLEAF			"--bvh-leaf"
+#define ARGOPT_BVHBINS			"--bvh-bins"
 /* 
 #define ARGV_
 */
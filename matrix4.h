@@ -25,7 +25,7 @@ typedef struct
 			float _31, _32, _33, _34;
 			float _41, _42, _43, _44;
 		};
-	};
+	} SIMD_ALIGN;	/* rows are used as vector4_t */
 } matrix4_t;
 
 /*  Functions related to handling matrices */
@@ -0,0 +1,258 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 15, 2008
+ * mesh.c
+ *
+ * This file contains the definitions for building and intersecting
+ * triangle meshes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mesh.h"
+#include "bvh.h"
+
+/* allocate the vertex and index buffers of a mesh */
+mesh_t* mesh_init(mesh_t *mesh, unsigned int nVertices,
+		unsigned int nTriangles)
+{
+	mesh->nVertices = nVertices;
+	mesh->nTriangles = nTriangles;
+	mesh->vx = malloc(sizeof(float) * (nVertices ? nVertices : 1));
+	mesh->vy = malloc(sizeof(float) * (nVertices ? nVertices : 1));
+	mesh->vz = malloc(sizeof(float) * (nVertices ? nVertices : 1));
+	mesh->index = malloc(sizeof(unsigned int) * 3 *
+			(nTriangles ? nTriangles : 1));
+	mesh->bvh = 0;
+
+	return mesh;
+}
+
+/* build the hierarchy over the triangles of a mesh */
+mesh_t* mesh_prepare(mesh_t *mesh, const bvh_options_t *options)
+{
+	aabb_t		*bounds = malloc(sizeof(aabb_t) *
+				(mesh->nTriangles ? mesh->nTriangles : 1));
+	const unsigned int *tri;
+	point_t		pt;
+	unsigned int	i = 0;
+	unsigned int	j;
+
+	for(; i < mesh->nTriangles; ++i)
+	{
+		tri = &mesh->index[i * 3];
+		aabb_init(&bounds[i]);
+		for(j = 0; j < 3; ++j)
+		{
+			pt = vec4v_make(mesh->vx[tri[j]], mesh->vy[tri[j]],
+				mesh->vz[tri[j]], 1.0f);
+			aabb_grow_point(&bounds[i], &pt);
+		}
+	}
+
+	bvh_free(mesh->bvh);
+	mesh->bvh = bvh_build(bounds, mesh->nTriangles, options);
+	free(bounds);
+
+	return mesh;
+}
+
+/* cleanup dynamic memory of a mesh */
+void mesh_free(mesh_t *mesh)
+{
+	bvh_free(mesh->bvh);
+	free(mesh->vx);
+	free(mesh->vy);
+	free(mesh->vz);
+	free(mesh->index);
+	mesh->bvh = 0;
+	mesh->vx = mesh->vy = mesh->vz = 0;
+	mesh->index = 0;
+}
+
+/* get bounding box of a mesh */
+aabb_t* get_mesh_bounds(aabb_t *boxout, const mesh_t *mesh)
+{
+	unsigned int	i = 0;
+	point_t		pt;
+
+	/* the root of the hierarchy already bounds everything */
+	if(mesh->bvh && mesh->bvh->nPrims)
+	{
+		*boxout = mesh->bvh->nodes[0].bounds;
+		return boxout;
+	}
+
+	aabb_init(boxout);
+	for(; i < mesh->nVertices; ++i)
+	{
+		pt = vec4v_make(mesh->vx[i], mesh->vy[i], mesh->vz[i], 1.0f);
+		aabb_grow_point(boxout, &pt);
+	}
+	return boxout;
+}
+
+/* get normal vector of a triangle of a mesh */
+vector4_t* get_mesh_normal(vector4_t *vecout, const mesh_t *mesh,
+			unsigned int triangle)
+{
+	const unsigned int *tri = &mesh->index[triangle * 3];
+	vector4_t	v0 = vec4v_make(mesh->vx[tri[0]], mesh->vy[tri[0]],
+				mesh->vz[tri[0]], 0.0f);
+	vector4_t	e1 = vec4v_sub(vec4v_make(mesh->vx[tri[1]],
+				mesh->vy[tri[1]], mesh->vz[tri[1]], 0.0f), v0);
+	vector4_t	e2 = vec4v_sub(vec4v_make(mesh->vx[tri[2]],
+				mesh->vy[tri[2]], mesh->vz[tri[2]], 0.0f), v0);
+
+	*vecout = vec4v_normalize(vec4v_cross(e1, e2));
+	return vecout;
+}
+
+/* distance along a ray to a triangle of a mesh (Moller-Trumbore), 0 if
+ * the ray misses it */
+static int ray_hit_triangle(const ray_t *ray, const mesh_t *mesh,
+			unsigned int triangle, float *distance)
+{
+	const unsigned int *tri = &mesh->index[triangle * 3];
+	const float	*d = ray->direction.c;
+	float		v0[3], e1[3], e2[3], p[3], s[3], q[3];
+	float		det, inv, u, v;
+
+	v0[0] = mesh->vx[tri[0]];
+	v0[1] = mesh->vy[tri[0]];
+	v0[2] = mesh->vz[tri[0]];
+	e1[0] = mesh->vx[tri[1]] - v0[0];
+	e1[1] = mesh->vy[tri[1]] - v0[1];
+	e1[2] = mesh->vz[tri[1]] - v0[2];
+	e2[0] = mesh->vx[tri[2]] - v0[0];
+	e2[1] = mesh->vy[tri[2]] - v0[1];
+	e2[2] = mesh->vz[tri[2]] - v0[2];
+
+	/* p = d x e2, det = e1 . p */
+	p[0] = d[1] * e2[2] - d[2] * e2[1];
+	p[1] = d[2] * e2[0] - d[0] * e2[2];
+	p[2] = d[0] * e2[1] - d[1] * e2[0];
+	det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	/* ray is parallel to the triangle (or the triangle is degenerate) */
+	if(det == 0.0f)
+		return 0;
+	inv = 1.0f / det;
+
+	s[0] = ray->origin.x - v0[0];
+	s[1] = ray->origin.y - v0[1];
+	s[2] = ray->origin.z - v0[2];
+	u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+	if(u < 0.0f || u > 1.0f)
+		return 0;
+
+	/* q = s x e1 */
+	q[0] = s[1] * e1[2] - s[2] * e1[1];
+	q[1] = s[2] * e1[0] - s[0] * e1[2];
+	q[2] = s[0] * e1[1] - s[1] * e1[0];
+	v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+	if(v < 0.0f || u + v > 1.0f)
+		return 0;
+
+	*distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+	return 1;
+}
+
+/* nearest triangle of a mesh the ray hits in (0, *distance) */
+unsigned int ray_hit_mesh(const ray_t *ray, const mesh_t *mesh,
+			float *distance, int any)
+{
+	const bvh_t	*bvh = mesh->bvh;
+	const bvh_node_t *node;
+	unsigned int	stack[BVH_STACK_SIZE];	/* nodes left to visit */
+	float		stackT[BVH_STACK_SIZE];	/* entry distance of each */
+	unsigned int	top = 0;
+	unsigned int	i;
+	unsigned int	left, right;
+	unsigned int	triangle = ~0u;	/* return value */
+	int		hitL, hitR;
+	float		tL, tR;
+	float		t;
+	float		tmax = *distance;
+	vector4_t	invDir;		/* reciprocal ray direction */
+
+	if(!bvh->nPrims)
+		return ~0u;
+
+	invDir.x = 1.0f / ray->direction.x;
+	invDir.y = 1.0f / ray->direction.y;
+	invDir.z = 1.0f / ray->direction.z;
+	invDir.w = 0.0f;
+
+	if(!ray_intersect_aabb(ray, &invDir, &bvh->nodes[0].bounds,
+			0.0f, tmax, &tL))
+		return ~0u;
+	stack[top] = 0;
+	stackT[top++] = tL;
+
+	/* same walk as bvh_intersect() */
+	while(top)
+	{
+		--top;
+		if(stackT[top] > tmax)
+			continue;
+		node = &bvh->nodes[stack[top]];
+
+		if(node->count)
+		{
+			for(i = node->first; i < node->first + node->count; ++i)
+			{
+				if(ray_hit_triangle(ray, mesh, bvh->prims[i], &t) &&
+					t > 0.0f && t < tmax)
+				{
+					tmax = t;
+					triangle = bvh->prims[i];
+					if(any)
+					{
+						*distance = tmax;
+						return triangle;
+					}
+				}
+			}
+			continue;
+		}
+
+		left = stack[top] + 1;
+		right = node->first;
+		hitL = ray_intersect_aabb(ray, &invDir, &bvh->nodes[left].bounds,
+				0.0f, tmax, &tL);
+		hitR = ray_intersect_aabb(ray, &invDir, &bvh->nodes[right].bounds,
+				0.0f, tmax, &tR);
+		if(hitL && hitR)
+		{
+			if(tL < tR)
+			{
+				stack[top] = right;
+				stackT[top++] = tR;
+				stack[top] = left;
+				stackT[top++] = tL;
+			}
+			else
+			{
+				stack[top] = left;
+				stackT[top++] = tL;
+				stack[top] = right;
+				stackT[top++] = tR;
+			}
+		}
+		else if(hitL)
+		{
+			stack[top] = left;
+			stackT[top++] = tL;
+		}
+		else if(hitR)
+		{
+			stack[top] = right;
+			stackT[top++] = tR;
+		}
+	}
+
+	if(triangle != ~0u)
+		*distance = tmax;
+	return triangle;
+}
@@ -0,0 +1,46 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 15, 2008
+ * mesh.h
+ *
+ * This file contains the definition for working with triangle meshes (see
+ * mesh_t in geometry.h).  A mesh with a million triangles is still one
+ * object: the scene hierarchy only sees its bounds and the mesh keeps a
+ * regular bvh_t over its own triangles that the intersection tests walk.
+ * Triangles are intersected with the Moller-Trumbore test straight out of
+ * the shared vertex buffers.
+ */
+
+#ifndef _MESH_H_
+#define _MESH_H_
+
+#include "geometry.h"
+#include "bvh.h"
+#include "ray.h"
+
+/* allocate the vertex and index buffers of a mesh */
+mesh_t* mesh_init(mesh_t *mesh, unsigned int nVertices,
+		unsigned int nTriangles);
+
+/* build the hierarchy over the triangles of a mesh - call once its
+ * buffers are filled in.  options may be null (see bvh_build()) */
+mesh_t* mesh_prepare(mesh_t *mesh, const bvh_options_t *options);
+
+/* cleanup dynamic memory of a mesh */
+void mesh_free(mesh_t *mesh);
+
+/* get bounding box of a mesh */
+aabb_t* get_mesh_bounds(aabb_t *boxout, const mesh_t *mesh);
+
+/* get normal vector of a triangle of a mesh */
+vector4_t* get_mesh_normal(vector4_t *vecout, const mesh_t *mesh,
+			unsigned int triangle);
+
+/* nearest triangle of a mesh the ray hits in (0, *distance).  With any set
+ * the first hit found is taken instead, which is enough for shadows.
+ * Returns the triangle with its distance in *distance, ~0 if none */
+unsigned int ray_hit_mesh(const ray_t *ray, const mesh_t *mesh,
+			float *distance, int any);
+
+#endif
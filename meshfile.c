@@ -0,0 +1,1081 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 16, 2008
+ * meshfile.c
+ *
+ * This file contains the definitions for loading triangle meshes from
+ * OBJ and PLY files.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "meshfile.h"
+#include "mesh.h"
+#include "scheduler.h"
+
+/* text files are cut into chunks of about this many bytes */
+#define MESHFILE_CHUNK_SIZE	(4 * 1024 * 1024)
+/* binary elements are cut into chunks of this many records */
+#define MESHFILE_CHUNK_RECORDS	(256 * 1024)
+
+#define PLY_MAX_ELEMENTS	16
+#define PLY_MAX_PROPERTIES	32
+
+/* scalar types of PLY properties */
+#define PLY_INT8	0
+#define PLY_UINT8	1
+#define PLY_INT16	2
+#define PLY_UINT16	3
+#define PLY_INT32	4
+#define PLY_UINT32	5
+#define PLY_FLOAT32	6
+#define PLY_FLOAT64	7
+
+/* names of the types, indexed by type - both spellings are in use */
+static const char *ply_type_names[] = {
+	"char", "uchar", "short", "ushort", "int", "uint", "float", "double" };
+static const char *ply_type_sized_names[] = {
+	"int8", "uint8", "int16", "uint16", "int32", "uint32", "float32",
+	"float64" };
+static const unsigned int ply_type_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+typedef struct
+{
+	unsigned int	type;		/* PLY_* of a value */
+	int		list;		/* non zero for a list of values */
+	unsigned int	countType;	/* PLY_* of the length of a list */
+	size_t		offset;		/* bytes into a binary record */
+} ply_property_t;
+
+typedef struct
+{
+	char		name[32];
+	size_t		count;		/* records */
+	size_t		size;		/* bytes of a binary record, 0 with lists */
+	unsigned int	nProperties;
+	ply_property_t	properties[PLY_MAX_PROPERTIES];
+} ply_element_t;
+
+/* a mapped file and what its header said */
+typedef struct
+{
+	const char	*data;
+	size_t		size;
+	const char	*body;		/* first byte after the header */
+	int		ply;
+	int		binary;
+	int		swap;		/* binary in the other byte order */
+
+	/* PLY only */
+	unsigned int	nElements;
+	ply_element_t	elements[PLY_MAX_ELEMENTS];
+	ply_element_t	*vertex;
+	ply_element_t	*face;
+	size_t		vertexStart;	/* first record - line in an ascii file, */
+	size_t		faceStart;	/* byte offset in a binary one */
+	int		xyz[3];		/* vertex properties x, y and z */
+	int		indices;	/* face property vertex_indices */
+	size_t		faceSize;	/* bytes of a binary triangle record */
+
+	mesh_t		*mesh;
+} meshfile_t;
+
+/* one chunk of a file */
+typedef struct
+{
+	meshfile_t	*file;
+	task_func_t	parse;		/* one pass over the chunk */
+	int		fill;		/* 0 - count pass, else write the mesh */
+	const char	*begin;		/* bytes of the chunk */
+	const char	*end;
+	size_t		line;		/* ascii PLY - line of begin */
+	size_t		nLines;
+	size_t		nRecords;	/* binary PLY - records of the chunk */
+	int		fixed;		/* binary PLY - faces are all assumed to
+					 * be triangles */
+	int		mixed;		/* and one of them was not */
+
+	unsigned int	nVertices;	/* found by the count pass */
+	unsigned int	nTriangles;
+	unsigned int	vertexBase;	/* where they go in the mesh */
+	unsigned int	triangleBase;
+
+	const char	*error;		/* first error message, if any */
+	const char	*errorPos;	/* where it happened, null if binary */
+} meshfile_chunk_t;
+
+/* record the first error of a chunk */
+static void chunk_error(meshfile_chunk_t *c, const char *pos, const char *msg)
+{
+	if(!c->error)
+	{
+		c->error = msg;
+		c->errorPos = pos;
+	}
+}
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* skip blanks, but not the end of the line */
+static const char* skip_blank(const char *p, const char *end)
+{
+	while(p < end && is_blank(*p))
+		++p;
+	return p;
+}
+
+/* start of the line after p */
+static const char* next_line(const char *p, const char *end)
+{
+	p = memchr(p, '\n', end - p);
+	return p ? p + 1 : end;
+}
+
+/* read a decimal number at p (see token_float() in scene.c).  Returns
+ * the end of the number or 0 if there is none */
+static const char* read_number(const char *p, const char *end, double *out)
+{
+	static const double	pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22 };
+	unsigned long long	mant = 0;
+	int			digits = 0;	/* significant digits in mant */
+	int			exp10 = 0;
+	int			e = 0;
+	int			neg = 0;
+	int			negExp = 0;
+	int			any = 0;
+	double			value;
+
+	if(p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	for(; p < end && *p >= '0' && *p <= '9'; ++p)
+	{
+		any = 1;
+		if(digits < 19)
+		{
+			mant = mant * 10 + (*p - '0');
+			digits += mant != 0;
+		}
+		else
+		{
+			++exp10;
+		}
+	}
+	if(p < end && *p == '.')
+	{
+		for(++p; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			any = 1;
+			if(digits < 19)
+			{
+				mant = mant * 10 + (*p - '0');
+				digits += mant != 0;
+				--exp10;
+			}
+		}
+	}
+	if(!any)
+		return 0;
+
+	if(end - p > 1 && (*p == 'e' || *p == 'E') &&
+		((p[1] >= '0' && p[1] <= '9') || p[1] == '-' || p[1] == '+'))
+	{
+		++p;
+		if(*p == '-' || *p == '+')
+			negExp = *p++ == '-';
+		for(; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			if(e < 10000)
+				e = e * 10 + (*p - '0');
+		}
+		exp10 += negExp ? -e : e;
+	}
+
+	value = (double)mant;
+	if(exp10 < 0)
+		value /= (exp10 >= -22) ? pow10[-exp10] : pow(10.0, -exp10);
+	else if(exp10 > 0)
+		value *= (exp10 <= 22) ? pow10[exp10] : pow(10.0, exp10);
+
+	*out = neg ? -value : value;
+	return p;
+}
+
+/* store triangle n of the fan of a face whose vertices so far are first,
+ * prev and v */
+static void fan_triangle(mesh_t *mesh, unsigned int triangle,
+			unsigned int first, unsigned int prev, unsigned int v)
+{
+	unsigned int	*tri = &mesh->index[triangle * 3];
+
+	tri[0] = first;
+	tri[1] = prev;
+	tri[2] = v;
+}
+
+/* task - one pass over the v and f lines of an OBJ chunk */
+static void obj_chunk(scheduler_t *sched, unsigned int worker, void *data)
+{
+	meshfile_chunk_t	*c = (meshfile_chunk_t *)data;
+	mesh_t			*mesh = c->file->mesh;
+	const char		*p = c->begin;
+	const char		*line;
+	unsigned int		nVertices = 0;
+	unsigned int		nTriangles = 0;
+	unsigned int		n;
+	unsigned int		k;
+	unsigned int		v = 0;
+	unsigned int		first = 0;
+	unsigned int		prev = 0;
+	double			f[3];
+	double			index;
+
+	for(; p < c->end; p = next_line(p, c->end))
+	{
+		line = p = skip_blank(p, c->end);
+		if(c->end - p > 1 && *p == 'v' && is_blank(p[1]))
+		{
+			if(c->fill)
+			{
+				for(++p, k = 0; k < 3; ++k)
+				{
+					p = read_number(skip_blank(p, c->end), c->end, &f[k]);
+					if(!p)
+					{
+						chunk_error(c, line, "bad vertex");
+						return;
+					}
+				}
+				v = c->vertexBase + nVertices;
+				mesh->vx[v] = (float)f[0];
+				mesh->vy[v] = (float)f[1];
+				mesh->vz[v] = (float)f[2];
+			}
+			++nVertices;
+		}
+		else if(c->end - p > 1 && *p == 'f' && is_blank(p[1]))
+		{
+			for(++p, n = 0;; ++n)
+			{
+				p = skip_blank(p, c->end);
+				if(p >= c->end || *p == '\n' || *p == '#')
+					break;
+				if(c->fill)
+				{	/* 1 is the first vertex, -1 the last one so far */
+					if(!read_number(p, c->end, &index))
+						index = -1.0;
+					else if(index < 0.0)
+						index += c->vertexBase + nVertices;
+					else
+						index -= 1.0;
+					if(index < 0.0 || index >= mesh->nVertices ||
+						index != floor(index))
+					{
+						chunk_error(c, line, "face uses a missing vertex");
+						return;
+					}
+					v = (unsigned int)index;
+					if(n == 0)
+						first = v;
+					else if(n >= 2)
+						fan_triangle(mesh, c->triangleBase + nTriangles + n - 2,
+							first, prev, v);
+					prev = v;
+				}
+				/* texture and normal indices are not used */
+				while(p < c->end && !is_blank(*p) && *p != '\n')
+					++p;
+			}
+			if(n >= 3)
+				nTriangles += n - 2;
+		}
+	}
+
+	c->nVertices = nVertices;
+	c->nTriangles = nTriangles;
+}
+
+/* task - count the lines of an ascii PLY chunk */
+static void ply_lines_chunk(scheduler_t *sched, unsigned int worker,
+			void *data)
+{
+	meshfile_chunk_t	*c = (meshfile_chunk_t *)data;
+	const char		*p = c->begin;
+
+	for(c->nLines = 0; p < c->end; ++c->nLines)
+	{
+		p = next_line(p, c->end);
+	}
+}
+
+/* task - one pass over the vertex and face records of an ascii PLY
+ * chunk, one record per line */
+static void ply_ascii_chunk(scheduler_t *sched, unsigned int worker,
+			void *data)
+{
+	meshfile_chunk_t	*c = (meshfile_chunk_t *)data;
+	meshfile_t		*file = c->file;
+	mesh_t			*mesh = file->mesh;
+	const ply_element_t	*elem;
+	const char		*p = c->begin;
+	const char		*line;
+	const char		*next;
+	size_t			record = c->line;
+	unsigned int		nVertices = 0;
+	unsigned int		nTriangles = 0;
+	unsigned int		i, j, k;
+	unsigned int		len;
+	unsigned int		v = 0;
+	unsigned int		first = 0;
+	unsigned int		prev = 0;
+	float			xyz[3] = { 0.0f, 0.0f, 0.0f };
+	double			f;
+
+	for(; p < c->end; ++record, p = next)
+	{
+		line = p;
+		next = next_line(p, c->end);
+		if(record - file->vertexStart < file->vertex->count)
+			elem = file->vertex;
+		else if(record - file->faceStart < file->face->count)
+			elem = file->face;
+		else
+			continue;
+		if(elem == file->vertex && !c->fill)
+		{
+			++nVertices;
+			continue;
+		}
+
+		for(i = 0; i < elem->nProperties; ++i)
+		{
+			len = 1;
+			if(elem->properties[i].list)
+			{
+				p = read_number(skip_blank(p, next), next, &f);
+				if(!p || f < 0.0)
+				{
+					chunk_error(c, line, "bad list length");
+					return;
+				}
+				len = (unsigned int)f;
+			}
+			for(j = 0; j < len; ++j)
+			{
+				p = read_number(skip_blank(p, next), next, &f);
+				if(!p)
+				{
+					chunk_error(c, line, "record is missing a value");
+					return;
+				}
+				if(elem == file->vertex)
+				{
+					for(k = 0; k < 3; ++k)
+					{
+						if((int)i == file->xyz[k])
+							xyz[k] = (float)f;
+					}
+				}
+				else if((int)i == file->indices && c->fill)
+				{
+					if(f < 0.0 || f >= mesh->nVertices)
+					{
+						chunk_error(c, line, "face uses a missing vertex");
+						return;
+					}
+					v = (unsigned int)f;
+					if(j == 0)
+						first = v;
+					else if(j >= 2)
+						fan_triangle(mesh, c->triangleBase + nTriangles + j - 2,
+							first, prev, v);
+					prev = v;
+				}
+			}
+			if(elem == file->face && (int)i == file->indices && len >= 3)
+				nTriangles += len - 2;
+		}
+
+		if(elem == file->vertex)
+		{
+			v = c->vertexBase + nVertices++;
+			mesh->vx[v] = xyz[0];
+			mesh->vy[v] = xyz[1];
+			mesh->vz[v] = xyz[2];
+		}
+	}
+
+	c->nVertices = nVertices;
+	c->nTriangles = nTriangles;
+}
+
+/* read one binary PLY value */
+static double ply_read(const unsigned char *p, unsigned int type, int swap)
+{
+	union
+	{
+		signed char	i8;
+		unsigned char	u8;
+		short		i16;
+		unsigned short	u16;
+		int		i32;
+		unsigned int	u32;
+		float		f32;
+		double		f64;
+		unsigned char	bytes[8];
+	}		value;
+	unsigned int	size = ply_type_sizes[type];
+	unsigned int	i = 0;
+
+	if(swap)
+	{
+		for(; i < size; ++i)
+		{
+			value.bytes[i] = p[size - 1 - i];
+		}
+	}
+	else
+	{
+		memcpy(value.bytes, p, size);
+	}
+
+	switch(type)
+	{
+	case PLY_INT8:		return value.i8;
+	case PLY_UINT8:		return value.u8;
+	case PLY_INT16:		return value.i16;
+	case PLY_UINT16:	return value.u16;
+	case PLY_INT32:		return value.i32;
+	case PLY_UINT32:	return value.u32;
+	case PLY_FLOAT32:	return value.f32;
+	default:		return value.f64;
+	}
+}
+
+/* task - one pass over the records of a binary PLY vertex chunk */
+static void ply_vertex_chunk(scheduler_t *sched, unsigned int worker,
+			void *data)
+{
+	meshfile_chunk_t	*c = (meshfile_chunk_t *)data;
+	meshfile_t		*file = c->file;
+	mesh_t			*mesh = file->mesh;
+	const ply_property_t	*x = &file->vertex->properties[file->xyz[0]];
+	const ply_property_t	*y = &file->vertex->properties[file->xyz[1]];
+	const ply_property_t	*z = &file->vertex->properties[file->xyz[2]];
+	const unsigned char	*rec = (const unsigned char *)c->begin;
+	size_t			r = 0;
+	unsigned int		v;
+
+	c->nVertices = (unsigned int)c->nRecords;
+	if(!c->fill)
+		return;
+
+	for(; r < c->nRecords; ++r, rec += file->vertex->size)
+	{
+		v = c->vertexBase + (unsigned int)r;
+		mesh->vx[v] = (float)ply_read(rec + x->offset, x->type, file->swap);
+		mesh->vy[v] = (float)ply_read(rec + y->offset, y->type, file->swap);
+		mesh->vz[v] = (float)ply_read(rec + z->offset, z->type, file->swap);
+	}
+}
+
+/* task - one pass over the records of a binary PLY face chunk */
+static void ply_face_chunk(scheduler_t *sched, unsigned int worker,
+			void *data)
+{
+	meshfile_chunk_t	*c = (meshfile_chunk_t *)data;
+	meshfile_t		*file = c->file;
+	mesh_t			*mesh = file->mesh;
+	const ply_property_t	*prop;
+	const unsigned char	*data8 = (const unsigned char *)file->data;
+	size_t			pos = c->begin - file->data;
+	size_t			r = 0;
+	size_t			size;
+	unsigned int		nTriangles = 0;
+	unsigned int		i, j;
+	unsigned int		len;
+	unsigned int		v = 0;
+	unsigned int		first = 0;
+	unsigned int		prev = 0;
+	double			f;
+
+	for(; r < c->nRecords; ++r)
+	{
+		for(i = 0; i < file->face->nProperties; ++i)
+		{
+			prop = &file->face->properties[i];
+			size = ply_type_sizes[prop->type];
+			len = 1;
+			if(prop->list)
+			{
+				if(file->size - pos < ply_type_sizes[prop->countType])
+				{
+					chunk_error(c, 0, "file is truncated");
+					return;
+				}
+				f = ply_read(data8 + pos, prop->countType, file->swap);
+				pos += ply_type_sizes[prop->countType];
+				if(f < 0.0)
+				{
+					chunk_error(c, 0, "bad list length");
+					return;
+				}
+				len = (unsigned int)f;
+			}
+			if((file->size - pos) / size < len)
+			{
+				chunk_error(c, 0, "file is truncated");
+				return;
+			}
+
+			if((int)i == file->indices)
+			{
+				if(c->fixed && len != 3)
+				{	/* records are not where they were assumed to be */
+					c->mixed = 1;
+					return;
+				}
+				for(j = 0; c->fill && j < len; ++j)
+				{
+					f = ply_read(data8 + pos + j * size, prop->type,
+						file->swap);
+					if(f < 0.0 || f >= mesh->nVertices)
+					{
+						chunk_error(c, 0, "face uses a missing vertex");
+						return;
+					}
+					v = (unsigned int)f;
+					if(j == 0)
+						first = v;
+					else if(j >= 2)
+						fan_triangle(mesh, c->triangleBase + nTriangles + j - 2,
+							first, prev, v);
+					prev = v;
+				}
+				if(len >= 3)
+					nTriangles += len - 2;
+			}
+			pos += len * size;
+		}
+	}
+
+	c->nTriangles = nTriangles;
+}
+
+/* compare a word of a header line against a keyword */
+static int word_is(const char *word, unsigned int len, const char *s)
+{
+	return strlen(s) == len && !memcmp(word, s, len);
+}
+
+/* split a header line into at most max words, returns how many */
+static unsigned int ply_words(const char *p, const char *end,
+			const char **word, unsigned int *len, unsigned int max)
+{
+	unsigned int	n = 0;
+
+	for(;;)
+	{
+		p = skip_blank(p, end);
+		if(p >= end || n == max)
+			return n;
+		word[n] = p;
+		while(p < end && !is_blank(*p))
+			++p;
+		len[n] = (unsigned int)(p - word[n]);
+		++n;
+	}
+}
+
+/* PLY_* type of a name, -1 if it is none */
+static int ply_type(const char *word, unsigned int len)
+{
+	int	i = 0;
+
+	for(; i < (int)(sizeof(ply_type_names) / sizeof(ply_type_names[0])); ++i)
+	{
+		if(word_is(word, len, ply_type_names[i]) ||
+			word_is(word, len, ply_type_sized_names[i]))
+			return i;
+	}
+	return -1;
+}
+
+/* read the header of a PLY file and work out where the vertex and face
+ * records are.  Returns an error message, 0 if it is fine */
+static const char* ply_header(meshfile_t *file)
+{
+	static const unsigned int	order = 1;
+	static const char		*axes[] = { "x", "y", "z" };
+	const char			*end = file->data + file->size;
+	const char			*p = next_line(file->data, end);
+	const char			*eol;
+	const char			*word[6];
+	unsigned int			len[6];
+	unsigned int			n;
+	unsigned int			i, k;
+	ply_element_t			*elem = 0;
+	ply_property_t			*prop;
+	int				type, countType;
+	int				littleEndian = *(const unsigned char *)&order;
+	size_t				pos;
+	double				f;
+
+	file->xyz[0] = file->xyz[1] = file->xyz[2] = -1;
+	file->indices = -1;
+	for(;; p = eol)
+	{
+		if(p >= end)
+			return "header has no end_header";
+		eol = next_line(p, end);
+		n = ply_words(p, eol - (eol[-1] == '\n'), word, len, 6);
+		if(!n)
+			continue;
+
+		if(word_is(word[0], len[0], "end_header"))
+		{
+			file->body = eol;
+			break;
+		}
+		else if(word_is(word[0], len[0], "format") && n >= 2)
+		{
+			if(word_is(word[1], len[1], "ascii"))
+				file->binary = 0;
+			else if(word_is(word[1], len[1], "binary_little_endian"))
+				file->binary = 1, file->swap = !littleEndian;
+			else if(word_is(word[1], len[1], "binary_big_endian"))
+				file->binary = 1, file->swap = littleEndian;
+			else
+				return "unknown format";
+		}
+		else if(word_is(word[0], len[0], "element") && n >= 3)
+		{
+			if(file->nElements == PLY_MAX_ELEMENTS)
+				return "too many elements";
+			elem = &file->elements[file->nElements++];
+			memset(elem, 0, sizeof(ply_element_t));
+			memcpy(elem->name, word[1], len[1] < sizeof(elem->name) ?
+				len[1] : sizeof(elem->name) - 1);
+			if(!read_number(word[2], word[2] + len[2], &f) || f < 0.0)
+				return "bad element count";
+			elem->count = (size_t)f;
+		}
+		else if(word_is(word[0], len[0], "property") && n >= 3)
+		{
+			if(!elem)
+				return "property outside of an element";
+			if(elem->nProperties == PLY_MAX_PROPERTIES)
+				return "too many properties";
+			prop = &elem->properties[elem->nProperties];
+			if(word_is(word[1], len[1], "list") && n >= 5)
+			{
+				countType = ply_type(word[2], len[2]);
+				type = ply_type(word[3], len[3]);
+				if(countType < 0 || type < 0 || countType >= PLY_FLOAT32)
+					return "unknown property type";
+				prop->list = 1;
+				prop->countType = countType;
+				prop->type = type;
+				if(!strcmp(elem->name, "face") &&
+					(word_is(word[4], len[4], "vertex_indices") ||
+					word_is(word[4], len[4], "vertex_index")))
+					file->indices = elem->nProperties;
+			}
+			else
+			{
+				type = ply_type(word[1], len[1]);
+				if(type < 0)
+					return "unknown property type";
+				prop->type = type;
+				for(k = 0; k < 3; ++k)
+				{
+					if(!strcmp(elem->name, "vertex") &&
+						word_is(word[2], len[2], axes[k]))
+						file->xyz[k] = elem->nProperties;
+				}
+			}
+			++elem->nProperties;
+		}
+	}
+
+	for(i = 0; i < file->nElements; ++i)
+	{
+		elem = &file->elements[i];
+		if(!strcmp(elem->name, "vertex"))
+			file->vertex = elem;
+		else if(!strcmp(elem->name, "face"))
+			file->face = elem;
+
+		/* binary record size and where every property sits in it */
+		for(k = 0; k < elem->nProperties; ++k)
+		{
+			prop = &elem->properties[k];
+			prop->offset = elem->size;
+			elem->size += ply_type_sizes[prop->type];
+		}
+		for(k = 0; k < elem->nProperties; ++k)
+		{
+			if(elem->properties[k].list)
+				elem->size = 0;
+		}
+	}
+	if(!file->vertex || file->xyz[0] < 0 || file->xyz[1] < 0 ||
+		file->xyz[2] < 0)
+		return "vertices have no x, y and z";
+	if(!file->face || file->indices < 0)
+		return "faces have no vertex_indices";
+	if(file->vertex->count > 0xffffffffu)
+		return "too many vertices";
+
+	/* first record of each - elements are stored one after another */
+	pos = file->binary ? (size_t)(file->body - file->data) : 0;
+	for(i = 0; i < file->nElements; ++i)
+	{
+		elem = &file->elements[i];
+		if(elem == file->vertex)
+			file->vertexStart = pos;
+		else if(elem == file->face)
+			file->faceStart = pos;
+
+		if(!file->binary)
+		{
+			pos += elem->count;
+		}
+		else if(elem->size)
+		{
+			if((file->size - pos) / elem->size < elem->count)
+				return "file is truncated";
+			pos += elem->count * elem->size;
+		}
+		else if(elem == file->face && file->vertexStart)
+		{	/* faces are found one at a time from here on */
+			break;
+		}
+		else
+		{
+			return "elements with lists must come after the vertices "
+				"and faces";
+		}
+	}
+
+	/* a binary triangle record, if every list is the vertex indices */
+	if(file->binary)
+	{
+		prop = &file->face->properties[file->indices];
+		file->faceSize = ply_type_sizes[prop->countType] +
+			3 * ply_type_sizes[prop->type];
+		for(k = 0; k < file->face->nProperties; ++k)
+		{
+			prop = &file->face->properties[k];
+			if(!prop->list)
+				file->faceSize += ply_type_sizes[prop->type];
+			else if((int)k != file->indices)
+				file->faceSize = 0;
+		}
+		if(file->faceSize &&
+			(file->size - file->faceStart) / file->faceSize <
+				file->face->count)
+			file->faceSize = 0;
+	}
+
+	return 0;
+}
+
+/* cut a file into chunks, returns how many */
+static unsigned int meshfile_chunks(meshfile_t *file,
+				meshfile_chunk_t **chunksOut)
+{
+	meshfile_chunk_t	*chunks;
+	meshfile_chunk_t	*c;
+	const char		*end = file->data + file->size;
+	const char		*p = file->body;
+	unsigned int		nChunks = 0;
+	unsigned int		maxChunks;
+	size_t			nVertex, nFace;
+	size_t			r;
+
+	if(!file->binary)
+	{	/* at line starts roughly MESHFILE_CHUNK_SIZE apart */
+		maxChunks = (unsigned int)((end - p) / MESHFILE_CHUNK_SIZE) + 1;
+		chunks = calloc(maxChunks, sizeof(meshfile_chunk_t));
+		do
+		{
+			c = &chunks[nChunks++];
+			c->parse = file->ply ? ply_ascii_chunk : obj_chunk;
+			c->begin = p;
+			c->end = (size_t)(end - p) <= MESHFILE_CHUNK_SIZE ? end :
+				next_line(p + MESHFILE_CHUNK_SIZE, end);
+			p = c->end;
+		} while(p < end);
+	}
+	else
+	{	/* runs of records - a single chunk for faces of any size */
+		nVertex = (file->vertex->count + MESHFILE_CHUNK_RECORDS - 1) /
+			MESHFILE_CHUNK_RECORDS;
+		nFace = file->faceSize ? (file->face->count +
+			MESHFILE_CHUNK_RECORDS - 1) / MESHFILE_CHUNK_RECORDS : 1;
+		chunks = calloc(nVertex + nFace, sizeof(meshfile_chunk_t));
+		for(r = 0; r < file->vertex->count; r += MESHFILE_CHUNK_RECORDS)
+		{
+			c = &chunks[nChunks++];
+			c->parse = ply_vertex_chunk;
+			c->begin = file->data + file->vertexStart +
+				r * file->vertex->size;
+			c->nRecords = file->vertex->count - r < MESHFILE_CHUNK_RECORDS ?
+				file->vertex->count - r : MESHFILE_CHUNK_RECORDS;
+		}
+		r = 0;
+		do
+		{
+			c = &chunks[nChunks++];
+			c->parse = ply_face_chunk;
+			c->fixed = file->faceSize != 0;
+			c->begin = file->data + file->faceStart + r * file->faceSize;
+			c->nRecords = !c->fixed ? file->face->count :
+				file->face->count - r < MESHFILE_CHUNK_RECORDS ?
+				file->face->count - r : MESHFILE_CHUNK_RECORDS;
+			r += c->nRecords;
+		} while(r < file->face->count);
+	}
+
+	for(r = 0; r < nChunks; ++r)
+	{
+		chunks[r].file = file;
+	}
+	*chunksOut = chunks;
+	return nChunks;
+}
+
+/* run a pass over every chunk - on every cpu if there is a scheduler */
+static void meshfile_run(scheduler_t *sched, meshfile_chunk_t *chunks,
+			unsigned int nChunks)
+{
+	unsigned int	i = 0;
+
+	if(!sched)
+	{
+		for(; i < nChunks; ++i)
+		{
+			chunks[i].parse(0, 0, &chunks[i]);
+		}
+		return;
+	}
+
+	for(; i < nChunks; ++i)
+	{
+		scheduler_push(sched, i % sched->nWorkers, chunks[i].parse,
+			&chunks[i]);
+	}
+	scheduler_run(sched);
+}
+
+/* first error in the file, 0 if there is none */
+static const meshfile_chunk_t* meshfile_error(const meshfile_chunk_t *chunks,
+					unsigned int nChunks)
+{
+	unsigned int	i = 0;
+
+	for(; i < nChunks; ++i)
+	{
+		if(chunks[i].error)
+			return &chunks[i];
+	}
+	return 0;
+}
+
+/* map a whole file into memory (read it on systems without mmap) */
+static const char* meshfile_map(const char *filename, size_t *size)
+{
+#if defined(_WIN32)
+	FILE	*fp = fopen(filename, "rb");
+	char	*data;
+
+	if(!fp)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(*size ? *size : 1);
+	*size = fread(data, 1, *size, fp);
+	fclose(fp);
+	return data;
+#else
+	struct stat	st;
+	void		*data;
+	int		fd = open(filename, O_RDONLY);
+
+	if(fd < 0)
+		return 0;
+	if(fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return 0;
+	}
+	*size = st.st_size;
+	if(*size == 0)
+	{	/* nothing to map - hand back any valid pointer */
+		close(fd);
+		return "";
+	}
+	data = mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return data == MAP_FAILED ? 0 : data;
+#endif
+}
+
+/* undo meshfile_map() */
+static void meshfile_unmap(const char *data, size_t size)
+{
+#if defined(_WIN32)
+	free((void *)data);
+#else
+	if(size)
+		munmap((void *)data, size);
+#endif
+}
+
+/* load the vertices and triangles of an OBJ or PLY file into a mesh */
+int meshfile_load(const char *filename, mesh_t *mesh)
+{
+	meshfile_t		file;
+	meshfile_chunk_t	*chunks = 0;
+	meshfile_chunk_t	*c;
+	const meshfile_chunk_t	*bad;
+	const char		*error = 0;
+	const char		*p;
+	scheduler_t		*sched = 0;
+	unsigned int		nChunks = 0;
+	unsigned int		i = 0;
+	unsigned int		line;
+	size_t			nVertices = 0;
+	size_t			nTriangles = 0;
+
+	memset(&file, 0, sizeof(meshfile_t));
+	memset(mesh, 0, sizeof(mesh_t));
+	file.mesh = mesh;
+	file.data = meshfile_map(filename, &file.size);
+	if(!file.data)
+	{
+		printf("Error opening file {%s} for reading.\n", filename);
+		return 0;
+	}
+
+	file.body = file.data;
+	file.ply = file.size >= 4 && !memcmp(file.data, "ply", 3) &&
+		(file.data[3] == '\n' || file.data[3] == '\r');
+	if(file.ply)
+		error = ply_header(&file);
+
+	if(!error)
+	{
+		nChunks = meshfile_chunks(&file, &chunks);
+		if(nChunks > 1)
+			sched = scheduler_create(0);
+
+		/* ascii PLY records are told apart by their line */
+		if(file.ply && !file.binary)
+		{
+			for(i = 0; i < nChunks; ++i)
+			{
+				chunks[i].parse = ply_lines_chunk;
+			}
+			meshfile_run(sched, chunks, nChunks);
+			for(i = 0; i < nChunks; ++i)
+			{
+				chunks[i].parse = ply_ascii_chunk;
+				if(i)
+					chunks[i].line = chunks[i - 1].line + chunks[i - 1].nLines;
+			}
+		}
+
+		meshfile_run(sched, chunks, nChunks);
+
+		/* faces were not all triangles after all - find them one by one */
+		for(i = 0; file.binary && i < nChunks; ++i)
+		{
+			if(chunks[i].mixed)
+			{
+				c = &chunks[nChunks - 1];
+				while(c > chunks && c[-1].parse == ply_face_chunk)
+					--c;
+				c->fixed = 0;
+				c->mixed = 0;
+				c->nRecords = file.face->count;
+				nChunks = (unsigned int)(c - chunks) + 1;
+				c->parse(0, 0, c);
+				break;
+			}
+		}
+
+		/* place every chunk in the mesh */
+		for(i = 0; i < nChunks; ++i)
+		{
+			chunks[i].vertexBase = (unsigned int)nVertices;
+			chunks[i].triangleBase = (unsigned int)nTriangles;
+			nVertices += chunks[i].nVertices;
+			nTriangles += chunks[i].nTriangles;
+		}
+		if(nVertices > 0xffffffffu || nTriangles > 0xffffffffu / 3)
+			error = "mesh is too big";
+		else if(!nTriangles && !meshfile_error(chunks, nChunks))
+			error = "mesh has no triangles";
+	}
+
+	if(!error && !meshfile_error(chunks, nChunks))
+	{
+		mesh_init(mesh, (unsigned int)nVertices, (unsigned int)nTriangles);
+		for(i = 0; i < nChunks; ++i)
+		{
+			chunks[i].fill = 1;
+		}
+		meshfile_run(sched, chunks, nChunks);
+	}
+
+	bad = meshfile_error(chunks, nChunks);
+	if(bad && bad->errorPos)
+	{	/* text files get the line too */
+		for(line = 1, p = file.data;
+			(p = memchr(p, '\n', bad->errorPos - p)) != 0; ++p)
+		{
+			++line;
+		}
+		printf("Error loading {%s} line %d: %s.\n", filename, line, bad->error);
+	}
+	else if(bad || error)
+	{
+		printf("Error loading {%s}: %s.\n", filename,
+			bad ? bad->error : error);
+	}
+	else
+	{
+		printf("Loaded {%s}:\t%u vertices, %u triangles (%u chunks)\n",
+			filename, mesh->nVertices, mesh->nTriangles, nChunks);
+	}
+
+	if(bad || error)
+		mesh_free(mesh);
+	free(chunks);
+	if(sched)
+		scheduler_free(sched);
+	meshfile_unmap(file.data, file.size);
+
+	return !bad && !error;
+}
@@ -0,0 +1,34 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 16, 2008
+ * meshfile.h
+ *
+ * This file contains the definition for loading triangle meshes from
+ * Wavefront OBJ and PLY files.  A file is mapped into memory and cut into
+ * chunks that are parsed on every cpu in two passes: the first counts the
+ * vertices and triangles of each chunk, which places every chunk in the
+ * mesh buffers, so they are allocated once at their final size and the
+ * second pass writes each chunk straight into its own part of them.
+ * Faces with more than 3 vertices are split into a fan of triangles.
+ *
+ * OBJ	- only v and f lines are read.  Texture and normal indices of a
+ *	  face are ignored, negative indices count back from the last
+ *	  vertex
+ * PLY	- ascii or binary in either byte order.  x, y, z of the vertex
+ *	  element and the vertex_indices list of the face element are
+ *	  read as any scalar type, everything else is skipped
+ */
+
+#ifndef _MESHFILE_H_
+#define _MESHFILE_H_
+
+#include "geometry.h"
+
+/* load the vertices and triangles of an OBJ or PLY file (told apart by
+ * the PLY magic number) into a mesh.  mesh_prepare() still has to be
+ * called on it.  Prints an error and returns 0 if the file cannot be
+ * loaded */
+int meshfile_load(const char *filename, mesh_t *mesh);
+
+#endif
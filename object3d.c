@@ -8,12 +8,14 @@
  * with objects in the ray tracing project.
  */
 
+#include <float.h>
 #include <math.h>
 #include "object3d.h"
+#include "mesh.h"
 
 /* gets the normal of an object at a specified point */
 vector4_t* get_object_normal(vector4_t *vecout, const object3d_t *obj,
-							 const point_t *pt)
+					unsigned int prim, const point_t *pt)
 {
 	switch(obj->geometryType)
 	{
@@ -21,6 +23,8 @@ vector4_t* get_object_normal(vector4_t *vecout, const object3d_t *obj,
 			return get_sphere_normal(vecout, &obj->sphr_obj, pt);
 		case GEOMETRY_POLYGON:
 			return get_polygon_normal(vecout, &obj->poly_obj, pt);
+		case GEOMETRY_TRIANGLE_MESH:
+			return get_mesh_normal(vecout, &obj->mesh_obj, prim);
 		default:
 			return vecout;
 	}
@@ -62,7 +66,7 @@ int get_col_pos(const sphere_t *sphere, const point_t *pt, int nSlices)
 /* note: not exactly the way I'd like to do this, but it seems to be
  * the cleanest approach at this point */
 color_t* get_object_color(color_t *colorout, const object3d_t *obj,
-							const point_t *pt)
+					unsigned int prim, const point_t *pt)
 {
 	point_t proj;
 	int nTilesX = 11;
@@ -75,8 +79,9 @@ color_t* get_object_color(color_t *colorout, const object3d_t *obj,
 	switch(obj->geometryType)
 	{
 		case GEOMETRY_SPHERE:
-			color_copy(colorout,
-				&obj->material.colors[MATERIAL_DIFFUSECOLOR]);
+		case GEOMETRY_TRIANGLE_MESH:
+			/* every triangle of a mesh shares its material */
+			*colorout = obj->material.colors[MATERIAL_DIFFUSECOLOR];
 /*
 			if(get_row_pos(&obj->sphr_obj, pt, nStacks)%2)
 			{
@@ -102,20 +107,71 @@ color_t* get_object_color(color_t *colorout, const object3d_t *obj,
 			ytile = nTilesY * proj.y;
 			if( (xtile%2) == (ytile%2) )
 			{
-				color_init(colorout);
-				colorout->r  = 1.0f;
+				*colorout = colorv_make(1.0f, 0.0f, 0.0f);
 			}
 			else
 			{
-				color_init(colorout);
-				colorout->r = 1.0f;
-				colorout->g = 1.0f;
+				*colorout = colorv_make(1.0f, 1.0f, 0.0f);
 			}
 			break;
 	}
 	return colorout;
 }
 
+/* gets the bounding box of an object */
+aabb_t* get_object_bounds(aabb_t *boxout, const object3d_t *obj)
+{
+	switch(obj->geometryType)
+	{
+		case GEOMETRY_SPHERE:
+			return get_sphere_bounds(boxout, &obj->sphr_obj);
+		case GEOMETRY_POLYGON:
+			return get_polygon_bounds(boxout, &obj->poly_obj);
+		case GEOMETRY_TRIANGLE_MESH:
+			return get_mesh_bounds(boxout, &obj->mesh_obj);
+		default:
+			return aabb_init(boxout);
+	}
+}
 
+/* returns intersection of ray with any object type */
+/* two output parameters - v and distance
+ * p - point of intersection
+ * distance - distance to intersection point from origin of ray */
+int ray_intersect_object(const ray_t* ray, const object3d_t *obj,
+						 point_t *p, float *distance)
+{
+	switch(obj->geometryType)
+	{
+		case GEOMETRY_POLYGON:
+			return ray_intersect_polygon(ray, &obj->poly_obj, p, distance);
+		case GEOMETRY_SPHERE:
+			return ray_intersect_sphere(ray, &obj->sphr_obj, p, distance);
+		case GEOMETRY_TRIANGLE_MESH:
+			*distance = FLT_MAX;
+			if(ray_hit_mesh(ray, &obj->mesh_obj, distance, 0) == ~0u)
+				return 0;
+			*p = vec4v_madd(ray->origin, ray->direction, *distance);
+			return 1;
+		default:
+			return 0;
+	};
+}
 
-
+/* returns intersection of ray with any object type without computing
+ * the point of intersection */
+int ray_hit_object(const ray_t* ray, const object3d_t *obj, float *distance)
+{
+	switch(obj->geometryType)
+	{
+		case GEOMETRY_POLYGON:
+			return ray_hit_polygon(ray, &obj->poly_obj, distance);
+		case GEOMETRY_SPHERE:
+			return ray_hit_sphere(ray, &obj->sphr_obj, distance);
+		case GEOMETRY_TRIANGLE_MESH:
+			*distance = FLT_MAX;
+			return ray_hit_mesh(ray, &obj->mesh_obj, distance, 0) != ~0u;
+		default:
+			return 0;
+	};
+}
@@ -13,6 +13,7 @@
 
 #include "geometry.h"
 #include "materials.h"
+#include "ray.h"
 
 typedef struct
 {
@@ -27,6 +28,7 @@ typedef struct
 	{
 		sphere_t 		sphr_obj;
 		polygon_t	 	poly_obj;
+		mesh_t			mesh_obj;
 	};
 #if defined(__PPU__) || defined(__SPU__)
 } object3d_t __attribute__(( aligned(16) ));
@@ -34,14 +36,26 @@ typedef struct
 } object3d_t;
 #endif
 
-/* gets the normal of an object at a specified point */
+/* gets the normal of an object at a specified point.  prim is the part
+ * of the object that was hit - the triangle of a mesh, ignored otherwise */
 vector4_t* get_object_normal(vector4_t *vecout, const object3d_t *obj,
-							 const point_t *pt);
-/* gets the color of an object at a specified point */
+					unsigned int prim, const point_t *pt);
+/* gets the color of an object at a specified point (prim as above) */
 /* note: not exactly the way I'd like to do this, but it seems to be
  * the cleanest approach at this point */
 color_t* get_object_color(color_t *colorout, const object3d_t *obj,
-							const point_t *pt);
+					unsigned int prim, const point_t *pt);
+
+/* gets the bounding box of an object */
+aabb_t* get_object_bounds(aabb_t *boxout, const object3d_t *obj);
+
+/* returns intersection of ray with any object type */
+int ray_intersect_object(const ray_t* ray, const object3d_t *obj,
+						 point_t *p, float *distance);
+
+/* returns intersection of ray with any object type without computing
+ * the point of intersection */
+int ray_hit_object(const ray_t* ray, const object3d_t *obj, float *distance);
 
 #endif
 
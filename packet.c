@@ -0,0 +1,390 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 4, 2008
+ * packet.c
+ *
+ * This file contains the definitions for tracing packets of coherent rays.
+ * Lanes of a packet that are still interested in a node are tracked with a
+ * bit mask (bit i = ray i) so a ray only ever tests the nodes and objects
+ * it would have reached when traced on its own.
+ */
+
+#include <float.h>
+#include "packet.h"
+#include "bvh.h"
+#include "cscene.h"
+#include "mesh.h"
+
+/* slack given to the frustum test to absorb rounding in the corner rays */
+#define PACKET_FRUSTUM_EPSILON	0.00001f
+
+/* node waiting to be visited along with the rays interested in it */
+typedef struct
+{
+	unsigned int	node;
+	unsigned int	mask;
+} packet_entry_t;
+
+/* set up a packet from a block of rays stored row by row */
+packet_t* packet_init(packet_t *packet, const ray_t *rays,
+		unsigned int width, unsigned int height, const vector4_t *corners)
+{
+	unsigned int	n = width * height;
+	unsigned int	i = 0;
+	unsigned int	k;
+	vector4_t	corner[4];
+	float		mag;
+
+	packet->nRays = n;
+	packet->origin = rays[0].origin;
+
+	/* unused lanes repeat the last ray so every lane holds sane values */
+	for(; i < PACKET_SIZE; ++i)
+	{
+		k = i < n ? i : n - 1;
+		packet->dx[i] = rays[k].direction.x;
+		packet->dy[i] = rays[k].direction.y;
+		packet->dz[i] = rays[k].direction.z;
+		packet->ix[i] = 1.0f / rays[k].direction.x;
+		packet->iy[i] = 1.0f / rays[k].direction.y;
+		packet->iz[i] = 1.0f / rays[k].direction.z;
+		packet->t[i] = FLT_MAX;
+		packet->hit[i] = -1;
+		packet->prim[i] = 0;
+	}
+
+	/* corner rays in order around the block */
+	if(corners)
+	{
+		for(i = 0; i < 4; ++i)
+			corner[i] = corners[i];
+	}
+	else
+	{
+		corner[0] = rays[0].direction;
+		corner[1] = rays[width - 1].direction;
+		corner[2] = rays[n - 1].direction;
+		corner[3] = rays[n - width].direction;
+	}
+	packet->center = vec4v_normalize(vec4v_add(
+		vec4v_add(corner[0], corner[1]), vec4v_add(corner[2], corner[3])));
+
+	/* side planes through neighboring corners, facing the center ray.
+	 * A block that is a single row or column gives a degenerate plane
+	 * which is left zero so it never rejects anything */
+	for(i = 0; i < 4; ++i)
+	{
+		packet->frustum[i] = vec4v_cross(corner[i], corner[(i + 1) % 4]);
+		mag = vec4v_magnitude(packet->frustum[i]);
+		if(mag < 0.000001f)
+		{
+			packet->frustum[i] = vec4v_make(0.0f, 0.0f, 0.0f, 0.0f);
+			continue;
+		}
+		packet->frustum[i] = vec4v_scale(packet->frustum[i], 1.0f / mag);
+		if(vec4v_dot(packet->frustum[i], packet->center) < 0.0f)
+			packet->frustum[i] = vec4v_scale(packet->frustum[i], -1.0f);
+	}
+
+	return packet;
+}
+
+/* tests if a box lies completely outside of one of the packet planes */
+static int packet_frustum_reject(const packet_t *packet, const aabb_t *box)
+{
+	unsigned int	i = 0;
+	const float	*n;
+	float		p[3];
+	float		dist;
+
+	for(; i < 4; ++i)
+	{
+		n = packet->frustum[i].c;
+		/* corner of the box furthest along the plane normal */
+		p[0] = (n[0] > 0.0f ? box->max[0] : box->min[0]) - packet->origin.x;
+		p[1] = (n[1] > 0.0f ? box->max[1] : box->min[1]) - packet->origin.y;
+		p[2] = (n[2] > 0.0f ? box->max[2] : box->min[2]) - packet->origin.z;
+		dist = n[0] * p[0] + n[1] * p[1] + n[2] * p[2];
+		if(dist < -PACKET_FRUSTUM_EPSILON *
+			(fabsf(p[0]) + fabsf(p[1]) + fabsf(p[2]) + 1.0f))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* which rays of the mask enter a box before their nearest hit so far.
+ * Same slab test as ray_intersect_aabb() done 4 rays at a time */
+static unsigned int packet_intersect_aabb(const packet_t *packet,
+		const aabb_t *box, unsigned int mask)
+{
+	const float	*inv[3];
+	simd4f_t	lo[3], hi[3];
+	simd4f_t	tmin, tmax, t0, t1, iv;
+	unsigned int	result = 0;
+	unsigned int	g = 0;
+	unsigned int	i;
+
+	inv[0] = packet->ix;
+	inv[1] = packet->iy;
+	inv[2] = packet->iz;
+	for(i = 0; i < 3; ++i)
+	{
+		lo[i] = simd4_splat(box->min[i] - packet->origin.c[i]);
+		hi[i] = simd4_splat(box->max[i] - packet->origin.c[i]);
+	}
+
+	for(; g < PACKET_GROUPS; ++g)
+	{
+		if(!((mask >> (g * 4)) & 0xF))
+			continue;
+
+		tmin = simd4_splat(0.0f);
+		tmax = simd4_load(&packet->t[g * 4]);
+		for(i = 0; i < 3; ++i)
+		{
+			iv = simd4_load(&inv[i][g * 4]);
+			t0 = simd4_mul(lo[i], iv);
+			t1 = simd4_mul(hi[i], iv);
+			/* min/max pick the second operand on NaN, which leaves
+			 * the interval alone like the single ray test */
+			tmin = simd4_max(simd4_min(t1, t0), tmin);
+			tmax = simd4_min(simd4_max(t0, t1), tmax);
+		}
+		result |= simd4m_bits(simd4m_andnot(simd4m_from_bits(~0u),
+				simd4_cmpgt(tmin, tmax))) << (g * 4);
+	}
+
+	return result & mask;
+}
+
+/* 4 rays against a compiled sphere - same math as ray_hit_sphere() */
+static simd4m_t packet_hit_sphere(const packet_t *packet, unsigned int g,
+		const cscene_t *cs, unsigned int slot, simd4f_t *w)
+{
+	vector4_t	d = vec4v_sub(packet->origin, vec4v_make(cs->sphereX[slot],
+				cs->sphereY[slot], cs->sphereZ[slot], 1.0f));
+	float		C = vec4v_dot(d, d) - (cs->sphereR[slot] * cs->sphereR[slot]);
+	simd4f_t	B, det, sq, wOne, wTwo, zero = simd4_splat(0.0f);
+	simd4f_t	half = simd4_splat(0.5f);
+
+	B = simd4_add(simd4_add(
+		simd4_mul(simd4_load(&packet->dx[g * 4]), simd4_splat(d.x)),
+		simd4_mul(simd4_load(&packet->dy[g * 4]), simd4_splat(d.y))),
+		simd4_mul(simd4_load(&packet->dz[g * 4]), simd4_splat(d.z)));
+	B = simd4_add(B, B);
+	det = simd4_sub(simd4_mul(B, B), simd4_splat(4.0f * C));
+	sq = simd4_sqrt(simd4_max(det, zero));
+	wOne = simd4_mul(simd4_sub(simd4_sub(zero, B), sq), half);
+	wTwo = simd4_mul(simd4_add(simd4_sub(zero, B), sq), half);
+
+	/* least positive root, 0 if neither is, wOne if they are equal */
+	*w = simd4_select(simd4_cmpgt(wOne, zero), wOne, zero);
+	*w = simd4_select(simd4m_and(simd4_cmpgt(wTwo, zero),
+		simd4_cmplt(wTwo, *w)), wTwo, *w);
+	*w = simd4_select(simd4_cmpeq(det, zero), wOne, *w);
+
+	/* spheres behind the rays give 0, they are no hit */
+	return simd4m_and(simd4m_andnot(simd4m_from_bits(~0u),
+		simd4_cmplt(det, zero)), simd4_cmpgt(*w, zero));
+}
+
+/* 4 rays against a compiled polygon - same math as ray_hit_polygon() */
+static simd4m_t packet_hit_polygon(const packet_t *packet, unsigned int g,
+		const cscene_t *cs, unsigned int slot, simd4f_t *w)
+{
+	const plane_t	*plane = &cs->polyPlane[slot];
+	const cscene_poly_t *info = &cs->polyInfo[slot];
+	const float	*dir[3];
+	const float	*e = &cs->polyEdge[info->firstEdge * 4];
+	const float	*end = e + 4 * info->nEdges;
+	float		num = -1.0f * (
+		simd4_dot3(plane->v, packet->origin.v) + plane->F);
+	simd4f_t	den, u, v, zero = simd4_splat(0.0f);
+	simd4m_t	valid;
+	simd4m_t	inside = simd4m_from_bits(0);
+
+	dir[0] = packet->dx;
+	dir[1] = packet->dy;
+	dir[2] = packet->dz;
+
+	den = simd4_add(simd4_add(
+		simd4_mul(simd4_splat(plane->A), simd4_load(&dir[0][g * 4])),
+		simd4_mul(simd4_splat(plane->B), simd4_load(&dir[1][g * 4]))),
+		simd4_mul(simd4_splat(plane->C), simd4_load(&dir[2][g * 4])));
+	/* parallel rays and planes behind (or through) the origin are
+	 * misses, as everywhere else */
+	valid = simd4m_andnot(simd4m_from_bits(~0u), simd4_cmpeq(den, zero));
+	*w = simd4_div(simd4_splat(num), den);
+	valid = simd4m_and(valid, simd4_cmpgt(*w, zero));
+
+	u = simd4_add(simd4_splat(packet->origin.c[info->axisU]),
+		simd4_mul(*w, simd4_load(&dir[info->axisU][g * 4])));
+	v = simd4_add(simd4_splat(packet->origin.c[info->axisV]),
+		simd4_mul(*w, simd4_load(&dir[info->axisV][g * 4])));
+
+	/* crossing test of poly_contains() */
+	for(; e < end; e += 4)
+	{
+		inside = simd4m_xor(inside, simd4m_and(
+			simd4m_xor(simd4_cmpgt(simd4_splat(e[1]), v),
+				simd4_cmpgt(simd4_splat(e[2]), v)),
+			simd4_cmplt(u, simd4_add(simd4_splat(e[0]),
+				simd4_mul(simd4_sub(v, simd4_splat(e[1])),
+					simd4_splat(e[3]))))));
+	}
+
+	return simd4m_and(valid, inside);
+}
+
+/* rays of the mask against a compiled mesh, one at a time */
+static void packet_intersect_mesh(packet_t *packet, const mesh_t *mesh,
+		unsigned int index, unsigned int mask)
+{
+	unsigned int	i = 0;
+	unsigned int	tri;
+	float		t;
+	ray_t		ray;
+
+	ray.origin = packet->origin;
+	ray.magnitude = FLT_MAX;
+	for(; i < PACKET_SIZE; ++i)
+	{
+		if(!(mask & (1u << i)))
+			continue;
+		ray.direction = vec4v_make(packet->dx[i], packet->dy[i],
+			packet->dz[i], 0.0f);
+		t = packet->t[i];
+		tri = ray_hit_mesh(&ray, mesh, &t, 0);
+		if(tri == ~0u)
+			continue;
+		packet->t[i] = t;
+		packet->hit[i] = index;
+		packet->prim[i] = tri;
+	}
+}
+
+/* test every ray of the mask against one object, keeping nearer hits */
+static void packet_intersect_object(packet_t *packet, const scene_t *scene,
+		unsigned int index, unsigned int mask)
+{
+	const cscene_t	*cs = scene->compiled;
+	unsigned int	ref = cs->objectRef[index];
+	unsigned int	g = 0;
+	unsigned int	bits;
+	unsigned int	i;
+	simd4f_t	t, w;
+	simd4m_t	hit;
+
+	if(ref != ~0u && CSCENE_REF_TYPE(ref) == CSCENE_REF_MESH)
+	{
+		packet_intersect_mesh(packet, &cs->meshes[CSCENE_REF_SLOT(ref)],
+			index, mask);
+		return;
+	}
+
+	for(; g < PACKET_GROUPS; ++g)
+	{
+		bits = (mask >> (g * 4)) & 0xF;
+		if(!bits)
+			continue;
+
+		if(ref == ~0u)
+			return;
+		if(CSCENE_REF_TYPE(ref) == CSCENE_REF_POLYGON)
+			hit = packet_hit_polygon(packet, g, cs,
+				CSCENE_REF_SLOT(ref), &w);
+		else
+			hit = packet_hit_sphere(packet, g, cs,
+				CSCENE_REF_SLOT(ref), &w);
+
+		t = simd4_load(&packet->t[g * 4]);
+		bits &= simd4m_bits(simd4m_and(hit, simd4_cmplt(w, t)));
+		if(!bits)
+			continue;
+		simd4_store(&packet->t[g * 4],
+			simd4_select(simd4m_from_bits(bits), w, t));
+		for(i = 0; i < 4; ++i)
+		{
+			if(bits & (1 << i))
+				packet->hit[g * 4 + i] = index;
+		}
+	}
+}
+
+/* find the nearest object along every ray of the packet */
+void packet_intersect(packet_t *packet, const scene_t *scene)
+{
+	const bvh_t	*bvh = scene->bvh;
+	const bvh_node_t *node;
+	packet_entry_t	stack[BVH_STACK_SIZE];	/* nodes left to visit */
+	unsigned int	top = 0;
+	unsigned int	index;
+	unsigned int	mask;
+	unsigned int	i;
+	unsigned int	left, right;
+	float		dL, dR;
+
+	/* an empty tree is a single empty leaf that is not a leaf */
+	if(!bvh->nPrims)
+		return;
+	stack[top].node = 0;
+	stack[top++].mask = (1u << packet->nRays) - 1;
+
+	while(top)
+	{
+		--top;
+		index = stack[top].node;
+		node = &bvh->nodes[index];
+
+		/* whole packet misses the node */
+		if(packet_frustum_reject(packet, &node->bounds))
+			continue;
+		/* rays that still reach the node before their nearest hit */
+		mask = packet_intersect_aabb(packet, &node->bounds,
+				stack[top].mask);
+		if(!mask)
+			continue;
+
+		if(node->count)
+		{	/* leaf - test every object in it */
+			for(i = node->first; i < node->first + node->count; ++i)
+			{
+				packet_intersect_object(packet, scene,
+					bvh->prims[i], mask);
+			}
+			continue;
+		}
+
+		/* interior - visit the child nearer along the packet first */
+		left = index + 1;
+		right = node->first;
+		dL = (bvh->nodes[left].bounds.min[0] +
+			bvh->nodes[left].bounds.max[0]) * packet->center.x +
+			(bvh->nodes[left].bounds.min[1] +
+			bvh->nodes[left].bounds.max[1]) * packet->center.y +
+			(bvh->nodes[left].bounds.min[2] +
+			bvh->nodes[left].bounds.max[2]) * packet->center.z;
+		dR = (bvh->nodes[right].bounds.min[0] +
+			bvh->nodes[right].bounds.max[0]) * packet->center.x +
+			(bvh->nodes[right].bounds.min[1] +
+			bvh->nodes[right].bounds.max[1]) * packet->center.y +
+			(bvh->nodes[right].bounds.min[2] +
+			bvh->nodes[right].bounds.max[2]) * packet->center.z;
+		if(dL < dR)
+		{
+			stack[top].node = right;
+			stack[top++].mask = mask;
+			stack[top].node = left;
+			stack[top++].mask = mask;
+		}
+		else
+		{
+			stack[top].node = left;
+			stack[top++].mask = mask;
+			stack[top].node = right;
+			stack[top++].mask = mask;
+		}
+	}
+}
@@ -0,0 +1,63 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 4, 2008
+ * packet.h
+ *
+ * This file contains the definition for packets of coherent rays that all
+ * start at the same point (primary rays leaving the eye).  A packet is
+ * traced through the scene hierarchy as a unit: each node is first tested
+ * against the frustum bounding the whole packet and then against the rays
+ * 4 at a time, and objects are intersected with 4 rays per SIMD operation
+ * (meshes one ray at a time).  Only the nearest object along each ray is
+ * found, shading is still done one ray at a time.
+ */
+
+#ifndef _PACKET_H_
+#define _PACKET_H_
+
+#include "scene.h"
+
+/* width/height of the square block of rays in a packet */
+#define PACKET_DIM		4
+#define PACKET_SIZE		(PACKET_DIM * PACKET_DIM)
+/* number of 4 wide SIMD groups in a packet */
+#define PACKET_GROUPS		(PACKET_SIZE / 4)
+
+typedef struct
+{
+	unsigned int	nRays;			/* rays in use */
+	point_t		origin;			/* shared by every ray */
+
+	/* ray directions and their reciprocals - one ray per element */
+	float		dx[PACKET_SIZE] SIMD_ALIGN;
+	float		dy[PACKET_SIZE] SIMD_ALIGN;
+	float		dz[PACKET_SIZE] SIMD_ALIGN;
+	float		ix[PACKET_SIZE] SIMD_ALIGN;
+	float		iy[PACKET_SIZE] SIMD_ALIGN;
+	float		iz[PACKET_SIZE] SIMD_ALIGN;
+
+	/* results - distance to and index of nearest object, -1 if none, and
+	 * the triangle hit if the object is a mesh */
+	float		t[PACKET_SIZE] SIMD_ALIGN;
+	int		hit[PACKET_SIZE];
+	unsigned int	prim[PACKET_SIZE];
+
+	/* inward normals of the 4 planes through origin bounding the packet */
+	vector4_t	frustum[4];
+	vector4_t	center;			/* direction through the middle */
+} packet_t;
+
+/* set up a packet from a block of rays stored row by row.  Every ray must
+ * share the same origin.  corners are 4 directions in order around the
+ * block bounding every ray, if null the ray targets must form a grid so
+ * the corner rays bound the others.  width * height <= PACKET_SIZE */
+packet_t* packet_init(packet_t *packet, const ray_t *rays,
+		unsigned int width, unsigned int height, const vector4_t *corners);
+
+/* find the nearest object along every ray of the packet using the scene
+ * hierarchy (scene->bvh must exist).  Matches get_object3d_intersect()
+ * for each ray. */
+void packet_intersect(packet_t *packet, const scene_t *scene);
+
+#endif
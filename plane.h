@@ -11,6 +11,8 @@
 #ifndef _PLANE_H_
 #define _PLANE_H_
 
+#include "simd.h"
+
 typedef struct
 {
 	union
@@ -20,12 +22,8 @@ typedef struct
 		{	/* dimension access */
 			float A, B, C, F;
 		};
-#if defined(__PPU__) || defined (__SPU__)
-		vector float v;
-	} __attribute__ ((aligned(16) ));
-#else
-	};
-#endif
+		simd4f_t v;		/* SIMD register access */
+	} SIMD_ALIGN;
 } plane_t;
 
 #ifdef _DEBUG
@@ -11,9 +11,7 @@
 
 #if defined(__SPU__)
 	#include <simdmath.h>
-	#include <simdmath/acosf4.h>
 	#include <simdmath/sqrtf4.h>
-	#define M_PI 3.1415926535897932384
 #else
 	#define _USE_MATH_DEFINES
 	#include <math.h>
@@ -28,14 +26,15 @@
 /* create a ray from two points [p1 -> p2] (vector4_t under the hood) */
 ray_t* ray_create(ray_t *rayout, const point_t *p1, const point_t *p2)
 {
-	/* origin of ray is point 1 */
-	vec4_set(&rayout->origin, (float *)p1);
 	/* get vector from point 1 to point 2 */
-	vec4_sub(&rayout->direction, p2, p1);
+	vector4_t d = vec4v_sub(*p2, *p1);
+
+	/* origin of ray is point 1 */
+	rayout->origin = *p1;
 	/* get magnitude of vector we just created */
-	rayout->magnitude = vec4_magnitude(&rayout->direction);
+	rayout->magnitude = vec4v_magnitude(d);
 	/* normalize the vector this way to prevent duplicate work */
-	vec4_scale(&rayout->direction, &rayout->direction, 1.0f / rayout->magnitude);
+	rayout->direction = vec4v_scale(d, 1.0f / rayout->magnitude);
 
 	return rayout;
 }
@@ -43,8 +42,8 @@ ray_t* ray_create(ray_t *rayout, const point_t *p1, const point_t *p2)
 /* copies a ray into another ray */
 ray_t* ray_copy(ray_t *rayout, const ray_t *ray)
 {
-	vec4_set(&rayout->direction, (float *)&ray->direction);
-	vec4_set(&rayout->origin, (float *)&ray->origin);
+	rayout->direction = ray->direction;
+	rayout->origin = ray->origin;
 	rayout->magnitude = ray->magnitude;
 
 	return rayout;
@@ -53,16 +52,15 @@ ray_t* ray_copy(ray_t *rayout, const ray_t *ray)
 /* reverse the direction and origin of a ray */
 ray_t* ray_reverse(ray_t *rayout, const ray_t *ray)
 {
-	ray_t tmpray;
-	ray_copy(&tmpray, ray);
 	/* scale original direction by magnitude of ray */
-	vec4_scale(&tmpray.direction, &ray->direction, ray->magnitude);
+	vector4_t d = vec4v_scale(ray->direction, ray->magnitude);
+
 	/* origin of new ray is destination of original ray */
-	vec4_add(&rayout->origin, &tmpray.direction, &ray->origin);	
+	rayout->origin = vec4v_add(d, ray->origin);
 	/* copy magnitude straight over */
 	rayout->magnitude = ray->magnitude;
 	/* direction of new ray is reverse that of old ray */
-	vec4_scale(&rayout->direction, &tmpray.direction, -1.0f);
+	rayout->direction = vec4v_scale(d, -1.0f);
 
 	return rayout;
 }
@@ -71,37 +69,26 @@ ray_t* ray_reverse(ray_t *rayout, const ray_t *ray)
  * hate doing.  R.I.P. clean code R.I.P. */
 ray_t* ray_tinypush(ray_t *rayout, const ray_t *ray)
 {
-	vector4_t v;
-	vec4_set(&v, (float *)&ray->direction);
-	/* make sure direction was normalized */
-	vec4_normalize(&v);
-	/* create a tiny displacement vector along direction */
-	vec4_scale(&v, &v, 0.001f);
+	/* make sure direction was normalized, then create a tiny
+	 * displacement vector along direction */
+	vector4_t v = vec4v_scale(vec4v_normalize(ray->direction), 0.001f);
+
 	/* copy the ray */
 	ray_copy(rayout, ray);
 	/* display the new rays origin */
-	vec4_add(&rayout->origin, &rayout->origin, &v);
+	rayout->origin = vec4v_add(rayout->origin, v);
 
 	return rayout;
 }
 
-/* tests if ray intersects a given polygon */
-int ray_intersect_polygon(const ray_t *ray, const polygon_t* poly,
-							point_t *pt, float *distance)
+/* distance along ray to a plane, returns 0 if the plane is parallel
+ * to or behind the ray */
+static int ray_plane_distance(const ray_t *ray, const plane_t* plane,
+							float *distance)
 {
 	float num = -1.0f * (
-		vec4_dot((vector4_t *)&poly->plane, &ray->origin) +
-		poly->plane.F);
-	float den = vec4_dot((vector4_t *)&poly->plane, &ray->direction);
-	float w;
-	unsigned int i = 0;		/* counter variable for loop */
-	double angleTotal = 0.0;	/* running total of angle */
-	double angleTmp = 0.0;		/* angle between current two vectors */	
-	vector4_t tmp;
-	vector4_t tmp2;
-#ifdef __SPU__
-	vector float vTmp;
-#endif
+		simd4_dot3(plane->v, ray->origin.v) + plane->F);
+	float den = simd4_dot3(plane->v, ray->direction.v);
 
 	/* if denomenator = 0, ray is parallel to plane */
 	if(den == 0.0f)
@@ -109,89 +96,87 @@ int ray_intersect_polygon(const ray_t *ray, const polygon_t* poly,
 		return 0;
 	}
 
-	w = num / den;		/* distance to intersection */
+	*distance = num / den;		/* distance to intersection */
 	/* if w < 0, intersection point is behind ray */
-	if(w < 0.0f)
+	if(*distance < 0.0f)
 	{	/* return no intersection */
 		return 0;
 	}
 
+	return 1;
+}
+
+/* tests if ray intersects a polygon given by its plane and point in
+ * polygon test data (see poly_prepare) */
+int ray_intersect_poly_edges(const ray_t *ray, const plane_t *plane,
+		unsigned int axisU, unsigned int axisV, const float *edge,
+		unsigned int nEdges, point_t *pt, float *distance)
+{
+	float w;
+
+	if(!ray_plane_distance(ray, plane, &w))
+		return 0;
+
 	/* now w is least positive root */
 	/* use it to calculate where intersection point is */
-	vec4_add(pt, &ray->origin,
-		vec4_scale(&tmp, &ray->direction, w));
+	*pt = vec4v_madd(ray->origin, ray->direction, w);
 	*distance = w;		/* pass back distance to intersection */
 
 	/* at this point we at least know the ray intersects the plane.
 	 * let's figure out if the point is actually inside the confined
 	 * polygonal area */
-	for(i = 0; i < poly->nVerticies; ++i)
-	{
-		if(i == (poly->nVerticies - 1))
-		{	/* last vertex, compare with first */
-			/* calculate two vectors */
-			vec4_sub(&tmp, &poly->vertex[i], pt);
-			vec4_sub(&tmp2, &poly->vertex[0], pt);
-			/* find angle between them - between normal vectors, dot
-			 * product is cos of angle between them */
-#ifdef __SPU__
-			vTmp[0] = vec4_costheta(&tmp, &tmp2);
-			vTmp = _acosf4(vTmp);
-			angleTotal += vTmp[0];
-#else
-			angleTmp = vec4_costheta(&tmp, &tmp2);
-			/* arccos to get theta */
-			angleTmp = acos(angleTmp);
-			angleTotal += angleTmp;
-#endif
-		}
-		else
-		{
-			/* calculate two vectors */
-			vec4_sub(&tmp, &poly->vertex[i], pt);
-			vec4_sub(&tmp2, &poly->vertex[i+1], pt);
-			/* find angle between them - between normal vectors, dot
-			 * product is cos of angle between them */
-#ifdef __SPU__
-			vTmp[0] = vec4_costheta(&tmp, &tmp2);
-			vTmp = _acosf4(vTmp);
-			angleTotal += vTmp[0];
-#else
-			angleTmp = vec4_costheta(&tmp, &tmp2);
-			/* arccos to get theta */
-			angleTmp = acos(angleTmp);
-			angleTotal += angleTmp;
-#endif
-		}
-	}
+	return poly_edges_contain(edge, nEdges, pt->c[axisU], pt->c[axisV]);
+}
 
-	/* TODO: this comparison is weak, should be refined */
-	if((angleTotal + .001) > (2.0 * M_PI))
-	{
-		return 1;
-	}
-	else
-	{
+/* same as above without passing back the point of intersection */
+int ray_hit_poly_edges(const ray_t *ray, const plane_t *plane,
+		unsigned int axisU, unsigned int axisV, const float *edge,
+		unsigned int nEdges, float *distance)
+{
+	float w;
+
+	if(!ray_plane_distance(ray, plane, &w))
 		return 0;
-	}
-}
 
+	*distance = w;
+	/* only the two projected coordinates of the point are needed */
+	return poly_edges_contain(edge, nEdges,
+		ray->origin.c[axisU] + w * ray->direction.c[axisU],
+		ray->origin.c[axisV] + w * ray->direction.c[axisV]);
+}
 
-/* tests if ray intersects a given sphere */
-int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
+/* tests if ray intersects a given polygon */
+int ray_intersect_polygon(const ray_t *ray, const polygon_t* poly,
 							point_t *pt, float *distance)
 {
-	vector4_t	tmp;	/* used to hold scale of ray direction */
+	return ray_intersect_poly_edges(ray, &poly->plane, poly->axisU,
+		poly->axisV, poly->edge, poly->nVerticies, pt, distance);
+}
+
+/* tests if ray intersects a given polygon without passing back the
+ * point of intersection */
+int ray_hit_polygon(const ray_t *ray, const polygon_t* poly, float *distance)
+{
+	return ray_hit_poly_edges(ray, &poly->plane, poly->axisU,
+		poly->axisV, poly->edge, poly->nVerticies, distance);
+}
+
+/* tests if ray intersects a given sphere without computing the point
+ * of intersection - only the distance along the ray */
+int ray_hit_sphere(const ray_t *ray, const sphere_t* sphere, float *distance)
+{
+	return ray_hit_sphere_at(ray, &sphere->center, sphere->radius, distance);
+}
+
+/* tests if ray intersects a sphere given by center and radius without
+ * computing the point of intersection - only the distance along the ray */
+int ray_hit_sphere_at(const ray_t *ray, const point_t *center, float radius,
+							float *distance)
+{
 	float A = 1;	/* since we know ray direction is normalized */
-	float dx = ray->origin.x - sphere->center.x;
-	float dy = ray->origin.y - sphere->center.y;
-	float dz = ray->origin.z - sphere->center.z;
-	float B = 2 * (
-		ray->direction.x * (dx) +
-		ray->direction.y * (dy) +
-		ray->direction.z * (dz));
-	float C = (dx * dx + dy * dy + dz * dz) 
-		- (sphere->radius * sphere->radius);
+	vector4_t d = vec4v_sub(ray->origin, *center);
+	float B = 2 * vec4v_dot(ray->direction, d);
+	float C = vec4v_dot(d, d) - (radius * radius);
 	float det = (B*B) - (4 * A * C);
 	float wOne;	/* distance to first intersection */
 	float wTwo;	/* distance to second intersection */
@@ -220,8 +205,6 @@ int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
 
 		if(det == 0.0f)
 		{	/* one root, wOne and wTwo should be equal */
-			vec4_add(pt, &ray->origin, 
-				vec4_scale(&tmp, &ray->direction, wOne));
 			*distance = wOne;	/* pass back distance to intersection */
 			return 1;
 		}
@@ -232,9 +215,6 @@ int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
 			if(wTwo > 0.0f && wTwo < w)
 				w = wTwo;
 			/* now w is least positive root */
-			/* use it to calculate where intersection point is */
-			vec4_add(pt, &ray->origin, 
-				vec4_scale(&tmp, &ray->direction, w));
 			*distance = w;		/* pass back distance to intersection */
 			return 1;
 		}
@@ -248,3 +228,44 @@ int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
 	return 0;
 }
 
+/* tests if ray intersects a given sphere */
+int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
+							point_t *pt, float *distance)
+{
+	if(!ray_hit_sphere(ray, sphere, distance))
+		return 0;
+
+	/* use distance to calculate where intersection point is */
+	*pt = vec4v_madd(ray->origin, ray->direction, *distance);
+	return 1;
+}
+
+/* tests if ray intersects a bounding box anywhere between tmin and tmax */
+int ray_intersect_aabb(const ray_t *ray, const vector4_t *invDir,
+			const aabb_t *box, float tmin, float tmax, float *tnear)
+{
+	unsigned int i = 0;
+	float t0, t1, tmp;
+
+	/* slab test - clip [tmin, tmax] against each pair of planes.
+	 * comparisons are written so a NaN (ray origin on a slab plane
+	 * with a zero direction component) leaves the interval alone */
+	for(; i < 3; ++i)
+	{
+		t0 = (box->min[i] - ray->origin.c[i]) * invDir->c[i];
+		t1 = (box->max[i] - ray->origin.c[i]) * invDir->c[i];
+		if(t0 > t1)
+		{
+			tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		tmin = t0 > tmin ? t0 : tmin;
+		tmax = t1 < tmax ? t1 : tmax;
+		if(tmin > tmax)
+			return 0;
+	}
+
+	*tnear = tmin;
+	return 1;
+}
@@ -57,4 +57,27 @@ int ray_intersect_polygon(const ray_t *ray, const polygon_t* poly,
 int ray_intersect_sphere(const ray_t *ray, const sphere_t* sphere,
 							point_t *pt, float *distance);
 
+/* distance only versions of the tests above.  These never compute the
+ * point of intersection and are meant for occlusion (shadow) queries */
+int ray_hit_polygon(const ray_t *ray, const polygon_t* poly, float *distance);
+int ray_hit_sphere(const ray_t *ray, const sphere_t* sphere, float *distance);
+
+/* the same tests on geometry that is not stored in a polygon_t/sphere_t
+ * (see cscene.h).  A polygon is given by its plane and the point in
+ * polygon data built by poly_prepare() */
+int ray_intersect_poly_edges(const ray_t *ray, const plane_t *plane,
+		unsigned int axisU, unsigned int axisV, const float *edge,
+		unsigned int nEdges, point_t *pt, float *distance);
+int ray_hit_poly_edges(const ray_t *ray, const plane_t *plane,
+		unsigned int axisU, unsigned int axisV, const float *edge,
+		unsigned int nEdges, float *distance);
+int ray_hit_sphere_at(const ray_t *ray, const point_t *center, float radius,
+		float *distance);
+
+/* tests if ray intersects a bounding box anywhere between tmin and tmax.
+ * invDir holds the reciprocal of each ray direction component.
+ * tnear is the distance the ray enters the box (clipped to tmin). */
+int ray_intersect_aabb(const ray_t *ray, const vector4_t *invDir,
+			const aabb_t *box, float tmin, float tmax, float *tnear);
+
 #endif
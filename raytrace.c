@@ -15,9 +15,19 @@
 #endif
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include "raytrace.h"
+#include "scheduler.h"
+#include "bvh.h"
+#include "cscene.h"
+#include "grid.h"
+#include "lightbvh.h"
+#include "lightgrid.h"
+#include "packet.h"
 #include "ray.h"
+#include "sampler.h"
 
 /* max value of a single color channel */
 #define COLORVALUE_MAX		0xFF
@@ -25,6 +35,90 @@
 /* max depth set by caller of ray trace */
 int MAX_DEPTH	=	4;
 
+/* a shading point waiting on the rays it spawns */
+typedef struct
+{
+	const object3d_t *obj;		/* object being shaded */
+	unsigned int	prim;		/* triangle hit on a mesh */
+	const material_t *mat;		/* its surface properties */
+	point_t		pt;		/* point of intersection */
+	vector4_t	N;		/* surface normal */
+	vector4_t	V;		/* towards the eye */
+	vector4_t	D;		/* direction of the eye ray */
+	color_t		color;		/* color accumulated so far */
+	float		weight;		/* throughput - share of the final
+					 * pixel color this point has */
+	float		k;		/* weight of the spawned ray in flight */
+	unsigned int	next;		/* SHADE_* ray to spawn next */
+} shade_frame_t;
+
+/* per thread tracing state */
+typedef struct
+{
+	/* shading points from the primary hit down to the deepest one */
+	shade_frame_t	stack[RENDER_MAX_DEPTH + 1];
+
+	float		minWeight;	/* see render_options_t */
+	int		roulette;
+	unsigned int	rng;		/* random state for roulette and
+					 * light picking */
+	unsigned int	lightSamples;	/* see render_options_t */
+	const sampler_t	*sampler;	/* places the sub samples of pixels */
+
+	/* spawned ray counts */
+	unsigned long long	traced;		/* rays traced */
+	unsigned long long	cut;		/* rays below minWeight skipped */
+	unsigned long long	killed;		/* rays that lost the roulette */
+} trace_context_t;
+
+/* a rectangular block of pixels rendered as a single task */
+typedef struct
+{
+	unsigned int	x;		/* left most pixel column */
+	unsigned int	y;		/* top most pixel row */
+	unsigned int	width;		/* clipped at right edge of image */
+	unsigned int	height;		/* clipped at bottom edge of image */
+	color_t		*colorbuffer;	/* full image color buffer */
+	const scene_t	*scene;
+	int		packets;	/* trace primary rays in packets */
+	trace_context_t	*contexts;	/* tracing state of every worker */
+	unsigned int	first;		/* sample indices [first, last) this */
+	unsigned int	last;		/* pass adds to every pixel */
+	unsigned int	preview;	/* preview pass - one sample every this
+					 * many pixels, spread over the rest */
+	float		*spread;	/* coarse pass - sample spread per pixel */
+	const unsigned char *refine;	/* refine pass - pixels to refine,
+					 * null = every pixel */
+	const struct timeval *deadline;	/* time budget - stop sampling at this
+					 * time (null = no budget) */
+	color_t		*previous;	/* time budget - colors before a pass */
+	unsigned int	samples;	/* time budget - samples every pixel of
+					 * the tile has */
+	float		noise;		/* time budget - average change of the
+					 * pixels in the last pass */
+	float		cost;		/* time budget - seconds per sample */
+} tile_t;
+
+/* fill in default render options */
+render_options_t* init_render_options(render_options_t *options)
+{
+	options->numThreads = 0;
+	options->tileSize = RENDER_DEFAULT_TILESIZE;
+	options->packets = 1;
+	options->minWeight = RENDER_DEFAULT_MINWEIGHT;
+	options->roulette = 0;
+	options->lightSamples = 0;
+	options->adaptive = 0.0f;
+	options->sampler = SAMPLER_GRID;
+	options->spp = 0;
+	options->progressive = 0;
+	options->snapshot = 0;
+	options->snapshotData = 0;
+	options->timeBudget = 0.0f;
+
+	return options;
+}
+
 /* returns pointer to this buffer */
 ray_t** create_raybuffer(unsigned int width, unsigned int height,
 						 unsigned int samplesPerPixelSq)
@@ -70,7 +164,7 @@ void free_raybuffer(ray_t** buffer, unsigned int width, unsigned int height)
 
 /* fill in attributes for generating rays on the fly */
 void prepare_scene(scene_t *scene, unsigned int width, unsigned int height,
-		unsigned int sqrtSpp, float fovY, float aspectRatio, float nearZ)
+		unsigned int spp, float fovY, float aspectRatio, float nearZ)
 {
 	
 	float	fovX = (fovY/2.0f) * aspectRatio;
@@ -78,10 +172,10 @@ void prepare_scene(scene_t *scene, unsigned int width, unsigned int height,
 	scene->viewPlaneHalfHeight = scene->viewDistance * tan((fovY/2.0f)*(M_PI/180.0f));
 	scene->viewPlaneHalfWidth = scene->viewPlaneHalfHeight * aspectRatio;
 	/* width of "pixel" in world space - a square so pix height is the same*/
-	scene->sppWidth = (scene->viewPlaneHalfWidth / (width/2.0f)) / (float)sqrtSpp;
+	scene->pixelWidth = scene->viewPlaneHalfWidth / (width/2.0f);
 	scene->frameBufferWidth = width;
 	scene->frameBufferHeight = height;
-	scene->sqrtSpp = sqrtSpp;
+	scene->spp = spp;
 }
 
 void init_raybuffer(ray_t **raybuffer, float fovY, float aspectRatio, 
@@ -163,41 +257,33 @@ void init_raybuffer(ray_t **raybuffer, float fovY, float aspectRatio,
 	}
 }
 
-/* returns intersection of ray with any object type */
-/* two output parameters - v and distance
- * p - point of intersection
- * distance - distance to intersection point from origin of ray */
-int ray_intersect_object(const ray_t* ray, const object3d_t *obj,
-						 point_t *p, float *distance)
-{
-	switch(obj->geometryType)
-	{
-		case GEOMETRY_POLYGON:
-			return ray_intersect_polygon(ray, &obj->poly_obj, p, distance);
-		case GEOMETRY_SPHERE:
-			return ray_intersect_sphere(ray, &obj->sphr_obj, p, distance);
-		default:
-			return 0;
-	};
-}
-
 /* gets the first object this ray intersects
  * also returns the point of intersection through first paramemter
  * and distance to the point through second parameter 
+ * and the triangle hit on a mesh through the third
  * returns null if there is no object intersected in the scene */
 object3d_t *get_object3d_intersect(point_t *intersect, float *d,
-					const ray_t *ray, const scene_t *scene)
+		unsigned int *prim, const ray_t *ray, const scene_t *scene)
 {
 	object3d_t		*obj = 0;
 	unsigned int	i = 0;		/* counting variable iterating over objects in scene */
 	float			tmpD;		/* temporary distance to last intersected object */
 	point_t			tmpInt;		/* temporary intersection point to last intersected obj */
+	unsigned int		tmpPrim;	/* triangle of last intersected mesh */
+
+	/* use the hierarchy or the grid if one was built */
+	if(scene->bvh)
+		return bvh_intersect(intersect, d, prim, ray, scene, 0, 0);
+	if(scene->grid)
+		return grid_intersect(intersect, d, prim, ray, scene, 0, 0);
 
 	/* first find what object ray intersects first if any */
 	/* iterate over every object in the scene */
 	for(i = 0; i < scene->nObjects; ++i)
 	{
-		if(ray_intersect_object(ray, &scene->objects[i], &tmpInt, &tmpD))
+		/* spheres behind the ray give distance 0, they are no hit */
+		if(cscene_intersect(scene->compiled, i, ray, &tmpInt, &tmpD,
+			&tmpPrim) && tmpD > 0.0f)
 		{	/* if objects intersect, compare distance to intersection */
 			/* if there is no intersection object yet, then
 			 * there being an intersection at all sets this as the 
@@ -205,6 +291,7 @@ object3d_t *get_object3d_intersect(point_t *intersect, float *d,
 			if(obj == 0)
 			{
 				*d = tmpD;
+				*prim = tmpPrim;
 				obj = &scene->objects[i];
 				vec4_set(intersect, (float *)&tmpInt);
 			}	/* otherwise, we want to make sure new
@@ -212,6 +299,7 @@ object3d_t *get_object3d_intersect(point_t *intersect, float *d,
 			else if(tmpD < *d)
 			{
 				*d = tmpD;
+				*prim = tmpPrim;
 				obj = &scene->objects[i];
 				vec4_set(intersect, (float *)&tmpInt);
 			}
@@ -227,14 +315,27 @@ object3d_t *get_object3d_intersect(point_t *intersect, float *d,
  *
  * Returns the point of intersection through first parameter
  * and distance to the point through second parameter 
- * returns null if there is no object intersected in the scene */
+ * and the triangle hit on a mesh through the third
+ * returns null if there is no object intersected in the scene.
+ * A mesh is never excluded, its triangles may shadow each other */
 object3d_t *get_object3d_intersect_excl(point_t *intersect, float *d,
-				const ray_t *ray, const scene_t *scene, const object3d_t *exc)
+		unsigned int *prim, const ray_t *ray, const scene_t *scene,
+		const object3d_t *exc)
 {
 	object3d_t	*obj = 0;	/* return value */
 	unsigned int	i = 0;		/* counting variable iterating over objects in scene */
 	float		tmpD;		/* temporary distance to last intersected object */
 	point_t		tmpInt;		/* temporary intersection point */
+	unsigned int	tmpPrim;	/* triangle of last intersected mesh */
+
+	if(exc && exc->geometryType == GEOMETRY_TRIANGLE_MESH)
+		exc = 0;
+
+	/* use the hierarchy or the grid if one was built */
+	if(scene->bvh)
+		return bvh_intersect(intersect, d, prim, ray, scene, exc, 1);
+	if(scene->grid)
+		return grid_intersect(intersect, d, prim, ray, scene, exc, 1);
 
 	/* first find what object ray intersects first if any */
 	/* iterate over every object in the scene */
@@ -244,7 +345,8 @@ object3d_t *get_object3d_intersect_excl(point_t *intersect, float *d,
 		if(&scene->objects[i] == exc)
 			continue;
 
-		if(ray_intersect_object(ray, &scene->objects[i], &tmpInt, &tmpD))
+		if(cscene_intersect(scene->compiled, i, ray, &tmpInt, &tmpD,
+			&tmpPrim))
 		{
 			/* if there is no intersection object yet, then
 			 * there being an intersection at all sets this as the 
@@ -254,6 +356,7 @@ object3d_t *get_object3d_intersect_excl(point_t *intersect, float *d,
 				if(obj == 0)
 				{
 					*d = tmpD;
+					*prim = tmpPrim;
 					obj = &scene->objects[i];
 					vec4_set(intersect, (float *)&tmpInt);
 				}	/* otherwise, we want to make sure new
@@ -261,6 +364,7 @@ object3d_t *get_object3d_intersect_excl(point_t *intersect, float *d,
 				else if(tmpD < *d)
 				{
 					*d = tmpD;
+					*prim = tmpPrim;
 					obj = &scene->objects[i];
 					vec4_set(intersect, (float *)&tmpInt);
 				}
@@ -271,295 +375,349 @@ object3d_t *get_object3d_intersect_excl(point_t *intersect, float *d,
 	return obj;
 }
 
-/* calculates the color at a particular shading point on a specified object
- * we pass in the scene primary to use lights, but also for casting other
- * rays.
- * obj - object being intersected
- * eye - observer of this shading point
- * pt - point of intersection on the object
- * scene - entire scene
- */
-color_t* get_shade_color_phong(color_t *colorout, const object3d_t *obj,
-						 const ray_t *eye, const point_t *pt,
-						 const scene_t *scene, unsigned int depth)
-{
-	unsigned int i = 0;				/* iterative variable over nLights */
-	vector4_t	N, S, V, R;			/* vectors for lighting calculations */
-	ray_t		shadow, reflRay, transRay;	/* reflected and transmitted rays*/
-	object3d_t	*recurseObject;			/* object hit by spawned rays */
-	point_t		recurseIntersect;		/* spawned ray intersection point */
-	float		recurseDistance;		/* distance to spawn ray intersection */
-	color_t		recurseColor;			/* color from spawned rays */
+/* tests if any object other than the supplied one lies on the ray between
+ * its origin and ray->magnitude.  This is all a shadow ray needs to know,
+ * so unlike get_object3d_intersect_excl() it returns on the first valid
+ * hit found and never computes points of intersection.
+ * returns non zero if the ray is blocked.  As above a mesh is never
+ * excluded */
+int get_object3d_occluded(const ray_t *ray, const scene_t *scene,
+				const object3d_t *exc)
+{
+	unsigned int	i = 0;		/* counting variable iterating over objects in scene */
+	float		tmpD;		/* distance to intersection */
+
+	if(exc && exc->geometryType == GEOMETRY_TRIANGLE_MESH)
+		exc = 0;
+
+	/* use the hierarchy or the grid if one was built */
+	if(scene->bvh)
+		return bvh_occluded(ray, scene, exc);
+	if(scene->grid)
+		return grid_occluded(ray, scene, exc);
+
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		/* if this is the object we want to exclude, skip over */
+		if(&scene->objects[i] == exc)
+			continue;
+
+		if(cscene_hit(scene->compiled, i, ray, &tmpD) &&
+			tmpD < ray->magnitude && tmpD > 0.0f)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* the ray a shading point spawns next */
+#define SHADE_REFLECT		0
+#define SHADE_TRANSMIT		1
+#define SHADE_DONE		2
+
+/* next random number in [0, 1) from a per thread xorshift generator */
+static float trace_random(trace_context_t *ctx)
+{
+	ctx->rng ^= ctx->rng << 13;
+	ctx->rng ^= ctx->rng >> 17;
+	ctx->rng ^= ctx->rng << 5;
+	return (ctx->rng >> 8) * (1.0f / 16777216.0f);
+}
+
+/* computes the local (phong) lighting at a shading point - ambient plus
+ * diffuse and specular from every light it can see - and gets the frame
+ * ready to spawn its reflected and transmitted rays.  With
+ * ctx->lightSamples set and more lights in reach than that, only that
+ * many lights picked from the light hierarchy are looked at, each
+ * weighted by one over its probability and the number of picks.
+ * eye - ray that found the shading point */
+static void shade_local(trace_context_t *ctx, shade_frame_t *f,
+			const ray_t *eye, const scene_t *scene)
+{
+	unsigned int i;					/* light being looked at */
+	unsigned int j = 0;				/* iterative variable over lights */
+	unsigned int n;					/* lights that may reach */
+	const unsigned int *list = 0;			/* which lights those are */
+	int		sampled;			/* lights are picked at random */
+	float		w = 1.0f;			/* weight of the light */
+	float		pdf;				/* probability of picking it */
+	vector4_t	S, R;				/* vectors for lighting calculations */
+	ray_t		shadow;				/* shadow ray */
 	float		tmpFloat;			/* used in various calculations */
 	color_t		objColor;			/* color of object at intersection */
 	color_t		diff;				/* diffuse term sum */
 	color_t		spec;				/* specular term sum */
-	float		nit;				/* index of refraction ratio */
+	/* surface properties of the object */
+	const material_t *mat = cscene_material(scene->compiled,
+						f->obj - scene->objects);
+
+	f->mat = mat;
+	f->D = eye->direction;
+	f->next = SHADE_REFLECT;
 
 	/* get color of object at intersection point */
-	get_object_color(&objColor, obj, pt);
+	get_object_color(&objColor, f->obj, f->prim, &f->pt);
 
 	/* get ambient light contribution first */
-	color_mult(colorout, &objColor,
-			&scene->ambientLightColor, 0);
-	/* here we will clamp even though ambient lighting should never
-	 * be enough to saturate a color channel */
-	color_scale(colorout, colorout, obj->material.phong_ka, 0);
+	f->color = colorv_scale(colorv_mult(objColor, scene->ambientLightColor),
+			mat->phong_ka);
 
 	/* initialize specular and diffuse components to 0 */
-	color_init(&diff);
-	color_init(&spec);
+	diff = spec = colorv_make(0.0f, 0.0f, 0.0f);
 
 	/* calculate relevant lighting vectors that do not change for each
 	 * light source */
 	/* get normal vector */
-	get_object_normal(&N, obj, pt);
+	get_object_normal(&f->N, f->obj, f->prim, &f->pt);
 	/* View vector is generated by subtracting intersection from eye pos */
-	vec4_sub(&V, &eye->origin, pt);
-	/* normalize V */
-	vec4_normalize(&V);
-/*
-	printf("V.direction:\t(%f, %f, %f) - %f\n", V.x, V.y, V.z, vec4_magnitude(&V));
-	printf("E.direction:\t(%f, %f, %f) - %f\n", eye->direction.x, eye->direction.y, eye->direction.z, vec4_magnitude(&eye->direction));
-*/
+	f->V = vec4v_normalize(vec4v_sub(eye->origin, f->pt));
+
+	/* only lights that can reach this point - all of them without a grid */
+	n = scene->lightGrid ? lightgrid_lookup(scene->lightGrid, &f->pt, &list) :
+		scene->nLights;
+	/* too many of them - pick a few instead */
+	sampled = ctx->lightSamples && scene->lightBvh && n > ctx->lightSamples;
+	if(sampled)
+		n = ctx->lightSamples;
 
 	/* for each light source - cast shadow ray towards light */
-	for( ; i < scene->nLights; ++i)
+	for( ; j < n; ++j)
 	{
+		if(sampled)
+		{
+			i = lightbvh_sample(scene->lightBvh, scene->lights, &f->pt,
+				&f->N, trace_random(ctx), &pdf);
+			if(i == ~0u)
+				continue;	/* picked nothing - counts as no light */
+			w = 1.0f / (pdf * n);
+		}
+		else
+		{
+			i = scene->lightGrid ? list[j] : j;
+		}
 		/* generate a ray from intersection point to light */
 		/* note - magnitude of ray created is the distance to the light */
-		ray_create(&shadow, pt, &scene->lights[i].position);
-		/* get first object that ray intersects NOT including this object */
-		ray_tinypush(&shadow, &shadow);
-		recurseObject = get_object3d_intersect_excl(&recurseIntersect,
-						&recurseDistance, &shadow, scene, obj);
-		if(recurseObject)
-		{	/* there is an object between this surface and the light */
-			/* continue to next light as this one has no contribution */
+		ray_create(&shadow, &f->pt, &scene->lights[i].position);
+		/* light does not reach this far */
+		if(scene->lights[i].range > 0.0f &&
+			shadow.magnitude > scene->lights[i].range)
 			continue;
-		}
 
-		/* this light has contribution, calculate it */
-		/* get S and R vectors which change for each light source */
 		/* Source vector is embedded in shadow ray direction */
-		vec4_set(&S, (float *)&shadow.direction);
-		/*
-		vec4_sub(&S, &scene->lights[i].position, pt);
-		vec4_normalize(&S);
-		*/
-		/* Reflected vector takes a bit more to calculate */
-		/* S == Ri?  */
-		tmpFloat = vec4_dot(&S, &N);
-		vec4_scale(&R, &N, 2.0f*tmpFloat);
-		vec4_sub(&R, &R, &S);
-		/* is this needed? */
-
+		S = shadow.direction;
+		tmpFloat = vec4v_dot(S, f->N);
 		/* only apply specular and diffuse components from light if 
 		 * surface normal points towards light
-		 * i.e. not a back face of surface */
+		 * i.e. not a back face of surface - no shadow ray needed */
 		if( tmpFloat <= 0.0f)
 			continue;
 
-		tmpFloat = vec4_dot(&S, &N);
-		diff.r += scene->lights[i].color.r * tmpFloat;
-		diff.g += scene->lights[i].color.g * tmpFloat;
-		diff.b += scene->lights[i].color.b * tmpFloat;
+		/* is any object other than this one in the way of the light */
+		ray_tinypush(&shadow, &shadow);
+		if(get_object3d_occluded(&shadow, scene, f->obj))
+		{	/* there is an object between this surface and the light */
+			/* continue to next light as this one has no contribution */
+			continue;
+		}
+
+		/* this light has contribution, calculate it */
+		/* S reflected about N */
+		R = vec4v_sub(vec4v_scale(f->N, 2.0f*tmpFloat), S);
 
-		tmpFloat = vec4_dot(&R, &V);
+		diff = colorv_madd(diff, scene->lights[i].color, tmpFloat * w);
+
+		tmpFloat = vec4v_dot(R, f->V);
 		if(tmpFloat < 0.0f)
 			tmpFloat = 0.0f;
-		tmpFloat = powf(tmpFloat, obj->material.phong_ke);
-		spec.r += scene->lights[i].color.r * tmpFloat;
-		spec.g += scene->lights[i].color.g * tmpFloat;
-		spec.b += scene->lights[i].color.b * tmpFloat;
-		
-		/*
-		colorout->r += scene->lights[i].color.r * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].r;
-		colorout->g += scene->lights[i].color.g * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].g;
-		colorout->b += scene->lights[i].color.b * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].b;
-		*/
-	}
-/*
-	color_clamp(&diff);
-	color_clamp(&spec);
-*/
-
-	colorout->r += 	obj->material.phong_kd * 
-		diff.r * objColor.r +
-		obj->material.phong_ks *
-		spec.r * obj->material.colors[MATERIAL_SPECULARCOLOR].r;
-	colorout->g += 	obj->material.phong_kd * 
-		diff.g * objColor.g +
-		obj->material.phong_ks *
-		spec.g * obj->material.colors[MATERIAL_SPECULARCOLOR].g;
-	colorout->b += 	obj->material.phong_kd * 
-		diff.b * objColor.b +
-		obj->material.phong_ks *
-		spec.b * obj->material.colors[MATERIAL_SPECULARCOLOR].b;
-
+		tmpFloat = powf(tmpFloat, mat->phong_ke);
+		spec = colorv_madd(spec, scene->lights[i].color, tmpFloat * w);
+	}
 
-	/* add reflection stuff */
-	if(obj->material.kr != 0.0f && depth != MAX_DEPTH)
-	{	/* calculate reflection ray and get color at that point */
-	
-		/* origin of spawned ray is *this* intersection point */
-		vec4_set(&reflRay.origin, (float *)pt);
-		/* start with a magnitude of zero */
-		reflRay.magnitude = 9999999.9f;
-
-		/* find reflection of eye vector */
-		tmpFloat = vec4_dot(&V, &N);
-		vec4_scale(&reflRay.direction, &N, 2.0f*tmpFloat);
-		vec4_sub(&reflRay.direction, &reflRay.direction, &V);
-		
-		/* normalize the vector this way */
-/*
-		tmpFloat = vec4_magnitude(&reflRay.direction);
-		vec4_scale(&reflRay.direction, &reflRay.direction, 1.0f / tmpFloat);
-*/
-
-		/* get recurse object */
-		ray_tinypush(&reflRay, &reflRay);
-/*
-		recurseObject = get_object3d_intersect(&recurseIntersect,
-						&recurseDistance, &reflRay, scene);
-*/
-		recurseObject = get_object3d_intersect_excl(&recurseIntersect,
-						&recurseDistance, &reflRay, scene, 0);
-
-
-		if(recurseObject)
-		{
-			/* get shade color */
-			get_shade_color_phong(&recurseColor, recurseObject, &reflRay,
-					&recurseIntersect, scene, depth+1);
+	f->color = colorv_add(f->color, colorv_add(
+		colorv_mult(colorv_scale(diff, mat->phong_kd), objColor),
+		colorv_mult(colorv_scale(spec, mat->phong_ks),
+			mat->colors[MATERIAL_SPECULARCOLOR])));
+}
 
-			colorout->r += obj->material.kr * recurseColor.r;
-			colorout->g += obj->material.kr * recurseColor.g;
-			colorout->b += obj->material.kr * recurseColor.b;
-		}
-		else
-		{	/* mix with background color */
-			colorout->r += obj->material.kr * scene->bgColor.r;
-			colorout->g += obj->material.kr * scene->bgColor.g;
-			colorout->b += obj->material.kr * scene->bgColor.b;
-		}
+/* gets the next ray a shading point spawns (reflection, then transmission
+ * or total internal reflection) and the weight its color is added with.
+ * returns 0 once the shading point has nothing left to spawn */
+static int shade_next_ray(shade_frame_t *f, unsigned int depth, ray_t *ray)
+{
+	float		tmpFloat;			/* used in various calculations */
+	float		disc;				/* refraction discriminant */
+	float		nit;				/* index of refraction ratio */
+	const material_t *mat = f->mat;
 
-	}
-	if(obj->material.kt != 0.0f && depth != MAX_DEPTH)
-	{	/* calculate transmitted ray and get color at that point */
-		/* assume indices of refraction ratio is heading into object */
-		nit = 1.0f / obj->material.n;
-		vec4_scale(&transRay.direction, &eye->direction, nit);
-		/* use transRay.origin as a tmp vector - (-D) */
-		tmpFloat = vec4_dot(&V, &N);
-		if(tmpFloat < 0.0f)
-		{	/* we are inside the object moving out */
-			nit = 1.0f / nit;
-			/* WARNING - N is being changed here */
-			vec4_scale(&N, &N, -1.0f);
-		}
+	/* nothing is spawned at the bottom of the tree */
+	if(depth == MAX_DEPTH)
+		f->next = SHADE_DONE;
 
-		/* use transRay.magnitude as tmpFloat2 */
-		transRay.magnitude = 1 + nit * nit * 
-				(tmpFloat*tmpFloat - 1);
-		/* total internal reflection */
-		if(transRay.magnitude < 0)
-		{
+	/* add reflection stuff */
+	if(f->next == SHADE_REFLECT)
+	{
+		f->next = SHADE_TRANSMIT;
+		if(mat->kr != 0.0f)
+		{	/* calculate reflection ray and get color at that point */
 			/* origin of spawned ray is *this* intersection point */
-			vec4_set(&reflRay.origin, (float *)pt);
-			/* start with a magnitude of zero */
-			reflRay.magnitude = 999999.0f;
-	
+			ray->origin = f->pt;
+			ray->magnitude = 9999999.9f;
 			/* find reflection of eye vector */
-			tmpFloat = vec4_dot(&V, &N);
-			vec4_scale(&reflRay.direction, &N, 2.0f*tmpFloat);
-			vec4_sub(&reflRay.direction, &reflRay.direction, &V);
-			
-			/* normalize the vector this way */
-	/*
-			tmpFloat = vec4_magnitude(&reflRay.direction);
-			vec4_scale(&reflRay.direction, &reflRay.direction, 1.0f / tmpFloat);
-	*/
-	
-			/* get recurse object */
-			ray_tinypush(&reflRay, &reflRay);
-/*
-			recurseObject = get_object3d_intersect(&recurseIntersect,
-							&recurseDistance, &reflRay, scene);
-*/
-			recurseObject = get_object3d_intersect_excl(&recurseIntersect,
-							&recurseDistance, &reflRay, scene, 0);
-	
-			if(recurseObject)
+			ray->direction = vec4v_sub(vec4v_scale(f->N,
+				2.0f*vec4v_dot(f->V, f->N)), f->V);
+			f->k = mat->kr;
+			return 1;
+		}
+	}
+
+	if(f->next == SHADE_TRANSMIT)
+	{
+		f->next = SHADE_DONE;
+		if(mat->kt != 0.0f)
+		{	/* calculate transmitted ray and get color at that point */
+			/* assume indices of refraction ratio is heading into object */
+			nit = 1.0f / mat->n;
+			ray->direction = vec4v_scale(f->D, nit);
+			/* (-D . N) */
+			tmpFloat = vec4v_dot(f->V, f->N);
+			if(tmpFloat < 0.0f)
+			{	/* we are inside the object moving out */
+				nit = 1.0f / nit;
+				/* WARNING - N is being changed here */
+				f->N = vec4v_scale(f->N, -1.0f);
+			}
+
+			f->k = mat->kt;
+			disc = 1 + nit * nit * (tmpFloat*tmpFloat - 1);
+			/* total internal reflection */
+			if(disc < 0)
 			{
-				/* get shade color */
-				get_shade_color_phong(&recurseColor, recurseObject, &reflRay,
-						&recurseIntersect, scene, depth+1);
-	
-				colorout->r += obj->material.kt * recurseColor.r;
-				colorout->g += obj->material.kt * recurseColor.g;
-				colorout->b += obj->material.kt * recurseColor.b;
+				/* origin of spawned ray is *this* intersection point */
+				ray->origin = f->pt;
+				ray->magnitude = 999999.0f;
+				/* find reflection of eye vector */
+				ray->direction = vec4v_sub(vec4v_scale(f->N,
+					2.0f*vec4v_dot(f->V, f->N)), f->V);
 			}
 			else
-			{	/* mix with background color */
-				colorout->r += obj->material.kt * scene->bgColor.r;
-				colorout->g += obj->material.kt * scene->bgColor.g;
-				colorout->b += obj->material.kt * scene->bgColor.b;
+			{
+				tmpFloat = 1.0f/mat->n * tmpFloat - sqrt(disc);
+				ray->direction = vec4v_madd(ray->direction, f->N,
+							tmpFloat);
+				/* now set origin appropriately */
+				ray->origin = f->pt;
+				ray->magnitude = 99999.9f;
 			}
+			return 1;
 		}
-		else
+	}
+
+	return 0;
+}
+
+/* decides if the ray a shading point just spawned is worth tracing.  A
+ * ray whose share of the pixel (throughput times f->k) falls below
+ * ctx->minWeight can change the pixel by at most that share (colors
+ * are clamped to 1 at every level) and is skipped - or with roulette
+ * on, survives with probability share / minWeight and has its weight
+ * raised to make up for the rays that did not.  (Roulette is unbiased
+ * up to the per level clamp.) */
+static int shade_keep_ray(trace_context_t *ctx, shade_frame_t *f)
+{
+	float	share = f->weight * f->k;
+	float	q;
+
+	if(share >= ctx->minWeight)
+		return 1;
+
+	if(ctx->roulette)
+	{
+		q = share / ctx->minWeight;
+		if(trace_random(ctx) < q)
 		{
-			/* tmpFloat = (-D . N), transRay.magnitude = det */
-			tmpFloat = 1.0f/obj->material.n * tmpFloat - 
-					sqrt(transRay.magnitude);
-			/* used again as tmp vector */
-			vec4_scale(&transRay.origin, &N, tmpFloat);
-			vec4_add(&transRay.direction, &transRay.direction, &transRay.origin);
-
-			/* now set origin appropriately */
-			vec4_set(&transRay.origin, (float *)pt);
-			transRay.magnitude = 99999.9f;
-			/*
-			printf("costheta(V, T):\t%f\n", vec4_dot(&V, &transRay.direction));
-			printf("V.direction:\t(%f, %f, %f) - %f\n", V.x, V.y, V.z, vec4_magnitude(&V));
-			printf("T.direction:\t(%f, %f, %f) - %f\n", transRay.direction.x, transRay.direction.y, transRay.direction.z, vec4_magnitude(&transRay.direction)); */
-
-
-/*
-			recurseObject = get_object3d_intersect(&recurseIntersect,
-				&recurseDistance, &transRay, scene);
-*/
-			/* get recurse object */
-			ray_tinypush(&transRay, &transRay);
-			recurseObject = get_object3d_intersect_excl(&recurseIntersect,
-				&recurseDistance, &transRay, scene, 0);
-		
-			if(recurseObject)
-			{
-				/* get shade color */
-				get_shade_color_phong(&recurseColor, recurseObject, &transRay,
-						&recurseIntersect, scene, depth+1);
-	
-				colorout->r += obj->material.kt * recurseColor.r;
-				colorout->g += obj->material.kt * recurseColor.g;
-				colorout->b += obj->material.kt * recurseColor.b;
-			}
-			else
-			{	/* mix with background color */
-				colorout->r += obj->material.kt * scene->bgColor.r;
-				colorout->g += obj->material.kt * scene->bgColor.g;
-				colorout->b += obj->material.kt * scene->bgColor.b;
+			f->k /= q;
+			return 1;
+		}
+		++ctx->killed;
+		return 0;
+	}
+
+	++ctx->cut;
+	return 0;
+}
+
+/* calculates the color at a particular shading point on a specified object
+ * we pass in the scene primary to use lights, but also for casting other
+ * rays.
+ * ctx - per thread tracing state
+ * obj - object being intersected
+ * prim - triangle being intersected if obj is a mesh
+ * eye - observer of this shading point
+ * pt - point of intersection on the object
+ * scene - entire scene
+ *
+ * The tree of reflected and transmitted rays is walked depth first with
+ * the shading points waiting on a spawned ray kept on ctx->stack rather
+ * than the call stack.  Every shading point is clamped before it is added
+ * to its parent, exactly like the recursive version did.
+ */
+color_t* get_shade_color_phong(trace_context_t *ctx, color_t *colorout,
+			const object3d_t *obj, unsigned int prim, const ray_t *eye,
+			const point_t *pt, const scene_t *scene)
+{
+	shade_frame_t	*stack = ctx->stack;
+	shade_frame_t	*f;
+	unsigned int	top = 0;
+	ray_t		ray;		/* spawned ray being traced */
+	object3d_t	*hit;		/* object hit by spawned ray */
+	float		distance;	/* distance to spawn ray intersection */
+	color_t		color;
+
+	stack[0].obj = obj;
+	stack[0].prim = prim;
+	stack[0].pt = *pt;
+	stack[0].weight = 1.0f;
+	shade_local(ctx, &stack[0], eye, scene);
+
+	for(;;)
+	{
+		f = &stack[top];
+		if(shade_next_ray(f, top, &ray))
+		{
+			if(!shade_keep_ray(ctx, f))
+				continue;
+
+			/* get object the spawned ray sees */
+			++ctx->traced;
+			ray_tinypush(&ray, &ray);
+			hit = get_object3d_intersect_excl(&stack[top+1].pt, &distance,
+					&stack[top+1].prim, &ray, scene, 0);
+			if(hit == 0)
+			{	/* background is added as is */
+				f->color = colorv_madd(f->color, scene->bgColor, f->k);
+				continue;
 			}
+
+			/* shade the new point before anything it spawns */
+			++top;
+			stack[top].obj = hit;
+			stack[top].weight = f->weight * f->k;
+			shade_local(ctx, &stack[top], &ray, scene);
+			continue;
 		}
-		
+
+		/* ensure colors don't spill over max values on each channel */
+		color = colorv_clamp(f->color);
+		if(top == 0)
+			break;
+
+		/* hand the finished color to the point that spawned it */
+		--top;
+		stack[top].color = colorv_madd(stack[top].color, color,
+					stack[top].k);
 	}
 
-	/* ensure colors don't spill over max values on each channel */
-	color_clamp(colorout);
+	*colorout = color;
 	return colorout;
 }
 
@@ -567,133 +725,111 @@ color_t* get_shade_color_phong(color_t *colorout, const object3d_t *obj,
  * we pass in the scene primary to use lights, but also for casting other
  * rays.
  * obj - object being intersected
+ * prim - triangle being intersected if obj is a mesh
  * eye - observer of this shading point
  * pt - point of intersection on the object
  * scene - entire scene
  */
 color_t* get_shade_color_phongblinn(color_t *colorout, const object3d_t *obj,
-						 const ray_t *eye, const point_t *pt,
-						 const scene_t *scene)
+						 unsigned int prim, const ray_t *eye,
+						 const point_t *pt, const scene_t *scene)
 {
-	unsigned int i = 0;
+	unsigned int i;					/* light being looked at */
+	unsigned int j = 0;				/* iterative variable over lights */
+	unsigned int n;					/* lights that may reach */
+	const unsigned int *list = 0;			/* which lights those are */
 	ray_t		shadow;				/* shadow ray */
-	point_t		shadow_intersect;	/* point on object shadow ray first intersects */
-	object3d_t	*shadow_int_object;	/* object shadow ray intersects */
-	float		shadow_int_dist;	/* distance to shadow object intersection */
-	vector4_t	N, S, V, H, tmp;		/* vectors for lighting calculations */
+	vector4_t	N, S, V, H;			/* vectors for lighting calculations */
 	float		tmpFloat;			/* used in various calculations */
+	color_t		color;				/* color being accumulated */
 	color_t		diff;				/* diffuse term sum */
 	color_t		spec;				/* specular term sum */
+	/* surface properties of the object */
+	const material_t *mat = cscene_material(scene->compiled,
+						obj - scene->objects);
 	
 	/* get ambient light contribution first */
-	color_mult(colorout, &obj->material.colors[MATERIAL_DIFFUSECOLOR],
-						&scene->ambientLightColor, 0);
-	/* here we will clamp even though ambient lighting should never
-	 * be enough to saturate a color channel */
-	color_scale(colorout, colorout, obj->material.phong_ka, 0);
+	color = colorv_scale(colorv_mult(mat->colors[MATERIAL_DIFFUSECOLOR],
+			scene->ambientLightColor), mat->phong_ka);
 
 	/* initialize specular and diffuse components to 0 */
-	color_init(&diff);
-	color_init(&spec);
+	diff = spec = colorv_make(0.0f, 0.0f, 0.0f);
 
 	/* calculate relevant lighting vectors that do not change for each
 	 * light source */
 	/* get normal vector */
-	get_object_normal(&N, obj, pt);
+	get_object_normal(&N, obj, prim, pt);
 	/* View vector is generated by subtracting intersection from eye pos */
-	vec4_sub(&V, &eye->origin, pt);
-	/* normalize V */
-	vec4_normalize(&V);
+	V = vec4v_normalize(vec4v_sub(eye->origin, *pt));
+
+	/* only lights that can reach this point - all of them without a grid */
+	n = scene->lightGrid ? lightgrid_lookup(scene->lightGrid, pt, &list) :
+		scene->nLights;
 
 	/* for each light source - cast shadow ray towards light */
-	for( ; i < scene->nLights; ++i)
+	for( ; j < n; ++j)
 	{
+		i = scene->lightGrid ? list[j] : j;
 		/* generate a ray from intersection point to light */
 		/* note - magnitude of ray created is the distance to the light */
 		ray_create(&shadow, pt, &scene->lights[i].position);
-		/* get first object that ray intersects NOT including this object */
-		shadow_int_object = get_object3d_intersect_excl(&shadow_intersect,
-									&shadow_int_dist, &shadow, scene, obj);
-		if(shadow_int_object)
-		{	/* there is an object between this surface and the light */
-			/* continue to next light as this one has no contribution */
+		/* light does not reach this far */
+		if(scene->lights[i].range > 0.0f &&
+			shadow.magnitude > scene->lights[i].range)
 			continue;
-		}
 
-		/* this light has contribution, calculate it */
-		/* get S and R vectors which change for each light source */
 		/* Source vector is embedded in shadow ray direction */
-		vec4_set(&S, (float *)&shadow.direction);
-		/*
-		vec4_sub(&S, &scene->lights[i].position, pt);
-		vec4_normalize(&S);
-		*/
-		/* halfway vector takes a bit more to calculate */
-		vec4_add(&tmp, &V, &S);
-		tmpFloat = 1.0 / vec4_magnitude(&tmp);
-		vec4_scale(&H, &tmp, tmpFloat);
-
-		tmpFloat = vec4_dot(&S, &N);
+		S = shadow.direction;
+
+		tmpFloat = vec4v_dot(S, N);
 		/* only apply specular and diffuse components from light if 
 		 * surface normal points towards light
-		 * i.e. not a back face of surface */
+		 * i.e. not a back face of surface - no shadow ray needed */
 		if( tmpFloat <= 0.0f)
 			continue;
 
-		diff.r += scene->lights[i].color.r * tmpFloat;
-		diff.g += scene->lights[i].color.g * tmpFloat;
-		diff.b += scene->lights[i].color.b * tmpFloat;
+		/* is any object other than this one in the way of the light */
+		if(get_object3d_occluded(&shadow, scene, obj))
+		{	/* there is an object between this surface and the light */
+			/* continue to next light as this one has no contribution */
+			continue;
+		}
 
-		tmpFloat = vec4_dot(&H, &N);
+		/* this light has contribution, calculate it */
+		diff = colorv_madd(diff, scene->lights[i].color, tmpFloat);
+
+		/* halfway vector between view and source */
+		H = vec4v_add(V, S);
+		H = vec4v_scale(H, 1.0 / vec4v_magnitude(H));
+		tmpFloat = vec4v_dot(H, N);
 		if(tmpFloat < 0.0f)
 			tmpFloat = 0.0f;
-		tmpFloat = powf(tmpFloat, obj->material.phong_ke);
-		spec.r += scene->lights[i].color.r * tmpFloat;
-		spec.g += scene->lights[i].color.g * tmpFloat;
-		spec.b += scene->lights[i].color.b * tmpFloat;
-		
-		/*
-		colorout->r += scene->lights[i].color.r * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].r;
-		colorout->g += scene->lights[i].color.g * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].g;
-		colorout->b += scene->lights[i].color.b * 
-			obj->material.colors[MATERIAL_DIFFUSECOLOR].b;
-		*/
-	}
-/*
-	color_clamp(&diff);
-	color_clamp(&spec);
-*/
-
-	colorout->r += 	obj->material.phong_kd * 
-		diff.r * obj->material.colors[MATERIAL_DIFFUSECOLOR].r +
-		obj->material.phong_ks *
-		spec.r * obj->material.colors[MATERIAL_SPECULARCOLOR].r;
-	colorout->g += 	obj->material.phong_kd * 
-		diff.g * obj->material.colors[MATERIAL_DIFFUSECOLOR].g +
-		obj->material.phong_ks *
-		spec.g * obj->material.colors[MATERIAL_SPECULARCOLOR].g;
-	colorout->b += 	obj->material.phong_kd * 
-		diff.b * obj->material.colors[MATERIAL_DIFFUSECOLOR].b +
-		obj->material.phong_ks *
-		spec.b * obj->material.colors[MATERIAL_SPECULARCOLOR].b;
+		tmpFloat = powf(tmpFloat, mat->phong_ke);
+		spec = colorv_madd(spec, scene->lights[i].color, tmpFloat);
+	}
+
+	color = colorv_add(color, colorv_add(
+		colorv_mult(colorv_scale(diff, mat->phong_kd),
+			mat->colors[MATERIAL_DIFFUSECOLOR]),
+		colorv_mult(colorv_scale(spec, mat->phong_ks),
+			mat->colors[MATERIAL_SPECULARCOLOR])));
 
 	/* ensure colors don't spill over max values on each channel */
-	color_clamp(colorout);
+	*colorout = colorv_clamp(color);
 	return colorout;
 }
 
 /* gets the color at the first shading point the ray intersects */
-color_t* get_ray_color(color_t *colorout, const ray_t *ray,
-					   const scene_t *scene)
+color_t* get_ray_color(trace_context_t *ctx, color_t *colorout,
+			const ray_t *ray, const scene_t *scene)
 {
 	point_t			intersect;	/* intersection point if we find one */
 	object3d_t		*obj = 0;	/* object being intersected if any */
 	float			distance;	/* gets distance to intersection */
+	unsigned int		prim;		/* triangle if obj is a mesh */
 
 	/* get first object ray intersects */
-	obj = get_object3d_intersect(&intersect, &distance, ray, scene);
+	obj = get_object3d_intersect(&intersect, &distance, &prim, ray, scene);
 
 	/* after we iterate over every object in the scene, let's
 	 * examine the results */
@@ -703,14 +839,15 @@ color_t* get_ray_color(color_t *colorout, const ray_t *ray,
 	}
 	else
 	{	/* there was an intersection with object */
-		return get_shade_color_phong(colorout, obj, ray, &intersect, scene, 0);
+		return get_shade_color_phong(ctx, colorout, obj, prim, ray,
+				&intersect, scene);
 	}
 }
 /* calculates the color of an individual pixel value */
 /* this version of the function relies on the raybuffer existing in memory -
  * it appears to work much faster but consumes far more memory */
-color_t* old_get_pixel_color(color_t *colorout, const ray_t *rays,
-						unsigned int nRays, const scene_t *scene)
+color_t* old_get_pixel_color(trace_context_t *ctx, color_t *colorout,
+		const ray_t *rays, unsigned int nRays, const scene_t *scene)
 {
 	unsigned int i = 0;
 	color_t color;
@@ -719,7 +856,7 @@ color_t* old_get_pixel_color(color_t *colorout, const ray_t *rays,
 	for(; i < nRays; ++i)
 	{
 		/* get color of point this ray hits */
-		get_ray_color(&color, &rays[i], scene);
+		get_ray_color(ctx, &color, &rays[i], scene);
 		/* add color to accumulated color */
 		color_add(colorout, colorout, &color, 0);
 	}
@@ -728,55 +865,205 @@ color_t* old_get_pixel_color(color_t *colorout, const ray_t *rays,
 	return color_scale(colorout, colorout, 1.0f/(float)nRays, 0);
 }
 
-/* calculates the color of an individual pixel value */
-color_t* get_pixel_color(color_t *colorout, unsigned int x, unsigned int y,
-			const scene_t *scene)
+/* creates the primary ray through offset (u, v) of pixel (x, y) - both
+ * in [0, 1), see sampler_get() */
+ray_t* get_primary_ray(ray_t *rayout, unsigned int x, unsigned int y,
+			float u, float v, const scene_t *scene)
 {
-	unsigned int i;
-	unsigned int j = 0;
-	float scale = 1.0f /(float)(scene->sqrtSpp * scene->sqrtSpp);
-	color_t color;
-	ray_t	ray;
 	/* base target point on view plane */
 	point_t target;	
 	vector4_t shift;
-	vector4_t tmp;
+
+	/* N - move by viewDistance into scene - same for every pixel */
+	shift = vec4v_scale(scene->N, scene->viewDistance);
+	/* U - move left/right based on X pos and sample offset */
+	shift = vec4v_add(shift, vec4v_scale(scene->U,
+		(((x-(scene->frameBufferWidth/2.0f))/(scene->frameBufferWidth/2.0f)) * scene->viewPlaneHalfWidth)
+		+ u*scene->pixelWidth));
+	/* V - move up/down based on Y pos and sample offset */
+	shift = vec4v_add(shift, vec4v_scale(scene->V,
+		((((scene->frameBufferHeight/2.0f) - y)/(scene->frameBufferHeight/2.0f)) * scene->viewPlaneHalfHeight)
+		+ v*scene->pixelWidth));
+
+	/* calculate target on view plane */
+	target = vec4v_add(scene->eyePos, shift);
+	/* cast a ray from eye point to target on view plane */
+	return ray_create(rayout, &scene->eyePos, &target);
+}
+
+/* largest difference between two colors on any channel */
+static float color_contrast(const color_t *a, const color_t *b)
+{
+	float	d = fabsf(a->r - b->r);
+
+	if(fabsf(a->g - b->g) > d)
+		d = fabsf(a->g - b->g);
+	if(fabsf(a->b - b->b) > d)
+		d = fabsf(a->b - b->b);
+	return d;
+}
+
+/* calculates the color of an individual pixel value - the average of
+ * its sub samples [0, last).  Only samples [first, last) are traced, on
+ * entry *colorout holds the average of the ones before first.  If spread
+ * is not null it gets the largest difference between any two of the
+ * samples traced on any channel */
+color_t* get_pixel_color(trace_context_t *ctx, color_t *colorout,
+			float *spread, unsigned int x, unsigned int y,
+			unsigned int first, unsigned int last,
+			const scene_t *scene)
+{
+	unsigned int k = first;
+	float scale = 1.0f /(float)last;
+	float u, v;
+	color_t color;
+	color_t sum = colorv_make(0.0f, 0.0f, 0.0f);
+	color_t lo = colorv_make(1e30f, 1e30f, 1e30f);
+	color_t hi = colorv_make(-1e30f, -1e30f, -1e30f);
+	ray_t	ray;
 
 	/* trace all rays in ray group and average color values */
-	for(; j < scene->sqrtSpp; ++j)
+	for(; k < last; ++k)
 	{
-		for(i = 0; i < scene->sqrtSpp; ++i)
+		sampler_get(ctx->sampler, x, y, k, &u, &v);
+		get_primary_ray(&ray, x, y, u, v, scene);
+		/* get color of point this ray hits */
+		get_ray_color(ctx, &color, &ray, scene);
+		/* add color to accumulated color */
+		sum = colorv_add(sum, color);
+		if(spread)
 		{
-			/* N - move by viewDistance into scene - same for every pixel */
-			vec4_scale(&tmp, &scene->N, scene->viewDistance);
-			vec4_set(&shift, (float *)&tmp);
-
-			/* U - move left/right based on X pos and spp */
-			vec4_scale(&tmp, &scene->U, 
-				(((x-(scene->frameBufferWidth/2.0f))/(scene->frameBufferWidth/2.0f)) * scene->viewPlaneHalfWidth) 
-				+ (scene->sppWidth/2.0f + i*scene->sppWidth));
-			vec4_add(&shift, &shift, &tmp);
-
-			/* N - move up/down based on Y pos and spp */
-			vec4_scale(&tmp, &scene->V, 
-				((((scene->frameBufferHeight/2.0f) - y)/(scene->frameBufferHeight/2.0f)) * scene->viewPlaneHalfHeight)
-				+ (scene->sppWidth/2.0f + j*scene->sppWidth));	/* v shift based on X */
-			vec4_add(&shift, &shift, &tmp);
-		
-			
-			/* calculate target on view plane */
-			vec4_add(&target, &scene->eyePos, &shift);
-			/* cast a ray from eye point to target on view plane */
-			ray_create(&ray, &scene->eyePos, &target);
-			/* get color of point this ray hits */
-			get_ray_color(&color, &ray, scene);
-			/* add color to accumulated color */
-			color_add(colorout, colorout, &color, 0);
+			lo = colorv_make(fminf(lo.r, color.r),
+				fminf(lo.g, color.g), fminf(lo.b, color.b));
+			hi = colorv_make(fmaxf(hi.r, color.r),
+				fmaxf(hi.g, color.g), fmaxf(hi.b, color.b));
+		}
+	}
+
+	if(spread)
+		*spread = color_contrast(&lo, &hi);
+
+	/* earlier samples count as much as the ones just traced */
+	if(first)
+		sum = colorv_madd(sum, *colorout, (float)first);
+
+	/* divide values by number of points being sampled */
+	*colorout = colorv_scale(sum, scale);
+	return colorout;
+}
+
+/* calculates the colors of a block of at most PACKET_DIM x PACKET_DIM
+ * pixels from their sub samples [first, last).  The primary rays of each
+ * sub sample are traced together as a packet, everything they spawn is
+ * traced one ray at a time.  Colors (and spread if not null) are worked
+ * out as in get_pixel_color() */
+void get_block_color(trace_context_t *ctx, color_t *colorbuffer,
+			float *spread, unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height,
+			unsigned int first, unsigned int last,
+			const scene_t *scene)
+{
+	unsigned int	i = first;
+	unsigned int	k;
+	unsigned int	n = width * height;
+	unsigned int	p;
+	float		scale = 1.0f /(float)last;
+	float		u, v;
+	packet_t	packet;
+	ray_t		rays[PACKET_SIZE];
+	ray_t		edge;
+	vector4_t	corners[4];
+	color_t		sum[PACKET_SIZE];
+	color_t		lo[PACKET_SIZE];
+	color_t		hi[PACKET_SIZE];
+	color_t		color;
+	object3d_t	*obj;
+	point_t		intersect;
+	float		distance;
+	unsigned int	prim;
+
+	for(k = 0; k < n; ++k)
+	{
+		color_init(&sum[k]);
+		lo[k] = colorv_make(1e30f, 1e30f, 1e30f);
+		hi[k] = colorv_make(-1e30f, -1e30f, -1e30f);
+	}
+
+	/* samples may fall anywhere in their pixels, so the packet is bounded
+	 * by the corners of the block rather than by its corner rays */
+	corners[0] = get_primary_ray(&edge, x, y, 0.0f, 1.0f, scene)->direction;
+	corners[1] = get_primary_ray(&edge, x + width - 1, y, 1.0f, 1.0f,
+		scene)->direction;
+	corners[2] = get_primary_ray(&edge, x + width - 1, y + height - 1, 1.0f,
+		0.0f, scene)->direction;
+	corners[3] = get_primary_ray(&edge, x, y + height - 1, 0.0f, 0.0f,
+		scene)->direction;
+
+	for(; i < last; ++i)
+	{
+		for(k = 0; k < n; ++k)
+		{
+			sampler_get(ctx->sampler, x + k % width, y + k / width, i,
+				&u, &v);
+			get_primary_ray(&rays[k], x + k % width, y + k / width, u, v,
+				scene);
+		}
+		packet_init(&packet, rays, width, height, corners);
+		packet_intersect(&packet, scene);
+
+		for(k = 0; k < n; ++k)
+		{
+			if(packet.hit[k] < 0)
+			{	/* background */
+				color = scene->bgColor;
+			}
+			else if(scene->objects[packet.hit[k]].geometryType ==
+				GEOMETRY_TRIANGLE_MESH)
+			{	/* meshes were already intersected one ray at
+				 * a time, the packet has the exact distance */
+				obj = &scene->objects[packet.hit[k]];
+				intersect = vec4v_madd(rays[k].origin,
+					rays[k].direction, packet.t[k]);
+				get_shade_color_phong(ctx, &color, obj,
+					packet.prim[k], &rays[k], &intersect,
+					scene);
+			}
+			else
+			{	/* exact intersection point with the winner */
+				obj = &scene->objects[packet.hit[k]];
+				if(cscene_intersect(scene->compiled,
+					packet.hit[k], &rays[k],
+					&intersect, &distance, &prim))
+					get_shade_color_phong(ctx, &color,
+						obj, prim, &rays[k], &intersect,
+						scene);
+				else
+					get_ray_color(ctx, &color, &rays[k],
+						scene);
+			}
+			sum[k] = colorv_add(sum[k], color);
+			if(spread)
+			{
+				lo[k] = colorv_make(fminf(lo[k].r, color.r),
+					fminf(lo[k].g, color.g),
+					fminf(lo[k].b, color.b));
+				hi[k] = colorv_make(fmaxf(hi[k].r, color.r),
+					fmaxf(hi[k].g, color.g),
+					fmaxf(hi[k].b, color.b));
+			}
 		}
 	}
 
 	/* divide values by number of points being sampled */
-	return color_scale(colorout, colorout, scale, 0);
+	for(k = 0; k < n; ++k)
+	{
+		p = (x + k % width) + (y + k / width) * scene->frameBufferWidth;
+		if(first)
+			sum[k] = colorv_madd(sum[k], colorbuffer[p], (float)first);
+		colorbuffer[p] = colorv_scale(sum[k], scale);
+		if(spread)
+			spread[p] = color_contrast(&lo[k], &hi[k]);
+	}
 }
 
 /* writes a 32 bit color value to memory in appropriate format */
@@ -789,6 +1076,513 @@ void write_color_32(unsigned int *pixel, const color_t *color)
 	*pixel |= (unsigned char)(COLORVALUE_MAX * color->b);
 }
 
+/* tests if every pixel of a block is marked for refining */
+static int block_refined(const tile_t *tile, unsigned int x, unsigned int y,
+			unsigned int w, unsigned int h)
+{
+	unsigned int	width = tile->scene->frameBufferWidth;
+	unsigned int	i;
+	unsigned int	j = y;
+
+	for(; j < y + h; ++j)
+	{
+		for(i = x; i < x + w; ++i)
+		{
+			if(!tile->refine[i+j*width])
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* preview pass - traces one sample at every tile->preview pixels of a
+ * tile (counting from its corner) and spreads it over the pixels after */
+static void render_preview(trace_context_t *ctx, tile_t *tile)
+{
+	unsigned int	width = tile->scene->frameBufferWidth;
+	unsigned int	step = tile->preview;
+	unsigned int	i, k, l;
+	unsigned int	j = tile->y;
+	color_t		color;
+
+	for(; j < tile->y + tile->height; j += step)
+	{
+		for(i = tile->x; i < tile->x + tile->width; i += step)
+		{
+			get_pixel_color(ctx, &color, 0, i, j, 0, 1, tile->scene);
+			for(l = j; l < j + step && l < tile->y + tile->height; ++l)
+			{
+				for(k = i; k < i + step && k < tile->x + tile->width;
+					++k)
+				{
+					tile->colorbuffer[k+l*width] = color;
+				}
+			}
+		}
+	}
+}
+
+/* adds samples [first, last) to every pixel of a tile (or the ones marked
+ * for refining) */
+static void render_tile_range(trace_context_t *ctx, tile_t *tile,
+			unsigned int first, unsigned int last)
+{
+	unsigned int	width = tile->scene->frameBufferWidth;
+	unsigned int	i, k, l;
+	unsigned int	j = tile->y;
+	unsigned int	w, h;
+
+	if(tile->packets)
+	{	/* packets need the hierarchy for their frustum test */
+		for(; j < tile->y + tile->height; j += PACKET_DIM)
+		{
+			h = tile->y + tile->height - j;
+			h = h < PACKET_DIM ? h : PACKET_DIM;
+			for(i = tile->x; i < tile->x + tile->width; i += PACKET_DIM)
+			{
+				w = tile->x + tile->width - i;
+				w = w < PACKET_DIM ? w : PACKET_DIM;
+				if(!tile->refine || block_refined(tile, i, j, w, h))
+				{
+					get_block_color(ctx, tile->colorbuffer,
+						tile->spread, i, j, w, h, first, last, tile->scene);
+					continue;
+				}
+				/* partly refined blocks go one pixel at a time */
+				for(l = j; l < j + h; ++l)
+				{
+					for(k = i; k < i + w; ++k)
+					{
+						if(tile->refine[k+l*width])
+							get_pixel_color(ctx,
+								&tile->colorbuffer[k+l*width],
+								0, k, l, first, last,
+								tile->scene);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	for(; j < tile->y + tile->height; ++j)
+	{
+		for(i = tile->x; i < tile->x + tile->width; ++i)
+		{
+			if(tile->refine && !tile->refine[i+j*width])
+				continue;
+			get_pixel_color(ctx, &tile->colorbuffer[i+j*width],
+				tile->spread ? &tile->spread[i+j*width] : 0, i, j,
+				first, last, tile->scene);
+		}
+	}
+}
+
+/* tests if the clock has reached a deadline */
+static int past_deadline(const struct timeval *deadline)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, 0);
+	return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec &&
+		now.tv_usec >= deadline->tv_usec);
+}
+
+/* time budget pass - adds samples one at a time until tile->last or the
+ * deadline, then measures how much they changed the tile (tile->noise) */
+static void render_tile_budget(trace_context_t *ctx, tile_t *tile)
+{
+	unsigned int	width = tile->scene->frameBufferWidth;
+	unsigned int	s = tile->first;
+	unsigned int	i;
+	unsigned int	j;
+	float		change = 0.0f;
+	struct timeval	start, end;
+
+	for(j = tile->y; j < tile->y + tile->height; ++j)
+	{
+		for(i = tile->x; i < tile->x + tile->width; ++i)
+			tile->previous[i+j*width] = tile->colorbuffer[i+j*width];
+	}
+
+	gettimeofday(&start, 0);
+	for(; s < tile->last && !past_deadline(tile->deadline); ++s)
+	{
+		render_tile_range(ctx, tile, s, s + 1);
+	}
+	if(s == tile->first)
+		return;
+	gettimeofday(&end, 0);
+
+	tile->cost = ((end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1e6f) / (s - tile->first);
+	tile->samples = s;
+	for(j = tile->y; j < tile->y + tile->height; ++j)
+	{
+		for(i = tile->x; i < tile->x + tile->width; ++i)
+			change += color_contrast(&tile->previous[i+j*width],
+				&tile->colorbuffer[i+j*width]);
+	}
+	tile->noise = change / (tile->width * tile->height);
+}
+
+/* task run by the scheduler - adds samples [tile->first, tile->last) to
+ * every pixel of one tile (or in the refine pass, to the ones marked for
+ * refining) */
+void render_tile(scheduler_t *sched, unsigned int worker, void *data)
+{
+	tile_t		*tile = (tile_t *)data;
+	trace_context_t	*ctx = &tile->contexts[worker];
+
+	/* roulette gives the same image no matter which worker runs a tile */
+	ctx->rng = (tile->x * 73856093u) ^ (tile->y * 19349663u) ^
+		(tile->first * 83492791u) ^ 0x9E3779B9u;
+	if(!ctx->rng)
+		ctx->rng = 1;
+
+	if(tile->preview)
+		render_preview(ctx, tile);
+	else if(tile->deadline)
+		render_tile_budget(ctx, tile);
+	else
+		render_tile_range(ctx, tile, tile->first, tile->last);
+}
+
+/* picks the pixels worth refining after the coarse pass - those whose
+ * coarse samples differ by more than threshold on any channel, or whose
+ * color differs that much from a neighbor's.  Returns how many there are */
+static unsigned int mark_refine(unsigned char *refine,
+		const color_t *colorbuffer, const float *spread,
+		unsigned int width, unsigned int height, float threshold)
+{
+	unsigned int	i;
+	unsigned int	j = 0;
+	unsigned int	p;
+	unsigned int	n = 0;
+
+	for(; j < height; ++j)
+	{
+		for(i = 0; i < width; ++i)
+		{
+			p = i + j * width;
+			refine[p] = spread[p] > threshold ||
+				(i > 0 && color_contrast(&colorbuffer[p],
+					&colorbuffer[p-1]) > threshold) ||
+				(i + 1 < width && color_contrast(&colorbuffer[p],
+					&colorbuffer[p+1]) > threshold) ||
+				(j > 0 && color_contrast(&colorbuffer[p],
+					&colorbuffer[p-width]) > threshold) ||
+				(j + 1 < height && color_contrast(&colorbuffer[p],
+					&colorbuffer[p+width]) > threshold);
+			n += refine[p];
+		}
+	}
+
+	return n;
+}
+
+/* hands every tile to the workers to add samples [first, last) to their
+ * pixels.  preview and refine are as in tile_t */
+static void render_pass(scheduler_t *sched, tile_t *tiles, unsigned int nTiles,
+			unsigned int first, unsigned int last,
+			unsigned int preview, const unsigned char *refine)
+{
+	unsigned int	i = 0;
+
+	for(; i < nTiles; ++i)
+	{
+		tiles[i].first = first;
+		tiles[i].last = last;
+		tiles[i].preview = preview;
+		tiles[i].refine = refine;
+		/* static split as a starting point for the work stealing */
+		scheduler_push(sched, (unsigned int)(((unsigned long long)i *
+			sched->nWorkers) / nTiles), render_tile, &tiles[i]);
+	}
+
+	scheduler_run(sched);
+}
+
+/* progressive mode - hands the image so far to options->snapshot */
+static void render_snapshot(unsigned int *buffer, const color_t *colorbuffer,
+		unsigned int width, unsigned int height, unsigned int spp,
+		const struct timeval *start, const render_options_t *options)
+{
+	struct timeval	now;
+	unsigned int	i = 0;
+
+	gettimeofday(&now, 0);
+	if(spp)
+		printf("Pass done:\t%d samples per pixel", spp);
+	else
+		printf("Preview done:\tevery %d pixels", options->progressive);
+	printf(" after %.3f ms\n", (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_usec - start->tv_usec) / 1000.0);
+
+	if(!options->snapshot)
+		return;
+	for(; i < width * height; ++i)
+	{
+		write_color_32(&buffer[i], &colorbuffer[i]);
+	}
+	options->snapshot(buffer, width, height, spp, options->snapshotData);
+}
+
+/* progressive mode - a preview tracing one sample every
+ * options->progressive pixels (if that is more than 1), then passes
+ * doubling the samples of every pixel until the sampler runs out, with a
+ * snapshot after each */
+static void render_progressive(scheduler_t *sched, tile_t *tiles,
+		unsigned int nTiles, unsigned int *buffer, color_t *colorbuffer,
+		unsigned int width, unsigned int height, const sampler_t *sampler,
+		const render_options_t *options)
+{
+	struct timeval	start;
+	unsigned int	first = 0;
+	unsigned int	last;
+
+	gettimeofday(&start, 0);
+
+	if(options->progressive > 1)
+	{
+		render_pass(sched, tiles, nTiles, 0, 1, options->progressive, 0);
+		render_snapshot(buffer, colorbuffer, width, height, 0, &start,
+			options);
+	}
+
+	for(; first < sampler->count; first = last)
+	{
+		last = first ? first * 2 : 1;
+		if(last > sampler->count)
+			last = sampler->count;
+		render_pass(sched, tiles, nTiles, first, last, 0, 0);
+		render_snapshot(buffer, colorbuffer, width, height, last, &start,
+			options);
+	}
+}
+
+/* how much doubling the samples of a tile is worth for the time it takes
+ * - its noise for the cost of the next pass.  Tiles whose last pass
+ * changed nothing come after every other, fewest samples first */
+static float tile_priority(const tile_t *tile)
+{
+	if(!(tile->noise > 0.0f))
+		return -(float)tile->samples;
+	return tile->noise / (tile->cost * tile->samples + 1e-9f);
+}
+
+/* orders tiles by falling priority for qsort() */
+static int compare_priority(const void *a, const void *b)
+{
+	float	pa = tile_priority(*(const tile_t * const *)a);
+	float	pb = tile_priority(*(const tile_t * const *)b);
+
+	return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+/* time budget mode - after a preview so every pixel has a color no matter
+ * how little time there is, rounds double the samples of the half of the
+ * tiles where that buys the most noise for the time (every tile in the
+ * first round) until every tile has all the samples of the sampler or
+ * options->timeBudget seconds have passed.  Tiles cut off by the deadline
+ * keep the average of the samples they got */
+static void render_budget(scheduler_t *sched, tile_t *tiles,
+		unsigned int nTiles, unsigned int width, unsigned int height,
+		const sampler_t *sampler, const render_options_t *options)
+{
+	struct timeval	start, deadline, now;
+	double		late;
+	tile_t		**order = malloc(sizeof(tile_t *) * nTiles);
+	color_t		*previous = malloc(sizeof(color_t) * width * height);
+	unsigned long long total = 0;
+	unsigned int	lo = ~0u, hi = 0;
+	unsigned int	rounds = 0;
+	unsigned int	i = 0;
+	unsigned int	n;
+	long		usec;
+
+	gettimeofday(&start, 0);
+	usec = start.tv_usec + (long)((options->timeBudget -
+		(long)options->timeBudget) * 1000000.0f);
+	deadline.tv_sec = start.tv_sec + (long)options->timeBudget +
+		usec / 1000000;
+	deadline.tv_usec = usec % 1000000;
+
+	render_pass(sched, tiles, nTiles, 0, 1, options->progressive > 1 ?
+		options->progressive : RENDER_BUDGET_PREVIEW, 0);
+
+	for(; i < nTiles; ++i)
+	{
+		tiles[i].deadline = &deadline;
+		tiles[i].previous = previous;
+		tiles[i].samples = 0;
+		tiles[i].noise = 0.0f;
+		tiles[i].cost = 0.0f;
+		tiles[i].preview = 0;
+	}
+
+	while(!past_deadline(&deadline))
+	{
+		/* tiles that can still take samples */
+		for(n = 0, i = 0; i < nTiles; ++i)
+		{
+			if(tiles[i].samples < sampler->count)
+				order[n++] = &tiles[i];
+		}
+		if(!n)
+			break;
+		if(rounds)
+		{
+			qsort(order, n, sizeof(tile_t *), compare_priority);
+			n = (n + 1) / 2;
+		}
+
+		for(i = 0; i < n; ++i)
+		{
+			order[i]->first = order[i]->samples;
+			order[i]->last = order[i]->samples ?
+				order[i]->samples * 2 : 1;
+			if(order[i]->last > sampler->count)
+				order[i]->last = sampler->count;
+			scheduler_push(sched, (unsigned int)(((unsigned long long)i *
+				sched->nWorkers) / n), render_tile, order[i]);
+		}
+		scheduler_run(sched);
+		++rounds;
+	}
+
+	gettimeofday(&now, 0);
+	for(i = 0; i < nTiles; ++i)
+	{
+		total += (unsigned long long)tiles[i].samples * tiles[i].width *
+			tiles[i].height;
+		lo = tiles[i].samples < lo ? tiles[i].samples : lo;
+		hi = tiles[i].samples > hi ? tiles[i].samples : hi;
+		tiles[i].deadline = 0;
+	}
+	late = (now.tv_sec - deadline.tv_sec) * 1000.0 +
+		(now.tv_usec - deadline.tv_usec) / 1000.0;
+	printf("Time budget:\t%d rounds, %d to %d samples per pixel (%.2f "
+		"average), %.3f ms %s the deadline\n", rounds, lo, hi,
+		(double)total / (width * height), late < 0.0 ? -late : late,
+		late < 0.0 ? "before" : "after");
+
+	free(order);
+	free(previous);
+}
+
+/* split the frame into tiles and render them on a pool of workers.
+ * Tiles are handed out to workers in contiguous runs so neighboring
+ * tiles stay on the same core, workers that finish early steal the rest.
+ * With options->adaptive set every pixel first gets a few coarse samples,
+ * then only the pixels picked by mark_refine() get the rest of them.
+ * With options->progressive set see render_progressive() - buffer gets
+ * the snapshots.  With options->timeBudget set see render_budget() */
+void render_tiles(unsigned int *buffer, color_t *colorbuffer,
+		const scene_t *scene, unsigned int width, unsigned int height,
+		const sampler_t *sampler, const render_options_t *options)
+{
+	unsigned int	tileSize = options->tileSize ? options->tileSize :
+				RENDER_DEFAULT_TILESIZE;
+	unsigned int	tilesX = (width + tileSize - 1) / tileSize;
+	unsigned int	tilesY = (height + tileSize - 1) / tileSize;
+	unsigned int	nTiles = tilesX * tilesY;
+	tile_t		*tiles = malloc(sizeof(tile_t) * nTiles);
+	scheduler_t	*sched = scheduler_create(options->numThreads);
+	trace_context_t	*contexts = malloc(sizeof(trace_context_t) *
+				sched->nWorkers);
+	unsigned long long traced = 0, cut = 0, killed = 0;
+	unsigned int	i = 0;
+	unsigned int	nRefined;
+	int		adaptive = options->adaptive > 0.0f &&
+				sampler->count > sampler->nCoarse &&
+				!options->progressive && options->timeBudget <= 0.0f;
+	float		*spread = adaptive ?
+				malloc(sizeof(float) * width * height) : 0;
+	unsigned char	*refine = adaptive ? malloc(width * height) : 0;
+
+	for(; i < sched->nWorkers; ++i)
+	{
+		contexts[i].minWeight = options->minWeight;
+		contexts[i].roulette = options->roulette;
+		contexts[i].lightSamples = options->lightSamples;
+		contexts[i].sampler = sampler;
+		contexts[i].traced = 0;
+		contexts[i].cut = 0;
+		contexts[i].killed = 0;
+	}
+
+	for(i = 0; i < nTiles; ++i)
+	{
+		tiles[i].x = (i % tilesX) * tileSize;
+		tiles[i].y = (i / tilesX) * tileSize;
+		tiles[i].width = (tiles[i].x + tileSize > width) ?
+			width - tiles[i].x : tileSize;
+		tiles[i].height = (tiles[i].y + tileSize > height) ?
+			height - tiles[i].y : tileSize;
+		tiles[i].colorbuffer = colorbuffer;
+		tiles[i].scene = scene;
+		tiles[i].packets = options->packets && scene->bvh;
+		tiles[i].contexts = contexts;
+		tiles[i].spread = spread;
+		tiles[i].deadline = 0;
+	}
+
+	printf("Rendering %d tiles (%dx%d) on %d threads...\n",
+		nTiles, tileSize, tileSize, sched->nWorkers);
+
+	if(options->timeBudget > 0.0f)
+	{
+		if(options->adaptive > 0.0f)
+			printf("Adaptive sampling is off with a time budget.\n");
+		render_budget(sched, tiles, nTiles, width, height, sampler,
+			options);
+	}
+	else if(options->progressive)
+	{
+		if(options->adaptive > 0.0f)
+			printf("Adaptive sampling is off in progressive mode.\n");
+		render_progressive(sched, tiles, nTiles, buffer, colorbuffer,
+			width, height, sampler, options);
+	}
+	else if(adaptive)
+	{
+		render_pass(sched, tiles, nTiles, 0, sampler->nCoarse, 0, 0);
+		nRefined = mark_refine(refine, colorbuffer, spread, width, height,
+			options->adaptive);
+		for(i = 0; i < nTiles; ++i)
+			tiles[i].spread = 0;
+		render_pass(sched, tiles, nTiles, sampler->nCoarse,
+			sampler->count, 0, refine);
+		printf("Refined pixels:\t%d of %d (%d samples, %d elsewhere)\n",
+			nRefined, width * height,
+			sampler->count, sampler->nCoarse);
+	}
+	else
+	{
+		render_pass(sched, tiles, nTiles, 0, sampler->count, 0, 0);
+	}
+
+	printf("Tiles stolen:\t%d\n", sched->steals);
+
+	for(i = 0; i < sched->nWorkers; ++i)
+	{
+		traced += contexts[i].traced;
+		cut += contexts[i].cut;
+		killed += contexts[i].killed;
+	}
+	printf("Spawned rays:\t%llu traced, %llu saved (%llu below weight "
+		"%g, %llu by roulette)\n", traced, cut + killed, cut,
+		options->minWeight, killed);
+
+	scheduler_free(sched);
+	free(contexts);
+	free(tiles);
+	free(spread);
+	free(refine);
+}
+
 void ward_tone(color_t *colorbuffer, float *lbuffer, unsigned int nPixels,
 		float ldMax, float totalLum, float totalLogLum)
 {
@@ -874,10 +1668,15 @@ void apply_tone(color_t *colorbuffer, unsigned int nPixels, int keyPix, const sc
 void raytrace(unsigned int *buffer, scene_t *scene,
 		float fovY, float aspectRatio, float nearZ, float farZ,
 		unsigned int width, unsigned int height,
-		unsigned int samplesPerPixelSq, unsigned int depth)
+		unsigned int samplesPerPixelSq, unsigned int depth,
+		const render_options_t *options)
 {
 	unsigned int i;
 	unsigned int j = 0;
+	/* places the sub samples of every pixel */
+	sampler_t sampler;
+	unsigned int spp = options->spp ? options->spp :
+		samplesPerPixelSq * samplesPerPixelSq;
 	/* ray buffer is (9*spp^2) times bigger than frame buffer 
 	 * for example - 1080p ray buffer at 16x super sampling is 
 	 * 1200MB in size */
@@ -888,10 +1687,22 @@ void raytrace(unsigned int *buffer, scene_t *scene,
 	/* immediate color observed */
 	color_t color;	
 	/* assign to global variable */
+	if(depth > RENDER_MAX_DEPTH)
+	{
+		printf("Depth %d is too deep, using %d.\n", depth, RENDER_MAX_DEPTH);
+		depth = RENDER_MAX_DEPTH;
+	}
 	MAX_DEPTH = depth;
 
+	sampler_init(&sampler, options->sampler, spp);
+	if(sampler.count != spp)
+		printf("The %s sampler needs a square sample count, using %d.\n",
+			sampler_name(sampler.type), sampler.count);
+	printf("Sampling:\t%d samples per pixel (%s)\n", sampler.count,
+		sampler_name(sampler.type));
+
 	/* generate some extra information in the scene to generate rays on the fly */
-	prepare_scene(scene, width, height, samplesPerPixelSq, fovY, aspectRatio, nearZ);
+	prepare_scene(scene, width, height, sampler.count, fovY, aspectRatio, nearZ);
 
 	/* generate initial rays using view plane */
 	/* init_raybuffer(raybuffer, fovY, aspectRatio, nearZ, farZ, width, height,
@@ -900,17 +1711,9 @@ void raytrace(unsigned int *buffer, scene_t *scene,
 	/* now start processing the pixels */
 
 	/* iterate every initial pixel and start ray tracing!!! */
-	for(; j < height; ++j)
-	{
-		for(i = 0; i < width; ++i)
-		{	/* for every pixel pass in the ray group and get color value*/
-			
-			color_init(&colorbuffer[i+j*width]);
-		 	get_pixel_color(&colorbuffer[i+j*width], i, j, scene);
-		/*	old_get_pixel_color(&colorbuffer[i+j*width], raybuffer[i+j*width], 
-				samplesPerPixelSq*samplesPerPixelSq, scene); */
-		}
-	}
+	/* pixels are rendered tile by tile across all worker threads */
+	render_tiles(buffer, colorbuffer, scene, width, height, &sampler,
+		options);
 
 	/* now that we have the raw colors, run the tone reproduction operation(s) */	
 	/* with reinhard key value location */
@@ -12,12 +12,68 @@
 #define _RAYTRACE_H_
 
 #include "scene.h"
+#include "sampler.h"
+
+/* default width and height of a square tile of pixels */
+#define RENDER_DEFAULT_TILESIZE		16
+/* deepest reflected/transmitted ray a pixel may spawn */
+#define RENDER_MAX_DEPTH		64
+/* spawned rays worth less than this share of a pixel are not traced -
+ * each one skipped moves the pixel by less than half an 8 bit step */
+#define RENDER_DEFAULT_MINWEIGHT	(1.0f / 512.0f)
+/* pixels between the samples of the preview a time budget starts with,
+ * unless progressive says otherwise */
+#define RENDER_BUDGET_PREVIEW		8
+
+/* called with the image so far (32 bit pixels) after every pass of a
+ * progressive render.  spp is the samples every pixel has, 0 for the
+ * preview */
+typedef void (*render_snapshot_t)(unsigned int *buffer, unsigned int width,
+			unsigned int height, unsigned int spp, void *data);
+
+/* options controlling how the frame is rendered, as opposed to what
+ * is rendered (the scene) */
+typedef struct
+{
+	unsigned int	numThreads;	/* worker threads (0 = one per cpu) */
+	unsigned int	tileSize;	/* tile width/height in pixels */
+	int		packets;	/* trace primary rays in packets */
+	float		minWeight;	/* skip spawned rays whose kr/kt product
+					 * is below this (0 = trace them all) */
+	int		roulette;	/* russian roulette below minWeight
+					 * instead of skipping */
+	unsigned int	lightSamples;	/* lights picked per shading point when
+					 * more are in reach (0 = all of them) */
+	float		adaptive;	/* only pixels whose coarse samples or
+					 * neighbors differ by more than this on
+					 * a channel get every sample (0 = all) */
+	unsigned int	sampler;	/* places sub samples (SAMPLER_*) */
+	unsigned int	spp;		/* samples per pixel (0 = the square of
+					 * samplesPerPixelSq given to raytrace) */
+	unsigned int	progressive;	/* render in passes that double the
+					 * samples, after a preview at every
+					 * nth pixel if above 1 (0 = one pass) */
+	render_snapshot_t snapshot;	/* progressive - gets every pass */
+	void		*snapshotData;	/* handed to snapshot */
+	float		timeBudget;	/* seconds to keep adding samples for,
+					 * noisiest tiles first (0 = no limit) */
+} render_options_t;
+
+/* gets the first object a ray intersects, its distance and point of
+ * intersection and the triangle hit on a mesh.  Returns null if there is
+ * none */
+object3d_t *get_object3d_intersect(point_t *intersect, float *d,
+		unsigned int *prim, const ray_t *ray, const scene_t *scene);
+
+/* fill in default render options */
+render_options_t* init_render_options(render_options_t *options);
 
 /* called to start the ray tracing process */
 void raytrace(unsigned int *buffer, scene_t *scene,
 		float fovY, float aspectRatio, float nearZ, float farZ,
 		unsigned int width, unsigned int height,
-		unsigned int samplesPerPixelSq, unsigned int depth);
+		unsigned int samplesPerPixelSq, unsigned int depth,
+		const render_options_t *options);
 
 #endif
 
@@ -0,0 +1,244 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 14, 2008
+ * sampler.c
+ *
+ * This file contains the definitions for the pixel samplers.  Correlated
+ * multi-jittering follows Kensler (Pixar tech memo 13-01), the Owen
+ * scrambling follows Burley (JCGT 2020).
+ */
+
+#include <math.h>
+#include <string.h>
+#include "sampler.h"
+
+/* names of the samplers, indexed by type */
+static const char *sampler_names[] = { "grid", "jitter", "sobol" };
+
+/* spreads the bits of a number all over (lowbias32) */
+static unsigned int sampler_hash(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+/* random seed of a pixel */
+static unsigned int sampler_seed(unsigned int x, unsigned int y)
+{
+	return sampler_hash(x ^ sampler_hash(y ^ 0x9E3779B9u));
+}
+
+/* 32 bit fixed point in [0, 1) to a float that stays below 1 */
+static float sampler_float(unsigned int x)
+{
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static unsigned int sampler_reverse(unsigned int x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+/* owen scrambling - flips every bit based on the bits above it */
+static unsigned int sampler_owen(unsigned int x, unsigned int seed)
+{
+	x = sampler_reverse(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return sampler_reverse(x);
+}
+
+/* second dimension of the sobol sequence (the first is the bit reversed
+ * index) */
+static unsigned int sampler_sobol(unsigned int index)
+{
+	unsigned int	v = 1u << 31;
+	unsigned int	x = 0;
+
+	for(; index; index >>= 1, v ^= v >> 1)
+	{
+		if(index & 1)
+			x ^= v;
+	}
+	return x;
+}
+
+/* random permutation of [0, l) picked by p, at position i */
+static unsigned int sampler_permute(unsigned int i, unsigned int l,
+				unsigned int p)
+{
+	unsigned int	w = l - 1;
+
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do
+	{
+		i ^= p;
+		i *= 0xe170893du;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3fu;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | p >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303u;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while(i >= l);
+	return (i + p) % l;
+}
+
+/* random number in [0, 1) picked by p, at position i */
+static float sampler_random(unsigned int i, unsigned int p)
+{
+	i ^= p;
+	i ^= i >> 17;
+	i ^= i >> 10;
+	i *= 0xb36534e5u;
+	i ^= i >> 12;
+	i ^= i >> 21;
+	i *= 0x93fc4795u;
+	i ^= 0xdf6e307fu;
+	i ^= i >> 17;
+	i *= 1 | p >> 18;
+	return sampler_float(i);
+}
+
+/* set up a sampler of a type for count samples per pixel */
+sampler_t* sampler_init(sampler_t *sampler, unsigned int type,
+			unsigned int count)
+{
+	unsigned int	s;
+
+	if(!count)
+		count = 1;
+
+	sampler->type = type;
+	sampler->side = 0;
+	if(type == SAMPLER_GRID)
+	{
+		s = (unsigned int)sqrtf((float)count);
+		while(s * s > count)
+			--s;
+		while((s + 1) * (s + 1) <= count)
+			++s;
+		sampler->side = s;
+		count = s * s;
+	}
+	sampler->count = count;
+
+	/* the middle sample, or 2x2 spread out once there are 4x4 */
+	sampler->nCoarse = count < 16 ? 1 : 4;
+	s = sampler->side;
+	if(sampler->nCoarse == 1)
+	{
+		sampler->coarse[0] = (s / 2) * s + s / 2;
+	}
+	else
+	{
+		sampler->coarse[0] = (s / 4) * s + s / 4;
+		sampler->coarse[1] = (s / 4) * s + 3 * s / 4;
+		sampler->coarse[2] = (3 * s / 4) * s + s / 4;
+		sampler->coarse[3] = (3 * s / 4) * s + 3 * s / 4;
+	}
+
+	return sampler;
+}
+
+/* gets the type of sampler called name, -1 if there is none */
+int sampler_type(const char *name)
+{
+	int	i = 0;
+
+	for(; i < (int)(sizeof(sampler_names) / sizeof(sampler_names[0])); ++i)
+	{
+		if(!strcmp(name, sampler_names[i]))
+			return i;
+	}
+	return -1;
+}
+
+/* gets the name of a type of sampler */
+const char* sampler_name(unsigned int type)
+{
+	return type < sizeof(sampler_names) / sizeof(sampler_names[0]) ?
+		sampler_names[type] : "unknown";
+}
+
+/* gets the offset of sample index of pixel (x, y) inside the pixel */
+void sampler_get(const sampler_t *sampler, unsigned int x, unsigned int y,
+			unsigned int index, float *u, float *v)
+{
+	unsigned int	seed;
+	unsigned int	m, n;
+	unsigned int	cell;
+	unsigned int	i = 0;
+
+	if(sampler->type == SAMPLER_SOBOL)
+	{
+		seed = sampler_seed(x, y);
+		*u = sampler_float(sampler_owen(sampler_reverse(index), seed));
+		*v = sampler_float(sampler_owen(sampler_sobol(index),
+			sampler_hash(seed)));
+		return;
+	}
+
+	if(sampler->type == SAMPLER_JITTER)
+	{	/* an m x n grid of cells, each also in its own row of n x m */
+		seed = sampler_seed(x, y);
+		m = (unsigned int)sqrtf((float)sampler->count);
+		n = (sampler->count + m - 1) / m;
+		index = sampler_permute(index, sampler->count, seed * 0x51633e2du);
+		*u = (sampler_permute(index % m, m, seed * 0x68bc21ebu) +
+			(sampler_permute(index / m, n, seed * 0x02e5be93u) +
+			sampler_random(index, seed * 0x967a889bu)) / n) / m;
+		*v = (index + sampler_random(index, seed * 0x368cc8b7u)) /
+			sampler->count;
+		/* rounding may reach the far edge */
+		if(*u >= 1.0f)
+			*u = 0.99999994f;
+		if(*v >= 1.0f)
+			*v = 0.99999994f;
+		return;
+	}
+
+	/* grid - leading samples first, then the other cells row by row */
+	if(index < sampler->nCoarse)
+	{
+		cell = sampler->coarse[index];
+	}
+	else
+	{
+		cell = index - sampler->nCoarse;
+		for(; i < sampler->nCoarse; ++i)
+		{
+			if(cell >= sampler->coarse[i])
+				++cell;
+		}
+	}
+	*u = (cell % sampler->side + 0.5f) / sampler->side;
+	*v = (cell / sampler->side + 0.5f) / sampler->side;
+}
@@ -0,0 +1,58 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 14, 2008
+ * sampler.h
+ *
+ * This file contains the definition for the samplers that place the sub
+ * samples of a pixel.  A sampler hands out any number of offsets inside
+ * the pixel, worked out from nothing but the pixel and the sample index
+ * so an image never depends on which thread renders which tile.
+ *
+ * grid	- the regular sqrt(n) x sqrt(n) lattice (n must be square)
+ * jitter	- correlated multi-jittered samples: one per cell of a grid
+ * 		  that fits n, jittered and shuffled per pixel
+ * sobol	- the 2D Sobol sequence, Owen scrambled per pixel
+ *
+ * The first few samples of every sampler are spread over the whole pixel
+ * (see sampler_t.nCoarse) so adaptive sampling can look at them first.
+ * Sobol prefixes are stratified at every power of 2, jittered prefixes
+ * are only random.
+ */
+
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+/* kinds of sampler */
+#define SAMPLER_GRID		0
+#define SAMPLER_JITTER		1
+#define SAMPLER_SOBOL		2
+
+typedef struct
+{
+	unsigned int	type;		/* SAMPLER_* */
+	unsigned int	count;		/* samples per pixel */
+	unsigned int	nCoarse;	/* leading samples that cover the pixel
+					 * on their own */
+	unsigned int	side;		/* grid - samples along each axis */
+	unsigned int	coarse[4];	/* grid - lattice cells of the leading
+					 * samples, row by row */
+} sampler_t;
+
+/* set up a sampler of a type for count samples per pixel.  A grid needs
+ * a square count, anything else is rounded down to one */
+sampler_t* sampler_init(sampler_t *sampler, unsigned int type,
+			unsigned int count);
+
+/* gets the type of sampler called name, -1 if there is none */
+int sampler_type(const char *name);
+
+/* gets the name of a type of sampler */
+const char* sampler_name(unsigned int type);
+
+/* gets the offset of sample index of pixel (x, y) inside the pixel, both
+ * coordinates in [0, 1) */
+void sampler_get(const sampler_t *sampler, unsigned int x, unsigned int y,
+			unsigned int index, float *u, float *v);
+
+#endif
@@ -5,6 +5,33 @@
  * Ray Tracing Project
  *
  * This file contains the definitions for functions associated with scene management.
+ *
+ * Scene files are made of blocks, '#' starts a comment that runs to the
+ * end of the line:
+ *
+ *	desc		{ [nObjects nLights] background r g b  ambient r g b
+ *			  ldmax l  lmax l  accel bvh|grid|none }
+ *	camera		{ position x y z  lookat x y z  upvector x y z
+ *			  projection fovY nearZ farZ }
+ *	pointlight	{ position x y z  diffuse r g b  range r }
+ *	sphere		{ name s  position x y z  radius r  <material> }
+ *	polygon		{ name s  point x y z  point x y z ...  <material> }
+ *	mesh		{ name s  vertex x y z ...  triangle a b c ...
+ *			  <material> }
+ *	mesh		{ name s  file path  <material> }
+ *
+ *	<material>	diffuse r g b  specular r g b  ka k  kd k  ks k  ke k
+ *			kr k  kt k  ior n
+ *
+ * Mesh triangles are counter clockwise from the front and index the
+ * vertices of their block from 0.  A mesh file is an OBJ or PLY file (see
+ * meshfile.h), relative paths start at the scene file's directory.  accel
+ * picks what rays are traced with: a hierarchy (the default), a uniform
+ * grid (see grid.h) or a test of every object.  Every key is optional and
+ * falls back to a default.  The file is mapped into memory and tokenized
+ * in place.  Big files are cut into chunks at lines that start a block and
+ * the chunks are parsed on every cpu, then stitched back together in file
+ * order.
  */
 
 #define _CRT_SECURE_NO_WARNINGS
@@ -15,254 +42,1028 @@
 	#include <free_align.h>
 #endif
 
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "scene.h"
+#include "bvh.h"
+#include "cscene.h"
+#include "grid.h"
+#include "lightbvh.h"
+#include "lightgrid.h"
+#include "mesh.h"
+#include "meshfile.h"
+#include "scenebin.h"
+#include "scheduler.h"
 
-/* load scene and camera properties from file */
-int parse_scene(const char *filename, scene_t *scene)
+/* files are cut into chunks of about this many bytes for parsing */
+#define SCENE_CHUNK_SIZE	(4 * 1024 * 1024)
+
+/* settings a chunk may have found (last one in the file wins) */
+#define SCENE_SET_EYE		0x001
+#define SCENE_SET_LOOKAT	0x002
+#define SCENE_SET_UP		0x004
+#define SCENE_SET_PROJECTION	0x008
+#define SCENE_SET_BACKGROUND	0x010
+#define SCENE_SET_AMBIENT	0x020
+#define SCENE_SET_LDMAX		0x040
+#define SCENE_SET_LMAX		0x080
+#define SCENE_SET_COUNTS	0x100
+#define SCENE_SET_ACCEL		0x200
+
+/* a token - points straight into the file, not null terminated */
+typedef struct
 {
-	/* open file for reading */
-	FILE* fp = fopen(filename, "r");
-	char string_buffer[STRING_BUFFER_SIZE];
-	char ch = '\0';		/*for flushing comment lines*/
+	const char	*str;
+	unsigned int	len;
+} token_t;
 
-	if(!fp)
+/* a mesh block that loads its triangles from a file */
+typedef struct
+{
+	unsigned int	object;		/* index into the chunk's objects */
+	token_t		path;
+} mesh_file_t;
+
+/* everything one chunk of the file produced */
+typedef struct
+{
+	const char	*begin;		/* range of the file to parse */
+	const char	*end;
+	const char	*p;		/* tokenizer position */
+
+	object3d_t	*objects;	/* objects in file order */
+	unsigned int	nObjects;
+	unsigned int	maxObjects;
+	unsigned int	*firstVertex;	/* per object - first polygon vertex */
+	point_t		*vertices;	/* polygon vertices of this chunk */
+	unsigned int	nVertices;
+	unsigned int	maxVertices;
+	unsigned int	*indices;	/* triangles of the mesh being parsed */
+	unsigned int	nIndices;
+	unsigned int	maxIndices;
+	mesh_file_t	*meshFiles;	/* meshes to load once parsed */
+	unsigned int	nMeshFiles;
+	unsigned int	maxMeshFiles;
+	pointlight_t	*lights;
+	unsigned int	nLights;
+	unsigned int	maxLights;
+
+	unsigned int	settings;	/* SCENE_SET_* found in this chunk */
+	scene_t		values;		/* their values */
+	unsigned int	descObjects;	/* counts from a desc block */
+	unsigned int	descLights;
+
+	const char	*error;		/* first error message, if any */
+	const char	*errorPos;	/* where it happened */
+
+	/* where this chunk's results went in the scene */
+	scene_t		*scene;
+	unsigned int	objectBase;
+	unsigned int	vertexBase;
+} parse_chunk_t;
+
+/* allocate memory for scene data - aligned for DMA on Cell */
+static void* scene_alloc(size_t size)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	return _malloc_align(size ? size : 16, 4);
+#else
+	return malloc(size ? size : 16);
+#endif
+}
+
+/* free memory from scene_alloc() */
+static void scene_release(void *p)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	_free_align(p);
+#else
+	free(p);
+#endif
+}
+
+/* make room for one more element of a growing array */
+static void* grow_array(void *array, unsigned int count, unsigned int *max,
+			size_t size)
+{
+	if(count < *max)
+		return array;
+	*max = *max ? *max * 2 : 64;
+	return realloc(array, size * *max);
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+		c == '\f' || c == '\v';
+}
+
+/* get the next token of a chunk - '{' and '}' are always tokens of their
+ * own, '#' comments are skipped.  Returns 0 at the end of the chunk */
+static int next_token(parse_chunk_t *c, token_t *tok)
+{
+	const char *p = c->p;
+
+	for(;;)
 	{
-		printf("Error opening file {%s} for reading.\n", filename);
+		while(p < c->end && is_space(*p))
+			++p;
+		if(p < c->end && *p == '#')
+		{	/* comment - flush rest of line */
+			while(p < c->end && *p != '\n')
+				++p;
+			continue;
+		}
+		break;
+	}
+
+	if(p >= c->end)
+	{
+		c->p = p;
 		return 0;
 	}
-	
-	/* scan while not end of file */
-	while(!feof(fp))
+
+	tok->str = p;
+	if(*p == '{' || *p == '}')
+	{
+		++p;
+	}
+	else
+	{
+		while(p < c->end && !is_space(*p) && *p != '{' && *p != '}' &&
+			*p != '#')
+			++p;
+	}
+	tok->len = (unsigned int)(p - tok->str);
+	c->p = p;
+
+	return 1;
+}
+
+/* compare a token against a keyword */
+static int token_is(const token_t *tok, const char *word)
+{
+	return strlen(word) == tok->len && !memcmp(tok->str, word, tok->len);
+}
+
+/* parse a decimal number (digits, fraction, exponent and a trailing 'f'
+ * like a C literal).  Up to 19 significant digits are kept in an integer
+ * and scaled by an exact power of ten in one step, which is correctly
+ * rounded for everything a scene file normally holds.
+ * Returns 0 if the token is not a number */
+static int token_float(const token_t *tok, float *out)
+{
+	static const double	pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22 };
+	const char		*p = tok->str;
+	const char		*end = p + tok->len;
+	unsigned long long	mant = 0;
+	int			digits = 0;	/* significant digits in mant */
+	int			exp10 = 0;
+	int			e = 0;
+	int			neg = 0;
+	int			negExp = 0;
+	int			any = 0;
+	double			value;
+
+	if(p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	for(; p < end && *p >= '0' && *p <= '9'; ++p)
+	{
+		any = 1;
+		if(digits < 19)
+		{
+			mant = mant * 10 + (*p - '0');
+			digits += mant != 0;
+		}
+		else
+		{
+			++exp10;
+		}
+	}
+	if(p < end && *p == '.')
 	{
-		/* scan the next string found in file
-		 * ignore scan if error is returned */
-		if(fscanf(fp, "%s", string_buffer) > 0)
+		for(++p; p < end && *p >= '0' && *p <= '9'; ++p)
 		{
-			/* printf("Token found:\t %s\n", string_buffer); */
-			/* if we read in a comment, flush rest of line */
-			if(string_buffer[0] == '#')
+			any = 1;
+			if(digits < 19)
 			{
-				/* printf("Flushing comment...\n"); */
-				/* read every character until newline is read 
- * 				 * or until fscanf stops reading for some
- * 				 * reason like eof */
-				while(ch != '\n' && fscanf(fp, "%c", &ch) > 0);
-				ch = '\0'; /* finished */
+				mant = mant * 10 + (*p - '0');
+				digits += mant != 0;
+				--exp10;
 			}
-			else 
+		}
+	}
+	if(!any)
+		return 0;
+
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+		if(p < end && (*p == '-' || *p == '+'))
+			negExp = *p++ == '-';
+		if(p >= end || *p < '0' || *p > '9')
+			return 0;
+		for(; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			if(e < 10000)
+				e = e * 10 + (*p - '0');
+		}
+		exp10 += negExp ? -e : e;
+	}
+	if(p < end && (*p == 'f' || *p == 'F'))
+		++p;
+	if(p != end)
+		return 0;
+
+	value = (double)mant;
+	if(exp10 < 0)
+		value /= (exp10 >= -22) ? pow10[-exp10] : pow(10.0, -exp10);
+	else if(exp10 > 0)
+		value *= (exp10 <= 22) ? pow10[exp10] : pow(10.0, exp10);
+
+	*out = (float)(neg ? -value : value);
+	return 1;
+}
+
+/* parse an unsigned decimal integer.  Returns 0 if the token is not one
+ * or does not fit an unsigned int */
+static int token_uint(const token_t *tok, unsigned int *out)
+{
+	unsigned int	i = 0;
+	unsigned int	value = 0;
+	unsigned int	digit;
+
+	if(!tok->len)
+		return 0;
+	for(; i < tok->len; ++i)
+	{
+		if(tok->str[i] < '0' || tok->str[i] > '9')
+			return 0;
+		digit = tok->str[i] - '0';
+		if(value > (UINT_MAX - digit) / 10)
+			return 0;
+		value = value * 10 + digit;
+	}
+	*out = value;
+	return 1;
+}
+
+/* record the first error of a chunk */
+static int parse_error(parse_chunk_t *c, const char *pos, const char *msg)
+{
+	if(!c->error)
+	{
+		c->error = msg;
+		c->errorPos = pos;
+	}
+	return 0;
+}
+
+/* read n numbers following a key */
+static int parse_floats(parse_chunk_t *c, float *out, unsigned int n)
+{
+	token_t		tok;
+	unsigned int	i = 0;
+
+	for(; i < n; ++i)
+	{
+		if(!next_token(c, &tok))
+			return parse_error(c, c->p, "unexpected end of file");
+		if(!token_float(&tok, &out[i]))
+			return parse_error(c, tok.str, "expected a number");
+	}
+	return 1;
+}
+
+/* read x y z following a key - w is 1 for points, 0 for vectors */
+static int parse_vector(parse_chunk_t *c, vector4_t *v, float w)
+{
+	float f[3];
+
+	if(!parse_floats(c, f, 3))
+		return 0;
+	*v = vec4v_make(f[0], f[1], f[2], w);
+	return 1;
+}
+
+/* read r g b following a key */
+static int parse_color(parse_chunk_t *c, color_t *color)
+{
+	float f[3];
+
+	if(!parse_floats(c, f, 3))
+		return 0;
+	*color = colorv_make(f[0], f[1], f[2]);
+	return 1;
+}
+
+/* material key of an object block.  Returns -1 if the key is not a
+ * material key, otherwise whether it parsed */
+static int parse_material_key(parse_chunk_t *c, const token_t *key,
+				material_t *m)
+{
+	if(token_is(key, "diffuse"))
+		return parse_color(c, &m->colors[MATERIAL_DIFFUSECOLOR]);
+	if(token_is(key, "specular"))
+		return parse_color(c, &m->colors[MATERIAL_SPECULARCOLOR]);
+	if(token_is(key, "ka"))
+		return parse_floats(c, &m->phong_ka, 1);
+	if(token_is(key, "kd"))
+		return parse_floats(c, &m->phong_kd, 1);
+	if(token_is(key, "ks"))
+		return parse_floats(c, &m->phong_ks, 1);
+	if(token_is(key, "ke"))
+		return parse_floats(c, &m->phong_ke, 1);
+	if(token_is(key, "kr"))
+		return parse_floats(c, &m->kr, 1);
+	if(token_is(key, "kt"))
+		return parse_floats(c, &m->kt, 1);
+	if(token_is(key, "ior"))
+		return parse_floats(c, &m->n, 1);
+	return -1;
+}
+
+/* material of objects that do not say otherwise */
+static void default_material(material_t *m)
+{
+	m->colors[MATERIAL_DIFFUSECOLOR] = colorv_make(1.0f, 1.0f, 1.0f);
+	m->colors[MATERIAL_SPECULARCOLOR] = colorv_make(1.0f, 1.0f, 1.0f);
+	m->phong_ka = 0.1f;
+	m->phong_kd = 0.7f;
+	m->phong_ks = 0.2f;
+	m->phong_ke = 20.0f;
+	m->kr = 0.0f;
+	m->kt = 0.0f;
+	m->n = 1.0f;
+}
+
+/* parse the 3 vertex indices of a mesh triangle */
+static int parse_triangle(parse_chunk_t *c)
+{
+	token_t		tok;
+	unsigned int	index;
+	unsigned int	i = 0;
+
+	for(; i < 3; ++i)
+	{
+		if(!next_token(c, &tok))
+			return parse_error(c, c->p, "unexpected end of file");
+		if(!token_uint(&tok, &index))
+			return parse_error(c, tok.str, "expected a vertex index");
+		c->indices = grow_array(c->indices, c->nIndices, &c->maxIndices,
+					sizeof(unsigned int));
+		c->indices[c->nIndices++] = index;
+	}
+	return 1;
+}
+
+/* move the vertices and triangles collected for a mesh into its own
+ * buffers.  The vertices are taken back off the chunk's polygon vertices */
+static int finish_mesh(parse_chunk_t *c, const token_t *block, mesh_t *mesh)
+{
+	unsigned int	first = c->firstVertex[c->nObjects - 1];
+	unsigned int	nVertices = c->nVertices - first;
+	unsigned int	i = 0;
+
+	if(!c->nIndices)
+		return parse_error(c, block->str, "mesh needs at least 1 triangle");
+	for(; i < c->nIndices; ++i)
+	{
+		if(c->indices[i] >= nVertices)
+			return parse_error(c, block->str,
+				"mesh triangle uses a missing vertex");
+	}
+
+	mesh_init(mesh, nVertices, c->nIndices / 3);
+	for(i = 0; i < nVertices; ++i)
+	{
+		mesh->vx[i] = c->vertices[first + i].x;
+		mesh->vy[i] = c->vertices[first + i].y;
+		mesh->vz[i] = c->vertices[first + i].z;
+	}
+	memcpy(mesh->index, c->indices, sizeof(unsigned int) * c->nIndices);
+	c->nVertices = first;
+	c->nIndices = 0;
+
+	return 1;
+}
+
+/* parse the keys of a block up to and including its closing brace.
+ * Called with the block keyword already read */
+static int parse_block(parse_chunk_t *c, const token_t *block)
+{
+	token_t		tok;
+	token_t		key;
+	token_t		path;		/* mesh file */
+	object3d_t	*obj = 0;
+	pointlight_t	*light = 0;
+	scene_t		*v = &c->values;
+	float		f[3];
+	int		result;
+
+	if(!next_token(c, &tok) || !token_is(&tok, "{"))
+		return parse_error(c, block->str, "expected { after block name");
+	path.len = 0;
+
+	if(token_is(block, "sphere") || token_is(block, "polygon") ||
+		token_is(block, "mesh"))
+	{
+		c->objects = grow_array(c->objects, c->nObjects, &c->maxObjects,
+					sizeof(object3d_t));
+		c->firstVertex = realloc(c->firstVertex,
+					sizeof(unsigned int) * c->maxObjects);
+		c->firstVertex[c->nObjects] = c->nVertices;
+		obj = &c->objects[c->nObjects++];
+		memset(obj, 0, sizeof(object3d_t));
+		default_material(&obj->material);
+		if(token_is(block, "sphere"))
+		{
+			obj->geometryType = GEOMETRY_SPHERE;
+			obj->sphr_obj.center = vec4v_make(0.0f, 0.0f, 0.0f, 1.0f);
+			obj->sphr_obj.radius = 1.0f;
+		}
+		else if(token_is(block, "mesh"))
+		{
+			obj->geometryType = GEOMETRY_TRIANGLE_MESH;
+			c->nIndices = 0;
+		}
+		else
+		{
+			obj->geometryType = GEOMETRY_POLYGON;
+		}
+#if !defined(__SPU__) && !defined(__PPU__)
+		/* names are not kept, the block type is enough for debugging */
+		obj->debugName = obj->geometryType == GEOMETRY_SPHERE ? "sphere" :
+			obj->geometryType == GEOMETRY_POLYGON ? "polygon" : "mesh";
+#endif
+	}
+	else if(token_is(block, "pointlight"))
+	{
+		c->lights = grow_array(c->lights, c->nLights, &c->maxLights,
+					sizeof(pointlight_t));
+		light = &c->lights[c->nLights++];
+		light->position = vec4v_make(0.0f, 0.0f, 0.0f, 1.0f);
+		light->color = colorv_make(1.0f, 1.0f, 1.0f);
+		light->range = 150.0f;
+	}
+	else if(!token_is(block, "camera") && !token_is(block, "desc"))
+	{
+		return parse_error(c, block->str, "unknown block");
+	}
+
+	for(;;)
+	{
+		if(!next_token(c, &key))
+			return parse_error(c, block->str, "block is missing its }");
+		if(token_is(&key, "}"))
+			break;
+
+		result = -1;
+		if(obj)
+		{
+			if(token_is(&key, "name"))
 			{
-				if(!strcmp(string_buffer, "camera"))
-				{	/* if we read the camera token */
-					
-				}
-				else if(strcmp(string_buffer, ""))
-				{
-
-				}
-				else if(strcmp(string_buffer, ""))
-				{
-
-				}
-				else if(strcmp(string_buffer, ""))
-				{
-
-				}
-				else if(strcmp(string_buffer, ""))
-				{
-
-				}
+				result = next_token(c, &tok);
+			}
+			else if(obj->geometryType == GEOMETRY_SPHERE &&
+				token_is(&key, "position"))
+			{
+				result = parse_vector(c, &obj->sphr_obj.center, 1.0f);
+			}
+			else if(obj->geometryType == GEOMETRY_SPHERE &&
+				token_is(&key, "radius"))
+			{
+				result = parse_floats(c, &obj->sphr_obj.radius, 1);
+			}
+			else if(obj->geometryType == GEOMETRY_POLYGON &&
+				token_is(&key, "point"))
+			{
+				c->vertices = grow_array(c->vertices, c->nVertices,
+					&c->maxVertices, sizeof(point_t));
+				result = parse_vector(c, &c->vertices[c->nVertices++],
+					1.0f);
+				++obj->poly_obj.nVerticies;
+			}
+			else if(obj->geometryType == GEOMETRY_TRIANGLE_MESH &&
+				token_is(&key, "vertex"))
+			{
+				c->vertices = grow_array(c->vertices, c->nVertices,
+					&c->maxVertices, sizeof(point_t));
+				result = parse_vector(c, &c->vertices[c->nVertices++],
+					1.0f);
+			}
+			else if(obj->geometryType == GEOMETRY_TRIANGLE_MESH &&
+				token_is(&key, "triangle"))
+			{
+				result = parse_triangle(c);
+			}
+			else if(obj->geometryType == GEOMETRY_TRIANGLE_MESH &&
+				token_is(&key, "file"))
+			{
+				result = next_token(c, &path);
+			}
+			else
+			{
+				result = parse_material_key(c, &key, &obj->material);
 			}
 		}
+		else if(light)
+		{
+			if(token_is(&key, "position"))
+				result = parse_vector(c, &light->position, 1.0f);
+			else if(token_is(&key, "diffuse"))
+				result = parse_color(c, &light->color);
+			else if(token_is(&key, "range"))
+				result = parse_floats(c, &light->range, 1);
+		}
+		else if(token_is(block, "camera"))
+		{
+			if(token_is(&key, "position"))
+			{
+				result = parse_vector(c, &v->eyePos, 1.0f);
+				c->settings |= SCENE_SET_EYE;
+			}
+			else if(token_is(&key, "lookat"))
+			{
+				result = parse_vector(c, &v->lookAt, 1.0f);
+				c->settings |= SCENE_SET_LOOKAT;
+			}
+			else if(token_is(&key, "upvector"))
+			{
+				result = parse_vector(c, &v->upVec, 0.0f);
+				c->settings |= SCENE_SET_UP;
+			}
+			else if(token_is(&key, "projection"))
+			{
+				result = parse_floats(c, f, 3);
+				v->fovY = f[0];
+				v->nearZ = f[1];
+				v->farZ = f[2];
+				c->settings |= SCENE_SET_PROJECTION;
+			}
+		}
+		else
+		{	/* desc */
+			if(token_float(&key, &f[0]))
+			{	/* object and light counts, in that order */
+				result = parse_floats(c, &f[1], 1);
+				c->descObjects = (unsigned int)f[0];
+				c->descLights = (unsigned int)f[1];
+				c->settings |= SCENE_SET_COUNTS;
+			}
+			else if(token_is(&key, "background"))
+			{
+				result = parse_color(c, &v->bgColor);
+				c->settings |= SCENE_SET_BACKGROUND;
+			}
+			else if(token_is(&key, "ambient"))
+			{
+				result = parse_color(c, &v->ambientLightColor);
+				c->settings |= SCENE_SET_AMBIENT;
+			}
+			else if(token_is(&key, "ldmax"))
+			{
+				result = parse_floats(c, &v->ldMax, 1);
+				c->settings |= SCENE_SET_LDMAX;
+			}
+			else if(token_is(&key, "lmax"))
+			{
+				result = parse_floats(c, &v->lMax, 1);
+				c->settings |= SCENE_SET_LMAX;
+			}
+			else if(token_is(&key, "accel"))
+			{
+				result = next_token(c, &tok);
+				if(result && token_is(&tok, "bvh"))
+					v->accel = SCENE_ACCEL_BVH;
+				else if(result && token_is(&tok, "grid"))
+					v->accel = SCENE_ACCEL_GRID;
+				else if(result && token_is(&tok, "none"))
+					v->accel = SCENE_ACCEL_NONE;
+				else
+					result = 0;
+				c->settings |= SCENE_SET_ACCEL;
+			}
+		}
+
+		if(result < 0)
+			return parse_error(c, key.str, "unknown key");
+		if(result == 0)
+			return parse_error(c, key.str, "bad value for key");
 	}
 
-	
-	/* close file */
-	fclose(fp);
+	if(obj && obj->geometryType == GEOMETRY_POLYGON &&
+		obj->poly_obj.nVerticies < 3)
+		return parse_error(c, block->str, "polygon needs at least 3 points");
+	if(obj && obj->geometryType == GEOMETRY_TRIANGLE_MESH && path.len)
+	{	/* loaded once the whole scene file is parsed */
+		if(c->nIndices || c->nVertices != c->firstVertex[c->nObjects - 1])
+			return parse_error(c, block->str,
+				"mesh has both a file and triangles");
+		c->meshFiles = grow_array(c->meshFiles, c->nMeshFiles,
+					&c->maxMeshFiles, sizeof(mesh_file_t));
+		c->meshFiles[c->nMeshFiles].object = c->nObjects - 1;
+		c->meshFiles[c->nMeshFiles++].path = path;
+		return 1;
+	}
+	if(obj && obj->geometryType == GEOMETRY_TRIANGLE_MESH)
+		return finish_mesh(c, block, &obj->mesh_obj);
 
-	/* hard coded scene description */
-	scene->ldMax = 100.0f;
-	scene->lMax = 1000.0f;
+	return 1;
+}
 
-	scene->bgColor.r = .4470588f;
-	scene->bgColor.g = .6274501f;
-	scene->bgColor.b = .8705882f;
+/* task - parse every block of one chunk */
+static void parse_chunk(scheduler_t *sched, unsigned int worker, void *data)
+{
+	parse_chunk_t	*c = (parse_chunk_t *)data;
+	token_t		tok;
 
-	scene->nLights = 1;
-#if defined(__SPU__) || defined(__PPU__)
-	/* use malloc align so DMA can transfer this chunk of memory */
-	scene->lights = _malloc_align(sizeof(pointlight_t) * scene->nLights, 4);
+	c->p = c->begin;
+	while(next_token(c, &tok))
+	{
+		if(!parse_block(c, &tok))
+			return;
+	}
+}
+
+/* task - hook the polygons of a chunk up to the shared vertex and edge
+ * storage and precompute their planes and edges */
+static void finish_chunk(scheduler_t *sched, unsigned int worker, void *data)
+{
+	parse_chunk_t	*c = (parse_chunk_t *)data;
+	scene_t		*scene = c->scene;
+	polygon_t	*poly;
+	unsigned int	i = 0;
+	unsigned int	first;
+
+	/* a chunk without polygons never allocated its vertices */
+	if(c->nVertices)
+		memcpy(&scene->vertexPool[c->vertexBase], c->vertices,
+			sizeof(point_t) * c->nVertices);
+
+	for(; i < c->nObjects; ++i)
+	{
+		scene->objects[c->objectBase + i] = c->objects[i];
+		if(c->objects[i].geometryType != GEOMETRY_POLYGON)
+			continue;
+
+		poly = &scene->objects[c->objectBase + i].poly_obj;
+		first = c->vertexBase + c->firstVertex[i];
+		poly->vertex = &scene->vertexPool[first];
+		poly->edge = &scene->edgePool[first * 4];
+		/* generate the plane for this polygon given the first three points */
+		poly_plane(&poly->plane, poly);
+		/* and the edge equations used by the point in polygon test */
+		poly_prepare(poly);
+	}
+}
+
+/* start of the first line at or after p whose first token opens a block.
+ * Comments only run to the end of a line and keys inside blocks never
+ * start with a block name, so a file can safely be cut there */
+static const char* find_block_line(const char *begin, const char *p,
+				const char *end)
+{
+	static const char	*blocks[] = {
+		"desc", "camera", "pointlight", "sphere", "polygon", "mesh" };
+	const char		*line;
+	const char		*q;
+	unsigned int		i;
+	size_t			len;
+
+	/* move to the start of a line */
+	while(p > begin && p < end && p[-1] != '\n')
+		++p;
+
+	while(p < end)
+	{
+		line = p;
+		while(p < end && (*p == ' ' || *p == '\t'))
+			++p;
+		for(i = 0; i < sizeof(blocks) / sizeof(blocks[0]); ++i)
+		{
+			len = strlen(blocks[i]);
+			q = p + len;
+			if(q <= end && !memcmp(p, blocks[i], len) &&
+				(q == end || is_space(*q) || *q == '{'))
+				return line;
+		}
+		while(p < end && *p != '\n')
+			++p;
+		if(p < end)
+			++p;
+	}
+
+	return end;
+}
+
+/* print where a parse error happened */
+static void report_error(const char *filename, const char *file,
+			const parse_chunk_t *c)
+{
+	const char	*p = file;
+	unsigned int	line = 1;
+
+	for(; p < c->errorPos; ++p)
+	{
+		line += *p == '\n';
+	}
+	printf("Error parsing {%s} line %d: %s.\n", filename, line, c->error);
+}
+
+/* map a whole file into memory (read it on systems without mmap) */
+static const char* map_file(const char *filename, size_t *size)
+{
+#if defined(_WIN32)
+	FILE	*fp = fopen(filename, "rb");
+	char	*data;
+
+	if(!fp)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(*size ? *size : 1);
+	*size = fread(data, 1, *size, fp);
+	fclose(fp);
+	return data;
 #else
-	scene->lights = malloc(sizeof(pointlight_t) * scene->nLights);
+	struct stat	st;
+	void		*data;
+	int		fd = open(filename, O_RDONLY);
+
+	if(fd < 0)
+		return 0;
+	if(fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return 0;
+	}
+	*size = st.st_size;
+	if(*size == 0)
+	{	/* nothing to map - hand back any valid pointer */
+		close(fd);
+		return "";
+	}
+	data = mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return 0;
+	/* the file is read front to back exactly once */
+	madvise(data, *size, MADV_SEQUENTIAL);
+	return data;
 #endif
+}
 
-	scene->nObjects = 3;
-#if defined(__SPU__) || defined(__PPU__)
-	scene->objects = _malloc_align(sizeof(object3d_t) * scene->nObjects, 4);
+/* undo map_file() */
+static void unmap_file(const char *data, size_t size)
+{
+#if defined(_WIN32)
+	free((void *)data);
 #else
-	scene->objects = malloc(sizeof(object3d_t) * scene->nObjects);
-#endif
-	
-#if !defined(__SPU__) && !defined(__PPU__)
-	scene->objects[0].debugName = "Sphere 1";
+	if(size)
+		munmap((void *)data, size);
 #endif
-	scene->objects[0].sphr_obj.center.x = 0.0f;
-	scene->objects[0].sphr_obj.center.y = 5.0f;
-	scene->objects[0].sphr_obj.center.z = -6.0f;
-	scene->objects[0].sphr_obj.center.w = 1.0f;
-	scene->objects[0].sphr_obj.radius = 1.15f;
-	scene->objects[0].material.colors[MATERIAL_DIFFUSECOLOR].r = 1.0f;
-	scene->objects[0].material.colors[MATERIAL_DIFFUSECOLOR].b = 1.0f;
-	scene->objects[0].material.colors[MATERIAL_DIFFUSECOLOR].g = 1.0f;
-	scene->objects[0].material.colors[MATERIAL_SPECULARCOLOR].r = 1.0f;
-	scene->objects[0].material.colors[MATERIAL_SPECULARCOLOR].b = 1.0f;
-	scene->objects[0].material.colors[MATERIAL_SPECULARCOLOR].g = 1.0f;
-	scene->objects[0].material.phong_ke = 20.0f;
-	scene->objects[0].material.phong_kd = 0.075f;
-	scene->objects[0].material.phong_ks = 0.2f;
-	scene->objects[0].material.phong_ka = 0.075f;
-	scene->objects[0].material.kr = 0.01f;
-	scene->objects[0].material.kt = 0.85f;
-	scene->objects[0].material.n = 0.95f;
-	scene->objects[0].geometryType = GEOMETRY_SPHERE;
+}
 
-#if !defined(__SPU__) && !defined(__PPU__)
-	scene->objects[1].debugName = "Sphere 2";
-#endif
-	scene->objects[1].sphr_obj.center.x = -1.25f;
-	scene->objects[1].sphr_obj.center.y = 3.75f;
-	scene->objects[1].sphr_obj.center.z = -7.25f;
-	scene->objects[1].sphr_obj.center.w = 1.0f;
-	scene->objects[1].sphr_obj.radius = 1.0f;
-	scene->objects[1].material.colors[MATERIAL_DIFFUSECOLOR].r = 0.7f;
-	scene->objects[1].material.colors[MATERIAL_DIFFUSECOLOR].b = 0.7f;
-	scene->objects[1].material.colors[MATERIAL_DIFFUSECOLOR].g = 0.7f;
-	scene->objects[1].material.colors[MATERIAL_SPECULARCOLOR].r = 1.0f;
-	scene->objects[1].material.colors[MATERIAL_SPECULARCOLOR].b = 1.0f;
-	scene->objects[1].material.colors[MATERIAL_SPECULARCOLOR].g = 1.0f;
-	scene->objects[1].material.phong_ke = 20.0f;
-	scene->objects[1].material.phong_kd = 0.25f;
-	scene->objects[1].material.phong_ks = 1.0f;
-	scene->objects[1].material.phong_ka = 0.15f;
-	scene->objects[1].material.kr = 0.75f;
-	scene->objects[1].material.kt = 0.0f;
-	scene->objects[1].material.n = 1.0f;
-	scene->objects[1].geometryType = GEOMETRY_SPHERE;
+/* load the meshes of every chunk that come from files.  Each file is
+ * parsed on every cpu itself, so they are loaded one after another */
+static int load_mesh_files(const char *filename, parse_chunk_t *chunks,
+			unsigned int nChunks)
+{
+	const char	*slash = strrchr(filename, '/');
+	size_t		dirLen = slash ? (size_t)(slash - filename) + 1 : 0;
+	size_t		len;
+	const token_t	*path;
+	char		*name;
+	unsigned int	i = 0;
+	unsigned int	j;
+	int		ok = 1;
 
-#if !defined(__SPU__) && !defined(__PPU__)
-	scene->objects[2].debugName = "Floor";
-#endif
-	scene->objects[2].poly_obj.nVerticies = 4;
+	for(; i < nChunks && ok; ++i)
+	{
+		for(j = 0; j < chunks[i].nMeshFiles && ok; ++j)
+		{
+			path = &chunks[i].meshFiles[j].path;
+			/* relative to the directory of the scene file */
+			len = path->str[0] == '/' ? 0 : dirLen;
+			name = malloc(len + path->len + 1);
+			memcpy(name, filename, len);
+			memcpy(name + len, path->str, path->len);
+			name[len + path->len] = '\0';
+			ok = meshfile_load(name, &chunks[i].objects[
+				chunks[i].meshFiles[j].object].mesh_obj);
+			free(name);
+		}
+	}
 
-#if defined(__SPU__) || defined(__PPU__)
-	scene->objects[2].poly_obj.vertex = _malloc_align(
-		sizeof(vector4_t)*scene->objects[2].poly_obj.nVerticies, 4);
-#else
-	scene->objects[2].poly_obj.vertex = malloc(
-		sizeof(vector4_t)*scene->objects[2].poly_obj.nVerticies);
-#endif
+	return ok;
+}
+
+/* load scene and camera properties from file */
+int parse_scene(const char *filename, scene_t *scene)
+{
+	size_t		size = 0;
+	const char	*file = map_file(filename, &size);
+	const char	*end = file + size;
+	const char	*p;
+	parse_chunk_t	*chunks;
+	parse_chunk_t	*c;
+	scheduler_t	*sched = 0;
+	unsigned int	nChunks = 0;
+	unsigned int	maxChunks;
+	unsigned int	nVertices = 0;
+	unsigned int	nLights = 0;
+	unsigned int	i = 0;
+	unsigned int	j;
+	int		ok = 1;
+
+	if(!file)
+	{
+		printf("Error opening file {%s} for reading.\n", filename);
+		return 0;
+	}
+
+	/* cut the file into chunks that each start at a block */
+	maxChunks = (unsigned int)(size / SCENE_CHUNK_SIZE) + 1;
+	chunks = calloc(maxChunks, sizeof(parse_chunk_t));
+	p = file;
+	do
+	{
+		c = &chunks[nChunks++];
+		c->begin = p;
+		c->end = (nChunks == maxChunks ||
+			(size_t)(end - p) <= SCENE_CHUNK_SIZE) ? end :
+			find_block_line(file, p + SCENE_CHUNK_SIZE, end);
+		p = c->end;
+	} while(p < end);
+
+	/* parse chunks - on every cpu if there is more than one */
+	if(nChunks > 1)
+	{
+		sched = scheduler_create(0);
+		for(i = 0; i < nChunks; ++i)
+		{
+			scheduler_push(sched, i % sched->nWorkers, parse_chunk, &chunks[i]);
+		}
+		scheduler_run(sched);
+	}
+	else
+	{
+		parse_chunk(0, 0, &chunks[0]);
+	}
+
+	/* settle where every chunk goes, first error in the file wins */
+	scene->nObjects = 0;
+	for(i = 0; i < nChunks && ok; ++i)
+	{
+		c = &chunks[i];
+		if(c->error)
+		{
+			report_error(filename, file, c);
+			ok = 0;
+		}
+		c->scene = scene;
+		c->objectBase = scene->nObjects;
+		c->vertexBase = nVertices;
+		scene->nObjects += c->nObjects;
+		nLights += c->nLights;
+		nVertices += c->nVertices;
+	}
+	if(ok)
+		ok = load_mesh_files(filename, chunks, nChunks);
+
+	if(ok)
+	{
+		/* defaults for everything a file may leave out */
+		scene->ldMax = 100.0f;
+		scene->lMax = 1000.0f;
+		scene->bgColor = colorv_make(.4470588f, .6274501f, .8705882f);
+		scene->ambientLightColor = colorv_make(1.0f, 1.0f, 1.0f);
+		scene->eyePos = vec4v_make(0.0f, 0.0f, 0.0f, 1.0f);
+		scene->lookAt = vec4v_make(0.0f, 0.0f, -1.0f, 1.0f);
+		scene->upVec = vec4v_make(0.0f, 1.0f, 0.0f, 0.0f);
+		scene->fovY = 45.0f;
+		scene->nearZ = 1.0f;
+		scene->farZ = 200.0f;
+
+		scene->bvh = 0;
+		scene->bvh4 = 0;
+		scene->grid = 0;
+		scene->accel = SCENE_ACCEL_BVH;
+		scene->compiled = 0;
+		scene->lightGrid = 0;
+		scene->lightBvh = 0;
+		scene->mapping = 0;
+		scene->mappingSize = 0;
+		scene->nLights = 0;
+		scene->lights = scene_alloc(sizeof(pointlight_t) * nLights);
+		scene->objects = scene_alloc(sizeof(object3d_t) * scene->nObjects);
+		scene->vertexPool = scene_alloc(sizeof(point_t) * nVertices);
+		scene->edgePool = scene_alloc(sizeof(float) * 4 * nVertices);
+
+		/* lights and settings in file order */
+		for(i = 0; i < nChunks; ++i)
+		{
+			c = &chunks[i];
+			if(c->nLights)
+				memcpy(&scene->lights[scene->nLights], c->lights,
+					sizeof(pointlight_t) * c->nLights);
+			scene->nLights += c->nLights;
+
+			if(c->settings & SCENE_SET_EYE)
+				scene->eyePos = c->values.eyePos;
+			if(c->settings & SCENE_SET_LOOKAT)
+				scene->lookAt = c->values.lookAt;
+			if(c->settings & SCENE_SET_UP)
+				scene->upVec = c->values.upVec;
+			if(c->settings & SCENE_SET_PROJECTION)
+			{
+				scene->fovY = c->values.fovY;
+				scene->nearZ = c->values.nearZ;
+				scene->farZ = c->values.farZ;
+			}
+			if(c->settings & SCENE_SET_BACKGROUND)
+				scene->bgColor = c->values.bgColor;
+			if(c->settings & SCENE_SET_AMBIENT)
+				scene->ambientLightColor = c->values.ambientLightColor;
+			if(c->settings & SCENE_SET_LDMAX)
+				scene->ldMax = c->values.ldMax;
+			if(c->settings & SCENE_SET_LMAX)
+				scene->lMax = c->values.lMax;
+			if(c->settings & SCENE_SET_ACCEL)
+				scene->accel = c->values.accel;
+			if((c->settings & SCENE_SET_COUNTS) &&
+				(c->descObjects != scene->nObjects ||
+				c->descLights != nLights))
+				printf("Warning: {%s} describes %d objects and %d lights "
+					"but has %d and %d.\n", filename, c->descObjects,
+					c->descLights, scene->nObjects, nLights);
+		}
+
+		/* objects, vertices and polygon edges */
+		if(sched)
+		{
+			for(i = 0; i < nChunks; ++i)
+			{
+				scheduler_push(sched, i % sched->nWorkers, finish_chunk,
+					&chunks[i]);
+			}
+			scheduler_run(sched);
+		}
+		else
+		{
+			finish_chunk(0, 0, &chunks[0]);
+		}
+
+		/* define N(into the scene) first */
+		scene->N = vec4v_normalize(vec4v_sub(scene->lookAt, scene->eyePos));
+		/* define V(up vector) second */
+		scene->V = scene->upVec;
+		/* define U(right vector) third */
+		scene->U = vec4v_cross(scene->N, scene->V);
+
+		/* intersection code only looks at the compiled objects */
+		cscene_build(scene);
+
+		printf("Parsed {%s}:\t%d objects, %d lights (%d chunks)\n",
+			filename, scene->nObjects, scene->nLights, nChunks);
+	}
+
+	for(i = 0; i < nChunks; ++i)
+	{
+		/* meshes parsed before an error went nowhere */
+		for(j = 0; !ok && j < chunks[i].nObjects; ++j)
+		{
+			if(chunks[i].objects[j].geometryType == GEOMETRY_TRIANGLE_MESH)
+				mesh_free(&chunks[i].objects[j].mesh_obj);
+		}
+		free(chunks[i].objects);
+		free(chunks[i].firstVertex);
+		free(chunks[i].vertices);
+		free(chunks[i].indices);
+		free(chunks[i].meshFiles);
+		free(chunks[i].lights);
+	}
+	free(chunks);
+	if(sched)
+		scheduler_free(sched);
+	unmap_file(file, size);
 
-	scene->objects[2].poly_obj.vertex[0].x = 7.0f;
-	scene->objects[2].poly_obj.vertex[0].y = 0.0f;
-	scene->objects[2].poly_obj.vertex[0].z = 0.0f;
-	scene->objects[2].poly_obj.vertex[0].w = 1.0f;
-
-	scene->objects[2].poly_obj.vertex[1].x = 7.0f;
-	scene->objects[2].poly_obj.vertex[1].y = 0.0f;
-	scene->objects[2].poly_obj.vertex[1].z = -100.0f;
-	scene->objects[2].poly_obj.vertex[1].w = 1.0f;
-
-	scene->objects[2].poly_obj.vertex[2].x = -15.0f;
-	scene->objects[2].poly_obj.vertex[2].y = 0.0f;
-	scene->objects[2].poly_obj.vertex[2].z = -100.0f;
-	scene->objects[2].poly_obj.vertex[2].w = 1.0f;
-
-	scene->objects[2].poly_obj.vertex[3].x = -15.0f;
-	scene->objects[2].poly_obj.vertex[3].y = 0.0f;
-	scene->objects[2].poly_obj.vertex[3].z = 0.0f;
-	scene->objects[2].poly_obj.vertex[3].w = 1.0f;
-	
-	/* generate the plane for this polygon given the first three points */
-	poly_plane(&scene->objects[2].poly_obj.plane, &scene->objects[2].poly_obj);
-
-	scene->objects[2].material.colors[MATERIAL_DIFFUSECOLOR].r = 0.0f;
-	scene->objects[2].material.colors[MATERIAL_DIFFUSECOLOR].b = 0.0f;
-	scene->objects[2].material.colors[MATERIAL_DIFFUSECOLOR].g = 1.0f;
-	scene->objects[2].material.colors[MATERIAL_SPECULARCOLOR].r = 1.0f;
-	scene->objects[2].material.colors[MATERIAL_SPECULARCOLOR].b = 1.0f;
-	scene->objects[2].material.colors[MATERIAL_SPECULARCOLOR].g = 1.0f;
-	scene->objects[2].material.phong_ke = 2.0f;
-	scene->objects[2].material.phong_kd = 0.7f;
-	scene->objects[2].material.phong_ks = 0.2f;
-	scene->objects[2].material.phong_ka = 0.1f;
-	scene->objects[2].material.kr = 0.0f;
-	scene->objects[2].material.kt = 0.0f;
-	scene->objects[2].material.n = 1.0f;
-	scene->objects[2].geometryType = GEOMETRY_POLYGON;
-
-	/* set the light properties */
-	scene->lights[0].color.r = 1.0f;
-	scene->lights[0].color.g = 1.0f;
-	scene->lights[0].color.b = 1.0f;
-	scene->lights[0].position.x = 1.0f;
-	scene->lights[0].position.y = 8.0f;
-	scene->lights[0].position.z = 1.0f;
-	scene->lights[0].position.w = 1.0f;
-	scene->lights[0].range = 150.0f;
-
-	
-	/* set the light properties */
-/*
-	scene->lights[1].color.r = 0.5f;
-	scene->lights[1].color.g = 0.5f;
-	scene->lights[1].color.b = 0.5f;
-	scene->lights[1].position.x = -4.0f;
-	scene->lights[1].position.y = 8.0f;
-	scene->lights[1].position.z = 1.0f;
-	scene->lights[1].position.w = 1.0f;
-	scene->lights[1].range = 150.0f;
-*/
-	
-
-	/* add ambient light to scene */
-	scene->ambientLightColor.r = 1.0f;
-	scene->ambientLightColor.g = 1.0f;
-	scene->ambientLightColor.b = 1.0f;
-
-
-	/* view matrix */
-	scene->eyePos.x = 0.0f;
-	scene->eyePos.y = 4.5f;
-	scene->eyePos.z = 0.0f;
-	scene->eyePos.w = 1.0f;
-
-	scene->lookAt.x = 0.0f;
-	scene->lookAt.y = 0.0f;
-	scene->lookAt.z = -1.0f;
-	scene->lookAt.w = 1.0f;
-	vec4_add(&scene->lookAt, &scene->eyePos, &scene->lookAt);
-
-	scene->upVec.x = 0.0f;
-	scene->upVec.y = 1.0f;
-	scene->upVec.z = 0.0f;
-	scene->upVec.w = 1.0f;
-
-	/* define N(into the scene) first */
-	vec4_sub(&scene->N, &scene->lookAt, &scene->eyePos);
-	vec4_normalize(&scene->N);
-	/* define V(up vector) second */
-	vec4_set(&scene->V, (float *)&scene->upVec);
-	/* define U(right vector) third */
-	vec4_cross(&scene->U, &scene->N, &scene->V);
-
-/*
-	mat4_viewv(&scene->viewMatrix,
-		&scene->eyePos,
-		&scene->lookAt,
-		&scene->upVec);
-*/
 #if defined(_DEBUG)
 	#if _DEBUG > 2
 		printf("Main sizeof(scene_t): %d\n", sizeof(scene_t));
@@ -277,39 +1078,105 @@ int parse_scene(const char *filename, scene_t *scene)
 	#endif
 #endif
 
-	return 1;
+	return ok;
 }
 
 /* cleanup dynamic memory from creating scene */
 void free_scene(scene_t *scene)
 {
-	unsigned int i = 0;
-	
-	/* free all lights */
-#if defined(__SPU__) || defined(__PPU__)
-	_free_align(scene->lights);
-#else
-	free(scene->lights);
-#endif
+	unsigned int	i = 0;
 
-	/* loop over every object */
-	for(; i < scene->nObjects; ++i)
-	{	/* if object is a polygon, free all of the verticies */
-		if(scene->objects[i].geometryType == GEOMETRY_POLYGON)
-#if defined(__SPU__) || defined (__PPU__)
-			_free_align(scene->objects[i].poly_obj.vertex);
-#else
-			free(scene->objects[i].poly_obj.vertex);
-#endif
+	/* free acceleration structure */
+	bvh4_free(scene->bvh4);
+	scene->bvh4 = 0;
+	grid_free(scene->grid);
+	scene->grid = 0;
+	bvh_free(scene->bvh);
+	scene->bvh = 0;
+	cscene_free(scene->compiled);
+	scene->compiled = 0;
+	lightgrid_free(scene->lightGrid);
+	scene->lightGrid = 0;
+	lightbvh_free(scene->lightBvh);
+	scene->lightBvh = 0;
+
+	/* everything else is part of a compiled scene file */
+	if(scene->mapping)
+	{
+		scenebin_unmap(scene);
+		return;
 	}
 
-	/* free all objects */
-#if defined(__SPU__) || defined (__PPU__)
-	_free_align(scene->objects);
-#else
-	free(scene->objects);
-#endif
+	/* free all lights, objects and the polygon vertices and edges */
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		if(scene->objects[i].geometryType == GEOMETRY_TRIANGLE_MESH)
+			mesh_free(&scene->objects[i].mesh_obj);
+	}
+	scene_release(scene->lights);
+	scene_release(scene->objects);
+	scene_release(scene->vertexPool);
+	scene_release(scene->edgePool);
+}
+
+/* tests if object is one of the scene of a geometry type, printing an
+ * error if not */
+static int scene_check_object(const scene_t *scene, unsigned int object,
+		unsigned int geometryType, const char *what)
+{
+	if(object < scene->nObjects &&
+		scene->objects[object].geometryType == geometryType)
+		return 1;
 
+	printf("Error moving object %u: not a %s.\n", object, what);
+	return 0;
 }
 
+/* move a sphere object to a new center and radius */
+int scene_move_sphere(scene_t *scene, unsigned int object,
+		const point_t *center, float radius)
+{
+	sphere_t *sphere;
+
+	if(!scene_check_object(scene, object, GEOMETRY_SPHERE, "sphere"))
+		return 0;
+
+	sphere = &scene->objects[object].sphr_obj;
+	sphere->center = *center;
+	sphere->radius = radius;
+	cscene_update(scene->compiled, scene, object);
+	return 1;
+}
+
+/* move the points of a polygon object */
+int scene_move_polygon(scene_t *scene, unsigned int object,
+		const point_t *points)
+{
+	polygon_t *poly;
 
+	if(!scene_check_object(scene, object, GEOMETRY_POLYGON, "polygon"))
+		return 0;
+
+	poly = &scene->objects[object].poly_obj;
+	memcpy(poly->vertex, points, sizeof(point_t) * poly->nVerticies);
+	/* plane and edge equations as when the scene was loaded */
+	poly_plane(&poly->plane, poly);
+	poly_prepare(poly);
+	cscene_update(scene->compiled, scene, object);
+	return 1;
+}
+
+/* bring the acceleration structure up to date after objects moved */
+void scene_update(scene_t *scene, const struct bvh_options_s *options)
+{
+	if(scene->bvh)
+	{
+		bvh_refit_scene(scene, options);
+	}
+	else if(scene->grid && !grid_build_scene(scene))
+	{	/* same fall back as when the scene was loaded */
+		printf("Objects do not fit a grid, using a hierarchy.\n");
+		scene->accel = SCENE_ACCEL_BVH;
+		bvh_build_scene(scene, options);
+	}
+}
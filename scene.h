@@ -16,6 +16,26 @@
 
 #define STRING_BUFFER_SIZE	1024
 
+/* acceleration structure a scene asks for (accel key of desc) */
+#define SCENE_ACCEL_BVH		0	/* hierarchy, the default */
+#define SCENE_ACCEL_GRID	1	/* uniform grid */
+#define SCENE_ACCEL_NONE	2	/* test every object */
+
+/* acceleration structure over the scene objects (see bvh.h) */
+struct bvh_s;
+/* 4 wide copy of it for single rays (see bvh.h) */
+struct bvh4_s;
+/* objects compiled for intersection (see cscene.h) */
+struct cscene_s;
+/* how a hierarchy is built (see bvh.h) */
+struct bvh_options_s;
+/* uniform grid over the objects (see grid.h) */
+struct grid_s;
+/* lights sorted into space by range (see lightgrid.h) */
+struct lightgrid_s;
+/* lights in a hierarchy for picking a few at random (see lightbvh.h) */
+struct lightbvh_s;
+
 /* this structure has evolved to a more general ray tracing support
  * structure beyond what would be considered something in the "scene."
  * Time constraints prevent me from making this fix clean */
@@ -30,15 +50,19 @@ typedef struct
 
 	unsigned int		frameBufferWidth;
 	unsigned int		frameBufferHeight;
-	unsigned int		sqrtSpp;
+	unsigned int		spp;		/* samples per pixel */
 	float			viewDistance;
 	float			viewPlaneHalfWidth;
 	float			viewPlaneHalfHeight;
-	float			sppWidth;
+	float			pixelWidth;	/* and height, on the view plane */
 
 	color_t			bgColor;	/* background color */
 	color_t			ambientLightColor;	/*ambient light color */
 
+	float			fovY;		/* vertical field of view (degrees) */
+	float			nearZ;		/* distance to view plane */
+	float			farZ;		/* far clipping distance (unused) */
+
 	float			ldMax;		/* max luminance of display */
 	float			lMax;		/* max luminance of scene */
 
@@ -61,6 +85,17 @@ typedef struct
 #ifdef __SPU__
 	};
 #endif
+	point_t			*vertexPool;	/* vertices of every polygon */
+	float			*edgePool;	/* edge data of every polygon */
+	void			*mapping;	/* compiled scene file in use (see scenebin.h) */
+	unsigned long		mappingSize;
+	struct bvh_s		*bvh;	/* hierarchy over objects (null = linear scan) */
+	struct bvh4_s		*bvh4;	/* 4 wide copy of bvh, set along with it */
+	struct grid_s		*grid;	/* grid over objects (null = not used) */
+	unsigned int		accel;	/* SCENE_ACCEL_* */
+	struct cscene_s		*compiled;	/* objects in intersection layout */
+	struct lightgrid_s	*lightGrid;	/* lights by cell (null = loop over all) */
+	struct lightbvh_s	*lightBvh;	/* lights to pick from (null = no picking) */
 } scene_t;
 
 /* load scene and camera properties from file */
@@ -69,4 +104,24 @@ int parse_scene(const char *filename, scene_t *scene);
 /* cleanup dynamic memory from creating scene */
 void free_scene(scene_t *scene);
 
+/* objects can be moved between frames without parsing the scene again.
+ * Each call updates the object and its compiled copy, scene_update()
+ * then brings the acceleration structure up to date for all of them */
+
+/* move a sphere object to a new center and radius.  Prints an error and
+ * returns 0 if object is not a sphere of the scene */
+int scene_move_sphere(scene_t *scene, unsigned int object,
+		const point_t *center, float radius);
+
+/* move the points of a polygon object, there must be as many as before.
+ * Prints an error and returns 0 if object is not a polygon of the scene */
+int scene_move_polygon(scene_t *scene, unsigned int object,
+		const point_t *points);
+
+/* bring the acceleration structure up to date after objects moved.  A
+ * hierarchy is refit (see bvh_refit_scene(), options may be null), a grid
+ * is built again - or replaced by a hierarchy if the objects no longer
+ * fit one */
+void scene_update(scene_t *scene, const struct bvh_options_s *options);
+
 #endif
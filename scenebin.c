@@ -0,0 +1,415 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 10, 2008
+ * scenebin.c
+ *
+ * This file contains the definitions for writing and mapping compiled
+ * scene files.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scenebin.h"
+#include "bvh.h"
+#include "cscene.h"
+
+/* round a file offset up to the start of the next section */
+#define SCENEBIN_ROUND(size)	(((size) + SCENEBIN_ALIGN - 1) & \
+				~(unsigned long long)(SCENEBIN_ALIGN - 1))
+
+/* fill in what a header written by this build looks like */
+static void scenebin_header_init(scenebin_header_t *header)
+{
+	memset(header, 0, sizeof(scenebin_header_t));
+	strcpy(header->magic, SCENEBIN_MAGIC);
+	header->version = SCENEBIN_VERSION;
+	header->byteOrder = 0x01020304;
+	header->pointerSize = sizeof(void *);
+	header->sceneSize = sizeof(scene_t);
+	header->objectSize = sizeof(object3d_t);
+	header->lightSize = sizeof(pointlight_t);
+	header->nodeSize = sizeof(bvh_node_t);
+	header->materialSize = sizeof(material_t);
+}
+
+/* pad the file out to the start of a section */
+static void scenebin_seek(FILE *fp, unsigned long long *pos,
+			unsigned long long offset)
+{
+	static const char zeros[SCENEBIN_ALIGN] = { 0 };
+
+	while(*pos < offset)
+	{
+		*pos += fwrite(zeros, 1, (size_t)(offset - *pos) < SCENEBIN_ALIGN ?
+			(size_t)(offset - *pos) : SCENEBIN_ALIGN, fp);
+	}
+}
+
+/* tests if a file is a compiled scene file */
+int scenebin_probe(const char *filename)
+{
+	char	magic[8];
+	FILE	*fp = fopen(filename, "rb");
+	int	result;
+
+	if(!fp)
+		return 0;
+	result = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+		!memcmp(magic, SCENEBIN_MAGIC, sizeof(SCENEBIN_MAGIC));
+	fclose(fp);
+
+	return result;
+}
+
+/* write a scene to a compiled scene file */
+int scenebin_write(const char *filename, const scene_t *scene)
+{
+	scenebin_header_t	header;
+	scene_t			sceneOut;
+	bvh_t			bvhOut;
+	cscene_t		csOut;
+	object3d_t		objOut;
+	const bvh_t		*bvh = scene->bvh;
+	const cscene_t		*cs = scene->compiled;
+	const polygon_t		*poly;
+	unsigned long long	pos = 0;
+	unsigned int		nVertices = 0;
+	unsigned int		i;
+	FILE			*fp;
+
+	/* a grid has no section yet */
+	if(scene->accel != SCENE_ACCEL_BVH)
+	{
+		printf("Scenes without a hierarchy cannot be compiled yet.\n");
+		return 0;
+	}
+	if(!bvh || !cs)
+	{
+		printf("Scene must have a hierarchy and compiled objects to be written.\n");
+		return 0;
+	}
+
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		if(scene->objects[i].geometryType == GEOMETRY_POLYGON)
+			nVertices += scene->objects[i].poly_obj.nVerticies;
+		/* mesh buffers and hierarchies have no section yet */
+		if(scene->objects[i].geometryType == GEOMETRY_TRIANGLE_MESH)
+		{
+			printf("Scenes with meshes cannot be compiled yet.\n");
+			return 0;
+		}
+	}
+
+	/* sizes then offsets of every section */
+	scenebin_header_init(&header);
+	header.size[SCENEBIN_SCENE] = sizeof(scene_t);
+	header.size[SCENEBIN_LIGHTS] = sizeof(pointlight_t) * scene->nLights;
+	header.size[SCENEBIN_OBJECTS] = sizeof(object3d_t) * scene->nObjects;
+	header.size[SCENEBIN_VERTICES] = sizeof(point_t) * nVertices;
+	header.size[SCENEBIN_EDGES] = sizeof(float) * 4 * nVertices;
+	header.size[SCENEBIN_BVH] = sizeof(bvh_t);
+	header.size[SCENEBIN_NODES] = sizeof(bvh_node_t) * bvh->nNodes;
+	header.size[SCENEBIN_PRIMS] = sizeof(unsigned int) * bvh->nPrims;
+	header.size[SCENEBIN_CSCENE] = sizeof(cscene_t);
+	header.size[SCENEBIN_BLOCK] = cs->blockSize;
+
+	pos = SCENEBIN_ROUND(sizeof(scenebin_header_t));
+	for(i = 0; i < SCENEBIN_SECTIONS; ++i)
+	{
+		header.offset[i] = pos;
+		pos = SCENEBIN_ROUND(pos + header.size[i]);
+	}
+	header.fileSize = pos;
+
+	fp = fopen(filename, "wb");
+	if(!fp)
+	{
+		printf("Error opening file {%s} for writing.\n", filename);
+		return 0;
+	}
+
+	pos = fwrite(&header, 1, sizeof(header), fp);
+
+	/* pointers are meaningless in a file, the loader sets them again */
+	sceneOut = *scene;
+	sceneOut.lights = 0;
+	sceneOut.objects = 0;
+	sceneOut.vertexPool = 0;
+	sceneOut.edgePool = 0;
+	sceneOut.bvh = 0;
+	sceneOut.bvh4 = 0;
+	sceneOut.grid = 0;
+	sceneOut.compiled = 0;
+	sceneOut.lightGrid = 0;
+	sceneOut.lightBvh = 0;
+	sceneOut.mapping = 0;
+	sceneOut.mappingSize = 0;
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_SCENE]);
+	pos += fwrite(&sceneOut, 1, sizeof(scene_t), fp);
+
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_LIGHTS]);
+	pos += fwrite(scene->lights, 1, (size_t)header.size[SCENEBIN_LIGHTS], fp);
+
+	/* polygons find their vertices again by walking the objects in order */
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_OBJECTS]);
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		objOut = scene->objects[i];
+#if !defined(__SPU__) && !defined(__PPU__)
+		objOut.debugName = 0;
+#endif
+		if(objOut.geometryType == GEOMETRY_POLYGON)
+		{
+			objOut.poly_obj.vertex = 0;
+			objOut.poly_obj.edge = 0;
+		}
+		pos += fwrite(&objOut, 1, sizeof(object3d_t), fp);
+	}
+
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_VERTICES]);
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		poly = &scene->objects[i].poly_obj;
+		if(scene->objects[i].geometryType == GEOMETRY_POLYGON)
+			pos += fwrite(poly->vertex, sizeof(point_t),
+				poly->nVerticies, fp) * sizeof(point_t);
+	}
+
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_EDGES]);
+	for(i = 0; i < scene->nObjects; ++i)
+	{
+		poly = &scene->objects[i].poly_obj;
+		if(scene->objects[i].geometryType == GEOMETRY_POLYGON)
+			pos += fwrite(poly->edge, sizeof(float) * 4,
+				poly->nVerticies, fp) * sizeof(float) * 4;
+	}
+
+	memset(&bvhOut, 0, sizeof(bvh_t));
+	bvhOut.nNodes = bvh->nNodes;
+	bvhOut.nPrims = bvh->nPrims;
+	bvhOut.mapped = 1;
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_BVH]);
+	pos += fwrite(&bvhOut, 1, sizeof(bvh_t), fp);
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_NODES]);
+	pos += fwrite(bvh->nodes, 1, (size_t)header.size[SCENEBIN_NODES], fp);
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_PRIMS]);
+	pos += fwrite(bvh->prims, 1, (size_t)header.size[SCENEBIN_PRIMS], fp);
+
+	/* only the counts matter, cscene_attach() carves the block again */
+	memset(&csOut, 0, sizeof(cscene_t));
+	csOut.nSpheres = cs->nSpheres;
+	csOut.nPolygons = cs->nPolygons;
+	csOut.nEdges = cs->nEdges;
+	csOut.nMaterials = cs->nMaterials;
+	csOut.nObjects = cs->nObjects;
+	csOut.blockSize = cs->blockSize;
+	csOut.mapped = 1;
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_CSCENE]);
+	pos += fwrite(&csOut, 1, sizeof(cscene_t), fp);
+	scenebin_seek(fp, &pos, header.offset[SCENEBIN_BLOCK]);
+	pos += fwrite(cs->block, 1, cs->blockSize, fp);
+	scenebin_seek(fp, &pos, header.fileSize);
+
+	if(fclose(fp) || pos != header.fileSize)
+	{
+		printf("Error writing file {%s}.\n", filename);
+		return 0;
+	}
+
+	printf("Compiled {%s}:\t%d objects, %d lights, %llu bytes\n",
+		filename, scene->nObjects, scene->nLights, header.fileSize);
+
+	return 1;
+}
+
+/* map a whole file copy on write (read it on systems without mmap) */
+static char* scenebin_map(const char *filename, unsigned long *size)
+{
+#if defined(_WIN32)
+	FILE	*fp = fopen(filename, "rb");
+	char	*data;
+
+	if(!fp)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(*size ? *size : 1);
+	*size = fread(data, 1, *size, fp);
+	fclose(fp);
+	return data;
+#else
+	struct stat	st;
+	void		*data;
+	int		fd = open(filename, O_RDONLY);
+
+	if(fd < 0)
+		return 0;
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(scenebin_header_t))
+	{
+		close(fd);
+		return 0;
+	}
+	*size = st.st_size;
+	/* private so relocating polygons never touches the file */
+	data = mmap(0, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return data == MAP_FAILED ? 0 : data;
+#endif
+}
+
+/* unmap a scene loaded by scenebin_load() */
+void scenebin_unmap(scene_t *scene)
+{
+	if(scene->mapping)
+	{
+#if defined(_WIN32)
+		free(scene->mapping);
+#else
+		munmap(scene->mapping, scene->mappingSize);
+#endif
+		scene->mapping = 0;
+		scene->mappingSize = 0;
+	}
+}
+
+/* tests if a header was written by a build like this one and describes
+ * sections that fit in the file */
+static int scenebin_check(const scenebin_header_t *header, unsigned long size)
+{
+	scenebin_header_t	expect;
+	unsigned int		i = 0;
+
+	scenebin_header_init(&expect);
+	if(size < sizeof(scenebin_header_t) || memcmp(header->magic, expect.magic, sizeof(expect.magic)) ||
+		header->version != expect.version ||
+		header->byteOrder != expect.byteOrder ||
+		header->pointerSize != expect.pointerSize ||
+		header->sceneSize != expect.sceneSize ||
+		header->objectSize != expect.objectSize ||
+		header->lightSize != expect.lightSize ||
+		header->nodeSize != expect.nodeSize ||
+		header->materialSize != expect.materialSize ||
+		header->fileSize != size)
+		return 0;
+
+	for(; i < SCENEBIN_SECTIONS; ++i)
+	{
+		if(header->offset[i] % SCENEBIN_ALIGN ||
+			header->offset[i] > size ||
+			header->size[i] > size - header->offset[i])
+			return 0;
+	}
+
+	return header->size[SCENEBIN_SCENE] == sizeof(scene_t) &&
+		header->size[SCENEBIN_BVH] == sizeof(bvh_t) &&
+		header->size[SCENEBIN_CSCENE] == sizeof(cscene_t);
+}
+
+/* map a compiled scene file and use it as the scene */
+int scenebin_load(const char *filename, scene_t *scene)
+{
+	unsigned long		size = 0;
+	char			*base = scenebin_map(filename, &size);
+	const scenebin_header_t	*header = (const scenebin_header_t *)base;
+	bvh_t			*bvh;
+	cscene_t		*cs;
+	polygon_t		*poly;
+	unsigned int		nVertices;
+	unsigned int		vertex = 0;
+	unsigned int		i = 0;
+
+	if(!base)
+	{
+		printf("Error opening file {%s} for reading.\n", filename);
+		return 0;
+	}
+	if(!scenebin_check(header, size))
+	{
+		printf("Error loading {%s}: not a compiled scene from this build.\n",
+			filename);
+#if defined(_WIN32)
+		free(base);
+#else
+		munmap(base, size);
+#endif
+		return 0;
+	}
+
+	memcpy(scene, base + header->offset[SCENEBIN_SCENE], sizeof(scene_t));
+	scene->mapping = base;
+	scene->mappingSize = size;
+	scene->lights = (pointlight_t *)(base + header->offset[SCENEBIN_LIGHTS]);
+	scene->objects = (object3d_t *)(base + header->offset[SCENEBIN_OBJECTS]);
+	scene->vertexPool = (point_t *)(base + header->offset[SCENEBIN_VERTICES]);
+	scene->edgePool = (float *)(base + header->offset[SCENEBIN_EDGES]);
+	nVertices = (unsigned int)(header->size[SCENEBIN_VERTICES] /
+			sizeof(point_t));
+
+	bvh = malloc(sizeof(bvh_t));
+	memcpy(bvh, base + header->offset[SCENEBIN_BVH], sizeof(bvh_t));
+	bvh->nodes = (bvh_node_t *)(base + header->offset[SCENEBIN_NODES]);
+	bvh->prims = (unsigned int *)(base + header->offset[SCENEBIN_PRIMS]);
+	bvh->mapped = 1;
+	scene->bvh = bvh;
+	scene->bvh4 = 0;
+	scene->grid = 0;
+
+	cs = malloc(sizeof(cscene_t));
+	memcpy(cs, base + header->offset[SCENEBIN_CSCENE], sizeof(cscene_t));
+	scene->compiled = cs;
+
+	if(header->size[SCENEBIN_LIGHTS] != sizeof(pointlight_t) * scene->nLights ||
+		header->size[SCENEBIN_OBJECTS] != sizeof(object3d_t) * scene->nObjects ||
+		header->size[SCENEBIN_EDGES] != sizeof(float) * 4 * nVertices ||
+		header->size[SCENEBIN_NODES] != sizeof(bvh_node_t) * bvh->nNodes ||
+		header->size[SCENEBIN_PRIMS] != sizeof(unsigned int) * bvh->nPrims ||
+		bvh->nPrims != scene->nObjects || cs->nObjects != scene->nObjects ||
+		!cscene_attach(cs, base + header->offset[SCENEBIN_BLOCK],
+			(unsigned int)header->size[SCENEBIN_BLOCK]))
+	{
+		printf("Error loading {%s}: sections do not match the scene.\n",
+			filename);
+		cs->mapped = 1;
+		free_scene(scene);
+		return 0;
+	}
+
+	/* point the polygons back at their vertices */
+	for(; i < scene->nObjects; ++i)
+	{
+		if(scene->objects[i].geometryType != GEOMETRY_POLYGON)
+			continue;
+		poly = &scene->objects[i].poly_obj;
+		if(poly->nVerticies > nVertices - vertex)
+		{
+			printf("Error loading {%s}: polygons do not match the "
+				"vertices.\n", filename);
+			free_scene(scene);
+			return 0;
+		}
+		poly->vertex = &scene->vertexPool[vertex];
+		poly->edge = &scene->edgePool[vertex * 4];
+		vertex += poly->nVerticies;
+	}
+
+	/* the wide hierarchy is not stored, it is quick to collapse again */
+	scene->bvh4 = bvh4_build(bvh);
+
+	printf("Loaded {%s}:\t%d objects, %d lights (%lu bytes mapped)\n",
+		filename, scene->nObjects, scene->nLights, size);
+
+	return 1;
+}
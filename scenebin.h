@@ -0,0 +1,71 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * June 10, 2008
+ * scenebin.h
+ *
+ * This file contains the definition for compiled scene files.  A compiled
+ * scene file is a binary image of a parsed scene together with its
+ * hierarchy and compiled objects, laid out exactly the way they sit in
+ * memory.  Loading one maps the file and uses it in place: the only work
+ * is pointing the polygons back at their vertices, so a scene is ready to
+ * render in the time it takes to map the file.
+ *
+ * Files are tied to the build that wrote them (byte order, pointer and
+ * structure sizes are checked) and are simply rejected otherwise.
+ */
+
+#ifndef _SCENEBIN_H_
+#define _SCENEBIN_H_
+
+#include "scene.h"
+
+#define SCENEBIN_MAGIC		"RTSCENE"
+#define SCENEBIN_VERSION	2
+/* every section starts on a boundary of this many bytes */
+#define SCENEBIN_ALIGN		64
+
+/* sections of a compiled scene file, in file order */
+#define SCENEBIN_SCENE		0	/* scene_t */
+#define SCENEBIN_LIGHTS		1	/* pointlight_t per light */
+#define SCENEBIN_OBJECTS	2	/* object3d_t per object */
+#define SCENEBIN_VERTICES	3	/* polygon vertices in object order */
+#define SCENEBIN_EDGES		4	/* 4 floats per polygon vertex */
+#define SCENEBIN_BVH		5	/* bvh_t */
+#define SCENEBIN_NODES		6	/* bvh_node_t per node */
+#define SCENEBIN_PRIMS		7	/* primitive indices of the leaves */
+#define SCENEBIN_CSCENE		8	/* cscene_t */
+#define SCENEBIN_BLOCK		9	/* storage of the compiled objects */
+#define SCENEBIN_SECTIONS	10
+
+typedef struct
+{
+	char			magic[8];	/* SCENEBIN_MAGIC */
+	unsigned int		version;	/* SCENEBIN_VERSION */
+	unsigned int		byteOrder;	/* 0x01020304 as written */
+	unsigned int		pointerSize;	/* sizes the file depends on */
+	unsigned int		sceneSize;
+	unsigned int		objectSize;
+	unsigned int		lightSize;
+	unsigned int		nodeSize;
+	unsigned int		materialSize;
+	unsigned long long	fileSize;	/* whole file in bytes */
+	unsigned long long	offset[SCENEBIN_SECTIONS];
+	unsigned long long	size[SCENEBIN_SECTIONS];
+} scenebin_header_t;
+
+/* tests if a file is a compiled scene file */
+int scenebin_probe(const char *filename);
+
+/* write a parsed scene, its hierarchy (scene->bvh) and compiled objects
+ * (scene->compiled) to a compiled scene file */
+int scenebin_write(const char *filename, const scene_t *scene);
+
+/* map a compiled scene file and use it as the scene.  free_scene() unmaps
+ * it again */
+int scenebin_load(const char *filename, scene_t *scene);
+
+/* unmap a scene loaded by scenebin_load() */
+void scenebin_unmap(scene_t *scene);
+
+#endif
@@ -0,0 +1,223 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * May 20, 2008
+ * scheduler.c
+ *
+ * This file contains the definitions for the work stealing task scheduler.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include "scheduler.h"
+
+/* argument handed to every spawned worker thread */
+typedef struct
+{
+	scheduler_t	*sched;
+	unsigned int	worker;
+} worker_arg_t;
+
+/* pop the most recently pushed task of a queue (owner side) */
+static int deque_pop_bottom(task_deque_t *deque, task_t *task)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->bottom > deque->top)
+	{
+		*task = deque->tasks[--deque->bottom];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return found;
+}
+
+/* take the oldest task of a queue (thief side) */
+static int deque_steal_top(task_deque_t *deque, task_t *task)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->bottom > deque->top)
+	{
+		*task = deque->tasks[deque->top++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return found;
+}
+
+/* find work for a worker - own queue first, then every other queue */
+static int scheduler_next_task(scheduler_t *sched, unsigned int worker,
+				task_t *task)
+{
+	unsigned int i = 1;
+
+	if(deque_pop_bottom(&sched->deques[worker], task))
+		return 1;
+
+	/* nothing left locally, go steal starting at the next worker over */
+	for(; i < sched->nWorkers; ++i)
+	{
+		if(deque_steal_top(&sched->deques[(worker + i) % sched->nWorkers],
+				task))
+		{
+			pthread_mutex_lock(&sched->lock);
+			++sched->steals;
+			pthread_mutex_unlock(&sched->lock);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* main loop of a worker - runs until no task is pending anywhere */
+static void scheduler_work(scheduler_t *sched, unsigned int worker)
+{
+	task_t		task;
+	unsigned int	pending;
+
+	for(;;)
+	{
+		if(scheduler_next_task(sched, worker, &task))
+		{
+			task.func(sched, worker, task.data);
+
+			pthread_mutex_lock(&sched->lock);
+			--sched->pending;
+			pthread_mutex_unlock(&sched->lock);
+			continue;
+		}
+
+		/* queues are empty but tasks still running may spawn more */
+		pthread_mutex_lock(&sched->lock);
+		pending = sched->pending;
+		pthread_mutex_unlock(&sched->lock);
+		if(pending == 0)
+			break;
+		sched_yield();
+	}
+}
+
+/* pthread entry point for spawned workers */
+static void* scheduler_thread(void *arg)
+{
+	worker_arg_t *warg = (worker_arg_t *)arg;
+	scheduler_work(warg->sched, warg->worker);
+	return 0;
+}
+
+/* number of processors online, at least 1 */
+unsigned int scheduler_cpu_count()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int)n : 1;
+}
+
+/* create a scheduler with a given number of workers (0 = one per cpu) */
+scheduler_t* scheduler_create(unsigned int nWorkers)
+{
+	scheduler_t	*sched = malloc(sizeof(scheduler_t));
+	unsigned int	i = 0;
+
+	if(nWorkers == 0)
+		nWorkers = scheduler_cpu_count();
+
+	sched->nWorkers = nWorkers;
+	sched->pending = 0;
+	sched->steals = 0;
+	pthread_mutex_init(&sched->lock, 0);
+	sched->threads = malloc(sizeof(pthread_t) * nWorkers);
+	sched->deques = malloc(sizeof(task_deque_t) * nWorkers);
+
+	for(; i < nWorkers; ++i)
+	{
+		pthread_mutex_init(&sched->deques[i].lock, 0);
+		sched->deques[i].capacity = SCHEDULER_DEQUE_SIZE;
+		sched->deques[i].tasks = malloc(sizeof(task_t) * SCHEDULER_DEQUE_SIZE);
+		sched->deques[i].top = 0;
+		sched->deques[i].bottom = 0;
+	}
+
+	return sched;
+}
+
+/* push a task onto the queue of a worker */
+void scheduler_push(scheduler_t *sched, unsigned int worker,
+			task_func_t func, void *data)
+{
+	task_deque_t *deque = &sched->deques[worker % sched->nWorkers];
+
+	/* count the task before it becomes visible so nobody quits early */
+	pthread_mutex_lock(&sched->lock);
+	++sched->pending;
+	pthread_mutex_unlock(&sched->lock);
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->bottom == deque->capacity)
+	{
+		if(deque->top > 0)
+		{	/* slide live tasks back to the front of the storage */
+			memmove(deque->tasks, &deque->tasks[deque->top],
+				sizeof(task_t) * (deque->bottom - deque->top));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		}
+		if(deque->bottom == deque->capacity)
+		{	/* still full, grow storage */
+			deque->capacity *= 2;
+			deque->tasks = realloc(deque->tasks,
+				sizeof(task_t) * deque->capacity);
+		}
+	}
+	deque->tasks[deque->bottom].func = func;
+	deque->tasks[deque->bottom].data = data;
+	++deque->bottom;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+/* run every queued task (and any task they spawn) to completion */
+void scheduler_run(scheduler_t *sched)
+{
+	worker_arg_t	*args = malloc(sizeof(worker_arg_t) * sched->nWorkers);
+	unsigned int	i = 1;
+
+	for(; i < sched->nWorkers; ++i)
+	{
+		args[i].sched = sched;
+		args[i].worker = i;
+		pthread_create(&sched->threads[i], 0, scheduler_thread, &args[i]);
+	}
+
+	/* calling thread is worker 0 */
+	scheduler_work(sched, 0);
+
+	for(i = 1; i < sched->nWorkers; ++i)
+	{
+		pthread_join(sched->threads[i], 0);
+	}
+
+	free(args);
+}
+
+/* cleanup all memory associated with the scheduler */
+void scheduler_free(scheduler_t *sched)
+{
+	unsigned int i = 0;
+
+	for(; i < sched->nWorkers; ++i)
+	{
+		pthread_mutex_destroy(&sched->deques[i].lock);
+		free(sched->deques[i].tasks);
+	}
+	pthread_mutex_destroy(&sched->lock);
+	free(sched->deques);
+	free(sched->threads);
+	free(sched);
+}
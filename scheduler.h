@@ -0,0 +1,75 @@
+/* David Oguns
+ * Computer Graphics II
+ * Ray Tracer
+ * May 20, 2008
+ * scheduler.h
+ *
+ * This file contains the definition for the work stealing task scheduler
+ * used to spread rendering work over a pool of pthreads.  Every worker owns
+ * a double ended queue of tasks.  A worker pops tasks off the bottom of its
+ * own queue and once it runs dry it steals from the top of another worker's
+ * queue, so uneven tasks (reflective/refractive tiles) still keep every core
+ * busy until the end of a frame.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <pthread.h>
+
+/* initial number of tasks each worker queue can hold before growing */
+#define SCHEDULER_DEQUE_SIZE	64
+
+struct scheduler_s;
+
+/* function that carries out a task.  worker is the index of the worker
+ * running the task and can be used to index per thread storage. */
+typedef void (*task_func_t)(struct scheduler_s *sched, unsigned int worker,
+				void *data);
+
+typedef struct
+{
+	task_func_t	func;		/* what to run */
+	void		*data;		/* argument handed to func */
+} task_t;
+
+/* double ended queue of tasks owned by a single worker */
+typedef struct
+{
+	pthread_mutex_t	lock;		/* guards every field below */
+	task_t		*tasks;		/* task storage */
+	unsigned int	capacity;	/* size of task storage */
+	unsigned int	top;		/* index thieves steal from */
+	unsigned int	bottom;		/* one past index owner pops from */
+} task_deque_t;
+
+typedef struct scheduler_s
+{
+	unsigned int	nWorkers;	/* number of threads (including caller) */
+	task_deque_t	*deques;	/* one queue per worker */
+	pthread_t	*threads;	/* nWorkers-1 spawned threads */
+
+	pthread_mutex_t	lock;		/* guards pending and steals */
+	unsigned int	pending;	/* tasks pushed but not finished yet */
+	unsigned int	steals;		/* how many tasks changed workers */
+} scheduler_t;
+
+/* create a scheduler with a given number of workers (0 = one per cpu) */
+scheduler_t* scheduler_create(unsigned int nWorkers);
+
+/* push a task onto the queue of a worker.  Safe to call from inside a
+ * running task to spawn more work. */
+void scheduler_push(scheduler_t *sched, unsigned int worker,
+			task_func_t func, void *data);
+
+/* run every queued task (and any task they spawn) to completion.  The
+ * calling thread participates as worker 0. */
+void scheduler_run(scheduler_t *sched);
+
+/* cleanup all memory associated with the scheduler */
+void scheduler_free(scheduler_t *sched);
+
+/* number of processors online, at least 1 */
+unsigned int scheduler_cpu_count();
+
+#endif
@@ -0,0 +1,502 @@
+/*  David Oguns
+ *  Computer Graphics II
+ *  Ray Tracing
+ *  June 2, 2008
+ *  simd.h
+ *
+ *  This file contains a thin portable layer over the 4 wide float SIMD
+ *  units of every processor the ray tracer runs on.  vector4.c and the
+ *  other hot paths are written against simd4f_t and the simd4_* functions
+ *  below and the backend is picked at compile time:
+ *
+ *	__SPU__		- SPU intrinsics (Cell SPE)
+ *	__PPU__		- AltiVec/VMX (Cell PPE)
+ *	__SSE4_1__	- SSE4.1 (x86 baseline, -msse4.1)
+ *	__FMA__		- also use fused multiply add (-mavx2 -mfma)
+ *	otherwise	- plain C on 4 floats
+ *
+ *  Every function is static inline so the compiler keeps values in
+ *  registers across calls.  Comparisons return a simd4m_t lane mask that
+ *  can be combined, turned into bits (lane i = bit i) or used to select
+ *  between two vectors.
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <math.h>
+
+#if defined(__SPU__)
+	#include <spu_intrinsics.h>
+	#define SIMD_BACKEND		"SPU"
+#elif defined(__PPU__)
+	#include <altivec.h>
+	#include <vec_types.h>
+	#define SIMD_BACKEND		"AltiVec"
+#elif defined(__SSE4_1__)
+	#include <smmintrin.h>
+	#if defined(__FMA__)
+		#include <immintrin.h>
+		#define SIMD_BACKEND	"SSE4.1+FMA"
+	#else
+		#define SIMD_BACKEND	"SSE4.1"
+	#endif
+#else
+	#define SIMD_SCALAR
+	#define SIMD_BACKEND		"scalar"
+#endif
+
+/* 16 byte alignment required by every vector load/store and by Cell DMA */
+#if defined(__GNUC__)
+	#define SIMD_ALIGN		__attribute__ ((aligned(16)))
+#else
+	#define SIMD_ALIGN
+#endif
+
+#if defined(__SPU__) || defined(__PPU__)
+	typedef vector float	simd4f_t;
+#elif defined(__SSE4_1__)
+	typedef __m128		simd4f_t;
+#else
+	typedef struct
+	{
+		float		f[4];
+	} simd4f_t;
+#endif
+
+/* result of a comparison - every bit of a lane set where it was true */
+#if defined(__SPU__)
+	typedef vector unsigned int	simd4m_t;
+#elif defined(__PPU__)
+	typedef vector bool int		simd4m_t;
+#elif defined(__SSE4_1__)
+	typedef __m128			simd4m_t;
+#else
+	typedef struct
+	{
+		unsigned int	u[4];
+	} simd4m_t;
+#endif
+
+/* load 4 floats from 16 byte aligned memory */
+static inline simd4f_t simd4_load(const float *p)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	return *((const vector float *)p);
+#elif defined(__SSE4_1__)
+	return _mm_load_ps(p);
+#else
+	simd4f_t r;
+	r.f[0] = p[0]; r.f[1] = p[1]; r.f[2] = p[2]; r.f[3] = p[3];
+	return r;
+#endif
+}
+
+/* load 4 floats from memory of any alignment */
+static inline simd4f_t simd4_loadu(const float *p)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return _mm_loadu_ps(p);
+#else
+	simd4f_t r SIMD_ALIGN;
+	float *f = (float *)&r;
+	f[0] = p[0]; f[1] = p[1]; f[2] = p[2]; f[3] = p[3];
+	return r;
+#endif
+}
+
+/* store 4 floats to 16 byte aligned memory */
+static inline void simd4_store(float *p, simd4f_t a)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	*((vector float *)p) = a;
+#elif defined(__SSE4_1__)
+	_mm_store_ps(p, a);
+#else
+	p[0] = a.f[0]; p[1] = a.f[1]; p[2] = a.f[2]; p[3] = a.f[3];
+#endif
+}
+
+/* all 4 elements set to s */
+static inline simd4f_t simd4_splat(float s)
+{
+#if defined(__SPU__)
+	return spu_splats(s);
+#elif defined(__PPU__)
+	return (vector float) {s, s, s, s};
+#elif defined(__SSE4_1__)
+	return _mm_set1_ps(s);
+#else
+	simd4f_t r;
+	r.f[0] = r.f[1] = r.f[2] = r.f[3] = s;
+	return r;
+#endif
+}
+
+/* build a vector out of 4 scalars */
+static inline simd4f_t simd4_set(float x, float y, float z, float w)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	return (vector float) {x, y, z, w};
+#elif defined(__SSE4_1__)
+	return _mm_setr_ps(x, y, z, w);
+#else
+	simd4f_t r;
+	r.f[0] = x; r.f[1] = y; r.f[2] = z; r.f[3] = w;
+	return r;
+#endif
+}
+
+/* a + b */
+static inline simd4f_t simd4_add(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_add(a, b);
+#elif defined(__PPU__)
+	return vec_add(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_add_ps(a, b);
+#else
+	simd4f_t r;
+	r.f[0] = a.f[0] + b.f[0]; r.f[1] = a.f[1] + b.f[1];
+	r.f[2] = a.f[2] + b.f[2]; r.f[3] = a.f[3] + b.f[3];
+	return r;
+#endif
+}
+
+/* a - b */
+static inline simd4f_t simd4_sub(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_sub(a, b);
+#elif defined(__PPU__)
+	return vec_sub(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_sub_ps(a, b);
+#else
+	simd4f_t r;
+	r.f[0] = a.f[0] - b.f[0]; r.f[1] = a.f[1] - b.f[1];
+	r.f[2] = a.f[2] - b.f[2]; r.f[3] = a.f[3] - b.f[3];
+	return r;
+#endif
+}
+
+/* a * b */
+static inline simd4f_t simd4_mul(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_mul(a, b);
+#elif defined(__PPU__)
+	/* AltiVec only has a fused multiply add, add -0 to keep signs */
+	return vec_madd(a, b, (vector float) {-0.0f, -0.0f, -0.0f, -0.0f});
+#elif defined(__SSE4_1__)
+	return _mm_mul_ps(a, b);
+#else
+	simd4f_t r;
+	r.f[0] = a.f[0] * b.f[0]; r.f[1] = a.f[1] * b.f[1];
+	r.f[2] = a.f[2] * b.f[2]; r.f[3] = a.f[3] * b.f[3];
+	return r;
+#endif
+}
+
+/* a / b */
+static inline simd4f_t simd4_div(simd4f_t a, simd4f_t b)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return _mm_div_ps(a, b);
+#else
+	/* neither Cell unit has an exact divide - do it element wise */
+	simd4f_t r SIMD_ALIGN;
+	float *fr = (float *)&r;
+	float *fa = (float *)&a;
+	float *fb = (float *)&b;
+	fr[0] = fa[0] / fb[0]; fr[1] = fa[1] / fb[1];
+	fr[2] = fa[2] / fb[2]; fr[3] = fa[3] / fb[3];
+	return r;
+#endif
+}
+
+/* a * b + c */
+static inline simd4f_t simd4_madd(simd4f_t a, simd4f_t b, simd4f_t c)
+{
+#if defined(__SPU__)
+	return spu_madd(a, b, c);
+#elif defined(__PPU__)
+	return vec_madd(a, b, c);
+#elif defined(__SSE4_1__) && defined(__FMA__)
+	return _mm_fmadd_ps(a, b, c);
+#elif defined(__SSE4_1__)
+	return _mm_add_ps(_mm_mul_ps(a, b), c);
+#else
+	return simd4_add(simd4_mul(a, b), c);
+#endif
+}
+
+/* element wise minimum */
+static inline simd4f_t simd4_min(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_sel(a, b, spu_cmpgt(a, b));
+#elif defined(__PPU__)
+	return vec_min(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_min_ps(a, b);
+#else
+	simd4f_t r;
+	r.f[0] = a.f[0] < b.f[0] ? a.f[0] : b.f[0];
+	r.f[1] = a.f[1] < b.f[1] ? a.f[1] : b.f[1];
+	r.f[2] = a.f[2] < b.f[2] ? a.f[2] : b.f[2];
+	r.f[3] = a.f[3] < b.f[3] ? a.f[3] : b.f[3];
+	return r;
+#endif
+}
+
+/* element wise maximum */
+static inline simd4f_t simd4_max(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_sel(b, a, spu_cmpgt(a, b));
+#elif defined(__PPU__)
+	return vec_max(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_max_ps(a, b);
+#else
+	simd4f_t r;
+	r.f[0] = a.f[0] > b.f[0] ? a.f[0] : b.f[0];
+	r.f[1] = a.f[1] > b.f[1] ? a.f[1] : b.f[1];
+	r.f[2] = a.f[2] > b.f[2] ? a.f[2] : b.f[2];
+	r.f[3] = a.f[3] > b.f[3] ? a.f[3] : b.f[3];
+	return r;
+#endif
+}
+
+/* same vector with the w element set to 0 */
+static inline simd4f_t simd4_clear_w(simd4f_t a)
+{
+#if defined(__SPU__)
+	return spu_insert(0.0f, a, 3);
+#elif defined(__PPU__)
+	return vec_sel(a, (vector float) {0.0f, 0.0f, 0.0f, 0.0f},
+		(vector unsigned int) {0, 0, 0, 0xFFFFFFFF});
+#elif defined(__SSE4_1__)
+	return _mm_blend_ps(a, _mm_setzero_ps(), 0x8);
+#else
+	a.f[3] = 0.0f;
+	return a;
+#endif
+}
+
+/* first element of a vector */
+static inline float simd4_x(simd4f_t a)
+{
+#if defined(__SPU__)
+	return spu_extract(a, 0);
+#elif defined(__PPU__)
+	return a[0];
+#elif defined(__SSE4_1__)
+	return _mm_cvtss_f32(a);
+#else
+	return a.f[0];
+#endif
+}
+
+/* dot product of the x, y and z elements */
+static inline float simd4_dot3(simd4f_t a, simd4f_t b)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return _mm_cvtss_f32(_mm_dp_ps(a, b, 0x71));
+#else
+	simd4f_t p SIMD_ALIGN = simd4_mul(a, b);
+	float *f = (float *)&p;
+	return f[0] + f[1] + f[2];
+#endif
+}
+
+/* dot product of all 4 elements */
+static inline float simd4_dot4(simd4f_t a, simd4f_t b)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return _mm_cvtss_f32(_mm_dp_ps(a, b, 0xF1));
+#else
+	simd4f_t p SIMD_ALIGN = simd4_mul(a, b);
+	float *f = (float *)&p;
+	return f[0] + f[1] + f[2] + f[3];
+#endif
+}
+
+/* cross product of the x, y and z elements (w = 0) */
+static inline simd4f_t simd4_cross(simd4f_t a, simd4f_t b)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	/* a.yzx * b.zxy - a.zxy * b.yzx */
+	simd4f_t r = _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)),
+			_mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2))),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)),
+			_mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))));
+	return simd4_clear_w(r);
+#else
+	float *fa = (float *)&a;
+	float *fb = (float *)&b;
+	return simd4_set(fa[1] * fb[2] - fa[2] * fb[1],
+			fa[2] * fb[0] - fa[0] * fb[2],
+			fa[0] * fb[1] - fa[1] * fb[0], 0.0f);
+#endif
+}
+
+/* square root of every element */
+static inline simd4f_t simd4_sqrt(simd4f_t a)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return _mm_sqrt_ps(a);
+#else
+	/* neither Cell unit has an exact square root - do it element wise */
+	simd4f_t r SIMD_ALIGN;
+	float *fr = (float *)&r;
+	float *fa = (float *)&a;
+	fr[0] = sqrtf(fa[0]); fr[1] = sqrtf(fa[1]);
+	fr[2] = sqrtf(fa[2]); fr[3] = sqrtf(fa[3]);
+	return r;
+#endif
+}
+
+/* a < b */
+static inline simd4m_t simd4_cmplt(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_cmpgt(b, a);
+#elif defined(__PPU__)
+	return vec_cmpgt(b, a);
+#elif defined(__SSE4_1__)
+	return _mm_cmplt_ps(a, b);
+#else
+	simd4m_t r;
+	r.u[0] = a.f[0] < b.f[0] ? ~0u : 0; r.u[1] = a.f[1] < b.f[1] ? ~0u : 0;
+	r.u[2] = a.f[2] < b.f[2] ? ~0u : 0; r.u[3] = a.f[3] < b.f[3] ? ~0u : 0;
+	return r;
+#endif
+}
+
+/* a > b */
+static inline simd4m_t simd4_cmpgt(simd4f_t a, simd4f_t b)
+{
+	return simd4_cmplt(b, a);
+}
+
+/* a == b */
+static inline simd4m_t simd4_cmpeq(simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_cmpeq(a, b);
+#elif defined(__PPU__)
+	return vec_cmpeq(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_cmpeq_ps(a, b);
+#else
+	simd4m_t r;
+	r.u[0] = a.f[0] == b.f[0] ? ~0u : 0; r.u[1] = a.f[1] == b.f[1] ? ~0u : 0;
+	r.u[2] = a.f[2] == b.f[2] ? ~0u : 0; r.u[3] = a.f[3] == b.f[3] ? ~0u : 0;
+	return r;
+#endif
+}
+
+/* a & b */
+static inline simd4m_t simd4m_and(simd4m_t a, simd4m_t b)
+{
+#if defined(__SPU__)
+	return spu_and(a, b);
+#elif defined(__PPU__)
+	return vec_and(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_and_ps(a, b);
+#else
+	simd4m_t r;
+	r.u[0] = a.u[0] & b.u[0]; r.u[1] = a.u[1] & b.u[1];
+	r.u[2] = a.u[2] & b.u[2]; r.u[3] = a.u[3] & b.u[3];
+	return r;
+#endif
+}
+
+/* a & ~b */
+static inline simd4m_t simd4m_andnot(simd4m_t a, simd4m_t b)
+{
+#if defined(__SPU__)
+	return spu_andc(a, b);
+#elif defined(__PPU__)
+	return vec_andc(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_andnot_ps(b, a);
+#else
+	simd4m_t r;
+	r.u[0] = a.u[0] & ~b.u[0]; r.u[1] = a.u[1] & ~b.u[1];
+	r.u[2] = a.u[2] & ~b.u[2]; r.u[3] = a.u[3] & ~b.u[3];
+	return r;
+#endif
+}
+
+/* a ^ b */
+static inline simd4m_t simd4m_xor(simd4m_t a, simd4m_t b)
+{
+#if defined(__SPU__)
+	return spu_xor(a, b);
+#elif defined(__PPU__)
+	return vec_xor(a, b);
+#elif defined(__SSE4_1__)
+	return _mm_xor_ps(a, b);
+#else
+	simd4m_t r;
+	r.u[0] = a.u[0] ^ b.u[0]; r.u[1] = a.u[1] ^ b.u[1];
+	r.u[2] = a.u[2] ^ b.u[2]; r.u[3] = a.u[3] ^ b.u[3];
+	return r;
+#endif
+}
+
+/* lane i of the mask set if bit i of bits is set */
+static inline simd4m_t simd4m_from_bits(unsigned int bits)
+{
+#if defined(__SPU__) || defined(__PPU__)
+	return (simd4m_t) {(bits & 1) ? ~0u : 0, (bits & 2) ? ~0u : 0,
+			(bits & 4) ? ~0u : 0, (bits & 8) ? ~0u : 0};
+#elif defined(__SSE4_1__)
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(
+		_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(1, 2, 4, 8)),
+		_mm_setr_epi32(1, 2, 4, 8)));
+#else
+	simd4m_t r;
+	r.u[0] = (bits & 1) ? ~0u : 0; r.u[1] = (bits & 2) ? ~0u : 0;
+	r.u[2] = (bits & 4) ? ~0u : 0; r.u[3] = (bits & 8) ? ~0u : 0;
+	return r;
+#endif
+}
+
+/* bit i set if lane i of the mask is set */
+static inline unsigned int simd4m_bits(simd4m_t m)
+{
+#if defined(__SSE4_1__) && !defined(__SPU__) && !defined(__PPU__)
+	return (unsigned int)_mm_movemask_ps(m);
+#else
+	simd4m_t t SIMD_ALIGN = m;
+	unsigned int *u = (unsigned int *)&t;
+	return (u[0] & 1) | ((u[1] & 1) << 1) | ((u[2] & 1) << 2) |
+		((u[3] & 1) << 3);
+#endif
+}
+
+/* m ? a : b - lane by lane */
+static inline simd4f_t simd4_select(simd4m_t m, simd4f_t a, simd4f_t b)
+{
+#if defined(__SPU__)
+	return spu_sel(b, a, m);
+#elif defined(__PPU__)
+	return vec_sel(b, a, m);
+#elif defined(__SSE4_1__)
+	return _mm_blendv_ps(b, a, m);
+#else
+	simd4f_t r;
+	r.f[0] = m.u[0] ? a.f[0] : b.f[0]; r.f[1] = m.u[1] ? a.f[1] : b.f[1];
+	r.f[2] = m.u[2] ? a.f[2] : b.f[2]; r.f[3] = m.u[3] ? a.f[3] : b.f[3];
+	return r;
+#endif
+}
+
+#endif
@@ -19,40 +19,22 @@
 #endif
 #include "vector4.h"
 
-#ifdef __SPU__
-	#include <spu_intrinsics.h>
-#elif defined(__PPU__)
-	#include <altivec.h>
-	#include <vec_types.h>
-#endif
-
-
+/* All of the element wise math below goes through the simd4_* layer in
+ * simd.h so the same code runs on SPU, AltiVec, SSE and plain C.  Like
+ * the original scalar versions, results always have w = 0. */
 
 /* set dimensions of vector to 0 (w = 1) */
 void vec4_clear(vector4_t *vec)
 {
-#if defined(__SPU__) || defined (__PPU__)
-	vec->v = (vector float) {0.0f, 0.0f, 0.0f, 0.0f};
-#else
-	vec->c[0] = 0.0f;
-	vec->c[1] = 0.0f;
-	vec->c[2] = 0.0f;
-	vec->c[3] = 0.0f;
-#endif
+	vec->v = simd4_splat(0.0f);
 }
 
 /* initialize elements of vector based on array values 
  * returns vector that was set */
 vector4_t* vec4_set(vector4_t *vec, const float *values)
 {
-#if defined (__PPU__)
-	vec->v = *((vector float *)values);
-#else
-	vec->c[0] = values[0];
-	vec->c[1] = values[1];
-	vec->c[2] = values[2];
-	vec->c[3] = values[3];
-#endif
+	/* values is not necessarily a vector4_t, don't assume alignment */
+	vec->v = simd4_loadu(values);
 	return vec;
 }
 
@@ -60,17 +42,7 @@ vector4_t* vec4_set(vector4_t *vec, const float *values)
 vector4_t* vec4_add(vector4_t *outvec,
 		const vector4_t *vec1, const vector4_t *vec2)
 {
-#if defined (__PPU__)
-	outvec->v = vec_add(vec1->v, vec2->v);
-#elif defined(__SPU__)
-	outvec->v = spu_add(vec1->v, vec2->v);
-#else
-	outvec->x = vec1->x + vec2->x;
-	outvec->y = vec1->y + vec2->y;
-	outvec->z = vec1->z + vec2->z;
-	outvec->w = 0.0f;
-#endif
-
+	outvec->v = simd4_clear_w(simd4_add(vec1->v, vec2->v));
 	return outvec;
 }
 
@@ -78,140 +50,50 @@ vector4_t* vec4_add(vector4_t *outvec,
 vector4_t* vec4_sub(vector4_t *outvec,
 		const vector4_t *vec1, const vector4_t *vec2)
 {
-#if defined (__PPU__)
-	outvec->v = vec_sub(vec1->v, vec2->v);
-#elif defined(__SPU__)
-	outvec->v = spu_sub(vec1->v, vec2->v);
-#else
-	outvec->x = vec1->x - vec2->x;
-	outvec->y = vec1->y - vec2->y;
-	outvec->z = vec1->z - vec2->z;
-	outvec->w = 0.0f;
-#endif
-
+	outvec->v = simd4_clear_w(simd4_sub(vec1->v, vec2->v));
 	return outvec;
 }
 
 /* vector scalar multiplication */
 vector4_t* vec4_scale(vector4_t *outvec, const vector4_t *vec, float scale)
 {
-#if defined (__PPU__)
-	vector float v;
-	v[0] = v[1] = v[2] = v[3] = scale;
-	vector float vz;
-	vz[0] = vz[1] = vz[2] = vz[3] = 0.0f;
-	outvec->v = vec_madd(vec->v, v, vz);
-#elif defined(__SPU__)
-	vector float v;
-	v[0] = v[1] = v[2] = v[3] = scale;
-	vector float vz;
-	vz[0] = vz[1] = vz[2] = vz[3] = 0.0f;
-	outvec->v = spu_madd(vec->v, v, vz);
-#else
-	outvec->x = vec->x * scale;
-	outvec->y = vec->y * scale;
-	outvec->z = vec->z * scale;
-	outvec->w = 0.0f;
-#endif
-
+	outvec->v = simd4_clear_w(simd4_mul(vec->v, simd4_splat(scale)));
 	return outvec;
 }
 
 /* dot product */
 float vec4_dot(const vector4_t *vec1, const vector4_t *vec2)
 {
-/*
-#if defined(__SPU__) || defined (__PPU__)
-	vector float tmp;
-	vector float tmp2;
-	vector float tmp3 = {0.0f, 0.0f, 0.0f, 0.0f};
-#endif
-
-#if defined(__SPU__)
-	tmp = spu_add(vec1->v, vec2->v);
-#elif defined(__PPU__)
-	tmp = vec_madd(vec1->v, vec2->v, tmp3);
-	tmp[3] = 0.0f;
-	tmp2 = vec_slo(tmp, VECPATTERN_SHIFTLEFT(8));
-	tmp = vec_add(tmp, tmp2);
-	tmp2 = vec_slo(tmp, VECPATTERN_SHIFTLEFT(4));
-	return vec_add(tmp, tmp2)[0];
-#else
-*/
-	return vec1->x * vec2->x +
-		vec1->y * vec2->y +
-		vec1->z * vec2->z;
+	return simd4_dot3(vec1->v, vec2->v);
 }
 
 float vec4_dot4(const vector4_t *vec1, const vector4_t *vec2)
 {
-#if defined(__SPU__) || defined (__PPU__)
-	vector float tmp;
-	vector float tmp2;
-	vector float tmp3 = {0.0f, 0.0f, 0.0f, 0.0f};
-#endif
-
-#if defined(__SPU__)
-	tmp = spu_add(vec1->v, vec2->v);
-#elif defined(__PPU__)
-	tmp = vec_madd(vec1->v, vec2->v, tmp3);
-	tmp2 = vec_slo(tmp, VECPATTERN_SHIFTLEFT(8));
-	tmp = vec_add(tmp, tmp2);
-	tmp2 = vec_slo(tmp, VECPATTERN_SHIFTLEFT(4));
-	return vec_add(tmp, tmp2)[0];
-#else
-	return vec1->x * vec2->x +
-		vec1->y * vec2->y +
-		vec1->z * vec2->z +
-		vec1->w * vec2->w;
-#endif
+	return simd4_dot4(vec1->v, vec2->v);
 }
 
 
 /* cross product 
  * This version works correctly if the output vector is the same
  * as one of the input vectors. i.e. A = A X B or B = A X B
- * It does this by instantiating temporary variables to hold
- * both input vectors
+ * Both inputs are loaded into registers before anything is written.
  */
 vector4_t* _vec4_cross(vector4_t *outvec,
 		const vector4_t *vec1, const vector4_t *vec2)
 {
-/*
-#if defined(__SPU__) || defined (__PPU__)
-#else
-*/
-	/* if the caller decided to use vector1 also as the ouput
- 	 * vector, then we want to make sure this function still
- 	 * works.  For that reason, we need a temporary variable */
-	vector4_t tmp;
-	vector4_t tmp2;
-	vec4_set(&tmp, (float *)vec1);	/* copy vector 1 into tmp */
-	vec4_set(&tmp2, (float *)vec2);	/* copy vector 2 into tmp2 */
-	
-	/* now start writing to outvec as normal */
-	outvec->x = tmp.y * tmp2.z - tmp.z * tmp2.y;
-	outvec->y = tmp.z * tmp2.x - tmp.x * tmp2.z;
-	outvec->z = tmp.x * tmp2.y - tmp.y * tmp2.x;
-	outvec->w = 0.0f;
-/* #endif */
-
+	outvec->v = simd4_cross(vec1->v, vec2->v);
 	return outvec;	
 }
 
 /* cross product 
- * This version is not safe to use if the output vector is the
- * same as one of the input vectors.  The writes to the output
- * vector will corrupt the inputs in the middle of the calculation
+ * This version used to be unsafe to use if the output vector is the
+ * same as one of the input vectors.  Working in registers makes it
+ * identical to _vec4_cross() now.
  */
 vector4_t* vec4_cross(vector4_t *outvec,
 		const vector4_t *vec1, const vector4_t *vec2)
 {
-	outvec->x = vec1->y * vec2->z - vec1->z * vec2->y;
-	outvec->y = vec1->z * vec2->x - vec1->x * vec2->z;
-	outvec->z = vec1->x * vec2->y - vec1->y * vec2->x;
-	outvec->w = 0.0f;
-
+	outvec->v = simd4_cross(vec1->v, vec2->v);
 	return outvec;	
 }
 
@@ -219,49 +101,35 @@ vector4_t* vec4_cross(vector4_t *outvec,
 float vec4_magnitude(const vector4_t *vec)
 {
 #ifdef __SPU__
-	vector float v = spu_promote(
-		vec->x * vec->x +
-		vec->y * vec->y +
-		vec->z * vec->z, 0);
+	vector float v = spu_promote(simd4_dot3(vec->v, vec->v), 0);
 	return _sqrtf4(v)[0];
 #else
-	return sqrt( 
-		vec->x * vec->x +
-		vec->y * vec->y +
-		vec->z * vec->z );
+	return sqrt(simd4_dot3(vec->v, vec->v));
 #endif
 }
 
 /* magnitude squared of vector */
 float vec4_magsquared(const vector4_t *vec)
 {
-	return 	vec->x * vec->x +
-		vec->y * vec->y +
-		vec->z * vec->z;
+	return simd4_dot3(vec->v, vec->v);
 }
 
 /* distance between two points */
 float point_distance(const point_t *p1, const point_t *p2)
 {
 #ifdef __SPU__
-	vector float v = spu_promote(
-		(p1->x - p2->x) * (p1->x - p2->x) +
-		(p1->y - p2->y) * (p1->y - p2->y) +
-		(p1->z - p2->z) * (p1->z - p2->z) , 0);
+	vector float v = spu_promote(point_distsquared(p1, p2), 0);
 	return _sqrtf4(v)[0];
 #else
-	return sqrt( (p1->x - p2->x) * (p1->x - p2->x) +
-		(p1->y - p2->y) * (p1->y - p2->y) +
-		(p1->z - p2->z) * (p1->z - p2->z) );
+	return sqrt(point_distsquared(p1, p2));
 #endif
 }
 
 /* distance squared between two points */
 float point_distsquared(const point_t *p1, const point_t *p2)
 {
-	return (p1->x - p2->x) * (p1->x - p2->x) +
-		(p1->y - p2->y) * (p1->y - p2->y) +
-		(p1->z - p2->z) * (p1->z - p2->z);
+	simd4f_t d = simd4_sub(p1->v, p2->v);
+	return simd4_dot3(d, d);
 }
 
 /* normalize */
@@ -269,10 +137,7 @@ vector4_t* vec4_normalize(vector4_t *vec)
 {
 	float mag = vec4_magnitude(vec);
 
-	vec->x /= mag;
-	vec->y /= mag;
-	vec->z /= mag;
-	vec->w = 0.0f;
+	vec->v = simd4_clear_w(simd4_div(vec->v, simd4_splat(mag)));
 
 	return vec;
 }
@@ -11,6 +11,11 @@
 #ifndef _VECTOR4_H_
 #define _VECTOR4_H_
 
+#if !defined(__SPU__)
+	#include <math.h>
+#endif
+#include "simd.h"
+
 typedef struct
 {
 	union 
@@ -20,12 +25,8 @@ typedef struct
 		{	/* dimension name access */
 			float x, y, z, w;
 		};
-#if defined(__PPU__) || defined(__SPU__)
-		vector float v;
-	} __attribute__ ((aligned(16) ));	/* for cell processor */
-#else
-	};
-#endif
+		simd4f_t v;		/* SIMD register access */
+	} SIMD_ALIGN;	/* for cell processor DMA and SIMD loads */
 } vector4_t, point_t;
 
 #ifdef __PPU__
@@ -85,6 +86,84 @@ vector4_t* vec4_normalize(vector4_t *vec);
 /* cosine of angle between vectors */
 float vec4_costheta(const vector4_t *vec1, const vector4_t *vec2);
 
+/* value returning versions of the math above.  These are static inline so
+ * the compiler can keep vectors in registers across calls in the inner
+ * loops (ray generation, intersection, shading) instead of bouncing every
+ * intermediate result through memory.  Like the versions above, results
+ * always have w = 0 */
+
+/* build a vector from components */
+static inline vector4_t vec4v_make(float x, float y, float z, float w)
+{
+	vector4_t r;
+	r.v = simd4_set(x, y, z, w);
+	return r;
+}
+
+/* a + b */
+static inline vector4_t vec4v_add(vector4_t a, vector4_t b)
+{
+	vector4_t r;
+	r.v = simd4_clear_w(simd4_add(a.v, b.v));
+	return r;
+}
+
+/* a - b */
+static inline vector4_t vec4v_sub(vector4_t a, vector4_t b)
+{
+	vector4_t r;
+	r.v = simd4_clear_w(simd4_sub(a.v, b.v));
+	return r;
+}
+
+/* a * s */
+static inline vector4_t vec4v_scale(vector4_t a, float s)
+{
+	vector4_t r;
+	r.v = simd4_clear_w(simd4_mul(a.v, simd4_splat(s)));
+	return r;
+}
+
+/* a + b * s - i.e. a point along a ray */
+static inline vector4_t vec4v_madd(vector4_t a, vector4_t b, float s)
+{
+	vector4_t r;
+	r.v = simd4_clear_w(simd4_madd(b.v, simd4_splat(s), a.v));
+	return r;
+}
+
+/* dot product */
+static inline float vec4v_dot(vector4_t a, vector4_t b)
+{
+	return simd4_dot3(a.v, b.v);
+}
+
+/* cross product */
+static inline vector4_t vec4v_cross(vector4_t a, vector4_t b)
+{
+	vector4_t r;
+	r.v = simd4_cross(a.v, b.v);
+	return r;
+}
+
+/* magnitude */
+static inline float vec4v_magnitude(vector4_t a)
+{
+#ifdef __SPU__
+	return vec4_magnitude(&a);
+#else
+	return sqrt(simd4_dot3(a.v, a.v));
+#endif
+}
+
+/* normalize */
+static inline vector4_t vec4v_normalize(vector4_t a)
+{
+	vector4_t r;
+	r.v = simd4_clear_w(simd4_div(a.v, simd4_splat(vec4v_magnitude(a))));
+	return r;
+}
+
 #ifdef _DEBUG
 	/* debug output vector */
 	void vec4_output(const vector4_t *vec);